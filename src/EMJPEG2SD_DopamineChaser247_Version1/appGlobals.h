@@ -152,6 +152,7 @@ static unsigned long COOLDOWN_DURATION = 5000;  // 5 seconds for OV2640
 #define WARN_HEAP (32 * 1024) // low free heap warning
 #define WARN_ALLOC (16 * 1024) // low free max allocatable free heap block
 #define MAX_FRAME_WAIT 1200
+#define FB_CNT 4 // number of camera frame buffers
 #define RGB888_BYTES 3 // number of bytes per pixel
 #define GRAYSCALE_BYTES 1 // number of bytes per pixel 
 
@@ -162,20 +163,26 @@ static unsigned long COOLDOWN_DURATION = 5000;  // 5 seconds for OV2640
 #endif
 #define GITHUB_PATH "/s60sc/ESP32-CAM_MJPEG2SD/master"
 #define RAMSIZE (1024 * 8) // set this to multiple of SD card sector size (512 or 1024 bytes)
+#define SD_SECTOR 512
 #define CHUNKSIZE (1024 * 4)
 #define ISCAM // cam specific code in generics
 
 // to determine if newer data files need to be loaded
-#define CFG_VER 26
+#define CFG_VER 37
 
 #define AVI_EXT "avi"
+#define MP4_EXT "mp4"
 #define CSV_EXT "csv"
 #define SRT_EXT "srt"
-#define AVI_HEADER_LEN 310 // AVI header length
+#define AVI_HEADER_LEN 3072 // OpenDML AVI header length in whole sectors, see avi.cpp
 #define CHUNK_HDR 8 // bytes per jpeg hdr in AVI 
-#define WAVTEMP "/current.wav"
 #define AVITEMP "/current.avi"
 #define TLTEMP "/current.tl"
+#define IDXTEMP "/current.idx" // avi index sidecar
+#define TLIDXTEMP "/current.tlx"
+#define MP4TEMP "/current.mp4"
+#define COMMITTEMP "/current.len" // committed length of preallocated recording
+#define EXPORTTEMP "/export.avi" // loop recording export
 #define TELETEMP "/current.csv"
 #define SRTTEMP "/current.srt"
 
@@ -201,16 +208,26 @@ static unsigned long COOLDOWN_DURATION = 5000;  // 5 seconds for OV2640
 #define MQTT_STACK_SIZE (1024 * 4)
 #define PING_STACK_SIZE (1024 * 5)
 #define PLAYBACK_STACK_SIZE (1024 * 2)
+#define SDWRITE_STACK_SIZE (1024 * 4)
+#define SDFLUSH_STACK_SIZE (1024 * 4)
 #define SERVO_STACK_SIZE (1024)
 #define SUSTAIN_STACK_SIZE (1024 * 4)
 #define TGRAM_STACK_SIZE (1024 * 6)
 #define TELEM_STACK_SIZE (1024 * 4)
 #define HB_STACK_SIZE (1024 * 2)
 #define UART_STACK_SIZE (1024 * 2)
+#define VALIDATE_STACK_SIZE (1024 * 4)
+#define CATALOG_STACK_SIZE (1024 * 4)
+#define RETENTION_STACK_SIZE (1024 * 4)
+#define EXPORT_STACK_SIZE (1024 * 4)
+#define BENCH_STACK_SIZE (1024 * 4)
+#define SCRUB_STACK_SIZE (1024 * 4)
 #define INTERCOM_STACK_SIZE (1024 * 2)
 
 // task priorities
 #define CAPTURE_PRI 6
+#define SDWRITE_PRI 5
+#define SDFLUSH_PRI 5
 #define SUSTAIN_PRI 5
 #define HTTP_PRI 5
 #define STICK_PRI 5
@@ -227,6 +244,12 @@ static unsigned long COOLDOWN_DURATION = 5000;  // 5 seconds for OV2640
 #define SERVO_PRI 1
 #define HB_PRI 1
 #define UART_PRI 1
+#define VALIDATE_PRI 1
+#define CATALOG_PRI 1
+#define RETENTION_PRI 1
+#define EXPORT_PRI 1
+#define BENCH_PRI 1
+#define SCRUB_PRI 1
 #define DS18B20_PRI 1
 #define BATT_PRI 1
 
@@ -238,59 +261,152 @@ struct mjpegStruct {
   size_t jpegSize;
 };
 
+struct frameHandle {
+  uint8_t* buf; // jpeg content, in camera buffer or pool slot
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  camera_fb_t* fb; // source camera buffer
+  bool pooled; // content copied to pool slot
+  uint8_t* slot; // PSRAM pool slot
+  size_t slotSize;
+  uint32_t ms; // capture time, ms since boot
+  std::atomic<uint8_t> refs; // handle free when zero
+};
+
 struct fnameStruct {
   uint8_t recFPS;
   uint32_t recDuration;
-  uint16_t frameCnt;
+  uint32_t frameCnt;
 };
 
+#include "catalog.h"
+#include "loopRec.h"
+#include "crc32c.h"
+#include "recCrypt.h"
+
 enum audioAction {NO_ACTION, UPDATE_CONFIG, RECORD_ACTION, PLAY_ACTION, PASS_ACTION, WAV_ACTION, STOP_ACTION};
 
 // global app specific functions
 
+void addMp4Frame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs);
 void applyFilters();
 void applyVolume();
 void appShutdown();
 void browserMicInput(uint8_t* wsMsg, size_t wsMsgLen);
-void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL = false);
+void buildAviHdr(uint8_t FPS, uint8_t frameType, uint32_t frameCnt, bool isTL = false);
 void buildAviIdx(size_t dataSize, bool isVid = true, bool isTL = false);
 size_t buildSubtitle(int srtSeqNo, uint32_t sampleInterval);
 void buzzerAlert(bool buzzerOn);
+void cancelStreamFrame(uint8_t taskNum);
+void catalogAdd(const catEntry& ce);
+void catalogAddFile(const char* path);
+size_t catalogFolder(const char* folder, std::vector<catEntry>& entries);
+size_t catalogFolders(std::vector<catEntry>& folders);
+bool catalogFind(const char* path, catEntry& ce);
+bool catalogOldest(char* oldestDir);
+bool catalogReady();
+void catalogRemove(const char* path);
+void catalogRename(const char* oldPath, const char* newPath);
 bool checkMotion(camera_fb_t* fb, bool motionStatus, bool lightLevelOnly = false);
 int8_t checkPotVol(int8_t adjVol);
 bool checkSDFiles();
 void currentStackUsage();
 void displayAudioLed(int16_t audioSample);
-void finalizeAviIndex(uint16_t frameCnt, bool isTL = false);
+void endCapture(frameHandle* fh);
+frameHandle* findFrame(const camera_fb_t* fb);
+size_t finalizeAviIndex(uint32_t frameCnt, bool isTL = false, uint16_t alignLen = 0);
+size_t findAviMovi(File& aviFile);
 void finishAudioRecord(bool isValid);
+size_t finishMp4(const uint8_t** mfraData);
+void frameCaptured(bool gotFrame);
+void frameProcessed(uint32_t processUs);
+void IRAM_ATTR frameTick();
+int frameTimingJson(char* p);
+void freePreRoll();
 float* getBMx280();
 float* getMPU9250();
+size_t getAviIndex(const uint8_t** idxData, bool isTL = false);
+size_t getMp4Data(const uint8_t** mp4Data, uint32_t nextMs = 0);
 mjpegStruct getNextFrame(bool firstCall = false);
+bool getPreRoll(uint8_t** jpegBuf, size_t* jpegLen, uint32_t* frameMs);
+frameHandle* getStreamFrame(uint8_t taskNum);
 int getInputPeripheral(uint8_t cmd);
 bool getPIRval();
-bool haveWavFile(bool isTL = false);
+frameHandle* holdFrame(frameHandle* fh);
 bool identifyBMx();
 void intercom();
 bool isNight(uint8_t nightSwitch);
 void keepFrame(camera_fb_t* fb);
+void logFrameTiming();
 void micTaskStatus();
+bool mp4FragDue(size_t jpegLen);
+void motionChecked(uint32_t checkUs);
 void motorSpeed(int speedVal, bool leftMotor = true);
 void notifyMotion(camera_fb_t* fb);
-void openSDfile(const char* streamFile);
+void offerStreamFrame(frameHandle* fh);
+void openSDfile(const char* streamFile, uint32_t startFrame = 0);
+size_t pendingAudio();
+void patchAviSegments(File& aviFile, bool isTL = false, void (*patchFn)(size_t offset, const void* data, size_t len) = NULL);
 void prepAudio();
+bool prepAviSplit(size_t chunkLen, bool isTL = false, uint16_t alignLen = 0);
 void prepAviIndex(bool isTL = false);
 bool prepCam();
+size_t prepMp4(uint16_t width, uint16_t height, uint8_t FPS, const uint8_t** initData);
 bool prepRecording();
+frameHandle* publishFrame(camera_fb_t* fb);
+void qosCapture(uint32_t frameUs, uint32_t backlog);
+void qosRecordSettings(uint8_t& fps, int& quality);
+bool qosWindow(bool recording, uint32_t writeMs, uint32_t bytes, uint32_t frames, uint32_t dropped, uint32_t queueHW, uint32_t queueLen);
+uint32_t parseSeek(const char* query);
+size_t queueAudio(const uint8_t* samples, size_t sampleLen);
+bool queuePreRoll(frameHandle* fh);
+size_t readAviFrame(const char* fname, uint32_t frameNum, uint8_t** jpegBuf);
+uint32_t recoverAviIndex(File& aviFile, uint8_t* buf, size_t bufSize, uint8_t& frameType, bool isTL = false);
+uint32_t recoverMp4(File& mp4File, size_t& validLen);
+void releaseAlert();
+void releaseAudio(size_t sampleLen);
+void releaseFrame(frameHandle* fh);
+uint32_t recordingByteRate();
+bool commitBegin(const char* tempName);
+void commitEnd();
+void commitLength(size_t len);
+bool committedLength(const char* tempName, size_t& len);
+bool encBegin(File& file, size_t hold);
+uint32_t encEnd(File& file);
+void encPatch(File& file, size_t offset, const uint8_t* data, size_t len);
+bool encReady();
+void encStage(uint8_t* buf, size_t len);
+void loopBegin(uint8_t frameType, uint8_t fps);
+void loopEnd();
+bool loopExportActive();
+size_t loopFrame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs);
+void loopInfo(char* jsonBuff);
+bool loopReady();
+void resetFrameTiming();
+void retentionHint(size_t recordingSize);
+uint64_t retentionFree();
 void uploadRecordings();
+bool validateAvi(File& aviFile, uint8_t* buf, size_t bufSize);
+File recDecrypt(File raw, encState* state = NULL);
+File recOpen(const char* path, const char* mode = FILE_READ, encState* state = NULL);
+void prepCatalog();
 void prepTelemetry();
 void prepMic();
 void prepMotors();
+void prepLoop();
+void prepRecCrypt();
+void prepRetention();
+void prepScrub();
+void prepSdBench();
 void prepRTSP();
 void prepUart();
 void setCamPan(int panVal);
 void setCamTilt(int tiltVal);
 uint8_t setFPS(uint8_t val);
 uint8_t setFPSlookup(uint8_t val);
+void setPacing(bool sensorPaced);
+void ticksSkipped(uint32_t numTicks);
 void setInputPeripheral(uint8_t cmd, uint32_t controlVal);
 void setLamp(uint8_t lampVal);
 void setLightsRC(bool lightsOn);
@@ -299,8 +415,17 @@ void setSteering(int steerVal);
 void setStepperPin(uint8_t pinNum, uint8_t pinPos);
 void setStickTimer(bool restartTimer, uint32_t interval = 0);
 bool shareI2C(int sdaShare, int sclShare);
-void startAudioRecord();
+void startAudioRecord(uint32_t preRollMs = 0);
+bool startAviValidation(const char* fileFolder);
+bool startCatalogRescan();
+bool startLoopExport(const char* timeRange);
+bool startScrub();
+bool startSdBench(bool fullBench);
+bool sdBenchActive();
+void sdBenchResults(httpd_req_t* req, const char* card);
 void startHeartbeat();
+uint32_t startPreRoll();
+bool seekAviFrame(File& aviFile, uint32_t frameNum, size_t& chunkPos);
 void startSustainTasks();
 bool startTelemetry();
 void stepperDone();
@@ -308,13 +433,15 @@ void stepperRun(float RPM, float revFraction, bool _clockwise);
 void stopPlaying();
 void stopSustainTask(int taskId);
 void stopTelemetry(const char* fileName);
+void storeAudioPreRoll(const uint8_t* samples, size_t sampleLen);
+void storePreRoll(frameHandle* fh);
 void storeSensorData(bool fromStream);
+size_t takeAudio(const uint8_t** samples, size_t maxLen);
 void takePhotos(bool startPhotos);
 void trackSteeering(int controlVal, bool steering);
 size_t updateWavHeader();
-size_t writeAviIndex(byte* clientBuf, size_t buffSize, bool isTL = false);
+size_t writeAudioPreRoll(uint32_t spanMs);
 bool writeUart(uint8_t cmd, uint32_t outputData);
-size_t writeWavFile(byte* clientBuf, size_t buffSize);
 
 /******************** Global app declarations *******************/
 
@@ -327,7 +454,7 @@ extern uint8_t lightLevel;  // Light level for night mode detection
 extern bool useMotion;     // Enable/disable motion detection
 
 // Variables for state machine
-enum RecordState { IDLE, RECORDING, COOLDOWN };
+#include "recordControl.h"
 extern RecordState recordState;
 extern bool motionTriggeredAudio; // Flag for audio triggered by motion
 
@@ -342,6 +469,22 @@ extern bool nightTime;     // Night mode status
 extern int moveStartChecks; // checks per second for start motion
 extern int moveStopSecs; // secs between each check for stop, also determines post motion time
 extern int maxFrames; // maximum number of frames in video before auto close 
+extern int preRollSecs; // secs of frames to keep before motion
+extern bool qosUse; // adapt quality, FPS & motion cadence to SD / CPU load
+extern int qosKbps; // target recording bitrate in kbps, 0 for none
+extern uint8_t motionCadence; // idle frames per motion check
+extern bool sensorPacing; // capture paced by sensor frames instead of frame timer
+extern bool singleMode; // sensor kept at recording resolution when not recording
+extern bool useMp4; // record as fragmented mp4 instead of avi
+extern uint8_t aviAlign; // start avi frames on 0: any DWORD, 1: sector, 2: RAMSIZE block
+extern bool sdPrealloc; // preallocate contiguous space for recording file
+extern uint8_t sdBufCount; // number of SD staging buffers
+extern uint8_t sdBufKB; // size of each SD staging buffer in KB
+extern bool loopRecord; // record into loop file instead of avi files
+extern int loopSizeMB; // size of loop file
+extern int sdFreeSpaceHigh; // free MBytes on SD that retention reclaims up to
+extern bool recEncrypt; // encrypt new recordings
+extern char Rec_Pass[]; // passphrase for recording encryption
 
 // motion recording parameters
 extern int detectMotionFrames; // min sequence of changed frames to confirm motion 
@@ -393,6 +536,13 @@ extern bool streamAud;
 extern bool streamSrt;
 extern uint8_t numStreams;
 extern uint8_t vidStreams;
+extern uint32_t sdqHighWater; // max SD writer queue depth in current recording
+extern uint32_t droppedFrames; // frames not recorded as SD writer queue full
+extern uint32_t copiesAvoided; // frame copies not needed due to shared frame handles
+extern uint32_t pooledFrames; // frames copied to pool slot to free camera buffer
+extern uint32_t preRollFrames; // pre-roll frames written to current recording
+extern uint32_t skippedTicks; // frame timer ticks not serviced in current recording
+extern uint32_t fbGetFails; // frame capture failures in current recording
 
 
 // buffers
@@ -400,8 +550,6 @@ extern uint8_t iSDbuffer[];
 extern uint8_t aviHeader[];
 extern const uint8_t dcBuf[]; // 00dc
 extern const uint8_t wbBuf[]; // 01wb
-extern byte* streamBuffer[]; // buffer for stream frame
-extern size_t streamBufferSize[];
 extern uint8_t* motionJpeg;
 extern size_t motionJpegLen;
 extern uint8_t* audioBuffer;
@@ -545,6 +693,7 @@ extern TaskHandle_t fsHandle;
 extern TaskHandle_t logHandle;
 extern TaskHandle_t mqttTaskHandle;
 extern TaskHandle_t playbackHandle;
+extern TaskHandle_t sdWriterHandle;
 extern esp_ping_handle_t pingHandle;
 extern TaskHandle_t servoHandle;
 extern TaskHandle_t stickHandle;
@@ -555,6 +704,7 @@ extern TaskHandle_t uartRxHandle;
 extern TaskHandle_t audioHandle;
 extern SemaphoreHandle_t frameSemaphore[];
 extern SemaphoreHandle_t motionSemaphore;
+extern SemaphoreHandle_t aviMutex;
 
 
 /************************** structures ********************************/
@@ -588,7 +738,7 @@ const frameStruct frameData[] = {
   {"HD", 1280, 720, 5, 3, 1}, 
   {"SXGA", 1280, 1024, 5, 3, 1}, 
   {"UXGA", 1600, 1200, 5, 4, 1},  
-  {"FHD", 920, 1080, 5, 3, 1},    // 3MP Sensors
+  {"FHD", 1920, 1080, 5, 3, 1},    // 3MP Sensors
   {"P_HD", 720, 1280, 5, 3, 1},
   {"P_3MP", 864, 1536, 5, 3, 1},
   {"QXGA", 2048, 1536, 5, 4, 1},
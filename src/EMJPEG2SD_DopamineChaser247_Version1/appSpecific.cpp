@@ -39,6 +39,20 @@ bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
   else if (!strcmp(variable, "moveStartChecks")) moveStartChecks = intVal;
   else if (!strcmp(variable, "moveStopSecs")) moveStopSecs = intVal;
   else if (!strcmp(variable, "maxFrames")) maxFrames = intVal;
+  else if (!strcmp(variable, "preRollSecs")) preRollSecs = intVal;
+  else if (!strcmp(variable, "qosUse")) qosUse = (bool)intVal;
+  else if (!strcmp(variable, "qosKbps")) qosKbps = intVal;
+  else if (!strcmp(variable, "sensorPacing")) setPacing((bool)intVal);
+  else if (!strcmp(variable, "singleMode")) singleMode = (bool)intVal;
+  else if (!strcmp(variable, "useMp4")) useMp4 = (bool)intVal;
+  else if (!strcmp(variable, "aviAlign")) aviAlign = intVal;
+  else if (!strcmp(variable, "sdPrealloc")) sdPrealloc = (bool)intVal;
+  else if (!strcmp(variable, "sdBufCount")) sdBufCount = intVal;
+  else if (!strcmp(variable, "sdBufKB")) sdBufKB = intVal;
+  else if (!strcmp(variable, "loopRecord")) loopRecord = (bool)intVal;
+  else if (!strcmp(variable, "loopSizeMB")) loopSizeMB = intVal;
+  else if (!strcmp(variable, "recEncrypt")) recEncrypt = (bool)intVal;
+  else if (!strcmp(variable, "sdFreeSpaceHigh")) sdFreeSpaceHigh = intVal;
   else if (!strcmp(variable, "detectMotionFrames")) detectMotionFrames = intVal;
   else if (!strcmp(variable, "detectNightFrames")) detectNightFrames = intVal;
   else if (!strcmp(variable, "detectNumBands")) detectNumBands = intVal;
@@ -70,6 +84,11 @@ bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
 #if INCLUDE_FTP_HFS
   else if (!strcmp(variable, "upload")) fsStartTransfer(value); 
 #endif
+  else if (!strcmp(variable, "validate")) startAviValidation(value);
+  else if (!strcmp(variable, "catalog")) startCatalogRescan();
+  else if (!strcmp(variable, "sdBench")) startSdBench(atoi(value));
+  else if (!strcmp(variable, "loopExport")) startLoopExport(value);
+  else if (!strcmp(variable, "scrub")) startScrub();
   else if (!strcmp(variable, "delete")) {
     stopPlayback = true;
     deleteFolderOrFile(value);
@@ -232,7 +251,7 @@ bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
     if (intVal > maxFS && fromUser) LOG_WRN("Frame size %s too large for %s PSRAM ", frameData[intVal].frameSizeStr, fmtSize(ESP.getPsramSize()));
     else {
       fsizePtr = intVal;
-      if (fsizePtr > FRAMESIZE_SXGA) LOG_WRN("Motion detection not available as frame size %s too large", frameData[fsizePtr].frameSizeStr);
+      if (frameData[fsizePtr].scaleFactor > 3) LOG_WRN("Motion detection not available as frame size %s too large", frameData[fsizePtr].frameSizeStr);
 
       if (s) {
         if (s->set_framesize(s, (framesize_t)fsizePtr) != ESP_OK) res = false;
@@ -305,6 +324,16 @@ esp_err_t appSpecificWebHandler(httpd_req_t *req, const char* variable, const ch
     httpd_resp_set_type(req, "application/json");
     httpd_resp_sendstr(req, jsonBuff);
   } 
+  else if (!strcmp(variable, "loopInfo")) {
+    // time range held in loop file
+    loopInfo(jsonBuff);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, jsonBuff);
+  } 
+  else if (!strcmp(variable, "sdResults")) {
+    // stored SD benchmark results for card id, current card if empty, or all
+    sdBenchResults(req, value);
+  } 
   else if (!strcmp(variable, "updateFPS")) {
     // requires response with updated default fps
     sprintf(jsonBuff, "{\"fps\":\"%u\"}", setFPSlookup(fsizePtr));
@@ -322,8 +351,24 @@ esp_err_t appSpecificWebHandler(httpd_req_t *req, const char* variable, const ch
       httpd_resp_send(req, (const char*)alertBuffer, alertBufferSize);   
       uint32_t jpegTime = millis() - startTime;
       LOG_INF("JPEG: %uB in %ums", alertBufferSize, jpegTime);
-      alertBufferSize = 0;
+      releaseAlert();
     } else LOG_WRN("Failed to get still");
+  } else if (!strcmp(variable, "scrub")) {
+    // send single frame of selected avi, eg for timeline slider, from scrub=[<file>]&frame=<n>|&t=<secs>
+    uint32_t startTime = millis();
+    uint32_t frameNum = parseSeek(value);
+    uint8_t* jpegBuf = NULL;
+    size_t jpegLen = readAviFrame(inFileName, frameNum, &jpegBuf);
+    if (jpegLen) {
+      httpd_resp_set_type(req, "image/jpeg");
+      httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=scrub.jpg");
+      httpd_resp_send(req, (const char*)jpegBuf, jpegLen);
+      LOG_VRB("Scrub frame %u: %uB in %ums", frameNum, jpegLen, millis() - startTime);
+    } else {
+      httpd_resp_set_status(req, "404 Frame not found");
+      httpd_resp_sendstr(req, NULL);
+    }
+    free(jpegBuf);
   } else if (!strcmp(variable, "svg")) {
     // build svg image for use by another app's hub instead of image
     const char* svgHtml = R"~(
@@ -468,6 +513,12 @@ void buildAppJsonString(bool filter) {
   }
   p += sprintf(p, "\"showRecord\":%u,", (uint8_t)((isCapturing && doRecording) || forceRecord));
   p += sprintf(p, "\"camModel\":\"%s\",", camModel);
+  p += sprintf(p, "\"sdQueueHW\":%u,", sdqHighWater);
+  p += sprintf(p, "\"droppedFrames\":%u,", droppedFrames);
+  p += sprintf(p, "\"copiesAvoided\":%u,", copiesAvoided);
+  p += sprintf(p, "\"preRollFrames\":%u,", preRollFrames);
+  p += sprintf(p, "\"motionCadence\":%u,", motionCadence);
+  p += frameTimingJson(p);
 #if INCLUDE_PERIPH
   p += sprintf(p, "\"SVactive\":\"%d\",", SVactive); 
  #if INCLUDE_AUDIO
@@ -599,6 +650,7 @@ void currentStackUsage() {
 #endif
   // 7: pingtask
   checkStackUse(playbackHandle, 8);
+  checkStackUse(sdWriterHandle, 21);
 #if INCLUDE_PERIPH
  #if INCLUDE_DS18B20
   checkStackUse(DS18B20handle, 1);
@@ -760,6 +812,7 @@ void appSpecificTelegramTask(void* p) {
         delay(1000); // time to get frame
         sprintf(userCmd, "/snap from %s", hostName);
         sendTgramPhoto(alertBuffer, alertBufferSize, userCmd);
+        releaseAlert();
       } else if (!strcmp(userCmd, "/log")) {
         saveRamLog();
         sprintf(userCmd, "/log from %s", hostName);
@@ -774,7 +827,7 @@ void appSpecificTelegramTask(void* p) {
       if (alertReady) {
         alertReady = false;
         sendTgramPhoto(alertBuffer, alertBufferSize, alertCaption);
-        alertBufferSize = 0;
+        releaseAlert();
       } else delay(5000); // avoid thrashing
     }
   }
@@ -867,6 +920,20 @@ tlPlaybackFPS~1~1~N~Timelapse playback FPS
 moveStartChecks~5~1~N~Checks per second for start motion
 moveStopSecs~2~1~N~Non movement to stop recording (secs)
 maxFrames~20000~1~N~Max frames in recording
+preRollSecs~3~1~N~Pre-motion recording (secs), needs singleMode
+qosUse~0~1~C~Adapt quality & FPS to SD / CPU load
+qosKbps~0~1~N~Target recording bitrate (kbps), 0 for none
+sensorPacing~0~1~C~Pace capture by sensor frames, not timer
+singleMode~0~1~C~Keep sensor at recording resolution
+useMp4~0~1~C~Record as fragmented MP4 instead of AVI
+aviAlign~0~1~S:Off:Sector:Block~Align AVI frames on SD boundary
+sdPrealloc~1~1~C~Preallocate recording files
+sdBufCount~4~1~N~Number of SD staging buffers (2 - 8)
+sdBufKB~16~1~N~SD staging buffer size in KB (8 - 64)
+loopRecord~0~1~C~Record into loop file (needs restart)
+loopSizeMB~4096~1~N~Loop file size in MB
+recEncrypt~0~1~C~Encrypt new recordings on SD
+Rec_Pass~~1~T~Recording encryption passphrase
 detectMotionFrames~5~1~N~Num changed frames to start motion
 detectNightFrames~10~1~N~Min dark frames to indicate night
 detectNumBands~10~1~N~Total num of detection bands
@@ -883,6 +950,7 @@ smtpUse~0~2~C~Enable email sending
 smtpMaxEmails~10~2~N~Max daily alerts
 sdMinCardFreeSpace~100~2~N~Min free MBytes on SD before action
 sdFreeSpaceMode~1~2~S:No Check:Delete oldest:Ftp then delete~Action mode on SD min free
+sdFreeSpaceHigh~500~2~N~Free MBytes on SD to reclaim up to
 formatIfMountFailed~0~2~C~Format file system on failure
 pirUse~0~3~C~Use PIR for detection
 lampType~0~3~S:Manual:PIR~How lamp activated
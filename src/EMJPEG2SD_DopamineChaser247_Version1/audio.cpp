@@ -42,6 +42,7 @@ static bool ampUse = false; // whether esp amp / speaker available
 bool spkrRem = false; // use browser speaker
 bool volatile stopAudio = false;
 static bool micRecording = false;
+static volatile uint32_t audioPreRollMs = 0; // pre-roll audio to add to recording
 
 // I2S devices
 bool I2Smic; // true if I2S, false if PDM
@@ -85,7 +86,14 @@ static const char* micLabels[2] = {"PDM", "I2S"};
 #endif
 #ifdef ISCAM
 bool AudActive = false; // whether to show audio features
-static File wavFile;
+// mic samples being recorded, passed by audio task to SD writer task
+// for interleaving into AVI, through single producer / single consumer ring
+#define REC_AUDIO_SECS 2 // buffering for SD writer latency, in addition to pre-roll
+static uint8_t* recRing = NULL;
+static size_t recRingSize = 0;
+static std::atomic<size_t> recHead(0); // written by audio task
+static std::atomic<size_t> recTail(0); // written by SD writer task
+static uint32_t recDropped = 0; // bytes lost when ring full
 #endif
 
 static uint8_t wavHeader[WAV_HDR_LEN] = { // WAV header template
@@ -308,16 +316,60 @@ void browserMicInput(uint8_t* wsMsg, size_t wsMsgLen) {
   }
 }    
 
-void startAudioRecord() {
+size_t queueAudio(const uint8_t* samples, size_t sampleLen) {
+  // called by audio task to pass recorded samples to SD writer task
+  size_t head = recHead.load(std::memory_order_relaxed);
+  size_t space = recRingSize - (head - recTail.load(std::memory_order_acquire));
+  if (sampleLen > space) {
+    // SD writer not keeping up
+    recDropped += sampleLen;
+    return 0;
+  }
+  for (size_t done = 0; done < sampleLen; ) {
+    size_t ringPos = (head + done) % recRingSize;
+    size_t partLen = std::min(sampleLen - done, recRingSize - ringPos);
+    memcpy(recRing + ringPos, samples + done, partLen);
+    done += partLen;
+  }
+  recHead.store(head + sampleLen, std::memory_order_release);
+  return sampleLen;
+}
+
+size_t pendingAudio() {
+  // recorded bytes waiting to be saved to AVI 
+  return recHead.load(std::memory_order_acquire) - recTail.load(std::memory_order_relaxed);
+}
+
+size_t takeAudio(const uint8_t** samples, size_t maxLen) {
+  // called by SD writer task to get contiguous block of recorded samples,
+  // which is released by releaseAudio() once saved
+  size_t ringPos = recTail.load(std::memory_order_relaxed) % recRingSize;
+  *samples = recRing + ringPos;
+  return std::min(std::min(maxLen, pendingAudio()), recRingSize - ringPos);
+}
+
+void releaseAudio(size_t sampleLen) {
+  recTail.store(recTail.load(std::memory_order_relaxed) + sampleLen, std::memory_order_release);
+}
+
+void startAudioRecord(uint32_t preRollMs) {
   // called from openAvi() in mjpeg2sd.cpp
-  // start audio recording and write recorded audio to SD card as WAV file 
-  // combined into AVI file as PCM channel on FTP upload or browser download
-  // so can be read by media players
+  // start audio recording, with recorded audio interleaved into AVI file
+  // as PCM channel by SD writer task, so can be read by media players
+  // preRollMs is duration of pre-roll video, to be matched by pre-roll audio
   if (micUse && micGain) {
-      wavFile = STORAGE.open(WAVTEMP, FILE_WRITE);
-      wavFile.write(wavHeader, WAV_HDR_LEN); 
-      micRecording = true;
-      totalSamples = 0;
+    size_t wantSize = (REC_AUDIO_SECS + std::max(preRollSecs, 0)) * SAMPLE_RATE * sampleWidth;
+    if (recRingSize != wantSize) {
+      free(recRing);
+      recRing = (uint8_t*)ps_malloc(wantSize);
+      recRingSize = recRing == NULL ? 0 : wantSize;
+    }
+    recHead = recTail = 0;
+    recDropped = 0;
+    audioPreRollMs = preRollMs;
+    totalSamples = 0;
+    micRecording = recRingSize > 0;
+    if (!micRecording) LOG_WRN("Insufficient PSRAM for audio recording");
   } else {
     micRecording = false;
     LOG_WRN("No ESP mic defined or mic is off");
@@ -325,17 +377,12 @@ void startAudioRecord() {
 }
 
 void finishAudioRecord(bool isValid) {
-  // called from closeAvi() in mjpeg2sd.cpp
+  // called from closeAvi() in mjpeg2sd.cpp, before remaining samples saved
   if (micRecording) {
-    // finish a recording and save if valid
     micRecording = false; 
     if (isValid) {
-      size_t dataBytes = updateWavHeader();
-      wavFile.seek(0, SeekSet); // start of file
-      wavFile.write(wavHeader, WAV_HDR_LEN); // overwrite default header
-      wavFile.close();  
       LOG_INF("Captured %d audio samples with gain factor %i", totalSamples, micGain - MIC_GAIN_CENTER);
-      LOG_INF("Saved %s to SD for %s", fmtSize(dataBytes + WAV_HDR_LEN), WAVTEMP);
+      if (recDropped) LOG_WRN("Audio samples dropped as SD writer not keeping up: %u", recDropped / sampleWidth);
     }
   }
 }
@@ -343,12 +390,16 @@ void finishAudioRecord(bool isValid) {
 static void camActions() {
   while (true) {
     size_t bytesRead = 0;
-    if (micRecording || !audioBytes || spkrRem) {
+    if (micRecording || !audioBytes || spkrRem || preRollSecs > 0) {
       bytesRead = espMicInput(); // load sampleBuffer
       if (micRecording && motionTriggeredAudio) {
-        wavFile.write((uint8_t*)sampleBuffer, bytesRead);
-        totalSamples += bytesRead / sampleWidth; 
-      }
+        if (audioPreRollMs) {
+          // precede live samples with pre-roll samples
+          totalSamples += writeAudioPreRoll(audioPreRollMs) / sampleWidth;
+          audioPreRollMs = 0;
+        }
+        totalSamples += queueAudio((uint8_t*)sampleBuffer, bytesRead) / sampleWidth; 
+      } else if (!micRecording) storeAudioPreRoll((uint8_t*)sampleBuffer, bytesRead);
       if (!audioBytes) {
         // fill audioBuffer to send to NVR
         memcpy(audioBuffer, sampleBuffer, bytesRead);
@@ -5,44 +5,94 @@ Generate AVI format for recorded videos
 s60sc 2020, 2022
 */
 
-/* AVI file format:
+/* AVI file format, using OpenDML (AVI 2.0) extensions so that recordings 
+are not limited by frame count or by 32 bit index offsets:
 header:
- 310 bytes
-per jpeg:
- 4 byte 00dc marker
- 4 byte jpeg size
- jpeg frame content
-0-3 bytes filler to align on DWORD boundary
-per PCM (audio file)
- 4 byte 01wb marker
- 4 byte pcm size
- pcm content
- 0-3 bytes filler to align on DWORD boundary
-footer:
- 4 byte idx1 marker
- 4 byte index size
+ AVI_HEADER_LEN bytes, containing for each of video and audio streams
+ an indx super index referencing the standard index chunks, and an 
+ odml list whose dmlh chunk holds the total frame count, then a JUNK
+ chunk padding the header to whole SD sectors
+first RIFF (AVI):
  per jpeg:
   4 byte 00dc marker
-  4 byte 0000
-  4 byte jpeg location
   4 byte jpeg size
- per pcm:
+  jpeg frame content
+  0-3 bytes filler to align on DWORD boundary
+  optionally preceded by JUNK chunk so that jpeg starts on sector or block boundary
+ per block of PCM (audio), interleaved with jpegs
   4 byte 01wb marker
-  4 byte 0000
-  4 byte pcm location
   4 byte pcm size
+  pcm content
+ per IX_ENTRIES jpegs or PCM blocks, and at end of each RIFF:
+  4 byte ix00 or ix01 marker
+  4 byte index size
+  24 byte standard index header, with 64 bit base offset
+  per jpeg or pcm:
+   4 byte location relative to base offset
+   4 byte size
+ legacy idx1 index of first RIFF, for older players:
+  4 byte idx1 marker
+  4 byte index size
+  per jpeg or pcm:
+   4 byte 00dc or 01wb marker
+   4 byte 0000
+   4 byte location
+   4 byte size
+further RIFFs (AVIX), each limited to ODML_SEG_MAX:
+ 12 byte RIFF header, 12 byte movi list header
+ jpegs, pcm and indexes as above
 */
 
 #include "appGlobals.h"
+#include "aviCheck.h"
+
+#define IDX_ENTRY 16 // bytes per idx1 index entry
+#define IDX_BATCH 4096 // idx1 entries buffered before writing to sidecar file, multiple of sector size
+#define IX_ENTRY 8 // bytes per standard index entry
+#define IX_HDR 32 // standard index chunk header length
+#define IX_ENTRIES 4096 // max entries per standard index chunk
+#define ODML_SUPER 64 // max entries in super index per stream
+#define INDX_LEN (32 + ODML_SUPER * 16) // super index chunk length
+#define ODML_SEGS 8 // max RIFFs per file, more than FAT32 file size limit
+#ifndef ODML_SEG_MAX
+#define ODML_SEG_MAX (1024 * ONEMEG) // max RIFF size, for player compatibility
+#endif
+#define DMLH_LEN 248
+#define SEG_HDR 24 // RIFF and movi list headers for further RIFFs
+#define ALIGN_MAX (RAMSIZE + CHUNK_HDR) // max JUNK padding before frame
+#define AVI_PARTS 8 // max index, RIFF and JUNK parts pending output
+
+// offsets in AVI header, extended from legacy 310 byte header 
+#define LEGACY_HDR_LEN 310
+#define VID_STRL 0x58 // video stream list
+#define VID_INDX 0xCC // video super index, after video strf
+#define AUD_STRL (VID_INDX + INDX_LEN) // audio stream list
+#define AUD_SHIFT (AUD_STRL - VID_INDX) // audio field offsets moved from legacy header
+#define AUD_INDX (AUD_STRL + 0x5E) // audio super index, after audio strf
+#define ODML_LIST (AUD_INDX + INDX_LEN)
+#define HDR_JUNK (ODML_LIST + 20 + DMLH_LEN) // pads header to AVI_HEADER_LEN
+#define MOVI_LIST (AVI_HEADER_LEN - 12)
+static_assert(HDR_JUNK + CHUNK_HDR <= MOVI_LIST, "AVI_HEADER_LEN too small for OpenDML header layout");
+static_assert(AVI_HEADER_LEN % SD_SECTOR == 0, "AVI_HEADER_LEN not whole sectors");
 
 // avi header data
 const uint8_t dcBuf[4] = {0x30, 0x30, 0x64, 0x63};   // 00dc
 const uint8_t wbBuf[4] = {0x30, 0x31, 0x77, 0x62};   // 01wb
 static const uint8_t idx1Buf[4] = {0x69, 0x64, 0x78, 0x31}; // idx1
 static const uint8_t zeroBuf[4] = {0x00, 0x00, 0x00, 0x00}; // 0000
-static uint8_t* idxBuf[2] = {NULL, NULL};
+static const uint8_t indxBuf[4] = {0x69, 0x6E, 0x64, 0x78}; // indx
+static const uint8_t ix00Buf[4] = {0x69, 0x78, 0x30, 0x30}; // ix00
+static const uint8_t ix01Buf[4] = {0x69, 0x78, 0x30, 0x31}; // ix01
+static const uint8_t odmlBuf[12] = {0x4C, 0x49, 0x53, 0x54, 0x00, 0x00, 0x00, 0x00, 0x6F, 0x64, 0x6D, 0x6C}; // LIST odml
+static const uint8_t dmlhBuf[4] = {0x64, 0x6D, 0x6C, 0x68}; // dmlh
+static const uint8_t moviBuf[12] = {0x4C, 0x49, 0x53, 0x54, 0x00, 0x00, 0x00, 0x00, 0x6D, 0x6F, 0x76, 0x69}; // LIST movi
+static const uint8_t avixBuf[12] = {0x52, 0x49, 0x46, 0x46, 0x00, 0x00, 0x00, 0x00, 0x41, 0x56, 0x49, 0x58}; // RIFF AVIX
+static const uint8_t junkBuf[4] = {0x4A, 0x55, 0x4E, 0x4B}; // JUNK
+static const uint8_t junkFill[RAMSIZE] = {0}; // JUNK content, held in flash
+
+uint8_t aviHeader[AVI_HEADER_LEN]; // built from template by buildAviHdr()
 
-uint8_t aviHeader[AVI_HEADER_LEN] = { // AVI header template
+static const uint8_t aviTemplate[LEGACY_HDR_LEN] = { // AVI header template
   0x52, 0x49, 0x46, 0x46, 0x00, 0x00, 0x00, 0x00, 0x41, 0x56, 0x49, 0x20, 0x4C, 0x49, 0x53, 0x54,
   0x16, 0x01, 0x00, 0x00, 0x68, 0x64, 0x72, 0x6C, 0x61, 0x76, 0x69, 0x68, 0x38, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
@@ -88,7 +138,7 @@ static const frameSizeStruct frameSizeData[] = {
   {{0x00, 0x05}, {0xD0, 0x02}}, // hd
   {{0x00, 0x05}, {0x00, 0x04}}, // sxga
   {{0x40, 0x06}, {0xB0, 0x04}}, // uxga 
-  {{0x98, 0x03}, {0x38, 0x04}}, // FHD
+  {{0x80, 0x07}, {0x38, 0x04}}, // FHD
   {{0xD0, 0x02}, {0x00, 0x05}}, // P_HD
   {{0x60, 0x03}, {0x00, 0x06}}, // P_3MP
   {{0x00, 0x08}, {0x00, 0x06}}, // QXGA
@@ -99,39 +149,299 @@ static const frameSizeStruct frameSizeData[] = {
   {{0x20, 0x0A}, {0x98, 0x07}}  // 5MP
 };
 
-#define IDX_ENTRY 16 // bytes per index entry
+struct superEntry {
+  uint64_t offset; // location of standard index chunk
+  uint32_t size; // size of standard index chunk
+  uint32_t duration; // frames, or audio samples, indexed
+};
+
+// standard and super index of a stream
+struct stdIndex {
+  uint8_t* buf; // standard index chunk being built
+  uint32_t cnt;
+  size_t base; // base offset for standard index entries
+  uint32_t duration;
+  superEntry super[ODML_SUPER];
+  uint16_t superCnt;
+};
+
+// state of each avi file being written
+struct odmlState {
+  size_t filePos; // location of next chunk
+  uint8_t segNum; // current RIFF
+  size_t segStart[ODML_SEGS]; // location of each RIFF
+  size_t moviEnd[ODML_SEGS]; // end of each movi list
+  size_t riffEnd[ODML_SEGS]; // end of each RIFF
+  uint32_t firstFrames; // frames in first RIFF
+  stdIndex ix[2]; // video, audio
+  size_t audBytes; // total pcm content
+  // legacy idx1 index for first RIFF, spilled to sidecar file in batches
+  File idxFile;
+  uint8_t* idxBuf; // batch of entries, then reused to copy sidecar to avi
+  size_t idxPtr; // bytes in batch
+  size_t idxLen; // total bytes of entries
+  size_t idxRemain; // sidecar bytes still to copy to avi
+  bool idxDone;
+  uint8_t idxHdr[CHUNK_HDR];
+  uint8_t segHdr[SEG_HDR];
+  uint8_t junkHdr[CHUNK_HDR];
+  size_t junkBytes; // JUNK padding in movi lists
+  // index, RIFF and JUNK data pending output by getAviIndex()
+  const uint8_t* part[AVI_PARTS];
+  size_t partLen[AVI_PARTS];
+  uint8_t partCnt;
+  uint8_t partIdx;
+};
+
+// separate state for motion capture and timelapse
+static odmlState odml[2];
+
+static inline void put32(uint8_t* buf, uint32_t val) {
+  memcpy(buf, &val, 4);
+}
+
+static inline void put64(uint8_t* buf, uint64_t val) {
+  memcpy(buf, &val, 8);
+}
+
+static void addPart(odmlState& od, const uint8_t* data, size_t dataLen) {
+  // queue data for output to avi file
+  od.part[od.partCnt] = data;
+  od.partLen[od.partCnt++] = dataLen;
+  od.filePos += dataLen;
+}
 
-// separate index for motion capture and timelapse
-static size_t idxPtr[2];
-static size_t idxOffset[2];
-static size_t moviSize[2];
-static size_t audSize;
-static size_t indexLen[2];
-static File wavFile;
-bool haveSoundFile = false;
+static void buildIxHdr(uint8_t* ixHdr, const uint8_t* ixId, const uint8_t* chunkId, uint32_t entries, uint64_t baseOffset) {
+  // standard index chunk header
+  memcpy(ixHdr, ixId, 4);
+  put32(ixHdr + 4, IX_HDR - CHUNK_HDR + entries * IX_ENTRY);
+  ixHdr[8] = 2; // longs per entry
+  ixHdr[9] = 0; // index sub type
+  ixHdr[10] = 1; // index of chunks
+  ixHdr[11] = 0;
+  put32(ixHdr + 12, entries);
+  memcpy(ixHdr + 16, chunkId, 4);
+  put64(ixHdr + 20, baseOffset);
+  put32(ixHdr + 28, 0);
+}
 
+static void closeIx(odmlState& od, bool isAud) {
+  // complete standard index chunk for stream since previous one, and add to super index
+  stdIndex& si = od.ix[isAud];
+  if (!si.cnt) return;
+  size_t ixLen = IX_HDR + si.cnt * IX_ENTRY;
+  buildIxHdr(si.buf, isAud ? ix01Buf : ix00Buf, isAud ? wbBuf : dcBuf, si.cnt, si.base);
+  if (si.superCnt < ODML_SUPER) si.super[si.superCnt++] = {od.filePos, (uint32_t)ixLen, si.duration};
+  else LOG_WRN("AVI super index full, %s not indexed", isAud ? "audio" : "frames");
+  addPart(od, si.buf, ixLen);
+  si.cnt = si.duration = 0;
+}
+
+static void padChunk(odmlState& od, uint16_t alignLen, size_t nextHdr) {
+  // queue JUNK chunk so that data after next chunk header of nextHdr bytes starts on alignLen boundary
+  size_t padLen = (alignLen - (od.filePos + nextHdr) % alignLen) % alignLen;
+  if (padLen && padLen < CHUNK_HDR) padLen += alignLen; // room for JUNK header
+  if (!padLen) return;
+  memcpy(od.junkHdr, junkBuf, 4);
+  put32(od.junkHdr + 4, padLen - CHUNK_HDR);
+  addPart(od, od.junkHdr, CHUNK_HDR);
+  addPart(od, junkFill, padLen - CHUNK_HDR);
+  od.junkBytes += padLen;
+}
+
+static void spillIdx(odmlState& od) {
+  // append batch of idx1 entries to sidecar file
+  if (od.idxPtr && od.idxFile.write(od.idxBuf, od.idxPtr) != od.idxPtr) LOG_WRN("Failed to write AVI index sidecar");
+  od.idxPtr = 0;
+}
+
+static void closeSegment(odmlState& od, uint16_t alignLen = 0) {
+  // end current RIFF, first RIFF also has legacy index, padded to alignLen boundary if given
+  od.moviEnd[od.segNum] = od.filePos;
+  if (!od.segNum && od.idxFile) {
+    spillIdx(od);
+    od.idxFile.flush();
+    od.idxFile.seek(0, SeekSet); // copied to avi by getAviIndex()
+    od.idxRemain = od.idxLen;
+    memcpy(od.idxHdr, idx1Buf, 4);
+    put32(od.idxHdr + 4, od.idxLen); // size of index 
+    addPart(od, od.idxHdr, CHUNK_HDR);
+    addPart(od, NULL, od.idxLen); // content from sidecar
+  }
+  od.idxDone = true;
+  if (alignLen) padChunk(od, alignLen, 0);
+  od.riffEnd[od.segNum] = od.filePos;
+}
 
 void prepAviIndex(bool isTL) {
-  // prep buffer to store index data, gets appended to end of file
-  if (idxBuf[isTL] == NULL) idxBuf[isTL] = (uint8_t*)ps_malloc((maxFrames+1)*IDX_ENTRY); // include some space for audio index
-  memcpy(idxBuf[isTL], idx1Buf, 4); // index header
-  idxPtr[isTL] = CHUNK_HDR;  // leave 4 bytes for index size
-  moviSize[isTL] = indexLen[isTL] = 0;
-  idxOffset[isTL] = 4; // 4 byte offset
+  // prep buffers to store index data, gets written to file during and at end of recording
+  odmlState& od = odml[isTL];
+  if (od.idxBuf == NULL) {
+    od.idxBuf = (uint8_t*)ps_malloc(IDX_BATCH); 
+    if (od.idxBuf != NULL) {
+      // fixed size, rather than holding whole idx1 index for maxFrames 
+      size_t fullIdx = CHUNK_HDR + (maxFrames+1)*IDX_ENTRY;
+      LOG_INF("AVI index buffer %u bytes, saves %s PSRAM", IDX_BATCH, fmtSize(fullIdx > IDX_BATCH ? fullIdx - IDX_BATCH : 0));
+    }
+  }
+  for (int i = 0; i < (isTL ? 1 : 2); i++) {
+    // no audio for timelapse
+    if (od.ix[i].buf == NULL) od.ix[i].buf = (uint8_t*)ps_malloc(IX_HDR + IX_ENTRIES*IX_ENTRY);
+    od.ix[i].cnt = od.ix[i].duration = od.ix[i].superCnt = 0;
+  }
+  if (od.idxFile) od.idxFile.close();
+  if (od.idxBuf != NULL) od.idxFile = STORAGE.open(isTL ? TLIDXTEMP : IDXTEMP, "w+");
+  if (!od.idxFile) LOG_WRN("AVI index sidecar unavailable, no idx1 index");
+  od.idxPtr = od.idxLen = od.idxRemain = 0;
+  od.idxDone = false;
+  od.filePos = AVI_HEADER_LEN;
+  od.segNum = 0;
+  od.segStart[0] = 0;
+  od.firstFrames = 0;
+  od.audBytes = od.junkBytes = 0;
+  od.partCnt = od.partIdx = 0;
 }
 
-void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL) {
-  // update AVI header template with file specific details
-  size_t aviSize = moviSize[isTL] + AVI_HEADER_LEN + ((CHUNK_HDR+IDX_ENTRY) * (frameCnt+(haveSoundFile?1:0))); // AVI content size 
+bool prepAviSplit(size_t chunkLen, bool isTL, uint16_t alignLen) {
+  // called before each frame or audio block is written, to output standard index if full, 
+  // start new RIFF if chunk would exceed RIFF size limit, and pad with JUNK so that
+  // chunk content starts on alignLen boundary if given.
+  // Returns true if data to be written from getAviIndex()
+  odmlState& od = odml[isTL];
+  size_t pendingIdx = (IX_HDR + (od.ix[0].cnt + 1) * IX_ENTRY) + (od.ix[1].cnt ? IX_HDR + (od.ix[1].cnt + 1) * IX_ENTRY : 0)
+    + (od.segNum ? 0 : CHUNK_HDR + od.idxLen + IDX_ENTRY);
+  // allow for max padding, so that RIFF splits are replayed by recoverAviIndex() whatever the alignment
+  bool newSeg = od.filePos + chunkLen + ALIGN_MAX + pendingIdx - od.segStart[od.segNum] > ODML_SEG_MAX 
+    && od.segNum < ODML_SEGS - 1;
+  bool ixFull[2] = {od.ix[0].cnt >= IX_ENTRIES, od.ix[1].cnt >= IX_ENTRIES};
+  for (int i = 0; i < 2; i++) if (newSeg || ixFull[i]) closeIx(od, i);
+  if (newSeg) {
+    closeSegment(od);
+    od.segStart[++od.segNum] = od.filePos;
+    memcpy(od.segHdr, avixBuf, 12);
+    memcpy(od.segHdr + 12, moviBuf, 12);
+    addPart(od, od.segHdr, SEG_HDR);
+    LOG_VRB("Started AVI RIFF %u at %s", od.segNum, fmtSize(od.segStart[od.segNum]));
+  }
+  if (alignLen) padChunk(od, alignLen, CHUNK_HDR);
+  return od.partCnt > 0;
+}
+
+size_t getAviIndex(const uint8_t** idxData, bool isTL) {
+  // supply index and RIFF data queued by prepAviSplit() or finalizeAviIndex()
+  // called repeatedly until return 0
+  odmlState& od = odml[isTL];
+  if (od.partIdx < od.partCnt) {
+    if (od.part[od.partIdx] != NULL) {
+      *idxData = od.part[od.partIdx];
+      return od.partLen[od.partIdx++];
+    }
+    // copy idx1 index from sidecar file in batch sized reads
+    size_t readLen = std::min(od.idxRemain, (size_t)IDX_BATCH);
+    if (od.idxFile.read(od.idxBuf, readLen) != readLen) LOG_WRN("Failed to read AVI index sidecar");
+    od.idxRemain -= readLen;
+    if (!od.idxRemain) {
+      // sidecar no longer needed
+      od.idxFile.close();
+      STORAGE.remove(isTL ? TLIDXTEMP : IDXTEMP);
+      od.partIdx++;
+    }
+    *idxData = od.idxBuf;
+    return readLen;
+  }
+  return od.partCnt = od.partIdx = 0;
+}
+
+void buildAviIdx(size_t dataSize, bool isVid, bool isTL) {
+  // build AVI indexes for chunk just written at current file location
+  // called from saveFrame() for each frame
+  odmlState& od = odml[isTL];
+  size_t chunkPos = od.filePos;
+  od.filePos += dataSize + CHUNK_HDR;
+  // standard index entry locates chunk content relative to base offset
+  stdIndex& si = od.ix[!isVid];
+  if (!si.cnt) si.base = chunkPos;
+  if (si.buf != NULL && si.cnt < IX_ENTRIES) {
+    uint8_t* ixEntry = si.buf + IX_HDR + si.cnt++ * IX_ENTRY;
+    put32(ixEntry, chunkPos + CHUNK_HDR - si.base);
+    put32(ixEntry + 4, dataSize);
+    si.duration += isVid ? 1 : dataSize / sizeof(int16_t);
+  }
+  if (isVid) {
+    if (!od.segNum) od.firstFrames++;
+  } else od.audBytes += dataSize;
+  // legacy index entry, 16 bytes per chunk in first RIFF, location relative to movi
+  if (!od.idxDone && od.idxFile) {
+    uint8_t* idxEntry = od.idxBuf + od.idxPtr;
+    memcpy(idxEntry, isVid ? dcBuf : wbBuf, 4);
+    memcpy(idxEntry+4, zeroBuf, 4);
+    put32(idxEntry+8, chunkPos - (MOVI_LIST + 8)); 
+    put32(idxEntry+12, dataSize); 
+    od.idxPtr += IDX_ENTRY; 
+    od.idxLen += IDX_ENTRY;
+    if (od.idxPtr == IDX_BATCH) spillIdx(od);
+  }
+}
+
+size_t finalizeAviIndex(uint32_t frameCnt, bool isTL, uint16_t alignLen) {
+  // queue remaining indexes for output by getAviIndex(), padded so that file ends on 
+  // alignLen boundary if given. Returns total JUNK padding after header
+  odmlState& od = odml[isTL];
+  closeIx(od, false);
+  closeIx(od, true);
+  closeSegment(od, alignLen);
+  LOG_VRB("AVI of %u frames in %u RIFFs, %u in first", frameCnt, od.segNum + 1, od.firstFrames);
+  return od.junkBytes;
+}
+
+static void buildSuperIdx(uint8_t* indx, const uint8_t* chunkId, const superEntry* entries, uint16_t numEntries) {
+  // super index chunk referencing standard index chunks of stream 
+  memset(indx, 0, INDX_LEN);
+  memcpy(indx, indxBuf, 4);
+  put32(indx + 4, INDX_LEN - CHUNK_HDR);
+  indx[8] = 4; // longs per entry
+  put32(indx + 12, numEntries);
+  memcpy(indx + 16, chunkId, 4);
+  for (int i = 0; i < numEntries; i++) {
+    uint8_t* entry = indx + 32 + i * 16;
+    put64(entry, entries[i].offset);
+    put32(entry + 8, entries[i].size);
+    put32(entry + 12, entries[i].duration);
+  }
+}
+
+void buildAviHdr(uint8_t FPS, uint8_t frameType, uint32_t frameCnt, bool isTL) {
+  // build AVI header from template with file specific details
+  // called after finalizeAviIndex()
+  odmlState& od = odml[isTL];
+  memcpy(aviHeader, aviTemplate, VID_INDX); // up to end of video stream format
+  memcpy(aviHeader+AUD_STRL, aviTemplate+VID_INDX, LEGACY_HDR_LEN - 12 - VID_INDX); // audio stream list
+  buildSuperIdx(aviHeader+VID_INDX, dcBuf, od.ix[0].super, od.ix[0].superCnt);
+  buildSuperIdx(aviHeader+AUD_INDX, wbBuf, od.ix[1].super, isTL ? 0 : od.ix[1].superCnt);
+  // list sizes allowing for super indexes and odml list
+  put32(aviHeader+0x10, HDR_JUNK - 0x14); // hdrl
+  put32(aviHeader+VID_STRL+4, AUD_STRL - (VID_STRL + 8)); 
+  put32(aviHeader+AUD_STRL+4, ODML_LIST - (AUD_STRL + 8));
+  // total frames in all RIFFs
+  memcpy(aviHeader+ODML_LIST, odmlBuf, 12);
+  put32(aviHeader+ODML_LIST+4, HDR_JUNK - (ODML_LIST + 8));
+  memcpy(aviHeader+ODML_LIST+12, dmlhBuf, 4);
+  put32(aviHeader+ODML_LIST+16, DMLH_LEN);
+  memset(aviHeader+ODML_LIST+20, 0, DMLH_LEN);
+  put32(aviHeader+ODML_LIST+20, frameCnt);
+  memcpy(aviHeader+HDR_JUNK, junkBuf, 4);
+  put32(aviHeader+HDR_JUNK+4, MOVI_LIST - (HDR_JUNK + CHUNK_HDR));
+  memset(aviHeader+HDR_JUNK+CHUNK_HDR, 0, MOVI_LIST - (HDR_JUNK + CHUNK_HDR));
+  memcpy(aviHeader+MOVI_LIST, moviBuf, 12);
+  put32(aviHeader+MOVI_LIST+4, od.moviEnd[0] - (MOVI_LIST + 8)); // first movi size 
+
   // update aviHeader with relevant stats
-  memcpy(aviHeader+4, &aviSize, 4);
+  put32(aviHeader+4, od.riffEnd[0] - CHUNK_HDR); // first RIFF size
   uint32_t usecs = (uint32_t)round(1000000.0f / FPS); // usecs_per_frame 
-  memcpy(aviHeader+0x20, &usecs, 4); 
-  memcpy(aviHeader+0x30, &frameCnt, 2);
-  memcpy(aviHeader+0x8C, &frameCnt, 2);
+  put32(aviHeader+0x20, usecs); 
+  put32(aviHeader+0x30, od.firstFrames); // frames in first RIFF
+  put32(aviHeader+0x8C, frameCnt); // frames in stream
   memcpy(aviHeader+0x84, &FPS, 1);
-  uint32_t dataSize = moviSize[isTL] + ((frameCnt+(haveSoundFile?1:0)) * CHUNK_HDR) + 4; 
-  memcpy(aviHeader+0x12E, &dataSize, 4); // data size 
 
   // apply video framesize to avi header
   memcpy(aviHeader+0x40, frameSizeData[frameType].frameWidth, 2);
@@ -141,102 +451,293 @@ void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL) {
 
 #if INCLUDE_AUDIO
   uint8_t withAudio = 2; // increase number of streams for audio
-  if (isTL) memcpy(aviHeader+0x100, zeroBuf, 4); // no audio for timelapse
+  if (isTL) memcpy(aviHeader+0x100+AUD_SHIFT, zeroBuf, 4); // no audio for timelapse
   else {
-    if (haveSoundFile) memcpy(aviHeader+0x38, &withAudio, 1); 
-    memcpy(aviHeader+0x100, &audSize, 4); // audio data size
+    if (od.audBytes) memcpy(aviHeader+0x38, &withAudio, 1); 
+    put32(aviHeader+0x100+AUD_SHIFT, od.audBytes / sizeof(int16_t)); // audio length in samples
   }
   // apply audio details to avi header
-  memcpy(aviHeader+0xF8, &SAMPLE_RATE, 4);
+  memcpy(aviHeader+0xF8+AUD_SHIFT, &SAMPLE_RATE, 4);
   uint32_t bytesPerSec = SAMPLE_RATE * 2;
-  memcpy(aviHeader+0x104, &bytesPerSec, 4); // suggested buffer size
-  memcpy(aviHeader+0x11C, &SAMPLE_RATE, 4);
-  memcpy(aviHeader+0x120, &bytesPerSec, 4); // bytes per sec
+  memcpy(aviHeader+0x104+AUD_SHIFT, &bytesPerSec, 4); // suggested buffer size
+  memcpy(aviHeader+0x11C+AUD_SHIFT, &SAMPLE_RATE, 4);
+  memcpy(aviHeader+0x120+AUD_SHIFT, &bytesPerSec, 4); // bytes per sec
 #else
-  memcpy(aviHeader+0x100, zeroBuf, 4);
+  memcpy(aviHeader+0x100+AUD_SHIFT, zeroBuf, 4);
 #endif
-
-  // reset state for next recording
-  moviSize[isTL] = idxPtr[isTL] = 0;
-  idxOffset[isTL] = 4; // 4 byte offset
 }
 
-void buildAviIdx(size_t dataSize, bool isVid, bool isTL) {
-  // build AVI video index into buffer - 16 bytes per frame
-  // called from saveFrame() for each frame
-  moviSize[isTL] += dataSize;
-  if (isVid) memcpy(idxBuf[isTL]+idxPtr[isTL], dcBuf, 4);
-  else memcpy(idxBuf[isTL]+idxPtr[isTL], wbBuf, 4);
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+4, zeroBuf, 4);
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+8, &idxOffset[isTL], 4); 
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+12, &dataSize, 4); 
-  idxOffset[isTL] += dataSize + CHUNK_HDR;
-  idxPtr[isTL] += IDX_ENTRY; 
-}
-
-size_t writeAviIndex(byte* clientBuf, size_t buffSize, bool isTL) {
-  // write completed index to avi file
-  // called repeatedly from closeAvi() until return 0
-  if (idxPtr[isTL] < indexLen[isTL]) {
-    if (indexLen[isTL]-idxPtr[isTL] > buffSize) {
-      memcpy(clientBuf, idxBuf[isTL]+idxPtr[isTL], buffSize);
-      idxPtr[isTL] += buffSize;
-      return buffSize;
+void patchAviSegments(File& aviFile, bool isTL, void (*patchFn)(size_t offset, const void* data, size_t len)) {
+  // update RIFF and movi sizes of each further RIFF, once file complete,
+  // via patchFn if given, as sizes were written as zero
+  odmlState& od = odml[isTL];
+  for (int i = 1; i <= od.segNum; i++) {
+    uint32_t riffSize = od.riffEnd[i] - od.segStart[i] - CHUNK_HDR;
+    uint32_t moviSize = od.moviEnd[i] - od.segStart[i] - 20;
+    if (patchFn != NULL) {
+      patchFn(od.segStart[i] + 4, &riffSize, 4);
+      patchFn(od.segStart[i] + 16, &moviSize, 4);
     } else {
-      // final part of index
-      size_t final = indexLen[isTL]-idxPtr[isTL];
-      memcpy(clientBuf, idxBuf[isTL]+idxPtr[isTL], final);
-      idxPtr[isTL] = indexLen[isTL];
-      return final;    
+      aviFile.seek(od.segStart[i] + 4, SeekSet);
+      aviFile.write((uint8_t*)&riffSize, 4);
+      aviFile.seek(od.segStart[i] + 16, SeekSet);
+      aviFile.write((uint8_t*)&moviSize, 4);
     }
   }
-  return idxPtr[isTL] = 0;
 }
-  
-void finalizeAviIndex(uint16_t frameCnt, bool isTL) {
-  // update index with size
-  uint32_t sizeOfIndex = (frameCnt+(haveSoundFile?1:0))*IDX_ENTRY;
-  memcpy(idxBuf[isTL]+4, &sizeOfIndex, 4); // size of index 
-  indexLen[isTL] = sizeOfIndex + CHUNK_HDR;
-  idxPtr[isTL] = 0; // pointer to index buffer
+
+size_t findAviMovi(File& aviFile) {
+  // locate first chunk in movi list, for legacy or OpenDML header
+  uint8_t chunkHdr[12];
+  size_t pos = 12; // skip RIFF header
+  size_t fileSize = aviFile.size();
+  while (pos + 12 <= fileSize) {
+    aviFile.seek(pos, SeekSet);
+    if (aviFile.read(chunkHdr, 12) != 12) break;
+    uint32_t chunkSize;
+    memcpy(&chunkSize, chunkHdr + 4, 4);
+    if (!memcmp(chunkHdr, moviBuf, 4) && !memcmp(chunkHdr + 8, moviBuf + 8, 4)) return pos + 12;
+    pos += CHUNK_HDR + chunkSize + (chunkSize & 1);
+  }
+  LOG_WRN("AVI movi list not found");
+  return LEGACY_HDR_LEN;
 }
 
-bool haveWavFile(bool isTL) {
-  haveSoundFile = false;
-  audSize = 0;
-#if INCLUDE_AUDIO
-  if (isTL) return false;
-  // check if wave file exists
-  if (!STORAGE.exists(WAVTEMP)) return 0; 
-  // open it and get its size
-  wavFile = STORAGE.open(WAVTEMP, FILE_READ);
-  if (wavFile) {
-    // add sound file index
-    audSize = wavFile.size() - WAV_HDR_LEN;
-    buildAviIdx(audSize, false); 
-    // add sound file header    
-    wavFile.seek(WAV_HDR_LEN, SeekSet); // skip over header
-    haveSoundFile = true;
-  } 
-#endif
-  return haveSoundFile;
-}
-
-size_t writeWavFile(byte* clientBuf, size_t buffSize) {
-  // read in wav file and write to avi file
-  // called repeatedly from closeAvi() until return 0
-  static size_t offsetWav = CHUNK_HDR;
-  if (offsetWav) {
-    // add sound file header         
-    memcpy(clientBuf, wbBuf, 4);     
-    memcpy(clientBuf+4, &audSize, 4); 
-  } 
-  size_t readLen = wavFile.read(clientBuf+offsetWav, buffSize-offsetWav) + offsetWav; 
-  offsetWav = 0;
-  if (readLen) return readLen; 
-  // get here if finished
-  wavFile.close();
-  STORAGE.remove(WAVTEMP);
-  offsetWav = CHUNK_HDR;
+/************** playback seek **************/
+
+// Index of file being played back or scrubbed, loaded on its first seek so
+// that sequential playback reads no index. The video super index is read
+// from the header, then each seek reads one standard index entry, plus the
+// index header on first use of that standard index, so costs O(1) reads.
+// Legacy files without a super index are seeked by scanning idx1.
+
+#define IDX1_SCAN 32 // idx1 entries read per scan block
+
+struct playIndex {
+  char fileName[FILE_NAME_LEN]; // file whose index is loaded
+  superEntry super[ODML_SUPER];
+  uint64_t base[ODML_SUPER]; // base offset of each standard index, 0 until read
+  uint16_t superCnt;
+  size_t idx1Pos; // location of legacy idx1 entries
+  uint32_t idx1Cnt;
+  size_t moviPos; // location of movi list type, idx1 offsets relative to this
+};
+static playIndex playIdx;
+
+static size_t findChunk(File& aviFile, size_t pos, size_t endPos, const char* chunkId, const char* listType = NULL) {
+  // location of chunk or list of given type between pos and endPos, else 0
+  uint8_t chunkHdr[12];
+  while (pos + 12 <= endPos) {
+    aviFile.seek(pos, SeekSet);
+    if (aviFile.read(chunkHdr, 12) != 12) break;
+    uint32_t chunkSize;
+    memcpy(&chunkSize, chunkHdr + 4, 4);
+    if (!memcmp(chunkHdr, chunkId, 4) && (listType == NULL || !memcmp(chunkHdr + 8, listType, 4))) return pos;
+    pos += CHUNK_HDR + chunkSize + (chunkSize & 1);
+  }
   return 0;
 }
+
+static inline size_t listEnd(File& aviFile, size_t listPos) {
+  uint32_t listSize = 0;
+  aviFile.seek(listPos + 4, SeekSet);
+  aviFile.read((uint8_t*)&listSize, 4);
+  return listPos + CHUNK_HDR + listSize;
+}
+
+static void loadPlayIndex(File& aviFile) {
+  // locate video super index in first stream list, else legacy idx1
+  memset(&playIdx, 0, sizeof(playIdx));
+  strncpy(playIdx.fileName, aviFile.path(), FILE_NAME_LEN - 1);
+  size_t fileSize = aviFile.size();
+  size_t riffEnd = std::min(listEnd(aviFile, 0), fileSize);
+  size_t hdrl = findChunk(aviFile, 12, riffEnd, "LIST", "hdrl");
+  size_t strl = hdrl ? findChunk(aviFile, hdrl + 12, listEnd(aviFile, hdrl), "LIST", "strl") : 0;
+  size_t indx = strl ? findChunk(aviFile, strl + 12, listEnd(aviFile, strl), "indx") : 0;
+  if (indx) {
+    uint8_t indxHdr[24];
+    aviFile.seek(indx + CHUNK_HDR, SeekSet);
+    if (aviFile.read(indxHdr, sizeof(indxHdr)) == sizeof(indxHdr) && indxHdr[0] == 4 && indxHdr[3] == 0) {
+      uint32_t entries;
+      memcpy(&entries, indxHdr + 4, 4);
+      playIdx.superCnt = std::min(entries, (uint32_t)ODML_SUPER);
+      // entries have same layout as superEntry
+      size_t superLen = playIdx.superCnt * sizeof(superEntry);
+      if (aviFile.read((uint8_t*)playIdx.super, superLen) != superLen) playIdx.superCnt = 0;
+    }
+  }
+  if (!playIdx.superCnt) {
+    size_t movi = findChunk(aviFile, 12, riffEnd, "LIST", "movi");
+    size_t idx1 = findChunk(aviFile, 12, riffEnd, "idx1");
+    if (movi && idx1) {
+      playIdx.moviPos = movi + CHUNK_HDR;
+      playIdx.idx1Pos = idx1 + CHUNK_HDR;
+      playIdx.idx1Cnt = (listEnd(aviFile, idx1) - playIdx.idx1Pos) / IDX_ENTRY;
+    }
+  }
+  LOG_VRB("Loaded index for %s, super entries %u, idx1 entries %u", playIdx.fileName, playIdx.superCnt, playIdx.idx1Cnt);
+}
+
+static bool seekSuperIdx(File& aviFile, uint32_t frameNum, size_t& chunkPos) {
+  // locate frame from standard index chunk covering it
+  uint32_t firstFrame = 0;
+  for (int i = 0; i < playIdx.superCnt; i++) {
+    if (frameNum < firstFrame + playIdx.super[i].duration) {
+      if (!playIdx.base[i]) {
+        aviFile.seek(playIdx.super[i].offset + 20, SeekSet);
+        if (aviFile.read((uint8_t*)&playIdx.base[i], 8) != 8) return false;
+      }
+      uint32_t ixEntry[2]; // offset of content from base, size
+      aviFile.seek(playIdx.super[i].offset + IX_HDR + (frameNum - firstFrame) * IX_ENTRY, SeekSet);
+      if (aviFile.read((uint8_t*)ixEntry, IX_ENTRY) != IX_ENTRY) return false;
+      chunkPos = playIdx.base[i] + ixEntry[0] - CHUNK_HDR;
+      return true;
+    }
+    firstFrame += playIdx.super[i].duration;
+  }
+  return false;
+}
+
+static bool seekIdx1(File& aviFile, uint32_t frameNum, size_t& chunkPos) {
+  // count video entries in idx1, as may be interleaved with audio
+  uint8_t idxBlock[IDX1_SCAN * IDX_ENTRY];
+  uint32_t frames = 0;
+  aviFile.seek(playIdx.idx1Pos, SeekSet);
+  for (uint32_t i = 0; i < playIdx.idx1Cnt; i += IDX1_SCAN) {
+    size_t blockLen = std::min(playIdx.idx1Cnt - i, (uint32_t)IDX1_SCAN) * IDX_ENTRY;
+    if (aviFile.read(idxBlock, blockLen) != blockLen) return false;
+    for (size_t j = 0; j < blockLen; j += IDX_ENTRY) {
+      if (memcmp(idxBlock + j, dcBuf, 4)) continue;
+      if (frames++ == frameNum) {
+        uint32_t offset;
+        memcpy(&offset, idxBlock + j + 8, 4);
+        chunkPos = playIdx.moviPos + offset;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool seekAviFrame(File& aviFile, uint32_t frameNum, size_t& chunkPos) {
+  // get location of chunk header for given frame number, from 0
+  if (strcmp(playIdx.fileName, aviFile.path())) loadPlayIndex(aviFile);
+  bool found = playIdx.superCnt ? seekSuperIdx(aviFile, frameNum, chunkPos) 
+    : playIdx.idx1Cnt ? seekIdx1(aviFile, frameNum, chunkPos) : false;
+  if (found) {
+    // confirm index is consistent with file
+    uint8_t chunkHdr[CHUNK_HDR];
+    aviFile.seek(chunkPos, SeekSet);
+    found = aviFile.read(chunkHdr, CHUNK_HDR) == CHUNK_HDR && !memcmp(chunkHdr, dcBuf, 4);
+  }
+  if (!found) LOG_WRN("Frame %u not located in %s", frameNum, aviFile.path());
+  return found;
+}
+
+static bool readChunkHdr(File& aviFile, size_t pos, uint8_t* chunkHdr, uint8_t* buf, size_t bufSize, size_t& bufStart, size_t& bufLen) {
+  // get chunk header from buffered file content, reading ahead in large blocks
+  if (pos < bufStart || pos + CHUNK_HDR > bufStart + bufLen) {
+    aviFile.seek(pos, SeekSet);
+    bufLen = aviFile.read(buf, bufSize);
+    bufStart = pos;
+    if (bufLen < CHUNK_HDR) return false;
+  }
+  memcpy(chunkHdr, buf + pos - bufStart, CHUNK_HDR);
+  return true;
+}
+
+static uint8_t jpegFrameType(File& aviFile, size_t jpegPos, uint8_t* buf, size_t bufSize, uint8_t frameType) {
+  // derive frame type from dimensions in SOF0 segment of jpeg
+  aviFile.seek(jpegPos, SeekSet);
+  size_t readLen = aviFile.read(buf, std::min(bufSize, (size_t)1024));
+  for (size_t i = 0; i + 9 < readLen; i++) {
+    if (buf[i] == 0xFF && buf[i+1] == 0xC0) {
+      uint8_t width[2] = {buf[i+8], buf[i+7]}; // big endian to little endian
+      uint8_t height[2] = {buf[i+6], buf[i+5]};
+      for (size_t j = 0; j < sizeof(frameSizeData) / sizeof(frameSizeData[0]); j++) 
+        if (!memcmp(frameSizeData[j].frameWidth, width, 2) && !memcmp(frameSizeData[j].frameHeight, height, 2)) return j;
+      break;
+    }
+  }
+  return frameType; // unchanged if not found
+}
+
+uint32_t recoverAviIndex(File& aviFile, uint8_t* buf, size_t bufSize, uint8_t& frameType, bool isTL) {
+  // rebuild index state for avi file whose recording was interrupted, by walking 
+  // its frame and audio chunks and replaying the index and RIFF splits made when recorded.
+  // Returns number of complete frames, with file positioned after last one,
+  // ready for finalizeAviIndex() and buildAviHdr()
+  odmlState& od = odml[isTL];
+  prepAviIndex(isTL);
+  size_t fileSize = aviFile.size();
+  size_t bufStart = 0, bufLen = 0;
+  uint8_t chunkHdr[CHUNK_HDR];
+  uint32_t frames = 0;
+  while (true) {
+    // locate next frame, passing over any index or RIFF headers
+    size_t pos = od.filePos;
+    size_t junkLen = 0; // alignment padding before chunk
+    uint32_t chunkSize = 0;
+    bool haveChunk = false;
+    bool isVid = true;
+    while (readChunkHdr(aviFile, pos, chunkHdr, buf, bufSize, bufStart, bufLen)) {
+      memcpy(&chunkSize, chunkHdr + 4, 4);
+      isVid = !memcmp(chunkHdr, dcBuf, 4);
+      if (isVid || !memcmp(chunkHdr, wbBuf, 4)) {
+        // empty frames represent gaps in capture times
+        haveChunk = (chunkSize || isVid) && chunkSize < fileSize && pos + CHUNK_HDR + chunkSize <= fileSize;
+        break;
+      }
+      if (!memcmp(chunkHdr, avixBuf, 4) || !memcmp(chunkHdr, moviBuf, 4)) pos += 12;
+      else if (!memcmp(chunkHdr, junkBuf, 4) && chunkSize < fileSize) {
+        junkLen += CHUNK_HDR + chunkSize;
+        pos += CHUNK_HDR + chunkSize;
+      }
+      else if ((!memcmp(chunkHdr, ix00Buf, 4) || !memcmp(chunkHdr, ix01Buf, 4) || !memcmp(chunkHdr, idx1Buf, 4)) 
+        && chunkSize < fileSize) pos += CHUNK_HDR + chunkSize;
+      else break;
+    }
+    if (!haveChunk) break; // end of complete frames and audio blocks
+    // index and RIFF data written before this frame should be where found
+    if (prepAviSplit(chunkSize + CHUNK_HDR, isTL)) {
+      const uint8_t* idxData;
+      while (getAviIndex(&idxData, isTL)); // already in file
+    }
+    od.filePos += junkLen;
+    od.junkBytes += junkLen;
+    if (od.filePos != pos) {
+      LOG_WRN("AVI structure mismatch at %u, expected %u", pos, od.filePos);
+      return 0;
+    }
+    if (!frames && isVid && chunkSize) {
+      frameType = jpegFrameType(aviFile, pos + CHUNK_HDR, buf, bufSize, frameType);
+      bufLen = 0; // buffer reused
+    }
+    buildAviIdx(chunkSize, isVid, isTL);
+    if (isVid) frames++;
+  }
+  aviFile.seek(od.filePos, SeekSet);
+  return frames;
+}
+
+/************** validation **************/
+
+static size_t readAviAt(void* ctx, uint64_t pos, uint8_t* buf, size_t len) {
+  File* aviFile = (File*)ctx;
+  aviFile->seek(pos, SeekSet);
+  return aviFile->read(buf, len);
+}
+
+static void logAviIssue(void* ctx, const char* issue) {
+  LOG_WRN("%s: %s", ((File*)ctx)->path(), issue);
+}
+
+bool validateAvi(File& aviFile, uint8_t* buf, size_t bufSize) {
+  // check avi structure, indexes and header fields against content, see aviCheck.h
+  aviCheck ac;
+  uint32_t issues = checkAviFile(ac, readAviAt, logAviIssue, &aviFile, aviFile.size(), buf, bufSize);
+  if (issues > AVI_CHECK_ISSUES) LOG_WRN("%s: %u further issues not shown", aviFile.path(), issues - AVI_CHECK_ISSUES);
+  LOG_INF("%s %s: %u frames (%u empty) in %u RIFFs, %u audio chunks, %u issues", issues ? "Invalid" : "Valid", 
+    aviFile.path(), ac.frames, ac.emptyFrames, ac.riffs, ac.audChunks, issues);
+  return !issues;
+}
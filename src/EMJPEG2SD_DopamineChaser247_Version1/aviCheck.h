@@ -0,0 +1,506 @@
+// AVI structure checker used by validateAvi() in avi.cpp
+// Parses the RIFF tree of a recording and checks every chunk and list size,
+// the idx1, super and standard index entries against the chunks they locate,
+// and the avih, strh, strf and dmlh header fields against the stream content.
+// Chunks are walked sequentially while each index is followed by its own
+// buffered cursor, so memory use is fixed whatever the file size.
+// Kept free of Arduino / ESP dependencies so that it can be built on a host
+// to check recordings copied from SD, and to check avi.cpp output under test.
+//
+// s60sc 2025
+
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define AVI_CHECK_ISSUES 10 // issues reported per file, rest only counted
+#define AVI_CHECK_WALK 2048 // buffer for chunk walk, rest of buffer shared by index cursors
+#define AVI_CHECK_MIN (AVI_CHECK_WALK + 3 * 512)
+#define AVI_CHECK_SOF 1024 // bytes of first jpeg searched for its dimensions
+
+typedef size_t (*aviReadFn)(void* ctx, uint64_t pos, uint8_t* buf, size_t len);
+typedef void (*aviIssueFn)(void* ctx, const char* issue);
+
+enum aviCursorId { CUR_WALK, CUR_VID, CUR_AUD, CUR_IDX1, CUR_COUNT };
+
+struct aviCursor {
+  uint8_t* buf;
+  size_t size;
+  uint64_t start; // file position of buffer content
+  size_t len;
+};
+
+struct aviStreamIdx {
+  // follows super index of stream, then each standard index it references
+  uint64_t indxPos; // location of super index entries
+  uint32_t superCnt;
+  uint32_t superIdx; // next super entry to open
+  uint32_t ixSeen; // standard index chunks found in movi
+  uint64_t entryPos; // next standard index entry
+  uint32_t entriesLeft;
+  uint64_t base;
+  uint32_t expectDur; // duration in super entry
+  uint32_t gotDur; // duration of chunks in standard index
+  uint64_t totalDur; // sum of super entry durations
+  bool open;
+};
+
+struct aviCheck {
+  aviReadFn read;
+  aviIssueFn issue;
+  void* ctx;
+  uint64_t fileSize;
+  aviCursor cur[CUR_COUNT];
+  uint32_t issues;
+  // from headers
+  bool haveAvih, haveOdml;
+  uint32_t usecs, avihFrames, avihStreams, avihWidth, avihHeight;
+  uint8_t strlCnt;
+  uint32_t vidScale, vidRate, vidLength, strfWidth, strfHeight;
+  bool haveAud;
+  uint32_t audScale, audRate, audLength, audSampleRate, audBytesPerSec, audBlockAlign;
+  uint32_t dmlhFrames;
+  aviStreamIdx six[2]; // video, audio
+  uint64_t moviPos; // first movi list, idx1 offsets are relative to its type
+  uint64_t idx1Pos;
+  uint32_t idx1Cnt;
+  uint32_t idx1Used;
+  // from content
+  uint16_t riffs;
+  uint32_t frames, emptyFrames, firstFrames, audChunks;
+  uint64_t audBytes;
+  uint16_t jpegWidth, jpegHeight;
+};
+
+static void aviIssue(aviCheck& ac, const char* format, ...) {
+  // count issue, only reporting first few
+  if (ac.issues++ >= AVI_CHECK_ISSUES) return;
+  char msg[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(msg, sizeof(msg), format, args);
+  va_end(args);
+  ac.issue(ac.ctx, msg);
+}
+
+static inline uint16_t aviGet16(const uint8_t* p) {
+  return p[0] | p[1] << 8;
+}
+
+static inline uint32_t aviGet32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t aviGet64(const uint8_t* p) {
+  return aviGet32(p) | (uint64_t)aviGet32(p + 4) << 32;
+}
+
+static const uint8_t* aviAt(aviCheck& ac, aviCursorId id, uint64_t pos, size_t len) {
+  // file content at pos from cursor buffer, read ahead from file on miss, else NULL if beyond file
+  aviCursor& c = ac.cur[id];
+  if (len > c.size || pos + len > ac.fileSize) return NULL;
+  if (pos < c.start || pos + len > c.start + c.len) {
+    c.start = pos;
+    c.len = ac.read(ac.ctx, pos, c.buf, (size_t)std::min((uint64_t)c.size, ac.fileSize - pos));
+    if (c.len < len) {
+      c.len = 0;
+      return NULL;
+    }
+  }
+  return c.buf + (pos - c.start);
+}
+
+static inline uint64_t aviChunkEnd(uint64_t pos, uint32_t size) {
+  return pos + 8 + size + (size & 1);
+}
+
+static void aviCheckStrl(aviCheck& ac, uint64_t pos, uint64_t end) {
+  // stream header, format and super index of one stream list
+  uint8_t stream = ac.strlCnt++;
+  if (stream > 1) {
+    aviIssue(ac, "Unexpected stream list %u", stream);
+    return;
+  }
+  const char* expectType = stream ? "auds" : "vids";
+  bool haveStrh = false;
+  while (pos + 8 <= end) {
+    const uint8_t* p = aviAt(ac, CUR_WALK, pos, 8);
+    if (p == NULL) break;
+    uint32_t size = aviGet32(p + 4);
+    uint64_t next = aviChunkEnd(pos, size);
+    if (next > end) {
+      aviIssue(ac, "Stream %u chunk %.4s at %llu overruns strl", stream, (const char*)p, pos);
+      return;
+    }
+    char id[5] = {0};
+    memcpy(id, p, 4);
+    if (!strcmp(id, "strh")) {
+      p = aviAt(ac, CUR_WALK, pos + 8, 36);
+      if (size < 36 || p == NULL) aviIssue(ac, "Stream %u strh too short, %u bytes", stream, size);
+      else {
+        haveStrh = true;
+        if (memcmp(p, expectType, 4)) aviIssue(ac, "Stream %u type %.4s, expected %s", stream, (const char*)p, expectType);
+        if (!stream) {
+          ac.vidScale = aviGet32(p + 20);
+          ac.vidRate = aviGet32(p + 24);
+          ac.vidLength = aviGet32(p + 32);
+        } else {
+          ac.haveAud = true;
+          ac.audScale = aviGet32(p + 20);
+          ac.audRate = aviGet32(p + 24);
+          ac.audLength = aviGet32(p + 32);
+        }
+      }
+    } else if (!strcmp(id, "strf")) {
+      p = aviAt(ac, CUR_WALK, pos + 8, stream ? 16 : 40);
+      if (p == NULL || size < (uint32_t)(stream ? 16 : 40)) aviIssue(ac, "Stream %u strf too short, %u bytes", stream, size);
+      else if (!stream) {
+        ac.strfWidth = aviGet32(p + 4);
+        ac.strfHeight = aviGet32(p + 8);
+        if (memcmp(p + 16, "MJPG", 4)) aviIssue(ac, "Video compression %.4s, expected MJPG", (const char*)p + 16);
+      } else {
+        if (aviGet16(p) != 1) aviIssue(ac, "Audio format %u, expected PCM", aviGet16(p));
+        ac.audSampleRate = aviGet32(p + 4);
+        ac.audBytesPerSec = aviGet32(p + 8);
+        ac.audBlockAlign = aviGet16(p + 12);
+        if (ac.audBytesPerSec != ac.audSampleRate * ac.audBlockAlign)
+          aviIssue(ac, "Audio %u bytes per sec, expected %u", ac.audBytesPerSec, ac.audSampleRate * ac.audBlockAlign);
+      }
+    } else if (!strcmp(id, "indx")) {
+      p = aviAt(ac, CUR_WALK, pos + 8, 24);
+      if (p == NULL || size < 24) aviIssue(ac, "Stream %u indx too short, %u bytes", stream, size);
+      else {
+        uint32_t entries = aviGet32(p + 4);
+        const char* chunkId = stream ? "01wb" : "00dc";
+        if (p[0] != 4 || p[3] != 0) aviIssue(ac, "Stream %u indx not a super index", stream);
+        else if (memcmp(p + 8, chunkId, 4)) aviIssue(ac, "Stream %u indx for %.4s, expected %s", stream, (const char*)p + 8, chunkId);
+        else if (24 + (uint64_t)entries * 16 > size) aviIssue(ac, "Stream %u indx has %u entries, room for %u", stream, entries, (size - 24) / 16);
+        else {
+          ac.six[stream].indxPos = pos + 8 + 24;
+          ac.six[stream].superCnt = entries;
+        }
+      }
+    }
+    pos = next;
+  }
+  if (pos != end) aviIssue(ac, "Stream %u strl content ends at %llu, list ends at %llu", stream, pos, end);
+  if (!haveStrh) aviIssue(ac, "Stream %u has no strh", stream);
+}
+
+static void aviCheckHdrl(aviCheck& ac, uint64_t pos, uint64_t end) {
+  // main header, stream lists and odml list
+  while (pos + 8 <= end) {
+    const uint8_t* p = aviAt(ac, CUR_WALK, pos, 8);
+    if (p == NULL) break;
+    uint32_t size = aviGet32(p + 4);
+    uint64_t next = aviChunkEnd(pos, size);
+    if (next > end) {
+      aviIssue(ac, "Chunk %.4s at %llu overruns hdrl", (const char*)p, pos);
+      return;
+    }
+    bool isList = !memcmp(p, "LIST", 4) && size >= 4 && (p = aviAt(ac, CUR_WALK, pos, 12)) != NULL;
+    if (!memcmp(p, "avih", 4)) {
+      p = aviAt(ac, CUR_WALK, pos + 8, 40);
+      if (size < 40 || p == NULL) aviIssue(ac, "avih too short, %u bytes", size);
+      else {
+        ac.haveAvih = true;
+        ac.usecs = aviGet32(p);
+        ac.avihFrames = aviGet32(p + 16);
+        ac.avihStreams = aviGet32(p + 24);
+        ac.avihWidth = aviGet32(p + 32);
+        ac.avihHeight = aviGet32(p + 36);
+      }
+    } else if (isList && !memcmp(p + 8, "strl", 4)) aviCheckStrl(ac, pos + 12, next);
+    else if (isList && !memcmp(p + 8, "odml", 4)) {
+      p = aviAt(ac, CUR_WALK, pos + 12, 12);
+      if (p == NULL || memcmp(p, "dmlh", 4) || aviGet32(p + 4) < 4) aviIssue(ac, "odml list without dmlh");
+      else {
+        ac.haveOdml = true;
+        ac.dmlhFrames = aviGet32(p + 8);
+      }
+    }
+    pos = next;
+  }
+  if (pos != end) aviIssue(ac, "hdrl content ends at %llu, list ends at %llu", pos, end);
+  if (!ac.haveAvih) aviIssue(ac, "No avih in hdrl");
+  if (!ac.strlCnt) aviIssue(ac, "No stream lists in hdrl");
+}
+
+static void aviCloseIx(aviCheck& ac, uint8_t stream) {
+  // compare duration of completed standard index with its super entry
+  aviStreamIdx& si = ac.six[stream];
+  if (si.open && si.gotDur != si.expectDur)
+    aviIssue(ac, "Stream %u standard index %u duration %u, super index has %u", stream, si.superIdx - 1, si.gotDur, si.expectDur);
+  si.open = false;
+}
+
+static bool aviNextIxEntry(aviCheck& ac, uint8_t stream, uint64_t& dataPos, uint32_t& dataSize) {
+  // next entry of stream standard indexes, in order of super index
+  aviStreamIdx& si = ac.six[stream];
+  aviCursorId cid = stream ? CUR_AUD : CUR_VID;
+  while (!si.entriesLeft) {
+    aviCloseIx(ac, stream);
+    if (si.superIdx >= si.superCnt) return false;
+    const uint8_t* p = aviAt(ac, cid, si.indxPos + si.superIdx * 16, 16);
+    if (p == NULL) return false;
+    si.superIdx++;
+    uint64_t ixPos = aviGet64(p);
+    uint32_t ixSize = aviGet32(p + 8);
+    si.expectDur = aviGet32(p + 12);
+    si.totalDur += si.expectDur;
+    const char* ixId = stream ? "ix01" : "ix00";
+    p = aviAt(ac, cid, ixPos, 32);
+    if (p == NULL || memcmp(p, ixId, 4)) {
+      aviIssue(ac, "Stream %u super entry %u locates no %s at %llu", stream, si.superIdx - 1, ixId, ixPos);
+      continue;
+    }
+    uint32_t entries = aviGet32(p + 12);
+    if (aviGet32(p + 4) + 8 != ixSize) aviIssue(ac, "%s at %llu size %u, super index has %u", ixId, ixPos, aviGet32(p + 4) + 8, ixSize);
+    if (p[8] != 2 || p[10] != 1 || memcmp(p + 16, stream ? "01wb" : "00dc", 4)) aviIssue(ac, "%s at %llu has invalid header", ixId, ixPos);
+    if (32 + (uint64_t)entries * 8 > aviGet32(p + 4) + 8) {
+      aviIssue(ac, "%s at %llu has %u entries, exceeding its size", ixId, ixPos, entries);
+      continue;
+    }
+    si.base = aviGet64(p + 20);
+    si.entryPos = ixPos + 32;
+    si.entriesLeft = entries;
+    si.gotDur = 0;
+    si.open = true;
+  }
+  const uint8_t* p = aviAt(ac, cid, si.entryPos, 8);
+  if (p == NULL) {
+    aviIssue(ac, "Stream %u standard index entry at %llu beyond end of file", stream, si.entryPos);
+    si.entriesLeft = 0;
+    return false;
+  }
+  dataPos = si.base + aviGet32(p);
+  dataSize = aviGet32(p + 4);
+  if (dataSize & 0x80000000) aviIssue(ac, "Stream %u chunk at %llu not indexed as key frame", stream, dataPos);
+  dataSize &= 0x7FFFFFFF;
+  si.gotDur += stream ? dataSize / (ac.audBlockAlign ? ac.audBlockAlign : 1) : 1;
+  si.entryPos += 8;
+  si.entriesLeft--;
+  return true;
+}
+
+static void aviCheckIxChunk(aviCheck& ac, uint8_t stream, uint64_t pos, uint32_t size) {
+  // standard index chunk in movi should be the next referenced by super index
+  aviStreamIdx& si = ac.six[stream];
+  if (!si.superCnt) return;
+  if (si.ixSeen >= si.superCnt) {
+    aviIssue(ac, "Stream %u standard index at %llu not in super index", stream, pos);
+    return;
+  }
+  const uint8_t* p = aviAt(ac, CUR_WALK, si.indxPos + si.ixSeen++ * 16, 16);
+  if (p != NULL && (aviGet64(p) != pos || aviGet32(p + 8) != size + 8))
+    aviIssue(ac, "Stream %u standard index at %llu, super entry %u has %llu", stream, pos, si.ixSeen - 1, aviGet64(p));
+}
+
+static void aviCheckIdx1(aviCheck& ac, const uint8_t* chunkId, uint64_t pos, uint32_t size) {
+  // legacy index entry for chunk in first RIFF, offset relative to movi list type
+  if (!ac.idx1Pos) return;
+  if (ac.idx1Used >= ac.idx1Cnt) {
+    if (ac.idx1Used++ == ac.idx1Cnt) aviIssue(ac, "idx1 ends before chunk %.4s at %llu", (const char*)chunkId, pos);
+    return;
+  }
+  const uint8_t* p = aviAt(ac, CUR_IDX1, ac.idx1Pos + ac.idx1Used++ * 16, 16);
+  if (p == NULL) return;
+  if (memcmp(p, chunkId, 4) || aviGet32(p + 8) != pos - (ac.moviPos + 8) || aviGet32(p + 12) != size)
+    aviIssue(ac, "idx1 entry %u %.4s at %u size %u, chunk %.4s at %llu size %u", ac.idx1Used - 1, (const char*)p,
+      aviGet32(p + 8), aviGet32(p + 12), (const char*)chunkId, pos - (ac.moviPos + 8), size);
+}
+
+static void aviJpegSize(aviCheck& ac, uint64_t pos, uint32_t size) {
+  // dimensions from SOF0 segment of first non empty frame
+  size_t len = std::min((size_t)size, (size_t)AVI_CHECK_SOF);
+  const uint8_t* p = aviAt(ac, CUR_WALK, pos, len);
+  if (p == NULL) return;
+  for (size_t i = 0; i + 9 < len; i++) {
+    if (p[i] == 0xFF && p[i+1] == 0xC0) {
+      ac.jpegHeight = p[i+5] << 8 | p[i+6];
+      ac.jpegWidth = p[i+7] << 8 | p[i+8];
+      return;
+    }
+  }
+  aviIssue(ac, "No SOF0 in first %u bytes of jpeg at %llu", len, pos);
+}
+
+static bool aviCheckMovi(aviCheck& ac, uint64_t pos, uint64_t end, bool firstRiff) {
+  // each chunk of movi list against stream indexes and idx1, returns false if walk cannot continue
+  while (pos + 8 <= end) {
+    const uint8_t* p = aviAt(ac, CUR_WALK, pos, 10);
+    if (p == NULL) p = aviAt(ac, CUR_WALK, pos, 8);
+    if (p == NULL) break;
+    uint8_t chunkId[4];
+    memcpy(chunkId, p, 4);
+    uint32_t size = aviGet32(p + 4);
+    uint64_t next = aviChunkEnd(pos, size);
+    if (next > end) {
+      aviIssue(ac, "Chunk %.4s at %llu size %u overruns movi ending at %llu", (const char*)chunkId, pos, size, end);
+      return false;
+    }
+    bool isVid = !memcmp(chunkId, "00dc", 4);
+    if (isVid || !memcmp(chunkId, "01wb", 4)) {
+      if (isVid) {
+        ac.frames++;
+        if (firstRiff) ac.firstFrames++;
+        if (!size) ac.emptyFrames++;
+        else if (size < 2 || p[8] != 0xFF || p[9] != 0xD8) aviIssue(ac, "Frame %u at %llu is not a jpeg", ac.frames - 1, pos);
+        else if (!ac.jpegWidth) aviJpegSize(ac, pos + 8, size);
+      } else {
+        ac.audChunks++;
+        ac.audBytes += size;
+      }
+      uint8_t stream = !isVid;
+      if (ac.six[stream].superCnt) {
+        uint64_t dataPos;
+        uint32_t dataSize;
+        if (!aviNextIxEntry(ac, stream, dataPos, dataSize)) aviIssue(ac, "Chunk %.4s at %llu not in stream index", (const char*)chunkId, pos);
+        else if (dataPos != pos + 8 || dataSize != size)
+          aviIssue(ac, "Chunk %.4s at %llu size %u, indexed at %llu size %u", (const char*)chunkId, pos, size, dataPos - 8, dataSize);
+      }
+      if (firstRiff) aviCheckIdx1(ac, chunkId, pos, size);
+    } else if (!memcmp(chunkId, "ix00", 4) || !memcmp(chunkId, "ix01", 4)) aviCheckIxChunk(ac, chunkId[3] - '0', pos, size);
+    else if (memcmp(chunkId, "JUNK", 4)) aviIssue(ac, "Unexpected chunk %.4s at %llu in movi", (const char*)chunkId, pos);
+    pos = next;
+  }
+  if (pos != end) {
+    aviIssue(ac, "movi content ends at %llu, list ends at %llu", pos, end);
+    return false;
+  }
+  return true;
+}
+
+static void aviCheckTotals(aviCheck& ac) {
+  // header fields against stream content
+  for (uint8_t stream = 0; stream < 2; stream++) {
+    aviStreamIdx& si = ac.six[stream];
+    uint64_t dataPos;
+    uint32_t dataSize;
+    if (si.entriesLeft || si.superIdx < si.superCnt) {
+      uint32_t extra = 0;
+      while (aviNextIxEntry(ac, stream, dataPos, dataSize)) extra++;
+      if (extra) aviIssue(ac, "Stream %u index has %u entries beyond chunks in file", stream, extra);
+    }
+    aviCloseIx(ac, stream);
+    if (si.ixSeen != si.superCnt) aviIssue(ac, "Stream %u super index has %u entries, %u standard indexes in file", stream, si.superCnt, si.ixSeen);
+  }
+  if (ac.six[0].superCnt && ac.six[0].totalDur != ac.frames)
+    aviIssue(ac, "Video super index duration %llu, file has %u frames", ac.six[0].totalDur, ac.frames);
+  if (ac.idx1Pos && ac.idx1Used < ac.idx1Cnt) aviIssue(ac, "idx1 has %u entries, first RIFF has %u chunks", ac.idx1Cnt, ac.idx1Used);
+  if (ac.riffs > 1 && !ac.haveOdml) aviIssue(ac, "%u RIFFs but no odml list", ac.riffs);
+  if (ac.haveOdml && ac.dmlhFrames != ac.frames) aviIssue(ac, "dmlh frames %u, file has %u", ac.dmlhFrames, ac.frames);
+  if (ac.avihFrames != ac.firstFrames) aviIssue(ac, "avih frames %u, first RIFF has %u", ac.avihFrames, ac.firstFrames);
+  if (ac.vidLength != ac.frames) aviIssue(ac, "Video strh length %u, file has %u frames", ac.vidLength, ac.frames);
+  if (!ac.vidRate || !ac.vidScale) aviIssue(ac, "Video strh rate %u / scale %u", ac.vidRate, ac.vidScale);
+  else {
+    uint32_t usecs = (uint32_t)((1000000ULL * ac.vidScale + ac.vidRate / 2) / ac.vidRate);
+    if (ac.usecs + 1 < usecs || ac.usecs > usecs + 1) aviIssue(ac, "avih %u usecs per frame, strh rate gives %u", ac.usecs, usecs);
+  }
+  if (ac.jpegWidth) {
+    if (ac.avihWidth != ac.jpegWidth || ac.avihHeight != ac.jpegHeight)
+      aviIssue(ac, "avih frame size %ux%u, jpeg is %ux%u", ac.avihWidth, ac.avihHeight, ac.jpegWidth, ac.jpegHeight);
+    if (ac.strfWidth != ac.jpegWidth || ac.strfHeight != ac.jpegHeight)
+      aviIssue(ac, "Video strf frame size %ux%u, jpeg is %ux%u", ac.strfWidth, ac.strfHeight, ac.jpegWidth, ac.jpegHeight);
+  }
+  if (ac.audChunks) {
+    if (!ac.haveAud) aviIssue(ac, "Audio chunks without audio stream list");
+    else {
+      uint32_t align = ac.audBlockAlign ? ac.audBlockAlign : 1;
+      if (ac.audBytes % align) aviIssue(ac, "Audio %llu bytes is not whole samples of %u bytes", ac.audBytes, align);
+      if (ac.audLength != ac.audBytes / align) aviIssue(ac, "Audio strh length %u, file has %llu samples", ac.audLength, ac.audBytes / align);
+      if (!ac.audScale || ac.audRate / ac.audScale != ac.audSampleRate)
+        aviIssue(ac, "Audio strh rate %u / scale %u, strf has %u", ac.audRate, ac.audScale, ac.audSampleRate);
+    }
+    if (ac.avihStreams < 2) aviIssue(ac, "avih has %u streams, file has audio", ac.avihStreams);
+  } else if (ac.audLength) aviIssue(ac, "Audio strh length %u, file has no audio", ac.audLength);
+  if (ac.avihStreams > ac.strlCnt) aviIssue(ac, "avih has %u streams, hdrl has %u", ac.avihStreams, ac.strlCnt);
+}
+
+static uint32_t checkAviFile(aviCheck& ac, aviReadFn read, aviIssueFn issue, void* ctx, uint64_t fileSize, 
+  uint8_t* buf, size_t bufSize) {
+  // check structure of avi file read by given function, reporting each issue, returns number of issues
+  memset(&ac, 0, sizeof(aviCheck));
+  ac.read = read;
+  ac.issue = issue;
+  ac.ctx = ctx;
+  ac.fileSize = fileSize;
+  if (bufSize < AVI_CHECK_MIN) {
+    aviIssue(ac, "Check buffer %u bytes, need %u", bufSize, AVI_CHECK_MIN);
+    return ac.issues;
+  }
+  size_t idxSize = (bufSize - AVI_CHECK_WALK) / 3;
+  for (int i = 0; i < CUR_COUNT; i++) {
+    ac.cur[i].buf = i ? buf + AVI_CHECK_WALK + (i - 1) * idxSize : buf;
+    ac.cur[i].size = i ? idxSize : AVI_CHECK_WALK;
+    ac.cur[i].len = 0;
+  }
+  const uint8_t* p = aviAt(ac, CUR_WALK, 0, 12);
+  if (p == NULL || memcmp(p, "RIFF", 4) || memcmp(p + 8, "AVI ", 4)) {
+    aviIssue(ac, "Not an AVI file");
+    return ac.issues;
+  }
+  // first RIFF holds headers, first movi list and idx1
+  uint64_t riffEnd = aviChunkEnd(0, aviGet32(p + 4));
+  if (riffEnd > ac.fileSize) aviIssue(ac, "RIFF size %u exceeds file size %llu", aviGet32(p + 4), ac.fileSize);
+  uint64_t hdrl = 0, hdrlEnd = 0, moviEnd = 0;
+  uint64_t pos = 12;
+  while (pos + 8 <= std::min(riffEnd, ac.fileSize)) {
+    p = aviAt(ac, CUR_WALK, pos, 8);
+    if (p == NULL) break;
+    uint32_t size = aviGet32(p + 4);
+    uint64_t next = aviChunkEnd(pos, size);
+    if (next > riffEnd) {
+      aviIssue(ac, "Chunk %.4s at %llu size %u overruns RIFF", (const char*)p, pos, size);
+      break;
+    }
+    bool isList = !memcmp(p, "LIST", 4) && size >= 4 && (p = aviAt(ac, CUR_WALK, pos, 12)) != NULL;
+    if (isList && !memcmp(p + 8, "hdrl", 4) && !hdrl) {
+      hdrl = pos;
+      hdrlEnd = next;
+    } else if (isList && !memcmp(p + 8, "movi", 4) && !ac.moviPos) {
+      ac.moviPos = pos;
+      moviEnd = next;
+    } else if (!memcmp(p, "idx1", 4)) {
+      if (size % 16) aviIssue(ac, "idx1 size %u not a whole number of entries", size);
+      ac.idx1Pos = pos + 8;
+      ac.idx1Cnt = size / 16;
+    }
+    pos = next;
+  }
+  if (!hdrl) aviIssue(ac, "No hdrl list");
+  else aviCheckHdrl(ac, hdrl + 12, hdrlEnd);
+  if (!ac.moviPos) {
+    aviIssue(ac, "No movi list");
+    return ac.issues;
+  }
+  if (ac.idx1Pos && ac.idx1Pos < moviEnd) aviIssue(ac, "idx1 at %llu precedes end of movi", ac.idx1Pos - 8);
+
+  // chunks of each movi list, then further RIFFs
+  bool walking = aviCheckMovi(ac, ac.moviPos + 12, std::min(moviEnd, ac.fileSize), true);
+  ac.riffs = 1;
+  pos = riffEnd;
+  while (walking && pos + 8 <= ac.fileSize) {
+    p = aviAt(ac, CUR_WALK, pos, 24);
+    if (p == NULL || memcmp(p, "RIFF", 4) || memcmp(p + 8, "AVIX", 4)) {
+      aviIssue(ac, "%llu bytes after last RIFF at %llu", ac.fileSize - pos, pos);
+      break;
+    }
+    riffEnd = aviChunkEnd(pos, aviGet32(p + 4));
+    if (riffEnd > ac.fileSize) aviIssue(ac, "RIFF %u size %u exceeds file size", ac.riffs, aviGet32(p + 4));
+    if (memcmp(p + 12, "LIST", 4) || memcmp(p + 20, "movi", 4)) {
+      aviIssue(ac, "RIFF %u at %llu does not start with movi list", ac.riffs, pos);
+      break;
+    }
+    moviEnd = aviChunkEnd(pos + 12, aviGet32(p + 16));
+    if (moviEnd > riffEnd) aviIssue(ac, "RIFF %u movi list overruns RIFF", ac.riffs);
+    ac.riffs++;
+    walking = aviCheckMovi(ac, pos + 24, std::min(moviEnd, ac.fileSize), false);
+    pos = riffEnd;
+  }
+  if (walking) aviCheckTotals(ac);
+  return ac.issues;
+}
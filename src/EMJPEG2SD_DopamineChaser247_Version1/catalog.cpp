@@ -0,0 +1,346 @@
+// Persistent catalog of recordings, so that folder listings, oldest folder
+// lookup, uploads and WebDAV need not walk FAT directories.
+// Each change to a recording folder is appended to the catalog file as a
+// checked record, and the records are replayed at boot into an index in
+// PSRAM sorted by path, so listing a folder is a binary search followed by
+// a copy of just its entries.
+// If the catalog is missing or damaged it is rebuilt by a full rescan of
+// the folders, which can also be requested from the web page.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include <unistd.h> // For truncate
+
+#define CATALOG_PATH DATA_DIR "/catalog.bin"
+#define CATALOG_TEMP DATA_DIR "/catalog.tmp"
+#define CAT_BATCH 32 // records per SD read or write
+#define CAT_COMPACT_MIN 256 // superseded records before catalog rewritten at boot
+#define AVIH_FRAMES 0x30 // offset of total frames in avi header
+
+static catIndex catIdx;
+static SemaphoreHandle_t catMutex = NULL;
+static volatile bool catReady = false; // index matches storage
+static volatile bool rescanning = false;
+static std::vector<catRecord> pendingOps; // changes made while rescan in progress
+static TaskHandle_t catalogHandle = NULL;
+
+static inline void usePsram(bool extmem) {
+  // small threshold forces vector content into psram
+  if (psramFound()) heap_caps_malloc_extmem_enable(extmem ? MIN_RAM : MAX_RAM);
+}
+
+static bool isTracked(const char* path) {
+  // only files in top level folders are catalogued, other than app data folder
+  size_t folderLen = catFolderLen(path);
+  return folderLen && strchr(path + folderLen + 1, '/') == NULL && strncmp(path, DATA_DIR "/", strlen(DATA_DIR) + 1)
+    && strstr(path, "System") == NULL && strlen(path) < CAT_PATH_LEN;
+}
+
+static void logOp(uint8_t op, const catEntry& ce) {
+  // apply change to index and append it to catalog file
+  if (catMutex == NULL || (op == CAT_ADD && !isTracked(ce.path))) return;
+  catRecord rec;
+  catSeal(rec, op, ce);
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  usePsram(true);
+  bool changed = op == CAT_ADD || catErase(catIdx, ce.path);
+  if (op == CAT_ADD) catPut(catIdx, ce);
+  if (rescanning) pendingOps.push_back(rec); // reapplied to rescanned index
+  usePsram(false);
+  if (changed && !rescanning) {
+    File catFile = STORAGE.open(CATALOG_PATH, FILE_APPEND);
+    if (!catFile || catFile.write((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) LOG_WRN("Failed to update catalog");
+    catFile.close();
+  }
+  xSemaphoreGive(catMutex);
+}
+
+static void makeEntry(File& file, catEntry& ce) {
+  // catalog entry from file content and name
+  memset(&ce, 0, sizeof(ce));
+  strncpy(ce.path, file.path(), CAT_PATH_LEN - 1);
+  ce.fileSize = file.size();
+  const char* ext = strrchr(ce.path, '.');
+  bool isRec = ext != NULL && (!strcmp(ext + 1, AVI_EXT) || !strcmp(ext + 1, MP4_EXT));
+  if (!isRec || !catParseName(ce.path, ce)) {
+    ce.flags = CAT_OTHER;
+    ce.startTime = file.getLastWrite();
+  } else {
+    encState state;
+    File rec = recDecrypt(file, &state);
+    if (state != ENC_NONE) ce.flags |= CAT_ENC;
+    if (!(ce.flags & CAT_MP4) && state != ENC_NO_KEY && rec.seek(AVIH_FRAMES)) {
+      // actual frame count from avi header
+      uint32_t frames = 0;
+      if (rec.read((uint8_t*)&frames, sizeof(frames)) == sizeof(frames) && frames) ce.frames = frames;
+    }
+  }
+}
+
+void catalogAdd(const catEntry& ce) {
+  // add details of new or changed recording
+  logOp(CAT_ADD, ce);
+}
+
+void catalogAddFile(const char* path) {
+  // add file with details derived from its name and content
+  if (catMutex == NULL || !isTracked(path)) return;
+  File file = STORAGE.open(path, FILE_READ);
+  if (!file) return;
+  catEntry ce;
+  makeEntry(file, ce);
+  file.close();
+  logOp(CAT_ADD, ce);
+}
+
+void catalogRemove(const char* path) {
+  // remove file, or all files in folder
+  catEntry ce = {};
+  strncpy(ce.path, path, CAT_PATH_LEN - 1);
+  logOp(CAT_DEL, ce);
+}
+
+void catalogRename(const char* oldPath, const char* newPath) {
+  // move entry for file, or entries for files in folder, to new path
+  if (catMutex == NULL) return;
+  std::vector<catEntry> moved;
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  auto it = catFind(catIdx, oldPath);
+  if (it != catIdx.end()) moved.push_back(*it);
+  else {
+    catIndex::iterator first, last;
+    catRange(catIdx, oldPath, first, last);
+    moved.assign(first, last);
+  }
+  xSemaphoreGive(catMutex);
+  catalogRemove(oldPath);
+  size_t oldLen = strlen(oldPath);
+  for (auto& ce : moved) {
+    char newName[CAT_PATH_LEN];
+    snprintf(newName, sizeof(newName), "%s%s", newPath, ce.path + oldLen);
+    strcpy(ce.path, newName);
+    uint8_t checked = ce.flags & (CAT_CRC | CAT_BAD | CAT_ENC); // content unchanged by move
+    if (ce.flags & CAT_OTHER || !catParseName(ce.path, ce)) ce.flags |= CAT_OTHER;
+    ce.flags |= checked;
+    logOp(CAT_ADD, ce);
+  }
+}
+
+bool catalogReady() {
+  return catReady;
+}
+
+bool catalogFind(const char* path, catEntry& ce) {
+  // get catalogued details of file
+  if (!catReady) return false;
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  auto it = catFind(catIdx, path);
+  bool found = it != catIdx.end();
+  if (found) ce = *it;
+  xSemaphoreGive(catMutex);
+  return found;
+}
+
+size_t catalogFolder(const char* folder, std::vector<catEntry>& entries) {
+  // copy entries for files in folder, in path order
+  if (!catReady) return 0;
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  catIndex::iterator first, last;
+  catRange(catIdx, folder, first, last);
+  entries.assign(first, last);
+  xSemaphoreGive(catMutex);
+  return entries.size();
+}
+
+size_t catalogFolders(std::vector<catEntry>& folders) {
+  // one entry per folder, with path as folder name, frames as file count and
+  // startTime as that of first file, by stepping over each folder's entries
+  folders.clear();
+  if (!catReady) return 0;
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  for (auto it = catIdx.begin(); it != catIdx.end(); ) {
+    catEntry fe = {};
+    memcpy(fe.path, it->path, catFolderLen(it->path));
+    catIndex::iterator first, last;
+    catRange(catIdx, fe.path, first, last);
+    fe.frames = last - first;
+    fe.startTime = it->startTime;
+    folders.push_back(fe);
+    it = last > it ? last : it + 1;
+  }
+  xSemaphoreGive(catMutex);
+  return folders.size();
+}
+
+bool catalogOldest(char* oldestDir) {
+  // oldest folder by its date name
+  if (!catReady) return false;
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  bool found = !catIdx.empty();
+  if (found) {
+    size_t len = catFolderLen(catIdx.front().path);
+    memcpy(oldestDir, catIdx.front().path, len);
+    oldestDir[len] = 0;
+  }
+  xSemaphoreGive(catMutex);
+  return found;
+}
+
+static bool writeCatalog() {
+  // rewrite catalog file from index, as one add record per entry
+  catRecord* recs = (catRecord*)malloc(CAT_BATCH * sizeof(catRecord));
+  File catFile = STORAGE.open(CATALOG_TEMP, FILE_WRITE);
+  if (recs == NULL || !catFile) {
+    free(recs);
+    LOG_WRN("Failed to write catalog");
+    return false;
+  }
+  size_t cnt = 0;
+  bool res = true;
+  for (auto& ce : catIdx) {
+    catSeal(recs[cnt++], CAT_ADD, ce);
+    if (cnt == CAT_BATCH) {
+      res &= catFile.write((uint8_t*)recs, CAT_BATCH * sizeof(catRecord)) == CAT_BATCH * sizeof(catRecord);
+      cnt = 0;
+    }
+  }
+  if (cnt) res &= catFile.write((uint8_t*)recs, cnt * sizeof(catRecord)) == cnt * sizeof(catRecord);
+  catFile.close();
+  free(recs);
+  if (res) {
+    STORAGE.remove(CATALOG_PATH);
+    res = STORAGE.rename(CATALOG_TEMP, CATALOG_PATH);
+  }
+  if (!res) LOG_WRN("Failed to write catalog");
+  return res;
+}
+
+static bool loadCatalog() {
+  // replay catalog records into index
+  File catFile = STORAGE.open(CATALOG_PATH, FILE_READ);
+  if (!catFile) return false;
+  size_t catSize = catFile.size();
+  catRecord* recs = (catRecord*)malloc(CAT_BATCH * sizeof(catRecord));
+  if (recs == NULL) {
+    catFile.close();
+    return false;
+  }
+  size_t pos = 0, records = 0;
+  bool res = true;
+  usePsram(true);
+  catIdx.clear();
+  while (res && pos < catSize) {
+    size_t readLen = catFile.read((uint8_t*)recs, CAT_BATCH * sizeof(catRecord));
+    if (!readLen) break;
+    for (size_t i = 0; i < readLen / sizeof(catRecord); i++, pos += sizeof(catRecord)) {
+      if (!catValid(recs[i])) {
+        res = false;
+        break;
+      }
+      catApply(catIdx, recs[i]);
+      records++;
+    }
+    if (readLen % sizeof(catRecord)) break; // partial record at end
+  }
+  usePsram(false);
+  catFile.close();
+  free(recs);
+  if (pos + sizeof(catRecord) < catSize) {
+    LOG_WRN("Catalog damaged at record %u of %u", records, catSize / sizeof(catRecord));
+    return false;
+  }
+  if (pos < catSize) {
+    // incomplete last record written at power loss
+    LOG_WRN("Catalog last record incomplete, discarded");
+    char sdPath[FILE_NAME_LEN];
+    snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", CATALOG_PATH);
+    if (truncate(sdPath, pos)) return false;
+  }
+  if (records - catIdx.size() > CAT_COMPACT_MIN && records > catIdx.size() * 2) writeCatalog();
+  return true;
+}
+
+static void catalogTask(void* parameter) {
+  // rebuild catalog by walking all folders
+  uint32_t cTime = millis();
+  catIndex scanned;
+  size_t folders = 0;
+  usePsram(true);
+  scanned.reserve(1000);
+  usePsram(false);
+  File root = STORAGE.open("/");
+  File dir = root.openNextFile();
+  while (dir) {
+    char folder[FILE_NAME_LEN];
+    snprintf(folder, sizeof(folder), "%s/", dir.path());
+    if (dir.isDirectory() && isTracked(folder)) {
+      folders++;
+      File file = dir.openNextFile();
+      while (file) {
+        if (!file.isDirectory() && isTracked(file.path())) {
+          catEntry ce;
+          makeEntry(file, ce);
+          usePsram(true);
+          scanned.push_back(ce);
+          usePsram(false);
+        }
+        file.close();
+        file = dir.openNextFile();
+      }
+    }
+    dir.close();
+    dir = root.openNextFile();
+  }
+  root.close();
+  std::sort(scanned.begin(), scanned.end(), [](const catEntry& a, const catEntry& b) { return strcmp(a.path, b.path) < 0; });
+
+  // replace index, including changes made during rescan
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  for (auto& ce : scanned) {
+    // keep checksums of files not changed in size, as not derivable from content
+    auto it = catFind(catIdx, ce.path);
+    if (it != catIdx.end() && it->flags & CAT_CRC && it->fileSize == ce.fileSize) {
+      ce.crc = it->crc;
+      ce.flags |= it->flags & (CAT_CRC | CAT_BAD);
+    }
+  }
+  usePsram(true);
+  catIdx.swap(scanned);
+  for (auto& rec : pendingOps) catApply(catIdx, rec);
+  pendingOps.clear();
+  usePsram(false);
+  writeCatalog();
+  rescanning = false;
+  catReady = true;
+  xSemaphoreGive(catMutex);
+  LOG_ALT("Catalog rebuilt with %u files in %u folders in %lu ms", catIdx.size(), folders, millis() - cTime);
+  catalogHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+bool startCatalogRescan() {
+  // rebuild catalog from folder contents, listings use folders meanwhile
+  if (catMutex == NULL || rescanning) {
+    LOG_WRN("Catalog rescan not available");
+    return false;
+  }
+  xSemaphoreTake(catMutex, portMAX_DELAY);
+  rescanning = true;
+  catReady = false;
+  STORAGE.remove(CATALOG_PATH); // so rescan restarted if interrupted
+  xSemaphoreGive(catMutex);
+  xTaskCreate(&catalogTask, "catalogTask", CATALOG_STACK_SIZE, NULL, CATALOG_PRI, &catalogHandle);
+  debugMemory("startCatalogRescan");
+  return true;
+}
+
+void prepCatalog() {
+  // load catalog at boot, or rebuild it if not usable
+  uint32_t cTime = millis();
+  catMutex = xSemaphoreCreateMutex();
+  if (loadCatalog()) {
+    catReady = true;
+    LOG_INF("Catalog loaded %u files in %lu ms", catIdx.size(), millis() - cTime);
+  } else startCatalogRescan();
+}
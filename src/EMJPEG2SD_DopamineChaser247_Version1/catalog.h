@@ -0,0 +1,160 @@
+// Recordings catalog entries, records and sorted index, see catalog.cpp
+// Kept free of Arduino / ESP dependencies so that it can be exercised
+// on a host against generated catalog files.
+//
+// s60sc 2025
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#define CAT_PATH_LEN 64 // same as FILE_NAME_LEN
+#define CAT_MAGIC 0x32544143 // "CAT2", as catEntry extended with crc
+
+// entry flags
+#define CAT_AUDIO 0x01 // recording has interleaved audio
+#define CAT_TELEM 0x02 // recording has telemetry files
+#define CAT_MP4 0x04 // fragmented mp4 instead of avi
+#define CAT_TL 0x08 // timelapse
+#define CAT_OTHER 0x10 // not a recording, eg telemetry or photo file
+#define CAT_CRC 0x20 // crc is CRC32C of file content, as decrypted if CAT_ENC
+#define CAT_BAD 0x40 // content no longer matches crc, see scrub.cpp
+#define CAT_ENC 0x80 // content encrypted, see recCrypt.cpp
+
+struct catEntry {
+  char path[CAT_PATH_LEN]; // full path of file in its folder
+  uint32_t startTime; // epoch secs, or last write time if not a recording
+  uint32_t duration; // secs
+  uint32_t frames;
+  uint32_t fileSize;
+  uint16_t motionChecks; // motion checks made while recording
+  uint16_t motionHits; // checks that found motion
+  uint8_t fps;
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t crc;
+};
+
+enum catOp : uint8_t {CAT_ADD = 1, CAT_DEL};
+
+struct catRecord {
+  // unit appended to catalog file for each change
+  uint32_t magic;
+  uint8_t op;
+  uint8_t reserved[3];
+  catEntry entry; // only path used for CAT_DEL
+  uint32_t check; // of preceding fields
+};
+
+typedef std::vector<catEntry> catIndex; // sorted by path
+
+inline uint32_t catCheck(const void* data, size_t len) {
+  // FNV-1a hash, detects torn or corrupted records
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+inline void catSeal(catRecord& rec, uint8_t op, const catEntry& ce) {
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = CAT_MAGIC;
+  rec.op = op;
+  rec.entry = ce;
+  rec.entry.path[CAT_PATH_LEN - 1] = 0;
+  rec.check = catCheck(&rec, offsetof(catRecord, check));
+}
+
+inline bool catValid(const catRecord& rec) {
+  return rec.magic == CAT_MAGIC && (rec.op == CAT_ADD || rec.op == CAT_DEL)
+    && rec.check == catCheck(&rec, offsetof(catRecord, check));
+}
+
+inline bool catLess(const catEntry& a, const char* b) { return strcmp(a.path, b) < 0; }
+
+inline catIndex::iterator catLower(catIndex& idx, const char* path) {
+  return std::lower_bound(idx.begin(), idx.end(), path, catLess);
+}
+
+inline catIndex::iterator catFind(catIndex& idx, const char* path) {
+  auto it = catLower(idx, path);
+  return it != idx.end() && !strcmp(it->path, path) ? it : idx.end();
+}
+
+inline void catRange(catIndex& idx, const char* folder, catIndex::iterator& first, catIndex::iterator& last) {
+  // entries in folder are those from "<folder>/" up to "<folder>0", as '/' precedes '0'
+  char key[CAT_PATH_LEN + 1];
+  snprintf(key, sizeof(key), "%s/", folder);
+  first = catLower(idx, key);
+  key[strlen(key) - 1] = '0';
+  last = catLower(idx, key);
+}
+
+inline void catPut(catIndex& idx, const catEntry& ce) {
+  // add entry or replace entry with same path
+  auto it = catLower(idx, ce.path);
+  if (it != idx.end() && !strcmp(it->path, ce.path)) *it = ce;
+  else idx.insert(it, ce);
+}
+
+inline size_t catErase(catIndex& idx, const char* path) {
+  // remove file entry, or entries for all files in folder
+  auto it = catFind(idx, path);
+  if (it != idx.end()) {
+    idx.erase(it);
+    return 1;
+  }
+  catIndex::iterator first, last;
+  catRange(idx, path, first, last);
+  size_t removed = last - first;
+  idx.erase(first, last);
+  return removed;
+}
+
+inline void catApply(catIndex& idx, const catRecord& rec) {
+  if (rec.op == CAT_ADD) catPut(idx, rec.entry);
+  else catErase(idx, rec.entry.path);
+}
+
+inline size_t catFolderLen(const char* path) {
+  // length of top level folder name in path, 0 if none
+  const char* slash = strchr(path + 1, '/');
+  return *path == '/' && slash != NULL ? slash - path : 0;
+}
+
+inline bool catParseName(const char* path, catEntry& ce) {
+  // derive recording details from file name of form
+  // /<folder>/YYYYMMDD_HHMMSS_<framesize>_<fps>_<duration>[_S][_M][_T].<ext>
+  const char* name = strrchr(path, '/');
+  if (name == NULL) return false;
+  char fields[CAT_PATH_LEN];
+  snprintf(fields, sizeof(fields), "%s", name + 1);
+  char* ext = strrchr(fields, '.');
+  if (ext == NULL) return false;
+  *ext++ = 0;
+  struct tm tm = {};
+  unsigned fps = 0, duration = 0;
+  int used = 0;
+  if (sscanf(fields, "%4d%2d%2d_%2d%2d%2d_%*[^_]_%u_%u%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+    &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &fps, &duration, &used) != 8) return false;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  ce.startTime = (uint32_t)mktime(&tm);
+  ce.fps = fps > 255 ? 255 : fps;
+  ce.duration = duration;
+  ce.frames = fps * duration; // nominal, unless known from file content
+  ce.flags = !strcmp(ext, "mp4") ? CAT_MP4 : 0;
+  // optional suffixes after duration
+  for (char* sfx = fields + used; *sfx == '_'; sfx += 2) {
+    if (sfx[1] == 'S') ce.flags |= CAT_AUDIO;
+    else if (sfx[1] == 'M') ce.flags |= CAT_TELEM;
+    else if (sfx[1] == 'T') ce.flags |= CAT_TL;
+  }
+  return true;
+}
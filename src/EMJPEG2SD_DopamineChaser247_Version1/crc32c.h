@@ -0,0 +1,99 @@
+// CRC32C (Castagnoli) of recordings, computed as data is written, see scrub.cpp
+// Slicing by 8 table lookup, as ESP32 has no CRC32C instruction.
+// Also allows for data later overwritten in place, such as the avi header
+// written on close, by combining the CRC of the change shifted to its
+// position, so the CRC need not be recalculated by reading back the file.
+// Kept free of Arduino / ESP dependencies so that it can be checked and
+// timed on a host.
+//
+// s60sc 2025
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CRC32C_POLY 0x82F63B78 // reversed Castagnoli polynomial
+
+struct crc32cTables {
+  uint32_t t[8][256]; // t[k][b] is CRC of byte b followed by k zero bytes
+  uint32_t x2n[64]; // x^(2^n) mod poly, for shifting CRC over zero bytes
+  crc32cTables() {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t crc = b;
+      for (int i = 0; i < 8; i++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+      t[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++)
+      for (int k = 1; k < 8; k++) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+    x2n[0] = 1u << 30; // x^1
+    for (int n = 1; n < 64; n++) x2n[n] = multModP(x2n[n - 1], x2n[n - 1]);
+  }
+  static uint32_t multModP(uint32_t a, uint32_t b) {
+    // a * b mod poly, in reflected bit order
+    uint32_t m = 1u << 31, p = 0;
+    while (m) {
+      if (a & m) p ^= b;
+      m >>= 1;
+      b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+  }
+};
+
+inline const crc32cTables& crcTables() {
+  static const crc32cTables tables; // built on first use, so held in RAM not flash
+  return tables;
+}
+
+inline uint32_t crc32cRaw(uint32_t crc, const uint8_t* data, size_t len) {
+  // CRC register update without pre and post inversion
+  const crc32cTables& ct = crcTables();
+  for (; len && ((uintptr_t)data & 3); len--) crc = (crc >> 8) ^ ct.t[0][(crc ^ *data++) & 0xFF];
+  for (; len >= 8; len -= 8, data += 8) {
+    // aligned little endian word loads, as byte loads on Xtensa if alignment unknown
+    const uint8_t* word = (const uint8_t*)__builtin_assume_aligned(data, 4);
+    uint32_t lo, hi;
+    memcpy(&lo, word, 4);
+    memcpy(&hi, word + 4, 4);
+    lo ^= crc;
+    crc = ct.t[7][lo & 0xFF] ^ ct.t[6][(lo >> 8) & 0xFF] ^ ct.t[5][(lo >> 16) & 0xFF] ^ ct.t[4][lo >> 24]
+      ^ ct.t[3][hi & 0xFF] ^ ct.t[2][(hi >> 8) & 0xFF] ^ ct.t[1][(hi >> 16) & 0xFF] ^ ct.t[0][hi >> 24];
+  }
+  while (len--) crc = (crc >> 8) ^ ct.t[0][(crc ^ *data++) & 0xFF];
+  return crc;
+}
+
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+  // continue CRC of preceding data, starting from 0
+  return ~crc32cRaw(~crc, (const uint8_t*)data, len);
+}
+
+inline uint32_t crc32cShift(uint32_t crc, uint64_t len) {
+  // raw CRC as if followed by len zero bytes
+  const crc32cTables& ct = crcTables();
+  // x^(2^n) repeats every 31 entries for this poly, not every 32 as for the
+  // zlib poly, so the table is not wrapped to 32 entries for lengths >= 512MB
+  len <<= 3; // bits
+  for (int n = 0; len; n++, len >>= 1) if (len & 1) crc = crc32cTables::multModP(ct.x2n[n], crc);
+  return crc;
+}
+
+inline uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+  // CRC of two blocks from CRC of each
+  return crc32cShift(crc1, len2) ^ crc2;
+}
+
+inline uint32_t crc32cPatch(uint32_t crc, uint64_t fileLen, uint64_t offset, const void* oldData, const void* newData, size_t len) {
+  // CRC of file after len bytes at offset replaced, as CRC is linear in data
+  uint8_t delta[64];
+  uint32_t diff = 0;
+  for (size_t done = 0; done < len; ) {
+    size_t part = len - done < sizeof(delta) ? len - done : sizeof(delta);
+    for (size_t i = 0; i < part; i++)
+      delta[i] = (oldData ? ((const uint8_t*)oldData)[done + i] : 0) ^ ((const uint8_t*)newData)[done + i];
+    diff = crc32cRaw(diff, delta, part);
+    done += part;
+  }
+  return crc ^ crc32cShift(diff, fileLen - offset - len);
+}
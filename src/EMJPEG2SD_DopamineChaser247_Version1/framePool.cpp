@@ -0,0 +1,154 @@
+// Reference counted frame handles, so that each captured frame is shared
+// by the recorder, web / NVR streams, RTSP and alerts without each consumer
+// taking its own copy.
+//
+// processFrame() publishes a handle once per capture, and each consumer
+// holds a reference until it has finished with the frame. The camera buffer
+// is returned to the driver when the last reference is released.
+// As the camera driver only has FB_CNT buffers, if too many are already
+// held by slow consumers, the new frame is copied once into a pooled PSRAM
+// slot instead, so that the driver is never starved of buffers.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define FRAME_HANDLES 16 // must exceed max frames held at once (SD queue, streams, alert, capture)
+#define CAM_FB_HOLD (FB_CNT - 2) // max camera buffers held outside driver
+
+// stream hand-off states
+#define STREAM_IDLE 0
+#define STREAM_REQ 1 // stream task waiting for frame
+#define STREAM_CLAIMED 2 // frame being handed to stream task
+
+static frameHandle frameHandles[FRAME_HANDLES];
+static frameHandle* capturedFrame = NULL; // frame currently held by capture task
+static std::atomic<uint8_t> camHeld(0); // camera buffers held via handles
+static frameHandle* streamFrame[MAX_STREAMS] = {NULL};
+static std::atomic<uint8_t> streamState[MAX_STREAMS];
+uint32_t copiesAvoided = 0; // frame copies not needed due to sharing
+uint32_t pooledFrames = 0; // frames copied to pool slot to free camera buffer
+
+static bool poolFrame(frameHandle* fh, camera_fb_t* fb) {
+  // copy frame into handle's PSRAM slot, enlarging slot if needed
+  size_t needLen = fb->len + 3; // allow for AVI filler
+  if (fh->slotSize < needLen) {
+    free(fh->slot);
+    fh->slot = (uint8_t*)ps_malloc(needLen);
+    fh->slotSize = fh->slot == NULL ? 0 : needLen;
+    if (fh->slot == NULL) {
+      LOG_WRN("Failed to allocate %s for frame pool slot", fmtSize(needLen));
+      return false;
+    }
+  }
+  memcpy(fh->slot, fb->buf, fb->len);
+  memset(fh->slot + fb->len, 0, 3); // filler
+  fh->buf = fh->slot;
+  fh->pooled = true;
+  pooledFrames++;
+  return true;
+}
+
+frameHandle* publishFrame(camera_fb_t* fb) {
+  // called by capture task to wrap new camera frame in a handle,
+  // with a reference held by the capture task
+  // only the capture task allocates handles, so a free handle cannot be taken concurrently
+  frameHandle* fh = NULL;
+  for (int i = 0; i < FRAME_HANDLES; i++) {
+    if (frameHandles[i].refs.load(std::memory_order_acquire) == 0) {
+      fh = &frameHandles[i];
+      break;
+    }
+  }
+  if (fh == NULL) {
+    LOG_VRB("No free frame handle");
+    return NULL;
+  }
+  fh->fb = fb;
+  fh->len = fb->len;
+  fh->width = fb->width;
+  fh->height = fb->height;
+  fh->ms = fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000; // set by driver at end of frame
+  fh->pooled = false;
+  if (camHeld >= CAM_FB_HOLD) {
+    // driver running short of buffers
+    if (!poolFrame(fh, fb)) return NULL;
+  } else {
+    fh->buf = fb->buf;
+    camHeld++;
+  }
+  fh->refs.store(1, std::memory_order_release);
+  capturedFrame = fh;
+  return fh;
+}
+
+frameHandle* findFrame(const camera_fb_t* fb) {
+  // obtain handle for frame currently being processed by capture task
+  return (capturedFrame != NULL && capturedFrame->fb == fb) ? capturedFrame : NULL;
+}
+
+frameHandle* holdFrame(frameHandle* fh) {
+  // consumer takes a reference to the frame instead of a copy
+  fh->refs.fetch_add(1, std::memory_order_acq_rel);
+  copiesAvoided++;
+  return fh;
+}
+
+void releaseFrame(frameHandle* fh) {
+  // consumer finished with frame, free camera buffer on last release
+  if (fh == NULL) return;
+  uint8_t refs = fh->refs.load(std::memory_order_acquire);
+  while (refs > 1) {
+    if (fh->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel)) return;
+  }
+  // sole owner, so tidy up before handle can be reused by capture task
+  if (!fh->pooled && fh->fb != NULL) {
+    esp_camera_fb_return(fh->fb);
+    camHeld--;
+  }
+  fh->fb = NULL;
+  fh->refs.store(0, std::memory_order_release);
+}
+
+void endCapture(frameHandle* fh) {
+  // capture task finished with frame
+  capturedFrame = NULL;
+  if (fh->pooled) {
+    // content in pool slot, so camera buffer can be returned now
+    esp_camera_fb_return(fh->fb);
+    fh->fb = NULL;
+  }
+  releaseFrame(fh);
+}
+
+/****************** stream hand-off *********************/
+
+void offerStreamFrame(frameHandle* fh) {
+  // called by capture task, pass frame to each stream task waiting for one
+  for (int i = 0; i < vidStreams; i++) {
+    uint8_t expected = STREAM_REQ;
+    if (streamState[i].compare_exchange_strong(expected, STREAM_CLAIMED)) {
+      streamFrame[i] = holdFrame(fh);
+      xSemaphoreGive(frameSemaphore[i]); // signal frame ready for stream
+    }
+  }
+}
+
+frameHandle* getStreamFrame(uint8_t taskNum) {
+  // called by stream task to wait for next frame, which must be released after use
+  if (streamState[taskNum] == STREAM_IDLE) streamState[taskNum] = STREAM_REQ;
+  if (xSemaphoreTake(frameSemaphore[taskNum], pdMS_TO_TICKS(MAX_FRAME_WAIT)) == pdFAIL) return NULL;
+  frameHandle* fh = streamFrame[taskNum];
+  streamFrame[taskNum] = NULL;
+  streamState[taskNum] = STREAM_IDLE;
+  return fh;
+}
+
+void cancelStreamFrame(uint8_t taskNum) {
+  // called by stream task when stopping, to withdraw any outstanding request
+  uint8_t expected = STREAM_REQ;
+  if (!streamState[taskNum].compare_exchange_strong(expected, STREAM_IDLE) && expected == STREAM_CLAIMED) {
+    // frame already being handed over, so collect it and release
+    releaseFrame(getStreamFrame(taskNum));
+  }
+}
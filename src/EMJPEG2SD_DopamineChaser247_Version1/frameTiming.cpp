@@ -0,0 +1,146 @@
+// Frame capture timing and drop accounting.
+//
+// The frame timer ISR timestamps each tick, and processFrame() reports when
+// esp_camera_fb_get() returns, from which are derived:
+// - latency from timer tick to frame being available to the capture task,
+//   not measured if capture is paced by sensor frames
+// - jitter of the interval between successive frames against 1 / FPS
+// - timer ticks discarded by captureTask() when too many outstanding
+// - failures of esp_camera_fb_get()
+// - CPU cost of processFrame() per frame, and of each motion check
+// Latency, jitter and costs are held as histograms so that percentiles can be
+// reported. Counts are reset at the start of each recording, reported
+// in the closeAvi() stats, and are available live on the web status.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define TICK_RING 8 // must exceed FB_CNT and be power of 2
+#define HIST_BINS 64
+#define HIST_BIN_US 2000 // bin width, so histogram covers 0 - 128ms
+#define MAX_INTERVAL USECS // ignore intervals from pauses in capture
+
+struct timingHist {
+  uint32_t count;
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint64_t sumUs;
+  uint32_t bins[HIST_BINS + 1]; // last bin for overflow
+};
+
+static timingHist latencyHist; // timer tick to frame available
+static timingHist jitterHist; // deviation of frame interval from nominal
+static timingHist processHist; // time in processFrame() per frame
+static timingHist motionHist; // time in checkMotion()
+static volatile uint32_t tickUs[TICK_RING]; // time of recent timer ticks
+static volatile uint32_t isrTicks = 0; // ticks raised by ISR
+static uint32_t servicedTicks = 0; // ticks handled by capture task
+static uint32_t lastFrameUs = 0;
+uint32_t skippedTicks = 0; // timer ticks not serviced
+uint32_t fbGetFails = 0; // esp_camera_fb_get() failures
+
+static void histReset(timingHist& hist) {
+  memset(&hist, 0, sizeof(timingHist));
+}
+
+static void histAdd(timingHist& hist, uint32_t valUs) {
+  if (!hist.count++ || valUs < hist.minUs) hist.minUs = valUs;
+  hist.sumUs += valUs;
+  if (valUs > hist.maxUs) hist.maxUs = valUs;
+  hist.bins[std::min(valUs / HIST_BIN_US, (uint32_t)HIST_BINS)]++;
+}
+
+static uint32_t histPercentile(const timingHist& hist, uint32_t pct) {
+  // upper bound of bin containing given percentile, in us
+  if (!hist.count) return 0;
+  uint32_t target = (uint32_t)(((uint64_t)hist.count * pct + 99) / 100);
+  uint32_t cumulative = 0;
+  for (int i = 0; i < HIST_BINS; i++) {
+    cumulative += hist.bins[i];
+    if (cumulative >= target) return std::min((uint32_t)(i + 1) * HIST_BIN_US, hist.maxUs);
+  }
+  return hist.maxUs;
+}
+
+static inline float histAvg(const timingHist& hist) {
+  return hist.count ? (float)hist.sumUs / hist.count : 0;
+}
+
+void IRAM_ATTR frameTick() {
+  // called from frame timer ISR
+  tickUs[isrTicks & (TICK_RING - 1)] = (uint32_t)esp_timer_get_time();
+  isrTicks = isrTicks + 1;
+}
+
+void ticksSkipped(uint32_t numTicks) {
+  // called by capture task for timer ticks it discards
+  skippedTicks += numTicks;
+  servicedTicks += numTicks;
+}
+
+void frameCaptured(bool gotFrame) {
+  // called by capture task when esp_camera_fb_get() returns
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  uint32_t ticks = isrTicks;
+  if (ticks - servicedTicks > TICK_RING) {
+    // ring overrun, oldest tick times lost
+    skippedTicks += ticks - servicedTicks - TICK_RING;
+    servicedTicks = ticks - TICK_RING;
+  }
+  if (servicedTicks != ticks) {
+    histAdd(latencyHist, nowUs - tickUs[servicedTicks & (TICK_RING - 1)]);
+    servicedTicks++;
+  }
+  if (!gotFrame) {
+    fbGetFails++;
+    return;
+  }
+  uint32_t intervalUs = nowUs - lastFrameUs;
+  if (lastFrameUs && intervalUs < MAX_INTERVAL && FPS) {
+    int32_t deviation = (int32_t)intervalUs - (int32_t)(USECS / FPS);
+    histAdd(jitterHist, abs(deviation));
+  }
+  lastFrameUs = nowUs;
+}
+
+void frameProcessed(uint32_t processUs) {
+  // called by capture task when frame processing complete
+  histAdd(processHist, processUs);
+}
+
+void motionChecked(uint32_t checkUs) {
+  // called by capture task after each motion check
+  histAdd(motionHist, checkUs);
+}
+
+void resetFrameTiming() {
+  // called at start of each recording
+  histReset(latencyHist);
+  histReset(jitterHist);
+  histReset(processHist);
+  histReset(motionHist);
+  skippedTicks = fbGetFails = 0;
+}
+
+void logFrameTiming() {
+  // called from closeAvi() stats
+  LOG_INF("Frame latency min / avg / p99: %0.1f / %0.1f / %0.1f ms", latencyHist.minUs / 1000.0,
+    histAvg(latencyHist) / 1000, histPercentile(latencyHist, 99) / 1000.0);
+  LOG_INF("Frame jitter min / avg / p99: %0.1f / %0.1f / %0.1f ms", jitterHist.minUs / 1000.0,
+    histAvg(jitterHist) / 1000, histPercentile(jitterHist, 99) / 1000.0);
+  LOG_INF("Frame processing min / avg / p99: %0.1f / %0.1f / %0.1f ms", processHist.minUs / 1000.0,
+    histAvg(processHist) / 1000, histPercentile(processHist, 99) / 1000.0);
+  LOG_INF("Motion check min / avg / p99: %0.1f / %0.1f / %0.1f ms over %u checks", motionHist.minUs / 1000.0,
+    histAvg(motionHist) / 1000, histPercentile(motionHist, 99) / 1000.0, motionHist.count);
+  LOG_INF("Skipped timer ticks: %u, frame capture failures: %u", skippedTicks, fbGetFails);
+}
+
+int frameTimingJson(char* p) {
+  // append live frame timing to web status json, in ms
+  return sprintf(p, "\"frameLatency\":\"%0.1f / %0.1f / %0.1f\",\"frameJitter\":\"%0.1f / %0.1f / %0.1f\",\"frameCost\":\"%0.1f / %0.1f / %0.1f\",\"skippedTicks\":%u,\"fbGetFails\":%u,",
+    latencyHist.minUs / 1000.0, histAvg(latencyHist) / 1000, histPercentile(latencyHist, 99) / 1000.0,
+    jitterHist.minUs / 1000.0, histAvg(jitterHist) / 1000, histPercentile(jitterHist, 99) / 1000.0,
+    processHist.minUs / 1000.0, histAvg(processHist) / 1000, histPercentile(processHist, 99) / 1000.0,
+    skippedTicks, fbGetFails);
+}
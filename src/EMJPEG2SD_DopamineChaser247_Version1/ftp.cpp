@@ -65,19 +65,37 @@ Content-Type: "application/octet-stream"
 #define END_BOUNDARY "\r\n--" BOUNDARY_VAL "--\r\n"
 #define FILE_NAME "file\"; filename=\""
 #define JSON_DATA "{\"pathname\":\"%s%s/%s\",\"passcode\":\"%s\"}"
+#define JSON_CRC ",\"crc32c\":\"%08x\"}" // replaces closing brace of JSON_DATA
 #define FORM_OFFSET 256 // offset in fsBuff to prepare form data
 
 NetworkClientSecure hclient;
 char* fsBuff;
 
+static bool knownCrc(File& fh, uint32_t& crc) {
+  // CRC32C of recording content, if catalogued when written, so receiver can verify upload
+#ifdef ISCAM
+  catEntry ce;
+  if (catalogFind(fh.path(), ce) && ce.flags & CAT_CRC && !(ce.flags & CAT_BAD) && encContentLen(ce) == fh.size()) {
+    crc = ce.crc;
+    return true;
+  }
+#endif
+  return false;
+}
+
+static void checkSentCrc(File& fh, bool haveCrc, uint32_t crc, uint32_t sentCrc) {
+  if (haveCrc && sentCrc != crc) LOG_WRN("Uploaded %s has CRC32C %08x, expected %08x", fh.name(), sentCrc, crc);
+}
+
 static void postHeader(const char* tmethod, const char* contentType, bool isFile, 
-  size_t fileSize, const char* fileName) {
+  size_t fileSize, const char* fileName, const uint32_t* fileCrc = NULL) {
   // create http post header
   char* p = fsBuff + FORM_OFFSET; // leave space for http request data
   if (isFile) {
     p += sprintf(p, FORM_DATA, "json", "", JSON_TYPE);
     // fsBuff initially contains folder name
     p += sprintf(p, JSON_DATA, fsWd, folderPath, fileName, FS_Pass);
+    if (fileCrc != NULL) p += sprintf(p - 1, JSON_CRC, *fileCrc) - 1;
     p += sprintf(p, "\r\n" FORM_DATA, FILE_NAME, fileName, BIN_TYPE); 
   } // else JSON data already loaded by hfsCreateFolder()
   size_t formLen = strlen(fsBuff + FORM_OFFSET);
@@ -98,24 +116,28 @@ static bool hfsStoreFile(File &fh) {
   // Upload individual file to HTTPS server
   // reject if folder or not valid file type
 #ifdef ISCAM
-  if (!strstr(fh.name(), AVI_EXT) && !strstr(fh.name(), CSV_EXT) && !strstr(fh.name(), SRT_EXT)) return false; 
+  if (!strstr(fh.name(), AVI_EXT) && !strstr(fh.name(), MP4_EXT) && !strstr(fh.name(), CSV_EXT) && !strstr(fh.name(), SRT_EXT)) return false; 
 #else
   if (!strstr(fh.name(), FILE_EXT)) return false; 
 #endif
   LOG_INF("Upload file: %s, size: %s", fh.name(), fmtSize(fh.size()));    
 
   // prep POST header and send file to HTTPS server
-  postHeader("upload", BIN_TYPE, true, fh.size(), fh.name());
+  uint32_t crc = 0, sentCrc = 0;
+  bool haveCrc = knownCrc(fh, crc);
+  postHeader("upload", BIN_TYPE, true, fh.size(), fh.name(), haveCrc ? &crc : NULL);
   // upload file content in chunks
   uint8_t percentLoaded = 0;
   size_t chunksize = 0, totalSent = 0;
   while ((chunksize = fh.read((uint8_t*)fsChunk, CHUNKSIZE))) {
     hclient.write((uint8_t*)fsChunk, chunksize);
+    if (haveCrc) sentCrc = crc32c(sentCrc, fsChunk, chunksize);
     totalSent += chunksize;
     if (calcProgress(totalSent, fh.size(), 5, percentLoaded)) LOG_INF("Uploaded %u%%", percentLoaded); 
   }
   percentLoaded = 100;
   hclient.println(END_BOUNDARY);
+  checkSentCrc(fh, haveCrc, crc, sentCrc);
   return true;
 }
 
@@ -231,11 +253,26 @@ static bool openDataPort() {
   return true;
 }
 
+static bool ftpStoreCrc(const char* fileName, uint32_t crc) {
+  // upload CRC32C of file as sidecar file, in same format as crc32c utility
+  char crcName[FILE_NAME_LEN + 8];
+  char crcLine[FILE_NAME_LEN + 16];
+  snprintf(crcName, sizeof(crcName), "%s.crc32c", fileName);
+  int crcLen = snprintf(crcLine, sizeof(crcLine), "%08x  %s\n", crc, fileName);
+  openDataPort();
+  if (!sendFtpCommand("STOR ", crcName, "150", "125")) return false;
+  bool res = dclient.write((const uint8_t*)crcLine, crcLen) == crcLen;
+  dclient.stop();
+  res = sendFtpCommand("", "", "226") && res;
+  if (!res) LOG_WRN("Failed to upload %s", crcName);
+  return res;
+}
+
 static bool ftpStoreFile(File &fh) {
   // Upload individual file to current folder, overwrite any existing file 
   // reject if folder, or not valid file type    
 #ifdef ISCAM
-  if (!strstr(fh.name(), AVI_EXT) && !strstr(fh.name(), CSV_EXT) && !strstr(fh.name(), SRT_EXT)) return false; 
+  if (!strstr(fh.name(), AVI_EXT) && !strstr(fh.name(), MP4_EXT) && !strstr(fh.name(), CSV_EXT) && !strstr(fh.name(), SRT_EXT)) return false; 
 #else
   if (!strstr(fh.name(), FILE_EXT)) return false; 
 #endif
@@ -249,6 +286,8 @@ static bool ftpStoreFile(File &fh) {
   uint32_t writeBytes = 0; 
   uint32_t uploadStart = millis();
   size_t readLen, writeLen;
+  uint32_t crc = 0, sentCrc = 0;
+  bool haveCrc = knownCrc(fh, crc);
   if (!sendFtpCommand("STOR ", ftpSaveName, "150", "125")) return false;
   do {
     // upload file in chunks
@@ -256,6 +295,7 @@ static bool ftpStoreFile(File &fh) {
     if (readLen) {
       writeLen = dclient.write((const uint8_t*)fsChunk, readLen);
       writeBytes += writeLen;
+      if (haveCrc) sentCrc = crc32c(sentCrc, fsChunk, writeLen);
       if (writeLen == 0) {
         LOG_WRN("Upload file to ftp failed");
         return false;
@@ -269,6 +309,8 @@ static bool ftpStoreFile(File &fh) {
   if (res) {
     LOG_ALT("Uploaded %s in %u sec", fmtSize(writeBytes), (millis() - uploadStart) / 1000);
     //sendFtpCommand("SITE CHMOD 644 ", ftpSaveName, "200", "550"); // unix only
+    checkSentCrc(fh, haveCrc, crc, sentCrc);
+    if (haveCrc) res = ftpStoreCrc(ftpSaveName, crc);
   } else LOG_WRN("File transfer not successful");
   return res;
 }
@@ -289,6 +331,16 @@ static bool getFolderName(const char* folderName) {
   return res;
 }
 
+static bool storeFile(File& fh) {
+  // upload file using FTP or HTTPS server, recording decrypted if encrypted
+#ifdef ISCAM
+  File rec = recDecrypt(fh);
+  return fsUse ? hfsStoreFile(rec) : ftpStoreFile(rec);
+#else
+  return fsUse ? hfsStoreFile(fh) : ftpStoreFile(fh);
+#endif
+}
+
 static bool uploadFolderOrFileFs(const char* fileOrFolder) {
   // Upload a single file or whole folder using FTP or HTTPS server
   // folder is uploaded file by file
@@ -307,7 +359,7 @@ static bool uploadFolderOrFileFs(const char* fileOrFolder) {
     // Upload a single file 
     char fsSaveName[FILE_NAME_LEN];
     strcpy(fsSaveName, root.path());
-    if (getFolderName(root.path())) res = fsUse ? hfsStoreFile(root) : ftpStoreFile(root); 
+    if (getFolderName(root.path())) res = storeFile(root); 
 #ifdef ISCAM
     // upload corresponding csv and srt files if exist
     if (res) {
@@ -337,7 +389,7 @@ static bool uploadFolderOrFileFs(const char* fileOrFolder) {
     }
     File fh = root.openNextFile();
     while (fh) {
-      res = fsUse ? hfsStoreFile(fh) : ftpStoreFile(fh);
+      res = storeFile(fh);
       if (!res) break; // abandon rest of files
       fh.close();
       fh = root.openNextFile();
@@ -382,6 +434,10 @@ bool fsStartTransfer(const char* fileFolder) {
   return false;
 }
 
+bool fsTransferBusy() {
+  return uploadInProgress;
+}
+
 void prepUpload() {
   LOG_INF("File uploads will use %s server", fsUse ? "HTTPS" : "FTP");
 }
@@ -30,6 +30,7 @@
 #include <ESPmDNS.h> 
 #include "lwip/sockets.h"
 #include <vector>
+#include <atomic>
 #include "ping/ping_sock.h"
 #include <Preferences.h>
 #include <regex>
@@ -136,8 +137,10 @@ void forceCrash();
 void formatElapsedTime(char* timeStr, uint32_t timeVal, bool noDays = false);
 void formatHex(const char* inData, size_t inLen);
 bool fsStartTransfer(const char* fileFolder);
+bool fsTransferBusy();
 const char* getEncType(int ssidIndex);
 void getExtIP();
+void getOldestDir(char* oldestDir);
 time_t getEpoch();
 size_t getFreeStorage();
 uint32_t getFrequency();
@@ -155,6 +158,7 @@ void logPrint(const char *fmtStr, ...);
 void logSetup();
 void OTAprereq();
 bool parseJson(int rxSize);
+bool preallocFile(const char* fileName, size_t fileSize);
 bool prepFreq(int maxFreq, int sampleInterval);
 bool prepI2C();
 void prepPeripherals();
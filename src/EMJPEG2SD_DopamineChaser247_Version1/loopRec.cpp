@@ -0,0 +1,341 @@
+// Loop recording into a preallocated file used as a ring of segments.
+// Instead of creating, renaming and later deleting an avi file and date
+// folder per recording, frames are appended to the current segment of a
+// contiguous loop file, and when it is full the oldest segment is reused.
+// So continuous operation makes no FAT changes after the loop file is
+// allocated, and the oldest frames are evicted without any unlinks.
+// A small table file holds a header and an entry per segment, committed
+// after the loop file is flushed, so that the table only describes frames
+// safely on SD. Frames written after the last commit are recovered at boot
+// by scanning the latest segment.
+// Any time range can be exported on demand as a normal avi file, which is
+// saved in the date folder of its first frame.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define LOOP_FILE DATA_DIR "/loop.bin"
+#define LOOP_TABLE DATA_DIR "/loop.tbl"
+#define LOOP_COMMIT_MS 10000 // interval between table commits while recording
+
+bool loopRecord = false; // record into loop file instead of avi files
+int loopSizeMB = 4096; // loop file size, limited to FAT32 max file size
+static File loopFile; // frame records
+static File tableFile; // header then segment entries
+static loopSeg* segTable = NULL; // committed segment entries, shared with export
+static loopSeg curEntry; // entry for current segment including uncommitted frames
+static int curSeg = -1; // segment being written, -1 before first
+static uint32_t segLen; // bytes per segment
+#define LOOP_MB ((uint32_t)((uint64_t)segLen * LOOP_SEGS / ONEMEG))
+static uint32_t lastSeq = 0;
+static uint64_t epochBase; // epoch ms at millis() 0, for frame times
+static uint32_t commitTime;
+static bool loopOK = false;
+static SemaphoreHandle_t loopMutex = NULL;
+static TaskHandle_t exportHandle = NULL;
+static uint64_t exportFrom, exportTo; // epoch ms
+
+static void writeEntry(int seg, const loopSeg& ls) {
+  // save segment entry in table file, and make it visible to export
+  xSemaphoreTake(loopMutex, portMAX_DELAY);
+  segTable[seg] = ls;
+  loopSeal(segTable[seg]);
+  xSemaphoreGive(loopMutex);
+  tableFile.seek(sizeof(loopHeader) + seg * sizeof(loopSeg), SeekSet);
+  tableFile.write((uint8_t*)&segTable[seg], sizeof(loopSeg));
+  tableFile.flush();
+}
+
+static void commitSeg() {
+  // table entry updated only after frames flushed to SD
+  if (curSeg < 0) return;
+  loopFile.flush();
+  writeEntry(curSeg, curEntry);
+  commitTime = millis();
+}
+
+static void nextSeg(uint8_t frameType, uint8_t fps) {
+  // start next segment, evicting its previous frames
+  commitSeg();
+  curSeg = (curSeg + 1) % LOOP_SEGS;
+  curEntry = {};
+  curEntry.seq = ++lastSeq;
+  curEntry.startMs = epochBase + millis();
+  curEntry.frameType = frameType;
+  curEntry.fps = fps;
+  writeEntry(curSeg, curEntry);
+  loopFile.seek(curSeg * segLen, SeekSet);
+  LOG_VRB("Loop segment %d started, seq %u", curSeg, lastSeq);
+}
+
+bool loopReady() {
+  return loopOK;
+}
+
+void loopBegin(uint8_t frameType, uint8_t fps) {
+  // recording started, continue in current segment unless different frame size
+  uint64_t epochMs = (uint64_t)getEpoch() * 1000;
+  epochBase = epochMs > millis() ? epochMs - millis() : 0;
+  if (curSeg < 0 || curEntry.frameType != frameType) nextSeg(frameType, fps);
+  commitTime = millis();
+}
+
+size_t loopFrame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs) {
+  // append frame record to current segment, called from SD writer task
+  size_t recLen = loopRecLen(jpegLen);
+  if (!jpegLen || recLen > segLen) return 0;
+  if (curEntry.usedLen + recLen > segLen) nextSeg(curEntry.frameType, curEntry.fps);
+  uint64_t epochMs = epochBase + frameMs;
+  loopFrameHdr fh = {LOOP_FRAME_MAGIC, curEntry.seq,
+    (uint32_t)(epochMs > curEntry.startMs ? epochMs - curEntry.startMs : 0), (uint32_t)jpegLen};
+  loopFile.write((uint8_t*)&fh, sizeof(fh));
+  loopFile.write(jpegBuf, jpegLen);
+  static const uint8_t filler[4] = {0};
+  loopFile.write(filler, recLen - sizeof(fh) - jpegLen);
+  curEntry.frames++;
+  curEntry.durMs = std::max(curEntry.durMs, fh.offMs);
+  curEntry.usedLen += recLen;
+  // commit periodically so that frames survive power loss, and can be exported
+  if (millis() - commitTime > LOOP_COMMIT_MS) commitSeg();
+  return recLen;
+}
+
+void loopEnd() {
+  // recording stopped
+  commitSeg();
+}
+
+static void recoverSeg() {
+  // find frames written to latest segment after its last commit
+  curSeg = loopLatest(segTable);
+  if (curSeg < 0) return;
+  curEntry = segTable[curSeg];
+  lastSeq = curEntry.seq;
+  uint32_t recovered = 0;
+  loopFrameHdr fh;
+  while (curEntry.usedLen + sizeof(fh) <= segLen) {
+    loopFile.seek(curSeg * segLen + curEntry.usedLen, SeekSet);
+    if (loopFile.read((uint8_t*)&fh, sizeof(fh)) != sizeof(fh)) break;
+    if (!loopFrameValid(fh, curEntry.seq, segLen - curEntry.usedLen)) break;
+    curEntry.frames++;
+    curEntry.durMs = std::max(curEntry.durMs, fh.offMs);
+    curEntry.usedLen += loopRecLen(fh.len);
+    recovered++;
+  }
+  if (recovered) {
+    writeEntry(curSeg, curEntry);
+    LOG_INF("Recovered %u frames in loop segment %d", recovered, curSeg);
+  }
+  loopFile.seek(curSeg * segLen + curEntry.usedLen, SeekSet);
+}
+
+static bool createLoop() {
+  // allocate contiguous loop file and empty table
+  STORAGE.remove(LOOP_TABLE);
+  STORAGE.remove(LOOP_FILE);
+  if (!preallocFile(LOOP_FILE, (size_t)segLen * LOOP_SEGS)) {
+    LOG_WRN("Insufficient contiguous space on SD for %uMB loop file", LOOP_MB);
+    return false;
+  }
+  loopHeader lh = {};
+  lh.magic = LOOP_MAGIC;
+  lh.version = LOOP_VERSION;
+  lh.segs = LOOP_SEGS;
+  lh.segLen = segLen;
+  loopSeal(lh);
+  memset(segTable, 0, LOOP_SEGS * sizeof(loopSeg));
+  File newTable = STORAGE.open(LOOP_TABLE, FILE_WRITE);
+  bool created = newTable.write((uint8_t*)&lh, sizeof(lh)) == sizeof(lh)
+    && newTable.write((uint8_t*)segTable, LOOP_SEGS * sizeof(loopSeg)) == LOOP_SEGS * sizeof(loopSeg);
+  newTable.close();
+  if (created) LOG_INF("Created %uMB loop file", LOOP_MB);
+  return created;
+}
+
+static bool openLoop() {
+  // use existing loop file if same layout, else create new one
+  segLen = loopSegLen(std::min((uint64_t)loopSizeMB * ONEMEG, (uint64_t)UINT32_MAX - ONEMEG));
+  if (!segLen) {
+    LOG_WRN("Loop file size %dMB too small", loopSizeMB);
+    return false;
+  }
+  loopHeader lh = {};
+  tableFile = STORAGE.open(LOOP_TABLE, FILE_READ);
+  bool valid = tableFile && tableFile.read((uint8_t*)&lh, sizeof(lh)) == sizeof(lh) && loopValid(lh, segLen)
+    && tableFile.read((uint8_t*)segTable, LOOP_SEGS * sizeof(loopSeg)) == LOOP_SEGS * sizeof(loopSeg);
+  tableFile.close();
+  if (valid) {
+    loopFile = STORAGE.open(LOOP_FILE, FILE_READ);
+    valid = loopFile && loopFile.size() >= (size_t)segLen * LOOP_SEGS;
+    loopFile.close();
+  }
+  if (!valid && !createLoop()) return false;
+  tableFile = STORAGE.open(LOOP_TABLE, "r+");
+  loopFile = STORAGE.open(LOOP_FILE, "r+");
+  if (!tableFile || !loopFile) return false;
+  // discard corrupted entries
+  for (int i = 0; i < LOOP_SEGS; i++) if (!loopValid(segTable[i])) memset(&segTable[i], 0, sizeof(loopSeg));
+  recoverSeg();
+  return true;
+}
+
+static void exportName(char* aviName, uint64_t firstMs, uint8_t frameType, uint8_t fps, unsigned long durSecs) {
+  // recording name from time of first frame, as for avi recordings
+  time_t firstEpoch = firstMs / 1000;
+  char folder[FILE_NAME_LEN];
+  strftime(folder, sizeof(folder), "/%Y%m%d", localtime(&firstEpoch));
+  STORAGE.mkdir(folder);
+  int nameLen = strftime(aviName, FILE_NAME_LEN, "/%Y%m%d/%Y%m%d_%H%M%S", localtime(&firstEpoch));
+  snprintf(aviName + nameLen, FILE_NAME_LEN - nameLen, "_%s_%u_%lu.%s",
+    frameData[frameType].frameSizeStr, fps, durSecs, AVI_EXT);
+}
+
+static bool exportLoop(uint64_t fromMs, uint64_t toMs) {
+  // copy frames in time range from loop file into new avi file
+  uint32_t eTime = millis();
+  if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+  std::vector<loopSeg> segs(LOOP_SEGS);
+  if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+  xSemaphoreTake(loopMutex, portMAX_DELAY);
+  memcpy(segs.data(), segTable, LOOP_SEGS * sizeof(loopSeg));
+  xSemaphoreGive(loopMutex);
+  std::vector<uint16_t> order = loopOrder(segs.data(), fromMs, toMs);
+  if (order.empty()) {
+    LOG_WRN("No loop recording in export time range");
+    return false;
+  }
+  File inFile = STORAGE.open(LOOP_FILE, FILE_READ);
+  File aviFile = STORAGE.open(EXPORTTEMP, FILE_WRITE);
+  size_t bufLen = AVI_HEADER_LEN;
+  uint8_t* buf = psramFound() ? (uint8_t*)ps_malloc(bufLen) : (uint8_t*)malloc(bufLen);
+  if (!inFile || !aviFile || buf == NULL) {
+    LOG_WRN("Unable to start loop export");
+    free(buf);
+    return false;
+  }
+  memset(buf, 0, AVI_HEADER_LEN);
+  aviFile.write(buf, AVI_HEADER_LEN); // space for avi header
+  prepAviIndex();
+  uint32_t frames = 0;
+  uint64_t firstMs = 0, lastMs = 0;
+  uint8_t frameType = segs[order[0]].frameType;
+  const uint8_t* idxData;
+  size_t idxLen;
+  for (uint16_t seg : order) {
+    const loopSeg& ls = segs[seg];
+    if (ls.frameType != frameType) continue; // avi has single frame size
+    loopFrameHdr fh;
+    for (uint32_t pos = 0; pos + sizeof(fh) <= ls.usedLen; pos += loopRecLen(fh.len)) {
+      inFile.seek(seg * segLen + pos, SeekSet);
+      if (inFile.read((uint8_t*)&fh, sizeof(fh)) != sizeof(fh)) break;
+      if (!loopFrameValid(fh, ls.seq, ls.usedLen - pos)) break;
+      uint64_t frameMs = ls.startMs + fh.offMs;
+      if (frameMs < fromMs || frameMs > toMs) continue;
+      size_t jpegSize = loopRecLen(fh.len) - sizeof(fh); // includes filler
+      if (jpegSize > bufLen) {
+        uint8_t* newBuf = (uint8_t*)realloc(buf, jpegSize);
+        if (newBuf == NULL) break;
+        buf = newBuf;
+        bufLen = jpegSize;
+      }
+      if (inFile.read(buf, jpegSize) != jpegSize) break;
+      if (segTable[seg].seq != ls.seq) break; // segment reused while being read
+      if (prepAviSplit(jpegSize + CHUNK_HDR)) while ((idxLen = getAviIndex(&idxData))) aviFile.write(idxData, idxLen);
+      uint8_t hdrBuff[CHUNK_HDR];
+      memcpy(hdrBuff, dcBuf, 4);
+      memcpy(hdrBuff+4, &jpegSize, 4);
+      aviFile.write(hdrBuff, CHUNK_HDR);
+      aviFile.write(buf, jpegSize);
+      buildAviIdx(jpegSize);
+      if (!frames++) firstMs = frameMs;
+      lastMs = frameMs;
+    }
+  }
+  free(buf);
+  inFile.close();
+  if (!frames) {
+    aviFile.close();
+    STORAGE.remove(EXPORTTEMP);
+    LOG_WRN("No loop frames in export time range");
+    return false;
+  }
+  finalizeAviIndex(frames);
+  while ((idxLen = getAviIndex(&idxData))) aviFile.write(idxData, idxLen);
+  uint32_t durMs = lastMs - firstMs;
+  uint8_t fps = durMs ? std::min(std::max((uint32_t)lround((frames - 1) * 1000.0 / durMs), (uint32_t)1), (uint32_t)255) : 1;
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  buildAviHdr(fps, frameType, frames);
+  xSemaphoreGive(aviMutex);
+  patchAviSegments(aviFile);
+  aviFile.seek(0, SeekSet); // start of file
+  aviFile.write(aviHeader, AVI_HEADER_LEN);
+  size_t aviLen = aviFile.size();
+  aviFile.close();
+  char aviName[FILE_NAME_LEN];
+  exportName(aviName, firstMs, frameType, fps, lround(durMs / 1000.0));
+  STORAGE.rename(EXPORTTEMP, aviName);
+  catalogAddFile(aviName);
+  LOG_ALT("Exported %u frames from loop file as %s, %s in %lu ms", frames, aviName, fmtSize(aviLen), millis() - eTime);
+  return true;
+}
+
+static void exportTask(void*) {
+  exportLoop(exportFrom, exportTo);
+  exportHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+bool loopExportActive() {
+  return exportHandle != NULL;
+}
+
+bool startLoopExport(const char* timeRange) {
+  // web request to export "<fromEpoch>-<toEpoch>" secs from loop file as avi
+  unsigned long fromSecs, toSecs;
+  if (sscanf(timeRange, "%lu-%lu", &fromSecs, &toSecs) != 2 || toSecs < fromSecs) {
+    LOG_WRN("Invalid loop export range: %s", timeRange);
+    return false;
+  }
+  // exporter uses avi index builder, so not while avi recording in progress
+  if (!loopOK || exportHandle != NULL || (recordState == RECORDING && !loopRecord)) {
+    LOG_WRN("Loop export not available");
+    return false;
+  }
+  exportFrom = (uint64_t)fromSecs * 1000;
+  exportTo = (uint64_t)toSecs * 1000 + 999;
+  xTaskCreate(&exportTask, "exportTask", EXPORT_STACK_SIZE, NULL, EXPORT_PRI, &exportHandle);
+  debugMemory("startLoopExport");
+  return true;
+}
+
+void loopInfo(char* jsonBuff) {
+  // time range held in loop file, as epoch secs
+  uint64_t oldestMs = 0, newestMs = 0;
+  uint32_t frames = 0;
+  if (loopOK) {
+    xSemaphoreTake(loopMutex, portMAX_DELAY);
+    for (int i = 0; i < LOOP_SEGS; i++) {
+      const loopSeg& ls = segTable[i];
+      if (!ls.frames) continue;
+      if (!oldestMs || ls.startMs < oldestMs) oldestMs = ls.startMs;
+      newestMs = std::max(newestMs, ls.startMs + ls.durMs);
+      frames += ls.frames;
+    }
+    xSemaphoreGive(loopMutex);
+  }
+  sprintf(jsonBuff, "{\"loop\":%u,\"sizeMB\":%lu,\"oldest\":%lu,\"newest\":%lu,\"frames\":%lu,\"exporting\":%u}",
+    loopOK, loopOK ? (unsigned long)LOOP_MB : 0UL, (unsigned long)(oldestMs / 1000), (unsigned long)(newestMs / 1000),
+    (unsigned long)frames, exportHandle != NULL);
+}
+
+void prepLoop() {
+  // open loop file if loop recording selected, applied at restart
+  STORAGE.remove(EXPORTTEMP); // incomplete export
+  if (!loopRecord) return;
+  loopMutex = xSemaphoreCreateMutex();
+  segTable = psramFound() ? (loopSeg*)ps_malloc(LOOP_SEGS * sizeof(loopSeg)) : (loopSeg*)malloc(LOOP_SEGS * sizeof(loopSeg));
+  loopOK = segTable != NULL && openLoop();
+  if (loopOK) LOG_INF("Loop recording into %uMB in %u segments of %s", LOOP_MB, LOOP_SEGS, fmtSize(segLen));
+  else LOG_WRN("Loop recording unavailable, recording to avi files");
+}
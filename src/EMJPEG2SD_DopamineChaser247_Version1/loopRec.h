@@ -0,0 +1,97 @@
+// Loop recording file layout and segment selection, see loopRec.cpp
+// Kept free of Arduino / ESP dependencies so that the exporter can be
+// exercised on a host against a file backed image.
+//
+// s60sc 2025
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "catalog.h" // for catCheck()
+
+#define LOOP_MAGIC 0x504F4F4C // "LOOP"
+#define LOOP_FRAME_MAGIC 0x5246504C // "LPFR"
+#define LOOP_VERSION 1
+#define LOOP_SEGS 256 // segments in loop file, oldest segment overwritten when full
+#define LOOP_SEG_ALIGN (64 * 1024) // segment length multiple
+#define LOOP_MIN_SEG (1024 * 1024)
+
+struct loopHeader {
+  // start of table file, identifies loop file layout
+  uint32_t magic;
+  uint16_t version;
+  uint16_t segs;
+  uint32_t segLen; // bytes per segment in loop file
+  uint8_t reserved[16];
+  uint32_t check;
+};
+
+struct loopSeg {
+  // table entry per segment, rewritten when frames committed
+  uint32_t seq; // order segments were started, 0 if unused
+  uint32_t frames; // committed frame records
+  uint64_t startMs; // epoch ms that frame times are relative to
+  uint32_t durMs; // time of last committed frame after startMs
+  uint32_t usedLen; // bytes of committed frame records
+  uint8_t frameType; // frame size of all frames in segment
+  uint8_t fps; // nominal frame rate
+  uint16_t reserved;
+  uint32_t check;
+};
+
+struct loopFrameHdr {
+  // precedes each jpeg in loop file, jpeg padded to DWORD
+  uint32_t magic;
+  uint32_t seq; // of segment when written, so that stale records are ignored
+  uint32_t offMs; // capture time after segment startMs
+  uint32_t len; // jpeg length
+};
+
+inline void loopSeal(loopHeader& lh) { lh.check = catCheck(&lh, offsetof(loopHeader, check)); }
+inline void loopSeal(loopSeg& ls) { ls.check = catCheck(&ls, offsetof(loopSeg, check)); }
+
+inline bool loopValid(const loopHeader& lh, uint32_t segLen) {
+  return lh.magic == LOOP_MAGIC && lh.version == LOOP_VERSION && lh.segs == LOOP_SEGS
+    && lh.segLen == segLen && lh.check == catCheck(&lh, offsetof(loopHeader, check));
+}
+
+inline bool loopValid(const loopSeg& ls) {
+  return ls.seq && ls.check == catCheck(&ls, offsetof(loopSeg, check));
+}
+
+inline size_t loopRecLen(uint32_t jpegLen) {
+  return sizeof(loopFrameHdr) + ((jpegLen + 3) & ~3);
+}
+
+inline bool loopFrameValid(const loopFrameHdr& fh, uint32_t seq, size_t room) {
+  // record belongs to segment and fits in space remaining
+  return fh.magic == LOOP_FRAME_MAGIC && fh.seq == seq && fh.len && loopRecLen(fh.len) <= room;
+}
+
+inline uint32_t loopSegLen(uint64_t fileLen) {
+  // segment length for loop file of given size, 0 if too small
+  uint64_t segLen = fileLen / LOOP_SEGS / LOOP_SEG_ALIGN * LOOP_SEG_ALIGN;
+  return segLen < LOOP_MIN_SEG ? 0 : (uint32_t)segLen;
+}
+
+inline int loopLatest(const loopSeg* segs) {
+  // segment most recently started, -1 if none
+  int latest = -1;
+  for (int i = 0; i < LOOP_SEGS; i++)
+    if (segs[i].seq && (latest < 0 || segs[i].seq > segs[latest].seq)) latest = i;
+  return latest;
+}
+
+inline std::vector<uint16_t> loopOrder(const loopSeg* segs, uint64_t fromMs, uint64_t toMs) {
+  // segments with frames in time range, oldest first
+  std::vector<uint16_t> order;
+  for (uint16_t i = 0; i < LOOP_SEGS; i++) {
+    const loopSeg& ls = segs[i];
+    if (ls.seq && ls.frames && ls.startMs <= toMs && ls.startMs + ls.durMs >= fromMs) order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [segs](uint16_t a, uint16_t b) { return segs[a].seq < segs[b].seq; });
+  return order;
+}
@@ -8,7 +8,10 @@
 
 #include "appGlobals.h"
 #include "motionDetect.h"
+#include "pacing.h"
 #include "esp_camera.h" // For camera_fb_t
+#include <unistd.h> // For truncate
+#include <inttypes.h> // For SCNu32
 
 // Define states
 #define STATE_IDLE 0
@@ -19,7 +22,6 @@
 #define MAX_RECORDING_TIME_MS (5 * 60 * 1000)     // 5 minutes maximum
 #define COOLDOWN_TIME_MS (5 * 1000)               // 5 seconds cooldown
 
-#define FB_CNT 4 // number of frame buffers
 
 
 static bool setupCameraConfig(); // Forward declaration
@@ -66,21 +68,83 @@ framesize_t maxFS = FRAMESIZE_SVGA; // default
 
 // header and reporting info
 static uint32_t vidSize; // total video size
-static uint16_t frameCnt;
+static uint32_t frameCnt;
 static uint32_t startTime; // total overall time
 static uint32_t dTimeTot; // total frame decode/monitor time
 static uint32_t fTimeTot; // total frame buffering time
 static uint32_t wTimeTot; // total SD write time
+static uint32_t stallTimeTot; // SD writer time waiting for free staging buffer
 static uint32_t oTime; // file opening time
 static uint32_t cTime; // file closing time
 static uint32_t sTime; // file streaming time
-static uint32_t frameInterval; // units of us between frames
+static uint8_t aviFPS; // avi frame rate, gaps in capture times filled by empty frames
+static uint32_t firstFrameMs; // capture time of first frame
+static uint32_t frameSlots; // avi frames including empty frames
+#define MAX_GAP_SECS 10 // max capture gap represented by empty frames
 
 // SD card storage
+#define AVI_SYNC_MS 10000 // interval between SD flushes, so recording recoverable after power loss
 uint8_t iSDbuffer[(RAMSIZE + CHUNK_HDR) * 2];
-static size_t highPoint;
+static size_t highPoint; // fill level of staging buffer being filled
+static uint32_t syncTime;
+static size_t audSize; // audio interleaved into avi
+static uint32_t audChunks;
+#define AUDIO_CHUNK_MS 250 // min audio per 01wb chunk
 static File aviFile;
 static char aviFileName[FILE_NAME_LEN];
+static bool recMp4 = false; // current recording is fragmented mp4
+static bool recLoop = false; // current recording is into loop file
+static uint16_t alignLen; // boundary that frame content starts on, 0 for none
+static size_t padLen; // JUNK padding for alignment
+static uint32_t sdWrites;
+static uint32_t partWrites; // writes not whole aligned sectors, so read-modify-write
+#define SLOW_WRITE_MS 100 // SD write stall threshold
+#define PREALLOC_MARGIN 125 // percent of expected recording size to preallocate
+static uint32_t maxWriteMs; // worst case SD write latency
+static uint32_t slowWrites;
+static size_t preallocLen; // contiguous space allocated to file at open, 0 if none
+static uint32_t recByteRate = 0; // bytes per sec of previous recording
+static uint16_t motionChecks; // motion checks during recording, for catalog
+static uint16_t motionHits;
+static uint32_t recCrc; // CRC32C of recording content written so far
+static uint32_t crcTimeUs; // flush task time spent updating recCrc
+static bool recCrypt; // recording encrypted as written, see recCrypt.cpp
+static size_t contentLen; // recording length excluding any encryption header
+
+// SD staging ring, filled by SD writer task and written to SD by flush task
+#define STAGE_MAX 8 // max number of staging buffers
+#define STAGE_MAX_KB 64 // max staging buffer size
+uint8_t sdBufCount = 4; // requested number of staging buffers
+uint8_t sdBufKB = 16; // requested staging buffer size in KB, rounded to multiple of RAMSIZE
+static uint8_t* stageBuf[STAGE_MAX] = {NULL};
+static size_t stageFill[STAGE_MAX]; // bytes to write from each filled buffer
+static uint8_t* stagePtr; // buffer being filled
+static uint8_t stageCount = 0; // buffers in use
+static size_t stageSize = 0; // bytes per buffer in use
+static uint16_t stageWanted = 0; // count and KB that stage buffers were allocated for
+static bool stagePooled = false; // buffers allocated from heap, else halves of iSDbuffer
+static std::atomic<uint32_t> stageHead(0); // written by SD writer task
+static std::atomic<uint32_t> stageTail(0); // written by flush task
+static SemaphoreHandle_t stageFreeSemaphore = NULL;
+static TaskHandle_t sdFlushHandle = NULL;
+struct stageResult {
+  uint8_t count;
+  uint8_t kb;
+  uint32_t writeMs;
+  uint64_t bytes;
+};
+static stageResult stageResults[STAGE_MAX]; // SD write rate per staging setting since boot
+
+// SD writer queue of frame handles
+#define SDQ_LEN 8 // must be power of 2
+static frameHandle* sdQueue[SDQ_LEN] = {NULL};
+static std::atomic<uint32_t> sdqHead(0); // written by capture task
+static std::atomic<uint32_t> sdqTail(0); // written by SD writer task
+static volatile bool sdSyncReq = false;
+static SemaphoreHandle_t sdSyncSemaphore = NULL;
+uint32_t sdqHighWater = 0; // max queue depth during recording
+static uint32_t sdqWindowHW = 0; // max queue depth during QoS window
+uint32_t droppedFrames = 0; // frames not recorded as queue full
 
 // SD playback
 static File playbackFile;
@@ -95,16 +159,26 @@ bool doPlayback = false; // controls playback
 // task control
 TaskHandle_t captureHandle = NULL;
 TaskHandle_t playbackHandle = NULL;
+TaskHandle_t sdWriterHandle = NULL;
 static SemaphoreHandle_t readSemaphore;
 static SemaphoreHandle_t playbackSemaphore;
 SemaphoreHandle_t frameSemaphore[MAX_STREAMS] = {NULL};
 SemaphoreHandle_t motionSemaphore = NULL;
 SemaphoreHandle_t aviMutex = NULL;
+// capture task runs from prepCam(), before prepRecording() creates the SD tasks,
+// so recording is not started until they are ready, which is also after any 
+// interrupted recording is recovered, as openAvi() would overwrite its temp file
+static volatile bool sdTasksReady = false;
 static volatile bool isPlaying = false; // controls playback on app
 bool isCapturing = false;
 //*bool stopPlayback = false; // controls if playback allowed
 bool timeLapseOn = false;
-static bool pirVal = false;
+bool sensorPacing = false; // capture paced by sensor frames instead of frame timer
+bool singleMode = false; // sensor kept at recording resolution when not recording
+bool useMp4 = false; // record as fragmented mp4 instead of avi
+bool sdPrealloc = true; // preallocate contiguous space for recording file
+uint8_t aviAlign = 0; // start avi frames on 0: any DWORD, 1: sector, 2: RAMSIZE block
+static frameDecimator frameDec;
 
 /**************** timers & ISRs ************************/
 
@@ -112,7 +186,10 @@ static void IRAM_ATTR frameISR() {
   // interrupt at current frame rate
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
   if (isPlaying) xSemaphoreGiveFromISR (playbackSemaphore, &xHigherPriorityTaskWoken ); // notify playback to send frame
-  vTaskNotifyGiveFromISR(captureHandle, &xHigherPriorityTaskWoken); // wake capture task to process frame
+  if (!sensorPacing) {
+    frameTick();
+    vTaskNotifyGiveFromISR(captureHandle, &xHigherPriorityTaskWoken); // wake capture task to process frame
+  }
   if (xHigherPriorityTaskWoken == pdTRUE) portYIELD_FROM_ISR();
 }
 
@@ -156,37 +233,104 @@ uint8_t setFPSlookup(uint8_t val) {
 
 /**************** capture AVI  ************************/
 
+static void stageData(const uint8_t* data, size_t dataLen);
+static void prepStage();
+
+uint32_t recordingByteRate() {
+  // expected recording bytes per sec, from previous recording, else target bitrate, else frame size
+  if (recByteRate) return recByteRate;
+  return qosKbps ? qosKbps * 1000 / 8 
+    : frameData[fsizePtr].frameWidth * frameData[fsizePtr].frameHeight / 8 * std::max(FPS, (uint8_t)1); // ~1 bit per pixel
+}
+
+static size_t preallocSize() {
+  // expected recording size from bitrate x max duration, limited by available space,
+  // as found by retention task, as reading it from the FAT can take seconds
+  uint32_t byteRate = recordingByteRate();
+  uint32_t maxSecs = std::min(MAX_RECORDING_TIME_MS / 1000, maxFrames / std::max(FPS, (uint8_t)1)) + preRollSecs;
+  uint64_t expected = (uint64_t)byteRate * maxSecs * PREALLOC_MARGIN / 100;
+  uint64_t freeBytes = retentionFree();
+  uint64_t reserved = (uint64_t)sdMinCardFreeSpace * ONEMEG;
+  uint64_t available = freeBytes > reserved ? freeBytes - reserved : 0;
+  expected = std::min(std::min(expected, available), (uint64_t)UINT32_MAX - ONEMEG); // FAT32 file size limit
+  return expected < ONEMEG ? 0 : (size_t)expected;
+}
+
 static void openAvi() {
   // derive filename from date & time, store in date folder
   oTime = millis();
-  dateFormat(partName, sizeof(partName), true);
-  STORAGE.mkdir(partName); // make date folder if not present
-  dateFormat(partName, sizeof(partName), false);
-  
-  // open avi file with temporary name 
-  aviFile = STORAGE.open(AVITEMP, FILE_WRITE);
+  // loop file also used while export in progress, as that uses avi index
+  recLoop = (loopRecord || loopExportActive()) && loopReady();
+  recMp4 = recLoop ? false : useMp4;
+  if (!recLoop) {
+    dateFormat(partName, sizeof(partName), true);
+    STORAGE.mkdir(partName); // make date folder if not present
+    dateFormat(partName, sizeof(partName), false);
+    
+    // open avi file with temporary name, container fixed for duration of recording
+    alignLen = recMp4 ? 0 : aviAlign == 1 ? SD_SECTOR : aviAlign == 2 ? RAMSIZE : 0;
+    const char* tempName = recMp4 ? MP4TEMP : AVITEMP;
+    // contiguous file avoids FAT cluster allocation stalls as file grows, unused space truncated on close.
+    // Its size then includes stale space, so length of data on SD is recorded, see recCommit.cpp
+    preallocLen = sdPrealloc ? preallocSize() : 0;
+    if (preallocLen && !(commitBegin(tempName) && preallocFile(tempName, preallocLen))) preallocLen = 0;
+    if (!preallocLen) commitEnd();
+    // encrypted file is read back when its header is patched on close
+    aviFile = STORAGE.open(tempName, preallocLen ? "r+" : encReady() ? "w+" : FILE_WRITE);
+    recCrypt = encBegin(aviFile, recMp4 ? 0 : AVI_HEADER_LEN);
+  } else {
+    recCrypt = false;
+    preallocLen = 0;
+  }
   oTime = millis() - oTime;
   LOG_VRB("File opening time: %ums", oTime);
   
-  // Force the resolution setting again just before recording starts
+  // Force the resolution setting again just before recording starts,
+  // unless sensor already kept at recording resolution
   sensor_t* s = esp_camera_sensor_get();
   if (s) {
-    s->set_framesize(s, recordState == RECORDING ? FRAMESIZE_FHD : FRAMESIZE_HD);
-    LOG_INF("AVI recording at resolution: %s", frameData[s->status.framesize].frameSizeStr);
+    if (!singleMode) s->set_framesize(s, recordState == RECORDING ? FRAMESIZE_FHD : FRAMESIZE_HD);
+    LOG_INF("%s recording at resolution: %s", recLoop ? "Loop" : recMp4 ? "MP4" : "AVI", frameData[s->status.framesize].frameSizeStr);
+  }
+  
+  // initialization of counters
+  frameCnt = fTimeTot = wTimeTot = stallTimeTot = dTimeTot = vidSize = 0;
+  recCrc = crcTimeUs = 0;
+  frameSlots = 0;
+  prepStage();
+  aviFPS = std::max(FPS, (uint8_t)1);
+  sdqHighWater = droppedFrames = 0;
+  audSize = audChunks = 0;
+  sdWrites = partWrites = padLen = 0;
+  maxWriteMs = slowWrites = 0;
+  motionChecks = motionHits = 0;
+  resetFrameTiming();
+  if (recLoop) loopBegin(s ? (uint8_t)s->status.framesize : fsizePtr, aviFPS);
+  else if (recMp4) {
+    // mp4 init segment at start of file, not rewritten on close
+    uint8_t frameType = s ? (uint8_t)s->status.framesize : fsizePtr;
+    const uint8_t* initData;
+    size_t initLen = prepMp4(frameData[frameType].frameWidth, frameData[frameType].frameHeight, FPS, &initData);
+    highPoint = 0;
+    stageData(initData, initLen);
+  } else {
+    // allot space for AVI header, zeroed so that file CRC can be patched when header written
+    memset(stagePtr, 0, AVI_HEADER_LEN);
+    highPoint = AVI_HEADER_LEN;
+    prepAviIndex();
   }
+  syncTime = millis();
+  // recording includes frames saved before motion detected
+  uint32_t preRollMs = startPreRoll();
+  startTime = millis() - preRollMs;
   
 #if INCLUDE_AUDIO
-  startAudioRecord();
+  if (!recMp4 && !recLoop) startAudioRecord(preRollMs); // mp4 and loop are video only
 #endif
 #if INCLUDE_TELEM
-  haveSrt = startTelemetry();
+  haveSrt = recLoop ? false : startTelemetry();
 #endif
-  
-  // initialization of counters
-  startTime = millis();
-  frameCnt = fTimeTot = wTimeTot = dTimeTot = vidSize = 0;
-  highPoint = AVI_HEADER_LEN; // allot space for AVI header
-  prepAviIndex();
+  if (preRollMs) xTaskNotifyGive(sdWriterHandle); // start saving pre-roll frames
 }
 
 
@@ -246,8 +390,14 @@ static void timeLapse(camera_fb_t* fb, bool tlStop = false) {
         uint16_t filler = (4 - (fb->len & 0x00000003)) & 0x00000003; 
         uint32_t jpegSize = fb->len + filler;
         memcpy(hdrBuff+4, &jpegSize, 4);
+        if (prepAviSplit(jpegSize + CHUNK_HDR, true)) {
+          const uint8_t* idxData;
+          size_t idxLen;
+          while ((idxLen = getAviIndex(&idxData, true))) tlFile.write(idxData, idxLen);
+        }
         tlFile.write(hdrBuff, CHUNK_HDR); // jpeg frame details
         tlFile.write(fb->buf, jpegSize);
+        tlFile.flush(); // infrequent, so commit each frame in case of power loss
         buildAviIdx(jpegSize, true, true); // save avi index for frame
         frameCntTL++;
         intervalCnt = 0;   
@@ -256,21 +406,21 @@ static void timeLapse(camera_fb_t* fb, bool tlStop = false) {
       intervalCnt++;
       if (frameCntTL > requiredFrames) {
         // finish timelapse recording
+        // add indexes
+        finalizeAviIndex(--frameCntTL, true);
+        const uint8_t* idxData;
+        size_t idxLen;
+        while ((idxLen = getAviIndex(&idxData, true))) tlFile.write(idxData, idxLen);
         xSemaphoreTake(aviMutex, portMAX_DELAY);
-        buildAviHdr(tlPlaybackFPS, fsizePtr, --frameCntTL, true);
+        buildAviHdr(tlPlaybackFPS, fsizePtr, frameCntTL, true);
         xSemaphoreGive(aviMutex);
-        // add index
-        finalizeAviIndex(frameCntTL, true);
-        size_t idxLen = 0;
-        do {
-          idxLen = writeAviIndex(iSDbuffer, RAMSIZE, true);
-          tlFile.write(iSDbuffer, idxLen);
-        } while (idxLen > 0);
+        patchAviSegments(tlFile, true);
         // add header
         tlFile.seek(0, SeekSet); // start of file
         tlFile.write(aviHeader, AVI_HEADER_LEN);
         tlFile.close(); 
         STORAGE.rename(TLTEMP, TLname);
+        catalogAddFile(TLname);
         frameCntTL = intervalCnt = 0;
         LOG_INF("Finished time lapse: %s", TLname);
 #if INCLUDE_FTP_HFS
@@ -282,76 +432,360 @@ static void timeLapse(camera_fb_t* fb, bool tlStop = false) {
 }
 
 
+static frameHandle* alertFrame = NULL;
+static byte* alertBufferSave = NULL;
+
 void keepFrame(camera_fb_t* fb) {
-  // keep required frame for external server alert
-  if (fb->len < maxFrameBuffSize && alertBuffer != NULL) {
-    memcpy(alertBuffer, fb->buf, fb->len);
-    alertBufferSize = fb->len;
+  // keep required frame for external server alert,
+  // alertBuffer refers to the shared frame until releaseAlert() called
+  frameHandle* fh = findFrame(fb);
+  if (fh != NULL) {
+    releaseAlert(); // discard any unused alert frame
+    alertFrame = holdFrame(fh);
+    alertBufferSave = alertBuffer;
+    alertBuffer = fh->buf;
+    alertBufferSize = fh->len;
   }
 }
 
-static void saveFrame(camera_fb_t* fb) {
-    // save frame on SD card
-    uint32_t fTime = millis();
-    // align end of jpeg on 4 byte boundary for AVI
-    uint16_t filler = (4 - (fb->len & 0x00000003)) & 0x00000003; 
-    size_t jpegSize = fb->len + filler;
-    // add avi frame header
-    memcpy(iSDbuffer+highPoint, dcBuf, 4); 
-    memcpy(iSDbuffer+highPoint+4, &jpegSize, 4);
-    highPoint += CHUNK_HDR;
-    
-  //New code added for optimization
-    // Minimize SD writes by buffering more data
-    static uint32_t writeCounter = 0;
-    writeCounter++;
-    // Only write to SD every 4 frames to reduce I/O overhead
-  if (highPoint >= RAMSIZE || writeCounter % 4 == 0) {
-    uint32_t wTime = millis();
-    aviFile.write(iSDbuffer, highPoint);
-    wTime = millis() - wTime;
-    wTimeTot += wTime;
-    LOG_VRB("SD storage time %u ms", wTime);
-    highPoint = 0;
-  }
-  //End of new code written for optimization
-
-  if (highPoint >= RAMSIZE) {
-    // marker overflows buffer
-    highPoint -= RAMSIZE;
-    aviFile.write(iSDbuffer, RAMSIZE);
-    // push overflow to buffer start
-    memcpy(iSDbuffer, iSDbuffer+RAMSIZE, highPoint);
+void releaseAlert() {
+  // alert frame no longer needed
+  alertBufferSize = 0;
+  if (alertFrame != NULL) {
+    alertBuffer = alertBufferSave;
+    releaseFrame(alertFrame);
+    alertFrame = NULL;
   }
-  // add frame content
-  size_t jpegRemain = jpegSize;
+}
+
+static void writeAvi(const uint8_t* data, size_t dataLen) {
+  // write to SD, counting writes that are not whole aligned sectors, and stalls
+  if (!dataLen) return;
+  if (aviFile.position() % SD_SECTOR || dataLen % SD_SECTOR) partWrites++;
+  sdWrites++;
   uint32_t wTime = millis();
-  while (jpegRemain >= RAMSIZE - highPoint) {
-    // write to SD when RAMSIZE is filled in buffer
-    memcpy(iSDbuffer+highPoint, fb->buf + jpegSize - jpegRemain, RAMSIZE - highPoint);
-    aviFile.write(iSDbuffer, RAMSIZE);
-    jpegRemain -= RAMSIZE - highPoint;
-    highPoint = 0;
-  } 
+  aviFile.write(data, dataLen);
   wTime = millis() - wTime;
-  wTimeTot += wTime;
-  LOG_VRB("SD storage time %u ms", wTime); 
-  // whats left or small frame
-  memcpy(iSDbuffer+highPoint, fb->buf + jpegSize - jpegRemain, jpegRemain);
-  highPoint += jpegRemain;
+  if (wTime > maxWriteMs) maxWriteMs = wTime;
+  if (wTime >= SLOW_WRITE_MS) slowWrites++;
+}
+
+static void submitStage(size_t dataLen) {
+  // pass staging buffer to flush task, then wait until next buffer in ring is free
+  uint32_t head = stageHead.load(std::memory_order_relaxed);
+  stageFill[head % stageCount] = dataLen;
+  stageHead.store(++head, std::memory_order_release);
+  xTaskNotifyGive(sdFlushHandle);
+  uint32_t sTime = millis();
+  while (head - stageTail.load(std::memory_order_acquire) >= stageCount) xSemaphoreTake(stageFreeSemaphore, portMAX_DELAY);
+  stallTimeTot += millis() - sTime;
+  stagePtr = stageBuf[head % stageCount];
+  highPoint = 0;
+}
+
+static void drainStage() {
+  // write out partly filled buffer, then wait until all buffers written to SD
+  if (highPoint) submitStage(highPoint);
+  while (stageTail.load(std::memory_order_acquire) != stageHead.load(std::memory_order_relaxed)) 
+    xSemaphoreTake(stageFreeSemaphore, portMAX_DELAY);
+}
+
+static void stageData(const uint8_t* data, size_t dataLen) {
+  // copy data into staging buffer, passing it to flush task each time it is filled
+  // so that all intermediate writes are whole multiples of the sector size
+  while (dataLen >= stageSize - highPoint) {
+    size_t partLen = stageSize - highPoint;
+    memcpy(stagePtr + highPoint, data, partLen);
+    submitStage(stageSize);
+    data += partLen;
+    dataLen -= partLen;
+  }
+  // whats left or small item
+  memcpy(stagePtr + highPoint, data, dataLen);
+  highPoint += dataLen;
+}
+
+static void stageAviSplit(size_t chunkLen, uint16_t chunkAlign = 0) {
+  // write out any index chunk, new RIFF or alignment padding due before next chunk
+  if (prepAviSplit(chunkLen, false, chunkAlign)) {
+    const uint8_t* idxData;
+    size_t idxLen;
+    while ((idxLen = getAviIndex(&idxData))) stageData(idxData, idxLen);
+  }
+}
+
+static void saveAudio(bool allAudio) {
+  // interleave audio recorded since previous call as PCM chunk in avi
+#if INCLUDE_AUDIO
+  size_t audLen = pendingAudio() & ~3; // whole samples, DWORD aligned
+  if (!audLen || (!allAudio && audLen < SAMPLE_RATE * AUDIO_CHUNK_MS / 1000 * sizeof(int16_t))) return;
+  stageAviSplit(audLen + CHUNK_HDR);
+  uint8_t hdrBuff[CHUNK_HDR];
+  memcpy(hdrBuff, wbBuf, 4); 
+  memcpy(hdrBuff+4, &audLen, 4);
+  stageData(hdrBuff, CHUNK_HDR);
+  for (size_t remain = audLen; remain; ) {
+    // samples may wrap round end of ring
+    const uint8_t* samples;
+    size_t partLen = takeAudio(&samples, remain);
+    stageData(samples, partLen);
+    releaseAudio(partLen);
+    remain -= partLen;
+  }
+  buildAviIdx(audLen, false);
+  audSize += audLen;
+  audChunks++;
+#endif
+}
+
+static void stageMp4(uint32_t nextMs = 0) {
+  // write out mp4 fragment of buffered frames
+  const uint8_t* mp4Data;
+  size_t mp4Len;
+  while ((mp4Len = getMp4Data(&mp4Data, nextMs))) stageData(mp4Data, mp4Len);
+}
+
+static size_t saveMp4Frame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs) {
+  // frames are buffered until their fragment is complete
+  if (mp4FragDue(jpegLen)) stageMp4(frameMs);
+  addMp4Frame(jpegBuf, jpegLen, frameMs);
+  // frame may be referenced from jpegBuf, so must be written before return
+  if (mp4FragDue(0)) stageMp4();
+  return jpegLen;
+}
+
+static void saveEmptyFrames(uint32_t frameMs) {
+  // avi has fixed frame rate, so represent gap in capture times by empty frames,
+  // which players show as a repeat of the previous frame, to keep real timing
+  if (!frameSlots) firstFrameMs = frameMs;
+  uint32_t slot = ((uint64_t)(frameMs - firstFrameMs) * aviFPS + 500) / 1000;
+  uint32_t gapSlots = std::min(slot > frameSlots ? slot - frameSlots : 0, (uint32_t)aviFPS * MAX_GAP_SECS);
+  uint8_t hdrBuff[CHUNK_HDR] = {0};
+  memcpy(hdrBuff, dcBuf, 4); 
+  for (uint32_t i = 0; i < gapSlots; i++) {
+    stageAviSplit(CHUNK_HDR);
+    stageData(hdrBuff, CHUNK_HDR);
+    buildAviIdx(0);
+    frameSlots++;
+  }
+}
+
+static size_t saveAviFrame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs) {
+  saveEmptyFrames(frameMs);
+  // align end of jpeg on 4 byte boundary for AVI
+  uint16_t filler = (4 - (jpegLen & 0x00000003)) & 0x00000003; 
+  size_t jpegSize = jpegLen + filler;
+  // write out any index chunk, new RIFF or alignment padding due before this frame
+  stageAviSplit(jpegSize + CHUNK_HDR, jpegSize ? alignLen : 0);
+  // add avi frame header
+  uint8_t hdrBuff[CHUNK_HDR];
+  memcpy(hdrBuff, dcBuf, 4); 
+  memcpy(hdrBuff+4, &jpegSize, 4);
+  stageData(hdrBuff, CHUNK_HDR);
+  // add frame content
+  stageData(jpegBuf, jpegSize);
   
   buildAviIdx(jpegSize); // save avi index for frame
-  vidSize += jpegSize + CHUNK_HDR;
+  frameSlots++;
+  saveAudio(false);
+  return jpegSize + CHUNK_HDR;
+}
+
+static void saveFrame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs) {
+  // save frame on SD card with its capture time, called from SD writer task
+  uint32_t fTime = millis();
+  uint32_t stallStart = stallTimeTot;
+  vidSize += recLoop ? loopFrame(jpegBuf, jpegLen, frameMs) 
+    : recMp4 ? saveMp4Frame(jpegBuf, jpegLen, frameMs) : saveAviFrame(jpegBuf, jpegLen, frameMs);
   frameCnt++; 
-  fTime = millis() - fTime - wTime;
+  fTime = millis() - fTime - (stallTimeTot - stallStart);
   fTimeTot += fTime;
   LOG_VRB("Frame processing time %u ms", fTime);
   LOG_VRB("============================");
-  
-  static uint32_t lastFrameLog = 0;
-  if (frameCnt % 30 == 0) {
-    size_t jpegSize = fb->len + filler;
-    LOG_VRB("Saved frame %u, size: %u bytes", frameCnt, jpegSize);
+  if (frameCnt % 30 == 0) LOG_VRB("Saved frame %u, size: %u bytes", frameCnt, jpegLen);
+}
+
+/**************** SD writer task ************************/
+
+// Frames to be recorded are passed by the capture task to the SD writer task
+// through a single producer / single consumer ring of frame descriptors, so 
+// that SD card latency spikes do not stall frame capture.
+// Capture task only advances sdqHead, SD writer task only advances sdqTail.
+
+static bool queueFrame(frameHandle* fh) {
+  // called from capture task to pass frame to SD writer task
+  uint32_t head = sdqHead.load(std::memory_order_relaxed);
+  uint32_t depth = head - sdqTail.load(std::memory_order_acquire);
+  if (depth >= SDQ_LEN) {
+    // SD writer not keeping up
+    droppedFrames++;
+    LOG_VRB("SD queue full, frame dropped");
+    return false;
+  }
+  sdQueue[head & (SDQ_LEN - 1)] = holdFrame(fh);
+  sdqHead.store(head + 1, std::memory_order_release);
+  if (++depth > sdqHighWater) sdqHighWater = depth;
+  if (depth > sdqWindowHW) sdqWindowHW = depth;
+  xTaskNotifyGive(sdWriterHandle);
+  return true;
+}
+
+static void syncSDwriter() {
+  // wait until SD writer task has saved all queued frames
+  if (sdWriterHandle == NULL) return;
+  sdSyncReq = true;
+  xTaskNotifyGive(sdWriterHandle);
+  xSemaphoreTake(sdSyncSemaphore, portMAX_DELAY);
+}
+
+static void sdWriterTask(void*) {
+  // woken by capture task when frames queued for saving
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // pre-roll frames, and any live frames captured while draining, precede queued frames
+    uint8_t* prBuf;
+    size_t prLen;
+    uint32_t prMs;
+    while (getPreRoll(&prBuf, &prLen, &prMs)) {
+      saveFrame(prBuf, prLen, prMs);
+      freePreRoll();
+    }
+    uint32_t tail = sdqTail.load(std::memory_order_relaxed);
+    while (tail != sdqHead.load(std::memory_order_acquire)) {
+      frameHandle* fh = sdQueue[tail & (SDQ_LEN - 1)];
+      saveFrame(fh->buf, fh->len, fh->ms);
+      releaseFrame(fh);
+      sdqTail.store(++tail, std::memory_order_release); // release slot
+    }
+    if (sdSyncReq) {
+      // queue now empty
+      sdSyncReq = false;
+      xSemaphoreGive(sdSyncSemaphore);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+static void prepSDwriter() {
+  sdSyncSemaphore = xSemaphoreCreateBinary();
+  stageFreeSemaphore = xSemaphoreCreateBinary();
+  sdqHead = sdqTail = 0;
+  LOG_INF("SD writer queue of %u frames", SDQ_LEN);
+}
+
+/**************** SD flush task ************************/
+
+// Recording data is staged by the SD writer task into a ring of buffers,
+// which the flush task writes to SD, so that the next buffer is filled while
+// the previous one is being written, and each SD write is a large transfer.
+// SD writer task only advances stageHead, flush task only advances stageTail.
+
+static void sdFlushTask(void*) {
+  // woken by SD writer task when staging buffer filled
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t tail = stageTail.load(std::memory_order_relaxed);
+    while (tail != stageHead.load(std::memory_order_acquire)) {
+      // CRC is of recording content, so taken before any encryption
+      uint32_t cTimeUs = micros();
+      recCrc = crc32c(recCrc, stageBuf[tail % stageCount], stageFill[tail % stageCount]);
+      crcTimeUs += micros() - cTimeUs;
+      if (recCrypt) encStage(stageBuf[tail % stageCount], stageFill[tail % stageCount]);
+      uint32_t wTime = millis();
+      writeAvi(stageBuf[tail % stageCount], stageFill[tail % stageCount]);
+      wTime = millis() - wTime;
+      wTimeTot += wTime;
+      LOG_VRB("SD storage time %u ms", wTime);
+      if (millis() - syncTime > AVI_SYNC_MS) {
+        // commit file size to SD so that data written so far survives power loss
+        aviFile.flush();
+        if (preallocLen) commitLength(aviFile.position());
+        syncTime = millis();
+      }
+      stageTail.store(++tail, std::memory_order_release); // release buffer
+      xSemaphoreGive(stageFreeSemaphore);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+static void freeStage() {
+  if (stagePooled) for (int i = 0; i < stageCount; i++) free(stageBuf[i]);
+  stageCount = stageSize = 0;
+  stagePooled = false;
+}
+
+static void prepStage() {
+  // allocate staging ring for recording if settings changed, in internal DMA capable
+  // memory so that SD driver transfers directly rather than through a bounce buffer
+  uint8_t wantCount = std::min(std::max(sdBufCount, (uint8_t)2), (uint8_t)STAGE_MAX);
+  uint8_t wantKB = std::min(std::max(sdBufKB * 1024 / RAMSIZE, 1), STAGE_MAX_KB * 1024 / RAMSIZE) * RAMSIZE / 1024;
+  if (stageCount && stageWanted == (wantCount << 8 | wantKB)) {
+    // reuse current buffers
+    stagePtr = stageBuf[stageHead % stageCount];
+    return;
+  }
+  freeStage();
+  stageWanted = wantCount << 8 | wantKB;
+  for (uint8_t count = wantCount, kb = wantKB; !stageCount; ) {
+    int i = 0;
+    for (; i < count; i++) {
+      stageBuf[i] = (uint8_t*)heap_caps_malloc(kb * 1024, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+      if (stageBuf[i] == NULL) break;
+    }
+    if (i == count) {
+      stageCount = count;
+      stageSize = kb * 1024;
+      stagePooled = true;
+    } else {
+      // try smaller buffers, then fewer
+      while (i--) free(stageBuf[i]);
+      if (kb > RAMSIZE / 1024) kb = std::max(kb / 2, RAMSIZE / 1024);
+      else if (count > 2) count--;
+      else break;
+    }
+  }
+  if (!stageCount) {
+    // use static buffer as 2 x RAMSIZE
+    stageBuf[0] = iSDbuffer;
+    stageBuf[1] = iSDbuffer + RAMSIZE;
+    stageCount = 2;
+    stageSize = RAMSIZE;
+  }
+  if (stageWanted != (stageCount << 8 | stageSize / 1024)) 
+    LOG_WRN("Insufficient memory for %u x %uKB SD staging buffers", wantCount, wantKB);
+  LOG_INF("SD staging %u x %uKB buffers", stageCount, stageSize / 1024);
+  // ring is empty, but indexes not reset as flush task may not yet have 
+  // rechecked stageHead after releasing last buffer of previous recording
+  stagePtr = stageBuf[stageHead % stageCount];
+}
+
+static void logStageRates(size_t bytesWritten) {
+  // accumulate SD write rate for current staging setting, and report all settings tried
+  int i = 0;
+  while (i < STAGE_MAX - 1 && stageResults[i].count && 
+    (stageResults[i].count != stageCount || stageResults[i].kb != stageSize / 1024)) i++;
+  stageResult& sr = stageResults[i];
+  if (sr.count != stageCount || sr.kb != stageSize / 1024) sr = {stageCount, (uint8_t)(stageSize / 1024), 0, 0};
+  sr.writeMs += wTimeTot;
+  sr.bytes += bytesWritten;
+  LOG_INF("SD staging %u x %uKB: %0.2f MB/s, writer waited %u ms for buffers", stageCount, stageSize / 1024, 
+    (float)bytesWritten / ONEMEG * 1000 / std::max(wTimeTot, (uint32_t)1), stallTimeTot);
+  char rates[STAGE_MAX * 20] = {0};
+  for (int j = 0; j < STAGE_MAX && stageResults[j].count; j++) 
+    sprintf(rates + strlen(rates), " %ux%uKB %0.2f,", stageResults[j].count, stageResults[j].kb, 
+      (float)stageResults[j].bytes / ONEMEG * 1000 / std::max(stageResults[j].writeMs, (uint32_t)1));
+  rates[strlen(rates) - 1] = 0;
+  LOG_INF("SD staging MB/s by setting:%s", rates);
+}
+
+static void patchRecording(size_t offset, const void* data, size_t dataLen) {
+  // rewrite recorded content at offset that was written as zeros, keeping its CRC and any MAC current
+  recCrc = crc32cPatch(recCrc, contentLen, offset, NULL, data, dataLen);
+  if (recCrypt) encPatch(aviFile, offset, (const uint8_t*)data, dataLen);
+  else {
+    aviFile.seek(offset, SeekSet);
+    writeAvi((const uint8_t*)data, dataLen);
   }
 }
 
@@ -363,36 +797,62 @@ static bool closeAvi() {
   LOG_VRB("Capture time %u, min seconds: %u ", vidDurationSecs, minSeconds);
 
   cTime = millis();
-  // write remaining frame content to SD
-  aviFile.write(iSDbuffer, highPoint); 
-  size_t readLen = 0;
-  bool haveWav = false;
+  const char* tempName = recMp4 ? MP4TEMP : AVITEMP;
+  // wait for SD writer task to save queued frames
+  syncSDwriter();
+  if (recLoop) {
+    // frames already in loop file, so no file to complete
+    loopEnd();
+    cTime = millis() - cTime;
+    LOG_INF("Loop recorded %u frames, %s in %u secs, dropped frames: %u", frameCnt, fmtSize(vidSize), vidDurationSecs, droppedFrames);
+    return true;
+  }
 #if INCLUDE_AUDIO
-  // add wav file if exists
+  // add remaining audio
   finishAudioRecord(true);
-  haveWav = haveWavFile();
-  if (haveWav) {
-    do {
-      readLen = writeWavFile(iSDbuffer, RAMSIZE);
-      aviFile.write(iSDbuffer, readLen);
-    } while (readLen > 0);
-  }
+  saveAudio(true);
 #endif
-  // save avi index
-  finalizeAviIndex(frameCnt);
-  do {
-    readLen = writeAviIndex(iSDbuffer, RAMSIZE);
-    if (readLen) aviFile.write(iSDbuffer, readLen);
-  } while (readLen > 0);
-  // save avi header at start of file
+  bool haveWav = audSize > 0;
   float actualFPS = (1000.0f * (float)frameCnt) / ((float)vidDuration);
   uint8_t actualFPSint = (uint8_t)(lround(actualFPS));  
-  xSemaphoreTake(aviMutex, portMAX_DELAY);
-  buildAviHdr(actualFPSint, fsizePtr, frameCnt);
-  xSemaphoreGive(aviMutex); 
-  aviFile.seek(0, SeekSet); // start of file
-  aviFile.write(aviHeader, AVI_HEADER_LEN); 
+  size_t aviLen = 0; // end of recorded data
+  uint32_t cryptUs = 0;
+  if (recMp4) {
+    // write final fragment, then random access index
+    stageMp4();
+    const uint8_t* mfraData;
+    size_t mfraLen = finishMp4(&mfraData);
+    if (mfraLen) stageData(mfraData, mfraLen);
+    drainStage();
+    aviLen = aviFile.position();
+    contentLen = recCrypt ? aviLen - ENC_HDR_LEN : aviLen;
+  } else {
+    // save avi indexes after remaining frame content, file end padded to whole sectors if aligned
+    size_t readLen = 0;
+    padLen = finalizeAviIndex(frameSlots, false, alignLen ? SD_SECTOR : 0);
+    const uint8_t* idxData;
+    while ((readLen = getAviIndex(&idxData))) stageData(idxData, readLen);
+    drainStage();
+    aviLen = aviFile.position();
+    contentLen = recCrypt ? aviLen - ENC_HDR_LEN : aviLen;
+    // save avi header at start of file
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    buildAviHdr(aviFPS, fsizePtr, frameSlots);
+    xSemaphoreGive(aviMutex); 
+    patchAviSegments(aviFile, false, patchRecording);
+    patchRecording(0, aviHeader, AVI_HEADER_LEN);
+  }
+  if (recCrypt) cryptUs = encEnd(aviFile);
   aviFile.close();
+  if (preallocLen) {
+    // release unused preallocated space, complete file committed in case of restart before truncated
+    commitLength(aviLen);
+    char sdPath[FILE_NAME_LEN];
+    snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", tempName);
+    if (preallocLen > aviLen && truncate(sdPath, aviLen)) LOG_WRN("Failed to truncate %s", tempName);
+    commitEnd();
+  }
+  if (vidDuration > 1000) recByteRate = (uint64_t)aviLen * 1000 / vidDuration; // sizes next preallocation
   LOG_VRB("Final SD storage time %lu ms", millis() - cTime);
   uint32_t hTime = millis();
 #if INCLUDE_MQTT
@@ -405,10 +865,23 @@ static bool closeAvi() {
   if (vidDurationSecs >= minSeconds) {
     // name file to include actual dateTime, FPS, duration, and frame count
     int alen = snprintf(aviFileName, FILE_NAME_LEN - 1, "%s_%s_%u_%lu%s%s.%s", 
-      partName, frameData[fsizePtr].frameSizeStr, actualFPSint, vidDurationSecs, 
-      haveWav ? "_S" : "", haveSrt ? "_M" : "", AVI_EXT); 
+      partName, frameData[fsizePtr].frameSizeStr, recMp4 ? actualFPSint : aviFPS, (unsigned long)vidDurationSecs, 
+      haveWav ? "_S" : "", haveSrt ? "_M" : "", recMp4 ? MP4_EXT : AVI_EXT); 
     if (alen > FILE_NAME_LEN - 1) LOG_WRN("file name truncated");
-    STORAGE.rename(AVITEMP, aviFileName);
+    STORAGE.rename(tempName, aviFileName);
+    // save recording details for listings
+    catEntry ce = {};
+    strncpy(ce.path, aviFileName, CAT_PATH_LEN - 1);
+    catParseName(ce.path, ce); // start time as in name
+    ce.duration = vidDurationSecs;
+    ce.frames = recMp4 ? frameCnt : frameSlots;
+    ce.fileSize = aviLen;
+    ce.motionChecks = motionChecks;
+    ce.motionHits = motionHits;
+    ce.fps = recMp4 ? actualFPSint : aviFPS;
+    ce.flags = (haveWav ? CAT_AUDIO : 0) | (haveSrt ? CAT_TELEM : 0) | (recMp4 ? CAT_MP4 : 0) | (recCrypt ? CAT_ENC : 0) | CAT_CRC;
+    ce.crc = recCrc;
+    catalogAdd(ce);
     LOG_VRB("AVI close time %lu ms", millis() - hTime); 
     cTime = millis() - cTime;
 #if INCLUDE_TELEM
@@ -421,15 +894,31 @@ static bool closeAvi() {
     LOG_INF("Number of frames: %u", frameCnt);
     LOG_INF("Required FPS: %u", FPS);
     LOG_INF("Actual FPS: %0.1f", actualFPS);
+    if (!recMp4) LOG_INF("Empty frames for capture gaps: %u", frameSlots - frameCnt);
     LOG_INF("File size: %s", fmtSize(vidSize));
+    LOG_INF("SD bytes written: %s", fmtSize(aviLen));
+    if (haveWav) LOG_INF("Audio interleaved: %s in %u chunks", fmtSize(audSize), audChunks);
+    if (alignLen) LOG_INF("Alignment padding to %u bytes: %s, %0.1f%% of file", alignLen, fmtSize(padLen), 100.0f * padLen / aviLen);
+    LOG_INF("SD writes: %u, not whole sectors: %u", sdWrites, partWrites);
+    LOG_INF("Worst SD write: %u ms, writes over %u ms: %u", maxWriteMs, SLOW_WRITE_MS, slowWrites);
+    logStageRates(aviLen);
+    LOG_INF("CRC32C: %08x, hashing time %u ms, %0.2f%% of recording time", recCrc, crcTimeUs / 1000, 
+      crcTimeUs / 10.0f / std::max(vidDuration, (uint32_t)1));
+    if (recCrypt) LOG_INF("Encryption time %u ms, %0.2f%% of recording time", cryptUs / 1000,
+      cryptUs / 10.0f / std::max(vidDuration, (uint32_t)1));
+    if (preallocLen) LOG_INF("Preallocated: %s, used %0.1f%%", fmtSize(preallocLen), 100.0f * aviLen / preallocLen);
+    else LOG_INF("File not preallocated");
     if (frameCnt) {
       LOG_INF("Average frame length: %u bytes", vidSize / frameCnt);
       LOG_INF("Average frame monitoring time: %u ms", dTimeTot / frameCnt);
       LOG_INF("Average frame buffering time: %u ms", fTimeTot / frameCnt);
       LOG_INF("Average frame storage time: %u ms", wTimeTot / frameCnt);
     }
-    LOG_INF("Average SD write speed: %u kB/s", ((vidSize / wTimeTot) * 1000) / 1024);
     LOG_INF("File open / completion times: %u ms / %u ms", oTime, cTime);
+    LOG_INF("SD queue high water: %u of %u, dropped frames: %u", sdqHighWater, SDQ_LEN, droppedFrames);
+    LOG_INF("Frame copies avoided: %u, pooled: %u", copiesAvoided, pooledFrames);
+    LOG_INF("Pre-roll frames: %u", preRollFrames);
+    logFrameTiming();
     LOG_INF("Busy: %u%%", std::min(100 * (wTimeTot + fTimeTot + dTimeTot + oTime + cTime) / vidDuration, (uint32_t)100));
     checkMemory();
     LOG_INF("*************************************");
@@ -445,11 +934,11 @@ static bool closeAvi() {
 #if INCLUDE_TGRAM
     if (tgramUse) tgramAlert(aviFileName, "");
 #endif
-    if (!checkFreeStorage()) doRecording = false; 
+    retentionHint(aviLen); // free space checked by retention task
     return true; 
   } else {
     // delete too small files if exist
-    STORAGE.remove(AVITEMP);
+    STORAGE.remove(tempName);
     LOG_INF("Insufficient capture duration: %u secs", vidDurationSecs); 
     return false;
   }
@@ -461,11 +950,12 @@ static bool closeAvi() {
 
 
 
-static uint32_t recordingStartTime = 0; // Tracks when recording started (in milliseconds)
+static recordMachine recMachine = {IDLE, 0, 0, 0}; // state transitions, see recordControl.h
+static uint32_t motionTriggerTime = 0; // when motion started recording
+static bool awaitFirstFrame = false; // no frame at recording resolution yet
 //unsigned long recordStartTime = 0;
 
 const uint32_t MOTION_CHECK_INTERVAL = 5 * 1000; // Check motion every 5 seconds
-static uint32_t lastMotionCheckTime = 0; // Tracks the last time motion was checked
 
 const unsigned long RECORD_DURATION = 60000; // 60 seconds
 const uint32_t MIN_RECORDING_TIME = 60 * 1000;  // 60 seconds minimum recording time (changed from 30)
@@ -481,10 +971,12 @@ unsigned long COOLDOWN_DURATION = 5 * 1000;  // 5 seconds for OV2640
 void startRecording() {
     Serial.println("Starting recording...");
     
-    // Create the folder for today if it doesn't exist
-    char folderName[64];
-    dateFormat(folderName, sizeof(folderName), true);
-    STORAGE.mkdir(folderName);
+    // Create the folder for today if it doesn't exist, unless recording into loop file
+    if (!loopRecord) {
+      char folderName[64];
+      dateFormat(folderName, sizeof(folderName), true);
+      STORAGE.mkdir(folderName);
+    }
     
     // Open the AVI file
     openAvi();
@@ -513,12 +1005,27 @@ void stopRecording() {
 }
 
 static bool setupCameraConfig() {
-  // Before changing camera settings, stop any active timers
-  controlFrameTimer(false);  // Stop frame timer
-
   sensor_t* s = esp_camera_sensor_get();
   if (!s) return false;
 
+  uint8_t recFPS = 10;
+  int recQuality = 10;
+  qosRecordSettings(recFPS, recQuality);
+
+  if (singleMode && s->status.framesize == FRAMESIZE_FHD) {
+    // sensor already at recording resolution, so no reconfiguration needed,
+    // only jpeg quality and frame rate changed
+    LOG_VRB("Camera kept at %s for state: %s", frameData[FRAMESIZE_FHD].frameSizeStr,
+      recordState == RECORDING ? "RECORDING" : recordState == IDLE ? "IDLE" : "COOLDOWN");
+    s->set_quality(s, recordState == RECORDING ? recQuality : 15);
+    uint8_t newFPS = recordState == RECORDING ? recFPS : 10;
+    if (newFPS != FPS) setFPS(newFPS);
+    return true;
+  }
+
+  // Before changing camera settings, stop any active timers
+  controlFrameTimer(false);  // Stop frame timer
+
   if (s->id.PID != OV5640_PID) {
     LOG_WRN("Expected OV5640 camera but found different sensor ID: %d", s->id.PID);
     // Continue anyway - we'll try to configure with OV5640 settings
@@ -529,21 +1036,28 @@ static bool setupCameraConfig() {
           recordState == RECORDING ? "RECORDING" : "COOLDOWN");
   
   // Resolution settings based on recording state
-  if (recordState == IDLE || recordState == COOLDOWN) {
+  if (singleMode) {
+    // Single mode: 1080p throughout, monitoring uses lower quality and motion
+    // detection uses downscaled decode
+    s->set_framesize(s, FRAMESIZE_FHD);
+    FPS = recordState == RECORDING ? recFPS : 10;
+    maxFrameBuffSize = frameData[FRAMESIZE_FHD].frameWidth * frameData[FRAMESIZE_FHD].frameHeight / 4;
+  } else if (recordState == IDLE || recordState == COOLDOWN) {
     // Monitoring mode: 720p at 10FPS
     s->set_framesize(s, FRAMESIZE_HD);
     FPS = 10;
     maxFrameBuffSize = frameData[FRAMESIZE_HD].frameWidth * frameData[FRAMESIZE_HD].frameHeight / 4;
   } else if (recordState == RECORDING) {
     // Recording mode: 1080p at 10FPS (reduced from 15 for stability)
+    // unless adjusted by QoS governor
     s->set_framesize(s, FRAMESIZE_FHD);
-    FPS = 10;
+    FPS = recFPS;
     maxFrameBuffSize = frameData[FRAMESIZE_FHD].frameWidth * frameData[FRAMESIZE_FHD].frameHeight / 4;
   }
   
   // Higher quality for recording, lower for monitoring
   if (recordState == RECORDING) {
-    s->set_quality(s, 10);  // Better quality for recording (lower value = higher quality)
+    s->set_quality(s, recQuality);  // Better quality for recording (lower value = higher quality)
   } else {
     s->set_quality(s, 15);  // Lower quality for monitoring
   }
@@ -563,46 +1077,48 @@ static bool setupCameraConfig() {
   return true;
 }
 
+void setPacing(bool sensorPaced) {
+  // select whether capture task is paced by sensor frames or by frame timer
+  resetDecimator(frameDec);
+  sensorPacing = sensorPaced;
+  // release capture task if waiting on frame timer
+  if (captureHandle != NULL) xTaskNotifyGive(captureHandle);
+}
+
+static camera_fb_t* getPacedFrame() {
+  // wait for next sensor frame due at current FPS, discarding those in between
+  while (sensorPacing) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (fb == NULL) return NULL;
+    int64_t frameUs = (int64_t)fb->timestamp.tv_sec * USECS + fb->timestamp.tv_usec;
+    if (decimateFrame(frameDec, frameUs, USECS / std::max(FPS, (uint8_t)1))) return fb;
+    esp_camera_fb_return(fb);
+  }
+  return NULL;
+}
+
 // Modify processFrame to reduce processing time
-void processFrame() {
+void processFrame(camera_fb_t* fb) {
   static RecordState previousState = IDLE;
-  static uint32_t frameCount = 0;
   
-  // Get a frame from the camera
-  camera_fb_t *fb = esp_camera_fb_get();
+  // frame from the camera, NULL if capture failed
+  uint32_t processUs = micros();
+  frameCaptured(fb != NULL);
   if (!fb) {
     Serial.println("Camera capture failed");
     return;
   }
-  
-  // Only check for motion on every Nth frame when in IDLE state to reduce CPU load
-  if (recordState == IDLE) {
-    frameCount++;
-    if (frameCount % 3 == 0 && useMotion) {  // Check every 3rd frame
-      bool motionDetected = checkMotion(fb, false, false);
-      if (motionDetected) {
-        recordState = RECORDING;
-        recordingStartTime = millis();
-        lastMotionCheckTime = millis();
-        startRecording();
-        Serial.println("Motion detected! Recording started.");
-        previousState = IDLE;  // Force camera reconfiguration
-      }
-    }
-  } 
-  
-
-
-/*void processFrame() {
-  static RecordState previousState = IDLE;
-  static uint32_t frameCount = 0;
-  
-  // Get a frame from the camera
-  camera_fb_t *fb = esp_camera_fb_get();
-  if (!fb) {
-    Serial.println("Camera capture failed");
+  // Publish frame once for all consumers
+  frameHandle* fh = publishFrame(fb);
+  if (fh == NULL) {
+    esp_camera_fb_return(fb);
     return;
   }
+  offerStreamFrame(fh);
+  if (doKeepFrame) {
+    keepFrame(fb);
+    doKeepFrame = false;
+  }
   
   // Check if we need to reconfigure camera for state change
   if (previousState != recordState) {
@@ -611,68 +1127,89 @@ void processFrame() {
     previousState = recordState;
   }
   
-  // Process frame based on current state
-  if (recordState == IDLE) {
-    frameCount++;
-    if (frameCount % 3 == 0 && useMotion) {  // Check every 3rd frame
-      bool motionDetected = checkMotion(fb, false, false);
-      if (motionDetected) {
-        recordState = RECORDING;
-        recordingStartTime = millis();
-        lastMotionCheckTime = millis();
-        startRecording();
-        Serial.println("Motion detected! Recording started.");
-      }
+  // Keep latest frames while not recording for start of next recording
+  if (recordState != RECORDING) storePreRoll(fh);
+  
+  if (recordState == RECORDING) {
+    if (awaitFirstFrame && fh->width == frameData[FRAMESIZE_FHD].frameWidth && fh->height == frameData[FRAMESIZE_FHD].frameHeight) {
+      // first frame captured at recording resolution after motion detected
+      awaitFirstFrame = false;
+      LOG_INF("Time to first recorded frame: %lu ms", millis() - motionTriggerTime);
     }
-  } else if (recordState == RECORDING) {
-    // Save the current frame to the recording
-    saveFrame(fb);
-    
-    // Check if recording time has exceeded minimum
-    if (millis() - recordingStartTime >= MIN_RECORDING_TIME) {
-      // Check for continued motion every MOTION_CHECK_INTERVAL
-      if (millis() - lastMotionCheckTime >= MOTION_CHECK_INTERVAL) {
-        lastMotionCheckTime = millis();
-        bool continuedMotion = checkMotion(fb, true, false);
-        
-        if (continuedMotion) {
-          Serial.println("Motion continues, extending recording");
-        } else if (millis() - recordingStartTime >= MAX_RECORDING_TIME) {
-          // Force stop if we hit maximum time
-          stopRecording();
-          recordState = COOLDOWN;
-          recordingStartTime = millis();
-          Serial.println("Maximum recording time reached, entering cooldown.");
-        } else {
-          stopRecording();
-          recordState = COOLDOWN;
-          recordingStartTime = millis();
-          Serial.println("Recording stopped, entering cooldown.");
-        }
-      }
+    // Pass the current frame to the SD writer task, via pre-roll buffer if still being saved
+    if (!queuePreRoll(fh)) queueFrame(fh);
+  }
+
+  // Process frame based on current state:
+  // when IDLE, only check for motion on every Nth frame to reduce CPU load, N set by QoS governor;
+  // when RECORDING, after minimum recording time, check for continued motion every MOTION_CHECK_INTERVAL
+  const recordTimes recTimes = {MIN_RECORDING_TIME, MAX_RECORDING_TIME, MOTION_CHECK_INTERVAL, 
+    (uint32_t)COOLDOWN_DURATION, motionCadence};
+  uint32_t nowMs = millis();
+  bool checked = motionCheckDue(recMachine, recTimes, nowMs, useMotion && sdTasksReady);
+  bool motion = false;
+  if (checked) {
+    uint32_t checkUs = micros();
+    motion = checkMotion(fb, recordState == RECORDING, false);
+    motionChecked(micros() - checkUs);
+    if (recordState == RECORDING) {
+      motionChecks++;
+      if (motion) motionHits++;
     }
-  } else if (recordState == COOLDOWN) {
-    if (millis() - recordingStartTime >= COOLDOWN_DURATION) {
+  }
+  switch (recordStep(recMachine, recTimes, nowMs, checked, motion)) {
+    case REC_START:
+      recordState = RECORDING;
+      motionTriggerTime = nowMs;
+      awaitFirstFrame = true;
+      startRecording();
+      Serial.println("Motion detected! Recording started.");
+      break;
+    case REC_EXTEND:
+      Serial.println("Motion continues, extending recording");
+      break;
+    case REC_STOP_MAX:
+      // Force stop if we hit maximum time
+      stopRecording();
+      recordState = COOLDOWN;
+      Serial.println("Maximum recording time reached, entering cooldown.");
+      break;
+    case REC_STOP:
+      stopRecording();
+      recordState = COOLDOWN;
+      Serial.println("Recording stopped, entering cooldown.");
+      break;
+    case REC_READY:
       recordState = IDLE;
       Serial.println("Cooldown ended, ready for new motion.");
-    }
+      break;
+    default:
+      break;
   }
 
-  // Release the frame buffer
-  esp_camera_fb_return(fb);
-}*/ // Make sure this closing brace exists
+  // Release the frame, camera buffer returned once consumers have finished
+  endCapture(fh);
+  frameProcessed(micros() - processUs);
+}
 
 
 /********************** plackback AVI as MJPEG ***********************/
 
 static fnameStruct extractMeta(const char* fname) {
-  // extract FPS, duration, and frame count from avi filename
+  // extract FPS, duration, and frame count from catalog, else from avi filename
   fnameStruct fnameMeta;
+  catEntry ce;
+  if (catalogFind(fname, ce) && !(ce.flags & CAT_OTHER)) {
+    fnameMeta.recFPS = ce.fps;
+    fnameMeta.recDuration = ce.duration;
+    fnameMeta.frameCnt = ce.frames;
+    return fnameMeta;
+  }
   char fnameStr[FILE_NAME_LEN];
   strcpy(fnameStr, fname);
   // replace all '_' with space for sscanf
   replaceChar(fnameStr, '_', ' ');
-  int items = sscanf(fnameStr, "%*s %*s %*s %hhu %lu", &fnameMeta.recFPS, &fnameMeta.recDuration);
+  int items = sscanf(fnameStr, "%*s %*s %*s %hhu %" SCNu32, &fnameMeta.recFPS, &fnameMeta.recDuration);
   if (items != 2) LOG_ERR("failed to parse %s, items %u", fname, items);
   return fnameMeta; 
 }
@@ -703,15 +1240,70 @@ static void readSD() {
 }
 
 
-void openSDfile(const char* streamFile) {
-  // open selected file on SD for streaming
+static size_t playStart; // location of first chunk to play in avi
+static size_t playSize; // avi file size
+
+uint32_t parseSeek(const char* query) {
+  // for playback or scrub query value of form [<file>][&frame=<n>|&t=<secs>],
+  // save any file name as selected file, and return frame number to seek to
+  const char* params = strchr(query, '&');
+  size_t nameLen = params == NULL ? strlen(query) : params - query;
+  if (*query == '/' && nameLen < IN_FILE_NAME_LEN) {
+    memcpy(inFileName, query, nameLen);
+    inFileName[nameLen] = 0;
+  }
+  if (params == NULL) return 0;
+  const char* p = strstr(params, "frame=");
+  if (p != NULL) return strtoul(p + 6, NULL, 10);
+  p = strstr(params, "t=");
+  if (p != NULL) return lround(atof(p + 2) * std::max(extractMeta(inFileName).recFPS, (uint8_t)1));
+  return 0;
+}
+
+static bool seekFrame(File& aviFile, uint32_t frameNum, size_t& chunkPos) {
+  // index shared by playback and scrub requests
+  if (aviMutex == NULL) return false;
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  bool found = seekAviFrame(aviFile, frameNum, chunkPos);
+  xSemaphoreGive(aviMutex);
+  return found;
+}
+
+size_t readAviFrame(const char* fname, uint32_t frameNum, uint8_t** jpegBuf) {
+  // read single frame of avi for scrub request, caller to free jpegBuf
+  size_t jpegLen = 0;
+  File aviFile = recOpen(fname);
+  if (!aviFile) return 0;
+  size_t chunkPos;
+  uint32_t chunkSize = 0;
+  uint32_t maxGap = MAX_GAP_SECS * extractMeta(fname).recFPS;
+  while (seekFrame(aviFile, frameNum, chunkPos)) {
+    aviFile.seek(chunkPos + 4, SeekSet);
+    aviFile.read((uint8_t*)&chunkSize, 4);
+    // empty frame repeats previous frame, so use that
+    if (chunkSize || !frameNum-- || !maxGap--) break;
+  }
+  if (chunkSize) {
+    *jpegBuf = (uint8_t*)ps_malloc(chunkSize);
+    if (*jpegBuf != NULL) jpegLen = aviFile.read(*jpegBuf, chunkSize);
+  }
+  aviFile.close();
+  return jpegLen;
+}
+
+void openSDfile(const char* streamFile, uint32_t startFrame) {
+  // open selected file on SD for streaming, from given frame
   if (stopPlayback) LOG_WRN("Playback refused - capture in progress");
   else {
     stopPlaying(); // in case already running
     strcpy(aviFileName, streamFile);
     LOG_INF("Playing %s", aviFileName);
-    playbackFile = STORAGE.open(aviFileName, FILE_READ);
-    playbackFile.seek(AVI_HEADER_LEN, SeekSet); // skip over header
+    playbackFile = recOpen(aviFileName);
+    playSize = playbackFile.size();
+    playStart = findAviMovi(playbackFile);
+    if (startFrame && !seekFrame(playbackFile, startFrame, playStart)) playStart = findAviMovi(playbackFile);
+    else if (startFrame) LOG_INF("Playback from frame %u", startFrame);
+    playbackFile.seek(playStart, SeekSet); // skip over header, or to seeked frame
     playbackFPS(aviFileName);
     isPlaying = true; //playback status
     doPlayback = true; // control playback
@@ -724,7 +1316,10 @@ mjpegStruct getNextFrame(bool firstCall) {
   mjpegStruct mjpegData;
   static bool remainingBuff;
   static bool completedPlayback;
+  static bool firstBuff;
+  static bool skipChunk;
   static size_t buffOffset;
+  static size_t dataPos; // file location of start of buffer
   static uint32_t hTimeTot;
   static uint32_t tTimeTot;
   static uint32_t hTime;
@@ -734,8 +1329,10 @@ mjpegStruct getNextFrame(bool firstCall) {
   if (firstCall) {
     sTime = millis();
     hTime = millis();  
-    remainingBuff = completedPlayback = false;
-    frameCnt = remainingFrame = vidSize = buffOffset = 0;
+    remainingBuff = completedPlayback = skipChunk = false;
+    firstBuff = true;
+    frameCnt = remainingFrame = vidSize = buffOffset = buffLen = 0;
+    dataPos = playStart - CHUNK_HDR; // first buffer loaded after overlap
     wTimeTot = fTimeTot = hTimeTot = tTimeTot = 1; // avoid divide by 0
   }  
   LOG_VRB("http send time %lu ms", millis() - hTime);
@@ -746,42 +1343,43 @@ mjpegStruct getNextFrame(bool firstCall) {
     if (!remainingBuff) {
       // load more data from SD
       mTime = millis();
-      // move final bytes to buffer start in case jpeg marker at end of buffer
-      memcpy(iSDbuffer, iSDbuffer+RAMSIZE, CHUNK_HDR);
+      // move final bytes to buffer start in case chunk header at end of buffer
+      size_t prevLen = buffLen;
+      memcpy(iSDbuffer, iSDbuffer+prevLen, CHUNK_HDR);
       xSemaphoreTake(readSemaphore, portMAX_DELAY); // wait for read from SD card completed
       buffLen = readLen;
       LOG_VRB("SD wait time %lu ms", millis()-mTime);
       wTimeTot += millis()-mTime;
       mTime = millis();  
-      // overlap buffer by CHUNK_HDR to prevent jpeg marker being split between buffers
+      // overlap buffer by CHUNK_HDR to prevent chunk header being split between buffers
       memcpy(iSDbuffer+CHUNK_HDR, iSDbuffer+RAMSIZE+CHUNK_HDR, buffLen); // load new cluster from double buffer
       LOG_VRB("memcpy took %lu ms for %u bytes", millis()-mTime, buffLen);
       fTimeTot += millis() - mTime;
       remainingBuff = true;
-      if (buffOffset > RAMSIZE) buffOffset = 4; // special case, marker overlaps end of buffer 
-      else buffOffset = frameCnt ? 0 : CHUNK_HDR; // only before 1st frame
+      if (firstBuff) buffOffset = CHUNK_HDR; // only before 1st chunk
+      else {
+        // continue from equivalent location in new buffer
+        buffOffset -= prevLen;
+        dataPos += prevLen;
+      }
+      firstBuff = false;
       xTaskNotifyGive(playbackHandle); // wake up task to get next cluster - sets readLen
     }
     mTime = millis();
+    mjpegData.jpegSize = 0; 
     if (!remainingFrame) {
-      // at start of jpeg frame marker
-      uint32_t inVal;
+      // at start of chunk
+      uint32_t inVal, chunkSize;
       memcpy(&inVal, iSDbuffer + buffOffset, 4);
-      if (inVal != dcVal) {
-        // reached end of frames to stream
-        mjpegData.buffLen = buffOffset; // remainder of final jpeg
-        mjpegData.buffOffset = 0; // from start of buff
-        mjpegData.jpegSize = 0; 
-        stopPlayback = completedPlayback = true;
-        return mjpegData;
-      } else {
-        // get jpeg frame size
-        uint32_t jpegSize;
-        memcpy(&jpegSize, iSDbuffer + buffOffset + 4, 4);
-        remainingFrame = jpegSize;
-        vidSize += jpegSize;
+      memcpy(&chunkSize, iSDbuffer + buffOffset + 4, 4);
+      bool atEnd = dataPos + buffOffset + CHUNK_HDR > playSize || buffOffset > buffLen;
+      if (!atEnd && inVal == dcVal) {
+        // get jpeg frame size, empty frame for capture gap just takes its frame interval
+        remainingFrame = chunkSize;
+        skipChunk = false;
+        vidSize += chunkSize;
         buffOffset += CHUNK_HDR; // skip over marker 
-        mjpegData.jpegSize = jpegSize; // signal start of jpeg to webServer
+        mjpegData.jpegSize = chunkSize; // signal start of jpeg to webServer
         mTime = millis();
         // wait on playbackSemaphore for rate control
         xSemaphoreTake(playbackSemaphore, portMAX_DELAY);
@@ -789,14 +1387,31 @@ mjpegStruct getNextFrame(bool firstCall) {
         tTimeTot += millis()-mTime;
         frameCnt++;
         showProgress();
+      } else if (!atEnd && (!memcmp(&inVal, "RIFF", 4) || !memcmp(&inVal, "LIST", 4))) {
+        // descend into list, skipping its type
+        remainingFrame = 4;
+        skipChunk = true;
+        buffOffset += CHUNK_HDR;
+      } else if (!atEnd && (!memcmp(&inVal, "ix00", 4) || !memcmp(&inVal, "ix01", 4) 
+          || !memcmp(&inVal, "idx1", 4) || !memcmp(&inVal, "JUNK", 4) || !memcmp(&inVal, wbBuf, 4))) {
+        // skip over indexes and audio
+        remainingFrame = chunkSize + (chunkSize & 1);
+        skipChunk = true;
+        buffOffset += CHUNK_HDR;
+      } else {
+        // reached end of frames to stream
+        mjpegData.buffLen = buffOffset; // remainder of final jpeg
+        mjpegData.buffOffset = 0; // from start of buff
+        stopPlayback = completedPlayback = true;
+        return mjpegData;
       }
-    } else mjpegData.jpegSize = 0; // within frame,    
+    }
     // determine amount of data to send to webServer
-    if (buffOffset > RAMSIZE) mjpegData.buffLen = 0; // special case 
-    else mjpegData.buffLen = (remainingFrame > buffLen - buffOffset) ? buffLen - buffOffset : remainingFrame;
-    mjpegData.buffOffset = buffOffset; // from here    
-    remainingFrame -= mjpegData.buffLen;
-    buffOffset += mjpegData.buffLen;
+    size_t partLen = (buffOffset >= buffLen) ? 0 : std::min(remainingFrame, buffLen - buffOffset);
+    remainingFrame -= partLen;
+    mjpegData.buffLen = skipChunk ? 0 : partLen;
+    mjpegData.buffOffset = mjpegData.buffLen ? buffOffset : CHUNK_HDR; // nothing to send is not end
+    buffOffset += partLen;
     if (buffOffset >= buffLen) remainingBuff = false;
   } else {
     // finished, close SD file used for streaming
@@ -851,7 +1466,7 @@ void stopPlaying() {
   }
 }
 
-static void playbackTask(void* parameter) {
+static void playbackTask(void*) {
   while (true) {
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     readSD();
@@ -861,21 +1476,44 @@ static void playbackTask(void* parameter) {
 
 /******************* Startup ********************/
 
-static void captureTask(void* parameter) {
-  // woken by frame timer when time to capture frame
+static void captureTask(void*) {
+  // woken by frame timer when time to capture frame, 
+  // or if sensorPacing, by arrival of frame from sensor due at current FPS
   uint32_t ulNotifiedValue;
+  uint32_t backlog, busyStart;
   while (true) {
-    ulNotifiedValue = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-    if (ulNotifiedValue > FB_CNT) ulNotifiedValue = FB_CNT; // prevent too big queue if FPS excessive
-    // may be more than one isr outstanding if the task delayed by SD write or jpeg decode
-    while (ulNotifiedValue-- > 0) processFrame();
+    if (sensorPacing) {
+      camera_fb_t* fb = getPacedFrame();
+      if (fb == NULL && !sensorPacing) continue; // switched to frame timer
+      backlog = 1;
+      busyStart = micros();
+      processFrame(fb);
+    } else {
+      ulNotifiedValue = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      if (sensorPacing) continue; // switched to sensor pacing
+      if (ulNotifiedValue > FB_CNT) {
+        // prevent too big queue if FPS excessive
+        ticksSkipped(ulNotifiedValue - FB_CNT);
+        ulNotifiedValue = FB_CNT;
+      }
+      // may be more than one isr outstanding if the task delayed by SD write or jpeg decode
+      backlog = ulNotifiedValue;
+      busyStart = micros();
+      while (ulNotifiedValue-- > 0) processFrame(esp_camera_fb_get());
+    }
+    qosCapture(micros() - busyStart, backlog);
+    if (qosWindow(recordState == RECORDING, wTimeTot, vidSize, frameCnt, droppedFrames, sdqWindowHW, SDQ_LEN)) sdqWindowHW = 0;
   }
   vTaskDelete(NULL);
 }
 
 static void startSDtasks() {
   // tasks to manage SD card operation
-  xTaskCreate(&captureTask, "captureTask", CAPTURE_STACK_SIZE, NULL, CAPTURE_PRI, &captureHandle);
+  if (captureHandle == NULL) xTaskCreate(&captureTask, "captureTask", CAPTURE_STACK_SIZE, NULL, CAPTURE_PRI, &captureHandle);
+  prepSDwriter();
+  xTaskCreate(&sdWriterTask, "sdWriterTask", SDWRITE_STACK_SIZE, NULL, SDWRITE_PRI, &sdWriterHandle);
+  xTaskCreate(&sdFlushTask, "sdFlushTask", SDFLUSH_STACK_SIZE, NULL, SDFLUSH_PRI, &sdFlushHandle);
+  sdTasksReady = true; // motion can now start recording
   xTaskCreate(&playbackTask, "playbackTask", PLAYBACK_STACK_SIZE, NULL, PLAY_PRI, &playbackHandle);
   // set initial camera framesize and FPS from configs
   sensor_t * s = esp_camera_sensor_get();
@@ -884,6 +1522,192 @@ static void startSDtasks() {
   debugMemory("startSDtasks");
 }
 
+static void trimUncommitted(const char* tempName) {
+  // discard space after data committed to preallocated file, which may hold an earlier recording
+  size_t commitLen;
+  if (!committedLength(tempName, commitLen)) return;
+  File tempFile = STORAGE.open(tempName, FILE_READ);
+  size_t tempSize = tempFile ? tempFile.size() : 0;
+  tempFile.close();
+  if (tempSize > commitLen) {
+    char sdPath[FILE_NAME_LEN];
+    snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", tempName);
+    if (truncate(sdPath, commitLen)) LOG_WRN("Failed to truncate %s", tempName);
+    else LOG_INF("Discarded %s of %s after committed data", fmtSize(tempSize - commitLen), tempName);
+  }
+  commitEnd();
+}
+
+static void recoverAvi(const char* tempName, bool isTL) {
+  // rebuild indexes and header of recording interrupted by restart or power loss,
+  // then save it under a recording name
+  if (!STORAGE.exists(tempName)) return;
+  uint32_t rTime = millis();
+  trimUncommitted(tempName);
+  encState state;
+  File tempFile = recOpen(tempName, "r+", &state);
+  if (!tempFile) return;
+  if (state == ENC_NO_KEY) {
+    // keep for decryption elsewhere, as next recording would overwrite it
+    tempFile.close();
+    char encName[FILE_NAME_LEN];
+    snprintf(encName, FILE_NAME_LEN, "%s.enc", tempName);
+    STORAGE.rename(tempName, encName);
+    LOG_WRN("Unable to recover %s without its passphrase, saved as %s", tempName, encName);
+    return;
+  }
+  size_t tempSize = tempFile.size();
+  uint8_t frameType = fsizePtr;
+  uint32_t frames = recoverAviIndex(tempFile, iSDbuffer, RAMSIZE, frameType, isTL);
+  if (!frames) {
+    tempFile.close();
+    STORAGE.remove(tempName);
+    LOG_WRN("No frames recoverable from %s", tempName);
+    return;
+  }
+  // append indexes after last complete frame
+  finalizeAviIndex(frames, isTL);
+  const uint8_t* idxData;
+  size_t idxLen;
+  while ((idxLen = getAviIndex(&idxData, isTL))) tempFile.write(idxData, idxLen);
+  size_t aviLen = tempFile.position();
+  uint8_t recFPS = isTL ? tlPlaybackFPS : FPS; // actual rate unknown
+  if (!recFPS) recFPS = 1;
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  buildAviHdr(recFPS, frameType, frames, isTL);
+  xSemaphoreGive(aviMutex);
+  patchAviSegments(tempFile, isTL);
+  tempFile.seek(0, SeekSet); // start of file
+  tempFile.write(aviHeader, AVI_HEADER_LEN);
+  time_t recTime = tempFile.getLastWrite();
+  tempFile.close();
+  if (tempSize > aviLen) {
+    // discard partial frame, after any encryption header
+    char sdPath[FILE_NAME_LEN];
+    snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", tempName);
+    if (truncate(sdPath, state == ENC_OPEN ? aviLen + ENC_HDR_LEN : aviLen)) LOG_WRN("Failed to truncate %s", tempName);
+  }
+
+  // name from time of last write if clock was set then
+  if (recTime < 1700000000) recTime = getEpoch();
+  char recName[FILE_NAME_LEN];
+  strftime(partName, sizeof(partName), "/%Y%m%d", localtime(&recTime));
+  STORAGE.mkdir(partName); // make date folder if not present
+  strftime(partName, sizeof(partName), "/%Y%m%d/%Y%m%d_%H%M%S", localtime(&recTime));
+  if (isTL) snprintf(recName, FILE_NAME_LEN - 1, "%s_%s_%u_%lu_T.%s", partName, frameData[frameType].frameSizeStr, 
+    recFPS, (unsigned long)(frames * tlSecsBetweenFrames / 60), AVI_EXT);
+  else snprintf(recName, FILE_NAME_LEN - 1, "%s_%s_%u_%lu.%s", partName, frameData[frameType].frameSizeStr, 
+    recFPS, (unsigned long)(frames / recFPS), AVI_EXT);
+  STORAGE.rename(tempName, recName);
+  catalogAddFile(recName);
+  LOG_ALT("Recovered %u frames from %s as %s in %lu ms", frames, tempName, recName, millis() - rTime);
+}
+
+static void recoverMp4File() {
+  // keep complete fragments of mp4 recording interrupted by restart or power loss,
+  // which is playable without an index, then save it under a recording name
+  if (!STORAGE.exists(MP4TEMP)) return;
+  uint32_t rTime = millis();
+  trimUncommitted(MP4TEMP);
+  encState state;
+  File tempFile = recOpen(MP4TEMP, FILE_READ, &state);
+  if (!tempFile) return;
+  if (state == ENC_NO_KEY) {
+    // keep for decryption elsewhere, as next recording would overwrite it
+    tempFile.close();
+    char encName[FILE_NAME_LEN];
+    snprintf(encName, FILE_NAME_LEN, "%s.enc", MP4TEMP);
+    STORAGE.rename(MP4TEMP, encName);
+    LOG_WRN("Unable to recover %s without its passphrase, saved as %s", MP4TEMP, encName);
+    return;
+  }
+  size_t tempSize = tempFile.size();
+  size_t mp4Len;
+  uint32_t frames = recoverMp4(tempFile, mp4Len);
+  time_t recTime = tempFile.getLastWrite();
+  tempFile.close();
+  if (!frames) {
+    STORAGE.remove(MP4TEMP);
+    LOG_WRN("No frames recoverable from %s", MP4TEMP);
+    return;
+  }
+  if (tempSize > mp4Len) {
+    // discard partial fragment, after any encryption header
+    char sdPath[FILE_NAME_LEN];
+    snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", MP4TEMP);
+    if (truncate(sdPath, state == ENC_OPEN ? mp4Len + ENC_HDR_LEN : mp4Len)) LOG_WRN("Failed to truncate %s", MP4TEMP);
+  }
+
+  // name from time of last write if clock was set then
+  if (recTime < 1700000000) recTime = getEpoch();
+  uint8_t recFPS = FPS ? FPS : 1; // actual rate unknown
+  char recName[FILE_NAME_LEN];
+  strftime(partName, sizeof(partName), "/%Y%m%d", localtime(&recTime));
+  STORAGE.mkdir(partName); // make date folder if not present
+  strftime(partName, sizeof(partName), "/%Y%m%d/%Y%m%d_%H%M%S", localtime(&recTime));
+  snprintf(recName, FILE_NAME_LEN - 1, "%s_%s_%u_%lu.%s", partName, frameData[fsizePtr].frameSizeStr, 
+    recFPS, (unsigned long)(frames / recFPS), MP4_EXT);
+  STORAGE.rename(MP4TEMP, recName);
+  catalogAddFile(recName);
+  LOG_ALT("Recovered %u frames from %s as %s in %lu ms", frames, MP4TEMP, recName, millis() - rTime);
+}
+
+/******************* validation *******************/
+
+#define VALIDATE_BUFF (32 * 1024) // larger buffer reads indexes in fewer SD accesses
+
+static char validatePath[FILE_NAME_LEN];
+static TaskHandle_t validateHandle = NULL;
+
+static void validateFolder(File& dir, uint8_t* buf, uint32_t& checked, uint32_t& failed, bool topLevel) {
+  // check each avi file in folder, and in date folders under top level folder
+  File fh = dir.openNextFile();
+  while (fh) {
+    if (fh.isDirectory()) {
+      if (topLevel) validateFolder(fh, buf, checked, failed, false);
+    } else if (strstr(fh.name(), AVI_EXT) && strcmp(fh.path(), AVITEMP)) {
+      // ignore recording in progress
+      checked++;
+      File rec = recDecrypt(fh);
+      if (!validateAvi(rec, buf, VALIDATE_BUFF)) failed++;
+    }
+    fh.close();
+    fh = dir.openNextFile();
+  }
+}
+
+static void validateTask(void*) {
+  // check structure of avi file, or of all avi files in folder
+  uint32_t vTime = millis();
+  uint32_t checked = 0, failed = 0;
+  uint8_t* buf = psramFound() ? (uint8_t*)ps_malloc(VALIDATE_BUFF) : (uint8_t*)malloc(VALIDATE_BUFF);
+  File root = STORAGE.open(validatePath);
+  if (buf == NULL || !root) LOG_WRN("Unable to validate %s", validatePath);
+  else if (root.isDirectory()) validateFolder(root, buf, checked, failed, true);
+  else {
+    checked++;
+    File rec = recDecrypt(root);
+    if (!validateAvi(rec, buf, VALIDATE_BUFF)) failed++;
+  }
+  if (root) root.close();
+  free(buf);
+  LOG_ALT("Validated %u AVI files in %s, %u invalid, in %lu ms", checked, validatePath, failed, millis() - vTime);
+  validateHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+bool startAviValidation(const char* fileFolder) {
+  // web request to check structure of recording or folder of recordings
+  if (validateHandle != NULL) {
+    LOG_WRN("Unable to validate %s as validation of %s in progress", fileFolder, validatePath);
+    return false;
+  }
+  setFolderName(fileFolder, validatePath);
+  xTaskCreate(&validateTask, "validateTask", VALIDATE_STACK_SIZE, NULL, VALIDATE_PRI, &validateHandle);
+  debugMemory("startAviValidation");
+  return true;
+}
+
 bool prepRecording() {
   // initialisation & prep for AVI capture
   readSemaphore = xSemaphoreCreateBinary();
@@ -892,6 +1716,19 @@ bool prepRecording() {
   motionSemaphore = xSemaphoreCreateBinary();
   for (int i = 0; i < vidStreams; i++) frameSemaphore[i] = xSemaphoreCreateBinary();
   reloadConfigs(); // apply camera config
+  if ((fs::LittleFSFS*)&STORAGE != &LittleFS) {
+    prepRecCrypt(); // before catalog, which reads encrypted recordings
+    prepCatalog();
+    // save any recordings interrupted by restart, which must complete
+    // before startSDtasks() allows motion to reach openAvi()
+    recoverAvi(AVITEMP, false);
+    recoverAvi(TLTEMP, true);
+    recoverMp4File();
+    prepLoop();
+    prepSdBench();
+    prepRetention();
+    prepScrub();
+  }
   startSDtasks();
 #if INCLUDE_TINYML
   LOG_INF("%sUsing TinyML", mlUse ? "" : "Not ");
@@ -172,20 +172,37 @@ bool checkMotion(camera_fb_t* fb, bool motionStatus, bool lightLevelOnly) {
   if (recordState != IDLE && recordState != RECORDING) return false;
   // check difference between current and previous image (subtract background)
   // convert image from JPEG to downscaled RGB888 or 8 bit grayscale bitmap
-  if (fsizePtr > FRAMESIZE_SXGA) return false;
+  // frame size taken from frame itself, as sensor may be at recording resolution
+  uint8_t fsIdx = fsizePtr;
+  for (uint8_t i = 0; i < sizeof(frameData) / sizeof(frameData[0]); i++) {
+    if (frameData[i].frameWidth == fb->width && frameData[i].frameHeight == fb->height) {
+      fsIdx = i;
+      break;
+    }
+  }
+  if (frameData[fsIdx].scaleFactor > JPG_SCALE_8X) return false; // too large for jpeg decoder downscale
   uint32_t dTime = millis();
   uint32_t lux = 0;
   static uint32_t motionCnt = 0;
   uint8_t* jpg_buf = NULL;
   // calculate parameters for sample size
-  uint8_t scaling = frameData[fsizePtr].scaleFactor; 
-  uint16_t reducer = frameData[fsizePtr].sampleRate;
+  uint8_t scaling = frameData[fsIdx].scaleFactor; 
+  uint16_t reducer = frameData[fsIdx].sampleRate;
   uint8_t downsize = pow(2, scaling) * reducer;
-  int sampleWidth = frameData[fsizePtr].frameWidth / downsize;
-  int sampleHeight = frameData[fsizePtr].frameHeight / downsize;
+  int sampleWidth = fb->width / downsize;
+  int sampleHeight = fb->height / downsize;
   stride = (colorDepth == RGB888_BYTES) ? GRAYSCALE_BYTES : RGB888_BYTES; // stride is inverse of colorDepth
 
-  static uint8_t* rgb_buf = (uint8_t*)ps_malloc(sampleWidth * sampleHeight * RGB888_BYTES);
+  // decode buffer enlarged if frame size increases
+  static uint8_t* rgb_buf = NULL;
+  static size_t rgbBufLen = 0;
+  size_t needLen = sampleWidth * sampleHeight * RGB888_BYTES;
+  if (needLen > rgbBufLen) {
+    free(rgb_buf);
+    rgb_buf = (uint8_t*)ps_malloc(needLen);
+    rgbBufLen = rgb_buf == NULL ? 0 : needLen;
+    if (rgb_buf == NULL) return motionStatus;
+  }
   if (!jpg2rgb((uint8_t*)fb->buf, fb->len, rgb_buf, (jpg_scale_t)scaling)) return motionStatus;
   LOG_VRB("JPEG to rescaled %s bitmap conversion %u bytes in %lums", colorDepth == RGB888_BYTES ? "color" : "grayscale", sampleWidth * sampleHeight * colorDepth, millis() - dTime);
   
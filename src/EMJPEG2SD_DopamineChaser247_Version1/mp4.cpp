@@ -0,0 +1,425 @@
+// Fragmented MP4 (MJPEG in fMP4) recording container, alternative to AVI.
+//
+// The init segment (ftyp + moov with empty sample tables and mvex) is written
+// at the start of the file, followed by a moof + mdat fragment for every
+// MP4_FRAG_FRAMES frames, so that the file can be played progressively and
+// remains playable if truncated, as no trailing index is needed.
+// An mfra random access index is appended when the recording is closed,
+// so that players can seek without reading every fragment.
+// Frames for the current fragment are copied into a PSRAM buffer, as the
+// moof listing their sizes has to precede them. Each frame's duration is
+// taken from the capture times of it and the next frame, so that players
+// reproduce the real timing of variable frame rate recordings. The init segment and
+// fragments are passed to the caller for writing through the SD staging buffer.
+// Audio is not included.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define MP4_FRAG_FRAMES 10 // max frames per fragment
+#define MP4_FRAG_BUF ONEMEG // PSRAM buffer for frames of fragment
+#define MP4_TIMESCALE 90000 // media time units per sec
+#define MP4_MAX_FRAGS 4096 // max fragments in mfra index
+#define MP4_INIT_LEN 1024 // space for init segment
+#define MOOF_LEN (8 + 16 + 8 + 20 + 20 + 20 + MP4_FRAG_FRAMES * 8) // max moof size
+#define TRUN_COUNT (8 + 16 + 8 + 20 + 20 + 12) // offset of sample count in moof
+
+struct fragEntry {
+  uint64_t time; // decode time of first frame
+  uint32_t offset; // location of moof
+};
+
+static uint8_t initSeg[MP4_INIT_LEN];
+static uint8_t moofBuf[MOOF_LEN + 8]; // moof and mdat header
+static uint8_t* fragBuf = NULL; // frames of current fragment
+static size_t fragBufSize = 0;
+static size_t fragBytes = 0;
+static uint32_t fragSizes[MP4_FRAG_FRAMES];
+static uint32_t fragMs[MP4_FRAG_FRAMES]; // capture times
+static uint32_t fragDurations[MP4_FRAG_FRAMES];
+static uint8_t fragCnt = 0;
+static const uint8_t* fragData = NULL; // frames to be output
+static bool fragDirect = false; // frame too large for buffer, output from caller's buffer
+static fragEntry* fragIndex = NULL;
+static uint32_t fragNum = 0; // fragments in file
+static uint64_t decodeTime = 0;
+static uint32_t frameDuration = 0; // nominal, from FPS
+static uint32_t lastDuration = 0;
+static size_t mp4Pos = 0; // location in file of next output
+// parts pending output by getMp4Data()
+static const uint8_t* mp4Part[3];
+static size_t mp4PartLen[3];
+static uint8_t mp4PartCnt = 0;
+static uint8_t mp4PartIdx = 0;
+
+/************** box construction, big endian **************/
+
+static inline uint8_t* put8(uint8_t* p, uint8_t val) {
+  *p = val;
+  return p + 1;
+}
+
+static inline uint8_t* put16(uint8_t* p, uint16_t val) {
+  p[0] = val >> 8; p[1] = val;
+  return p + 2;
+}
+
+static inline uint8_t* put32be(uint8_t* p, uint32_t val) {
+  p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+  return p + 4;
+}
+
+static inline uint8_t* put64be(uint8_t* p, uint64_t val) {
+  p = put32be(p, val >> 32);
+  return put32be(p, (uint32_t)val);
+}
+
+static inline uint8_t* putStr(uint8_t* p, const char* str, size_t len) {
+  memcpy(p, str, len);
+  return p + len;
+}
+
+static inline uint8_t* putZero(uint8_t* p, size_t len) {
+  memset(p, 0, len);
+  return p + len;
+}
+
+static uint8_t* openBox(uint8_t* p, const char* type) {
+  // box size filled in by closeBox()
+  put32be(p, 0);
+  memcpy(p + 4, type, 4);
+  return p + 8;
+}
+
+static inline uint8_t* openFullBox(uint8_t* p, const char* type, uint8_t version, uint32_t flags) {
+  p = openBox(p, type);
+  return put32be(p, (version << 24) | flags);
+}
+
+static inline void closeBox(uint8_t* box, uint8_t* end) {
+  put32be(box, end - box);
+}
+
+static uint8_t* putMatrix(uint8_t* p) {
+  // unity matrix
+  const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+  for (int i = 0; i < 9; i++) p = put32be(p, matrix[i]);
+  return p;
+}
+
+static size_t buildInitSeg(uint16_t width, uint16_t height) {
+  // ftyp and moov for single MJPEG video track, samples described by fragments
+  uint8_t* p = initSeg;
+  uint8_t* ftyp = p;
+  p = openBox(p, "ftyp");
+  p = putStr(p, "isom", 4);
+  p = put32be(p, 0x200);
+  p = putStr(p, "isomiso5mp41", 12);
+  closeBox(ftyp, p);
+
+  uint8_t* moov = p;
+  p = openBox(p, "moov");
+  uint8_t* mvhd = p;
+  p = openFullBox(p, "mvhd", 0, 0);
+  p = putZero(p, 8); // creation & modification time
+  p = put32be(p, MP4_TIMESCALE);
+  p = put32be(p, 0); // duration given by fragments
+  p = put32be(p, 0x00010000); // rate
+  p = put16(p, 0x0100); // volume
+  p = putZero(p, 10);
+  p = putMatrix(p);
+  p = putZero(p, 24);
+  p = put32be(p, 2); // next track id
+  closeBox(mvhd, p);
+
+  uint8_t* trak = p;
+  p = openBox(p, "trak");
+  uint8_t* tkhd = p;
+  p = openFullBox(p, "tkhd", 0, 3); // enabled, in movie
+  p = putZero(p, 8); // creation & modification time
+  p = put32be(p, 1); // track id
+  p = putZero(p, 4);
+  p = put32be(p, 0); // duration
+  p = putZero(p, 8);
+  p = putZero(p, 8); // layer, alternate group, volume, reserved
+  p = putMatrix(p);
+  p = put32be(p, width << 16);
+  p = put32be(p, height << 16);
+  closeBox(tkhd, p);
+
+  uint8_t* mdia = p;
+  p = openBox(p, "mdia");
+  uint8_t* mdhd = p;
+  p = openFullBox(p, "mdhd", 0, 0);
+  p = putZero(p, 8);
+  p = put32be(p, MP4_TIMESCALE);
+  p = put32be(p, 0);
+  p = put16(p, 0x55C4); // language und
+  p = put16(p, 0);
+  closeBox(mdhd, p);
+  uint8_t* hdlr = p;
+  p = openFullBox(p, "hdlr", 0, 0);
+  p = put32be(p, 0);
+  p = putStr(p, "vide", 4);
+  p = putZero(p, 12);
+  p = putStr(p, "VideoHandler", 13);
+  closeBox(hdlr, p);
+
+  uint8_t* minf = p;
+  p = openBox(p, "minf");
+  uint8_t* vmhd = p;
+  p = openFullBox(p, "vmhd", 0, 1);
+  p = putZero(p, 8); // graphics mode, opcolor
+  closeBox(vmhd, p);
+  uint8_t* dinf = p;
+  p = openBox(p, "dinf");
+  uint8_t* dref = p;
+  p = openFullBox(p, "dref", 0, 0);
+  p = put32be(p, 1);
+  uint8_t* url = p;
+  p = openFullBox(p, "url ", 0, 1); // data in same file
+  closeBox(url, p);
+  closeBox(dref, p);
+  closeBox(dinf, p);
+
+  uint8_t* stbl = p;
+  p = openBox(p, "stbl");
+  uint8_t* stsd = p;
+  p = openFullBox(p, "stsd", 0, 0);
+  p = put32be(p, 1);
+  uint8_t* jpeg = p;
+  p = openBox(p, "jpeg"); // visual sample entry for MJPEG
+  p = putZero(p, 6);
+  p = put16(p, 1); // data reference index
+  p = putZero(p, 16);
+  p = put16(p, width);
+  p = put16(p, height);
+  p = put32be(p, 0x00480000); // 72 dpi
+  p = put32be(p, 0x00480000);
+  p = put32be(p, 0);
+  p = put16(p, 1); // frames per sample
+  p = put8(p, 10);
+  p = putStr(p, "Photo JPEG", 10);
+  p = putZero(p, 21); // compressor name
+  p = put16(p, 0x18); // depth
+  p = put16(p, 0xFFFF);
+  closeBox(jpeg, p);
+  closeBox(stsd, p);
+  const char* emptyTables[3] = {"stts", "stsc", "stco"};
+  for (auto table : emptyTables) {
+    uint8_t* box = p;
+    p = openFullBox(p, table, 0, 0);
+    p = put32be(p, 0);
+    closeBox(box, p);
+  }
+  uint8_t* stsz = p;
+  p = openFullBox(p, "stsz", 0, 0);
+  p = putZero(p, 8);
+  closeBox(stsz, p);
+  closeBox(stbl, p);
+  closeBox(minf, p);
+  closeBox(mdia, p);
+  closeBox(trak, p);
+
+  uint8_t* mvex = p;
+  p = openBox(p, "mvex");
+  uint8_t* trex = p;
+  p = openFullBox(p, "trex", 0, 0);
+  p = put32be(p, 1); // track id
+  p = put32be(p, 1); // sample description index
+  p = put32be(p, frameDuration);
+  p = put32be(p, 0); // sample size
+  p = put32be(p, 0); // sample flags, sync sample
+  closeBox(trex, p);
+  closeBox(mvex, p);
+  closeBox(moov, p);
+  return p - initSeg;
+}
+
+static size_t buildMoof() {
+  // moof for frames in buffer, followed by mdat header
+  uint8_t* p = moofBuf;
+  uint8_t* moof = p;
+  p = openBox(p, "moof");
+  uint8_t* mfhd = p;
+  p = openFullBox(p, "mfhd", 0, 0);
+  p = put32be(p, fragNum + 1); // sequence number
+  closeBox(mfhd, p);
+  uint8_t* traf = p;
+  p = openBox(p, "traf");
+  uint8_t* tfhd = p;
+  p = openFullBox(p, "tfhd", 0, 0x020008); // default base is moof, default duration
+  p = put32be(p, 1); // track id
+  p = put32be(p, frameDuration);
+  closeBox(tfhd, p);
+  uint8_t* tfdt = p;
+  p = openFullBox(p, "tfdt", 1, 0);
+  p = put64be(p, decodeTime);
+  closeBox(tfdt, p);
+  uint8_t* trun = p;
+  p = openFullBox(p, "trun", 0, 0x000301); // data offset, sample durations and sizes
+  p = put32be(p, fragCnt);
+  uint8_t* dataOffset = p;
+  p = put32be(p, 0);
+  for (int i = 0; i < fragCnt; i++) {
+    p = put32be(p, fragDurations[i]);
+    p = put32be(p, fragSizes[i]);
+  }
+  closeBox(trun, p);
+  closeBox(traf, p);
+  closeBox(moof, p);
+  put32be(dataOffset, p - moof + 8); // frames follow mdat header
+  put32be(p, fragBytes + 8);
+  p = putStr(p + 4, "mdat", 4);
+  return p - moofBuf;
+}
+
+static void addMp4Part(const uint8_t* data, size_t dataLen) {
+  mp4Part[mp4PartCnt] = data;
+  mp4PartLen[mp4PartCnt++] = dataLen;
+  mp4Pos += dataLen;
+}
+
+/************** recording **************/
+
+size_t prepMp4(uint16_t width, uint16_t height, uint8_t FPS, const uint8_t** initData) {
+  // start mp4 recording, returns init segment to be written at start of file
+  if (fragBuf == NULL) {
+    fragBufSize = std::max((size_t)MP4_FRAG_BUF, maxFrameBuffSize);
+    fragBuf = (uint8_t*)ps_malloc(fragBufSize);
+    if (fragBuf == NULL) fragBufSize = 0;
+  }
+  if (fragIndex == NULL) fragIndex = (fragEntry*)ps_malloc(MP4_MAX_FRAGS * sizeof(fragEntry));
+  frameDuration = lastDuration = MP4_TIMESCALE / (FPS ? FPS : 1);
+  fragBytes = fragCnt = fragNum = 0;
+  fragDirect = false;
+  decodeTime = 0;
+  mp4PartCnt = mp4PartIdx = 0;
+  size_t initLen = buildInitSeg(width, height);
+  mp4Pos = initLen;
+  *initData = initSeg;
+  return initLen;
+}
+
+bool mp4FragDue(size_t jpegLen) {
+  // whether buffered frames to be output as fragment before frame of given size is added,
+  // or after a frame is added if jpegLen is 0, which is only needed if the frame was not copied.
+  // Otherwise a full fragment is held until the next frame, whose capture time completes
+  // the duration of the last frame
+  if (!fragCnt) return false;
+  if (!jpegLen) return fragDirect;
+  return fragCnt >= MP4_FRAG_FRAMES || fragDirect || fragBytes + jpegLen > fragBufSize;
+}
+
+void addMp4Frame(const uint8_t* jpegBuf, size_t jpegLen, uint32_t frameMs) {
+  // add frame to current fragment, called after any due fragment output
+  if (!fragCnt) fragData = fragBuf;
+  if (fragBytes + jpegLen > fragBufSize) {
+    // only happens for first frame of fragment, so output it directly from callers buffer
+    fragData = jpegBuf;
+    fragDirect = true;
+  } else memcpy(fragBuf + fragBytes, jpegBuf, jpegLen);
+  fragMs[fragCnt] = frameMs;
+  fragSizes[fragCnt++] = jpegLen;
+  fragBytes += jpegLen;
+}
+
+static void closeFragment(uint32_t nextMs) {
+  // queue moof, mdat header and frames of fragment for output,
+  // with last frame duration from capture time of next frame if known
+  if (!fragCnt) return;
+  uint64_t fragDuration = 0;
+  for (int i = 0; i < fragCnt; i++) {
+    uint32_t endMs = i + 1 < fragCnt ? fragMs[i + 1] : nextMs;
+    if (endMs) lastDuration = std::max(endMs - fragMs[i], (uint32_t)1) * (MP4_TIMESCALE / 1000);
+    fragDurations[i] = lastDuration;
+    fragDuration += lastDuration;
+  }
+  if (fragIndex != NULL && fragNum < MP4_MAX_FRAGS) fragIndex[fragNum] = {decodeTime, (uint32_t)mp4Pos};
+  size_t moofLen = buildMoof();
+  addMp4Part(moofBuf, moofLen);
+  addMp4Part(fragData, fragBytes);
+  decodeTime += fragDuration;
+  fragNum++;
+  fragBytes = fragCnt = 0;
+  fragDirect = false;
+}
+
+size_t getMp4Data(const uint8_t** mp4Data, uint32_t nextMs) {
+  // supply fragment for output, called repeatedly until return 0,
+  // when mp4FragDue() is true, giving capture time of next frame, or at end of recording
+  if (!mp4PartCnt) closeFragment(nextMs);
+  if (mp4PartIdx < mp4PartCnt) {
+    *mp4Data = mp4Part[mp4PartIdx];
+    return mp4PartLen[mp4PartIdx++];
+  }
+  return mp4PartCnt = mp4PartIdx = 0;
+}
+
+size_t finishMp4(const uint8_t** mfraData) {
+  // random access index, to be written at end of file after final fragment
+  uint32_t entries = std::min(fragNum, (uint32_t)MP4_MAX_FRAGS);
+  size_t mfraLen = 8 + (12 + 12 + entries * 19) + 16;
+  uint8_t* mfraBuf = fragBuf; // no longer needed for frames
+  if (fragIndex == NULL || mfraLen > fragBufSize) return 0;
+  uint8_t* p = mfraBuf;
+  uint8_t* mfra = p;
+  p = openBox(p, "mfra");
+  uint8_t* tfra = p;
+  p = openFullBox(p, "tfra", 1, 0);
+  p = put32be(p, 1); // track id
+  p = put32be(p, 0); // 1 byte traf, trun and sample numbers
+  p = put32be(p, entries);
+  for (uint32_t i = 0; i < entries; i++) {
+    p = put64be(p, fragIndex[i].time);
+    p = put64be(p, fragIndex[i].offset);
+    p = put8(p, 1);
+    p = put8(p, 1);
+    p = put8(p, 1);
+  }
+  closeBox(tfra, p);
+  uint8_t* mfro = p;
+  p = openFullBox(p, "mfro", 0, 0);
+  p = put32be(p, mfraLen);
+  closeBox(mfro, p);
+  closeBox(mfra, p);
+  *mfraData = mfraBuf;
+  LOG_VRB("MP4 of %u fragments", fragNum);
+  return p - mfraBuf;
+}
+
+/************** recovery **************/
+
+static inline uint32_t get32be(const uint8_t* p) {
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+uint32_t recoverMp4(File& mp4File, size_t& validLen) {
+  // walk fragments of mp4 file whose recording was interrupted, returns
+  // number of frames in complete fragments, and length of file containing them
+  size_t fileSize = mp4File.size();
+  size_t pos = 0;
+  uint32_t frames = 0, moofFrames = 0;
+  uint8_t boxHdr[TRUN_COUNT + 4];
+  validLen = 0;
+  while (pos + 8 <= fileSize) {
+    mp4File.seek(pos, SeekSet);
+    size_t hdrLen = mp4File.read(boxHdr, sizeof(boxHdr));
+    if (hdrLen < 8) break;
+    uint32_t boxSize = get32be(boxHdr);
+    if (boxSize < 8 || boxSize > fileSize - pos) break; // incomplete
+    if (!memcmp(boxHdr + 4, "moof", 4)) {
+      if (hdrLen < sizeof(boxHdr) || memcmp(boxHdr + TRUN_COUNT - 8, "trun", 4)) break;
+      moofFrames = get32be(boxHdr + TRUN_COUNT);
+    } else if (!memcmp(boxHdr + 4, "mdat", 4)) {
+      // fragment complete
+      frames += moofFrames;
+      moofFrames = 0;
+      validLen = pos + boxSize;
+    } else if (!memcmp(boxHdr + 4, "moov", 4) || !memcmp(boxHdr + 4, "mfra", 4)) validLen = pos + boxSize;
+    else if (memcmp(boxHdr + 4, "ftyp", 4)) break; // not expected
+    pos += boxSize;
+  }
+  return frames;
+}
@@ -0,0 +1,48 @@
+// Frame decimator for sensor paced capture, see captureTask() in mjpeg2sd.cpp
+// Selects from the frames output by the sensor, using their timestamps,
+// those that give the most even cadence at the target FPS.
+// Kept free of Arduino / ESP dependencies so that it can be exercised
+// on a host against synthetic timestamp streams.
+//
+// s60sc 2025
+
+#pragma once
+#include <stdint.h>
+
+#define PACE_RESYNC 2 // periods late before cadence restarted from current frame
+
+struct frameDecimator {
+  int64_t nextDueUs; // target time of next frame to keep
+  int64_t lastUs; // timestamp of previous sensor frame
+  uint32_t srcPeriodUs; // smoothed interval between sensor frames
+  bool started;
+};
+
+static inline void resetDecimator(frameDecimator& dec) {
+  dec.nextDueUs = dec.lastUs = 0;
+  dec.srcPeriodUs = 0;
+  dec.started = false;
+}
+
+static inline bool decimateFrame(frameDecimator& dec, int64_t frameUs, uint32_t periodUs) {
+  // returns true if sensor frame with given timestamp is to be kept
+  // for target frame interval periodUs
+  if (!dec.started || frameUs <= dec.lastUs) {
+    // first frame, or timestamps restarted
+    dec.started = true;
+    dec.srcPeriodUs = 0;
+    dec.lastUs = frameUs;
+    dec.nextDueUs = frameUs + periodUs;
+    return true;
+  }
+  uint32_t intervalUs = (uint32_t)(frameUs - dec.lastUs);
+  dec.lastUs = frameUs;
+  // smoothed sensor interval, ignoring gaps from frames not output
+  if (!dec.srcPeriodUs) dec.srcPeriodUs = intervalUs;
+  else if (intervalUs < dec.srcPeriodUs * 2) dec.srcPeriodUs = (dec.srcPeriodUs * 7 + intervalUs) / 8;
+  // keep frame nearest to due time, ie within half a sensor interval
+  if (frameUs + dec.srcPeriodUs / 2 < dec.nextDueUs) return false;
+  if (frameUs - dec.nextDueUs > (int64_t)periodUs * PACE_RESYNC) dec.nextDueUs = frameUs; // too far behind
+  dec.nextDueUs += periodUs;
+  return true;
+}
@@ -98,8 +98,9 @@ static void getPhoto() {
     // save file to SD
     pFile.write((uint8_t*)alertBuffer, alertBufferSize);
     pFile.close();
+    catalogAddFile(pName);
     LOG_INF("Photo %u of % u saved in %s", photosDone + 1, numberOfPhotos, pName);
-    alertBufferSize = 0;
+    releaseAlert();
   } else LOG_WRN("Failed to get photo");
   setLamp(0);
 }
@@ -0,0 +1,230 @@
+// Pre-event (pre-roll) buffer, so that recordings include the seconds
+// before motion was confirmed.
+//
+// While not recording, the capture task copies each frame into a PSRAM
+// ring holding the last preRollSecs of frames, the oldest being discarded
+// as space is needed. The ring size is derived from the frame size so
+// memory use is bounded, and it is capped to a share of free PSRAM.
+// When a recording starts, the SD writer task drains the ring into the
+// new AVI ahead of live frames. Live frames captured while the ring is
+// being drained are appended to the ring so that frame order is kept,
+// after which live frames are passed through the SD writer queue as usual.
+//
+// Pre-roll is only kept if singleMode and doRecording are set, as otherwise
+// frames captured while idle are at a lower resolution than the recording,
+// or are not recorded. The rings are freed when either is cleared, and the
+// frame ring is resized when the frame size changes.
+//
+// If INCLUDE_AUDIO is set, a ring of the last preRollSecs of microphone
+// samples is also kept, and is queued ahead of live samples at recording start.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define PREROLL_RATIO 16 // assumed average pixels per jpeg byte
+#define PREROLL_PSRAM 3 // max 1/n of free PSRAM to use for ring
+#define PREROLL_WRAP 0xFFFFFFFF // marker for unused space at end of ring
+
+int preRollSecs = 3; // secs of frames to keep before motion, 0 to disable
+uint32_t preRollFrames = 0; // pre-roll frames written to current recording
+
+struct preRollHdr {
+  uint32_t len; // jpeg length
+  uint32_t ms; // capture time
+};
+
+static uint8_t* preRollBuf = NULL;
+static size_t preRollSize = 0;
+static size_t prHead = 0; // next entry written here
+static size_t prTail = 0; // oldest entry
+static uint32_t prCount = 0; // entries in ring
+static int prSecs = 0; // preRollSecs when ring allocated
+static size_t prPixels = 0; // frame size when ring allocated, 0 if not wanted
+static bool draining = false; // SD writer draining ring to AVI
+static SemaphoreHandle_t preRollMutex = NULL;
+
+static inline size_t entrySize(size_t jpegLen) {
+  // entry is header plus jpeg padded to 4 byte boundary for AVI filler
+  return sizeof(preRollHdr) + ((jpegLen + 3) & ~3);
+}
+
+static inline void checkWrap(size_t& offset) {
+  // move offset to start of ring if no entry can start here
+  if (preRollSize - offset < sizeof(preRollHdr)
+    || ((preRollHdr*)(preRollBuf + offset))->len == PREROLL_WRAP) offset = 0;
+}
+
+static void dropOldest() {
+  // discard oldest entry in ring
+  checkWrap(prTail);
+  prTail += entrySize(((preRollHdr*)(preRollBuf + prTail))->len);
+  if (--prCount == 0) prHead = prTail = 0;
+}
+
+static bool findSpace(size_t needLen, bool canDrop) {
+  // locate contiguous space at head for new entry, dropping oldest entries if allowed
+  if (needLen > preRollSize) return false;
+  while (true) {
+    if (!prCount) prHead = prTail = 0;
+    if (prHead >= prTail) {
+      // free space is at end of ring and before tail
+      if (preRollSize - prHead >= needLen) return true;
+      if (prTail > needLen) {
+        // insufficient space at end so wrap to start
+        if (preRollSize - prHead >= sizeof(preRollHdr)) ((preRollHdr*)(preRollBuf + prHead))->len = PREROLL_WRAP;
+        prHead = 0;
+        return true;
+      }
+    } else if (prTail - prHead > needLen) return true; // head must not catch up with tail
+    if (!canDrop) return false;
+    dropOldest();
+  }
+}
+
+static void prepPreRoll(size_t framePixels) {
+  // (re)allocate ring in PSRAM, or free it if framePixels is 0,
+  // called on capture task when not recording
+  if (preRollMutex == NULL) preRollMutex = xSemaphoreCreateMutex();
+  prSecs = preRollSecs;
+  prPixels = framePixels;
+  free(preRollBuf);
+  preRollBuf = NULL;
+  preRollSize = prHead = prTail = prCount = 0;
+  if (prSecs > 0 && framePixels) {
+    size_t wantSize = (size_t)prSecs * FPS * framePixels / PREROLL_RATIO;
+    preRollSize = std::min(wantSize, (size_t)ESP.getFreePsram() / PREROLL_PSRAM);
+    preRollBuf = (uint8_t*)ps_malloc(preRollSize);
+    if (preRollBuf == NULL) {
+      LOG_WRN("Failed to allocate %s for pre-roll buffer", fmtSize(preRollSize));
+      preRollSize = 0;
+    } else LOG_INF("Pre-roll buffer of %s for %u secs", fmtSize(preRollSize), prSecs);
+  }
+}
+
+static bool addPreRoll(frameHandle* fh, bool canDrop) {
+  // copy frame into ring
+  size_t needLen = entrySize(fh->len);
+  if (!findSpace(needLen, canDrop)) return false;
+  preRollHdr* hdr = (preRollHdr*)(preRollBuf + prHead);
+  hdr->len = fh->len;
+  hdr->ms = fh->ms;
+  uint8_t* jpeg = preRollBuf + prHead + sizeof(preRollHdr);
+  memcpy(jpeg, fh->buf, fh->len);
+  memset(jpeg + fh->len, 0, needLen - sizeof(preRollHdr) - fh->len); // filler
+  prHead += needLen;
+  prCount++;
+  return true;
+}
+
+void storePreRoll(frameHandle* fh) {
+  // called by capture task when not recording, to keep latest frames
+  // idle frames are only at recording resolution in singleMode
+  size_t framePixels = doRecording && singleMode ? (size_t)fh->width * fh->height : 0;
+  if (!draining && (prSecs != preRollSecs || prPixels != framePixels)) prepPreRoll(framePixels);
+  if (preRollBuf == NULL) return;
+  xSemaphoreTake(preRollMutex, portMAX_DELAY);
+  addPreRoll(fh, true);
+  xSemaphoreGive(preRollMutex);
+}
+
+uint32_t startPreRoll() {
+  // called by openAvi() to start draining ring into AVI,
+  // returns time span of pre-roll frames in ms
+  uint32_t spanMs = 0;
+  preRollFrames = prCount;
+  if (prCount) {
+    size_t oldest = prTail;
+    checkWrap(oldest);
+    spanMs = millis() - ((preRollHdr*)(preRollBuf + oldest))->ms;
+    draining = true;
+    LOG_VRB("Pre-roll of %u frames over %u ms", prCount, spanMs);
+  }
+  return spanMs;
+}
+
+bool queuePreRoll(frameHandle* fh) {
+  // called by capture task during recording, frame is added to ring if still draining
+  // so that it is saved after the pre-roll frames, else returns false
+  if (!draining) return false;
+  xSemaphoreTake(preRollMutex, portMAX_DELAY);
+  bool isDraining = draining;
+  if (isDraining && !addPreRoll(fh, false)) {
+    // ring full as SD writer not keeping up
+    droppedFrames++;
+    LOG_VRB("Pre-roll buffer full, frame dropped");
+  }
+  xSemaphoreGive(preRollMutex);
+  return isDraining;
+}
+
+bool getPreRoll(uint8_t** jpegBuf, size_t* jpegLen, uint32_t* frameMs) {
+  // called by SD writer task to obtain oldest frame in ring to save,
+  // returns false once ring emptied, which ends draining
+  if (!draining) return false;
+  xSemaphoreTake(preRollMutex, portMAX_DELAY);
+  if (prCount) {
+    checkWrap(prTail);
+    preRollHdr* hdr = (preRollHdr*)(preRollBuf + prTail);
+    *jpegBuf = preRollBuf + prTail + sizeof(preRollHdr);
+    *jpegLen = hdr->len;
+    *frameMs = hdr->ms;
+  } else draining = false;
+  xSemaphoreGive(preRollMutex);
+  return draining;
+}
+
+void freePreRoll() {
+  // called by SD writer task once frame from getPreRoll() has been saved
+  xSemaphoreTake(preRollMutex, portMAX_DELAY);
+  dropOldest();
+  xSemaphoreGive(preRollMutex);
+}
+
+#if INCLUDE_AUDIO
+
+static uint8_t* audioRing = NULL;
+static size_t audioRingSize = 0;
+static size_t audioRingHead = 0;
+static size_t audioRingFill = 0;
+
+void storeAudioPreRoll(const uint8_t* samples, size_t sampleLen) {
+  // called by audio task when not recording, to keep latest mic samples
+  // while frame pre-roll is kept
+  size_t wantSize = preRollSecs > 0 && doRecording && singleMode ? (size_t)preRollSecs * SAMPLE_RATE * sizeof(int16_t) : 0;
+  if (audioRingSize != wantSize) {
+    free(audioRing);
+    audioRing = wantSize ? (uint8_t*)ps_malloc(wantSize) : NULL;
+    audioRingSize = audioRing == NULL ? 0 : wantSize;
+    audioRingHead = audioRingFill = 0;
+  }
+  if (audioRing == NULL) return;
+  while (sampleLen) {
+    size_t partLen = std::min(sampleLen, audioRingSize - audioRingHead);
+    memcpy(audioRing + audioRingHead, samples, partLen);
+    audioRingHead = (audioRingHead + partLen) % audioRingSize;
+    audioRingFill = std::min(audioRingFill + partLen, audioRingSize);
+    samples += partLen;
+    sampleLen -= partLen;
+  }
+}
+
+size_t writeAudioPreRoll(uint32_t spanMs) {
+  // called by audio task at recording start, to queue the mic samples
+  // covering the last spanMs for the recording, returns bytes queued
+  if (!audioRingFill) return 0;
+  size_t wantLen = ((uint64_t)spanMs * SAMPLE_RATE / 1000) * sizeof(int16_t);
+  size_t outLen = std::min(wantLen, audioRingFill);
+  size_t readPos = (audioRingHead + audioRingSize - outLen) % audioRingSize;
+  size_t remain = outLen;
+  while (remain) {
+    size_t partLen = std::min(remain, audioRingSize - readPos);
+    queueAudio(audioRing + readPos, partLen);
+    readPos = (readPos + partLen) % audioRingSize;
+    remain -= partLen;
+  }
+  audioRingFill = 0;
+  return outLen;
+}
+
+#endif
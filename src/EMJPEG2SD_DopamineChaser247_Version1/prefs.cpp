@@ -194,6 +194,9 @@ static bool savePrefs(bool retain = true) {
 #endif
 #if INCLUDE_RTSP
   prefs.putString("RTSP_Pass", RTSP_Pass);
+#endif
+#ifdef ISCAM
+  prefs.putString("Rec_Pass", Rec_Pass);
 #endif
   prefs.end();
   LOG_INF("Saved preferences");
@@ -227,6 +230,9 @@ static bool loadPrefs() {
 #endif
 #if INCLUDE_RTSP
   prefs.getString("RTSP_Pass", RTSP_Pass, MAX_PWD_LEN);
+#endif
+#ifdef ISCAM
+  prefs.getString("Rec_Pass", Rec_Pass, MAX_PWD_LEN);
 #endif
   prefs.end();
   return true;
@@ -320,6 +326,9 @@ void updateStatus(const char* variable, const char* _value, bool fromUser) {
   else if (!strcmp(variable, "mqtt_user_Pass") && value[0] != '*') strncpy(mqtt_user_Pass, value, MAX_PWD_LEN-1);
   else if (!strcmp(variable, "mqtt_topic_prefix")) strncpy(mqtt_topic_prefix, value, (FILE_NAME_LEN/2)-1);
 #endif
+#ifdef ISCAM
+  else if (!strcmp(variable, "Rec_Pass") && value[0] != '*') strncpy(Rec_Pass, value, MAX_PWD_LEN-1);
+#endif
 #if INCLUDE_RTSP
   else if (!strcmp(variable, "RTSP_Name")) strncpy(RTSP_Name, value, MAX_HOST_LEN-1);
   else if (!strcmp(variable, "RTSP_Pass")  && value[0] != '*')strncpy(RTSP_Pass, value, MAX_PWD_LEN-1);
@@ -432,6 +441,9 @@ void buildJsonString(uint8_t filter) {
 #endif
 #if INCLUDE_RTSP
       p += sprintf(p, "\"RTSP_Pass\":\"%.*s\",", strlen(RTSP_Pass), FILLSTAR);
+#endif
+#ifdef ISCAM
+      p += sprintf(p, "\"Rec_Pass\":\"%.*s\",", strlen(Rec_Pass), FILLSTAR);
 #endif
     }
   } else {
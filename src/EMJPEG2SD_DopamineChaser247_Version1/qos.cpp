@@ -0,0 +1,95 @@
+// Recording quality of service governor.
+// Once per QOS_WINDOW, the capture task passes measurements of SD write time,
+// recorded bytes, capture backlog, processing time and dropped frames.
+// The control law in qos.h then adjusts jpeg quality, recording FPS and
+// idle motion check cadence to hold the target bitrate with no dropped frames.
+// Each change is logged with the measurements that caused it, and at verbose
+// level the measurements of every window are logged as a trace for host replay.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "qos.h"
+
+#define QOS_WINDOW 1000 // ms per control window
+
+bool qosUse = false; // whether governor is active
+int qosKbps = 0; // target recording bitrate in kbps, 0 for no target
+uint8_t motionCadence = QOS_CADENCE_MIN; // idle frames per motion check
+
+static qosState qos = {QOS_Q_BEST, 0, QOS_CADENCE_MIN, 0, 0, NULL};
+static qosLimits qosLim = {0, 0, QOS_MIN_FPS};
+static uint32_t windowStart = 0;
+static uint32_t busyUs = 0;
+static uint32_t backlogMax = 0;
+static uint32_t lastWriteMs = 0, lastBytes = 0, lastFrames = 0, lastDropped = 0;
+
+void qosRecordSettings(uint8_t& fps, int& quality) {
+  // called when camera configured for recording, fps & quality contain
+  // default settings, replaced by governed settings if active
+  if (!qos.fps) {
+    // first use, start from defaults
+    qosLim.maxFPS = fps;
+    qos.fps = fps;
+    qos.quality = quality;
+  }
+  if (qosUse) {
+    fps = qos.fps;
+    quality = qos.quality;
+  }
+}
+
+void qosCapture(uint32_t frameUs, uint32_t backlog) {
+  // called by capture task for each batch of frames processed
+  busyUs += frameUs;
+  if (backlog > backlogMax) backlogMax = backlog;
+}
+
+static inline uint32_t counterDelta(uint32_t now, uint32_t& last) {
+  // recording counters are reset at start of each recording
+  uint32_t delta = now >= last ? now - last : now;
+  last = now;
+  return delta;
+}
+
+bool qosWindow(bool recording, uint32_t writeMs, uint32_t bytes, uint32_t frames, uint32_t dropped, uint32_t queueHW, uint32_t queueLen) {
+  // called by capture task with cumulative recording counters,
+  // evaluates control law at end of each window, returns true if window ended
+  uint32_t windowMs = millis() - windowStart;
+  if (windowMs < QOS_WINDOW) return false;
+  qosInputs in;
+  in.recording = recording;
+  in.windowMs = windowMs;
+  in.sdWriteMs = counterDelta(writeMs, lastWriteMs);
+  in.bytes = counterDelta(bytes, lastBytes);
+  in.frames = counterDelta(frames, lastFrames);
+  in.dropped = counterDelta(dropped, lastDropped);
+  in.busyMs = busyUs / 1000;
+  in.backlog = backlogMax;
+  in.queueHW = queueHW;
+  in.queueLen = queueLen;
+  windowStart = millis();
+  busyUs = backlogMax = 0;
+  LOG_VRB(QOS_TRACE QOS_TRACE_FMT, in.recording, in.windowMs, in.sdWriteMs, in.busyMs,
+    in.bytes, in.frames, in.dropped, in.backlog, in.queueHW, in.queueLen);
+  if (!qosUse || !qos.fps) {
+    motionCadence = QOS_CADENCE_MIN;
+    return true;
+  }
+
+  qosLim.targetKbps = qosKbps;
+  qosState prev = qos;
+  qos = qosControl(qos, in, qosLim);
+  if (qos.reason != NULL) {
+    LOG_INF("QoS %s: quality %d, FPS %u, motion cadence %u (SD %u%%, CPU %u%%, %u kbps, backlog %u, dropped %u)",
+      qos.reason, qos.quality, qos.fps, qos.cadence, qosPercent(in.sdWriteMs, windowMs),
+      qosPercent(in.busyMs, windowMs), in.bytes * 8 / windowMs, in.backlog, in.dropped);
+    motionCadence = qos.cadence;
+    if (recording) {
+      sensor_t* s = esp_camera_sensor_get();
+      if (s && qos.quality != prev.quality) s->set_quality(s, qos.quality);
+      if (qos.fps != prev.fps) setFPS(qos.fps);
+    }
+  }
+  return true;
+}
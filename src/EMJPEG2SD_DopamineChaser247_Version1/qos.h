@@ -0,0 +1,115 @@
+// Control law for recording quality of service governor, see qos.cpp
+// Kept free of Arduino / ESP dependencies so that it can be exercised
+// on a host against recorded traces of qosInputs.
+//
+// s60sc 2025
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define QOS_Q_BEST 10 // best (lowest) jpeg quality value allowed
+#define QOS_Q_WORST 30 // worst jpeg quality value allowed
+#define QOS_Q_STEP 2
+#define QOS_CADENCE_MIN 3 // check for motion every n frames when idle
+#define QOS_CADENCE_MAX 12
+#define QOS_SD_HIGH 80 // % of window spent writing to SD
+#define QOS_SD_LOW 50
+#define QOS_CPU_HIGH 85 // % of window spent processing frames
+#define QOS_CPU_LOW 60
+#define QOS_RATE_BAND 10 // % tolerance around target bitrate
+#define QOS_UP_HOLD 5 // consecutive healthy windows before improving
+#define QOS_COOLDOWN 2 // windows to wait after any change
+#define QOS_MIN_FPS 2
+// qosInputs logged each window at verbose level, for replay on a host
+#define QOS_TRACE "QoS trace: "
+#define QOS_TRACE_FMT "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u"
+
+struct qosInputs {
+  // measurements over one control window
+  bool recording;
+  uint32_t windowMs;
+  uint32_t sdWriteMs; // time spent in SD writes
+  uint32_t busyMs; // time spent processing frames on capture task
+  uint32_t bytes; // video bytes recorded
+  uint32_t frames; // frames recorded
+  uint32_t dropped; // frames dropped
+  uint32_t backlog; // max frames behind on capture task
+  uint32_t queueHW; // max SD writer queue depth
+  uint32_t queueLen; // SD writer queue capacity
+};
+
+struct qosLimits {
+  // configured bounds
+  uint32_t targetKbps; // 0 for no bitrate target
+  uint8_t maxFPS;
+  uint8_t minFPS;
+};
+
+struct qosState {
+  int quality; // jpeg quality, lower is better
+  uint8_t fps;
+  uint8_t cadence; // idle frames per motion check
+  uint8_t healthy; // consecutive healthy windows
+  uint8_t cooldown; // windows remaining before next change
+  const char* reason; // why last change made, NULL if no change
+};
+
+static inline uint32_t qosPercent(uint32_t part, uint32_t whole) {
+  return whole ? (uint32_t)((uint64_t)part * 100 / whole) : 0;
+}
+
+static inline qosState qosControl(qosState st, const qosInputs& in, const qosLimits& lim) {
+  // derive new settings from current settings and window measurements.
+  // Degrades immediately on overload, but only improves after QOS_UP_HOLD
+  // consecutive healthy windows, to avoid oscillation.
+  // Quality and FPS only adjusted while recording, and are degraded before
+  // motion cadence so that recording is not cut short by missed motion
+  st.reason = NULL;
+  if (!in.windowMs) return st;
+  uint32_t sdPct = qosPercent(in.sdWriteMs, in.windowMs);
+  uint32_t cpuPct = qosPercent(in.busyMs, in.windowMs);
+  uint32_t kbps = (uint32_t)((uint64_t)in.bytes * 8 / in.windowMs); // bits per ms is kbps
+  bool cpuOver = cpuPct > QOS_CPU_HIGH || in.backlog > 1;
+  bool sdOver = in.recording && (in.dropped || sdPct > QOS_SD_HIGH || in.queueHW * 2 > in.queueLen);
+  bool rateOver = in.recording && lim.targetKbps && kbps * 100 > lim.targetKbps * (100 + QOS_RATE_BAND);
+  bool rateUnder = !in.recording || !lim.targetKbps || kbps * 100 < lim.targetKbps * (100 - QOS_RATE_BAND);
+  bool healthy = !cpuOver && !sdOver && cpuPct < QOS_CPU_LOW && (!in.recording || sdPct < QOS_SD_LOW);
+  st.healthy = healthy ? (st.healthy < 255 ? st.healthy + 1 : 255) : 0;
+  if (st.cooldown) {
+    st.cooldown--;
+    if (!in.dropped) return st; // dropped frames override cooldown
+  }
+
+  if (in.recording && (sdOver || rateOver || cpuOver) && st.quality + QOS_Q_STEP <= QOS_Q_WORST) {
+    // reduce frame size
+    st.quality += QOS_Q_STEP;
+    st.reason = sdOver ? "sd overload, lower quality" : (rateOver ? "bitrate above target, lower quality" : "cpu overload, lower quality");
+  } else if (in.recording && (sdOver || cpuOver) && st.fps > lim.minFPS) {
+    // quality at limit so reduce frame rate
+    st.fps--;
+    st.reason = sdOver ? "sd overload, lower fps" : "cpu overload, lower fps";
+  } else if (cpuOver && st.cadence < QOS_CADENCE_MAX) {
+    // reduce motion checking load, only reached while recording
+    // once quality and fps at their limits
+    st.cadence++;
+    st.reason = "cpu overload, less frequent motion checks";
+  } else if (st.healthy >= QOS_UP_HOLD) {
+    // sustained spare capacity, restore in reverse order
+    if (st.cadence > QOS_CADENCE_MIN) {
+      st.cadence--;
+      st.reason = "spare capacity, more frequent motion checks";
+    } else if (in.recording && st.fps < lim.maxFPS && !rateOver) {
+      st.fps++;
+      st.reason = "spare capacity, higher fps";
+    } else if (in.recording && rateUnder && st.quality - QOS_Q_STEP >= QOS_Q_BEST) {
+      st.quality -= QOS_Q_STEP;
+      st.reason = "spare capacity, higher quality";
+    }
+  }
+  if (st.reason != NULL) {
+    st.cooldown = QOS_COOLDOWN;
+    st.healthy = 0;
+  }
+  return st;
+}
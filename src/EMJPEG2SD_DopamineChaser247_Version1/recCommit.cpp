@@ -0,0 +1,74 @@
+// Committed length of preallocated recording files.
+// A preallocated temporary recording file has its full preallocated size
+// from the start, so after a restart its data is followed by whatever the
+// reused clusters held before, which may be an earlier recording with frames
+// at the same offsets. Avi and mp4 chunks carry no per file marker that would
+// tell them apart, so as for the loop table, a small record file holds the
+// length of data known to be on SD, rewritten each time the recording is
+// flushed, and recovery discards the file beyond it.
+// The record is created before the file is preallocated, so a preallocated
+// file is never without one, and is removed once the file is truncated.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define COMMIT_MAGIC 0x4E454C52 // "RLEN"
+
+struct commitRecord {
+  uint32_t magic;
+  uint32_t len; // bytes of recording file committed to SD
+  char name[16]; // temporary recording file described
+  uint32_t check;
+};
+
+static File commitFile;
+static commitRecord curCommit;
+
+static void writeCommit() {
+  curCommit.check = catCheck(&curCommit, offsetof(commitRecord, check));
+  commitFile.seek(0, SeekSet);
+  commitFile.write((uint8_t*)&curCommit, sizeof(curCommit));
+  commitFile.flush();
+}
+
+bool commitBegin(const char* tempName) {
+  // start record for file about to be preallocated, with no data committed
+  commitEnd();
+  commitFile = STORAGE.open(COMMITTEMP, FILE_WRITE);
+  if (!commitFile) {
+    LOG_WRN("Failed to create %s", COMMITTEMP);
+    return false;
+  }
+  curCommit = {COMMIT_MAGIC, 0, {0}, 0};
+  strncpy(curCommit.name, tempName, sizeof(curCommit.name) - 1);
+  writeCommit();
+  return true;
+}
+
+void commitLength(size_t len) {
+  // called after recording file flushed, with length of its data now on SD
+  if (!commitFile) return;
+  curCommit.len = len;
+  writeCommit();
+}
+
+void commitEnd() {
+  // recording file truncated to its data, or not preallocated
+  if (commitFile) commitFile.close();
+  if (STORAGE.exists(COMMITTEMP)) STORAGE.remove(COMMITTEMP);
+}
+
+bool committedLength(const char* tempName, size_t& len) {
+  // length of data committed to interrupted recording file, if it was preallocated
+  File file = STORAGE.open(COMMITTEMP, FILE_READ);
+  if (!file) return false;
+  commitRecord cr;
+  bool valid = file.read((uint8_t*)&cr, sizeof(cr)) == sizeof(cr) && cr.magic == COMMIT_MAGIC
+    && cr.check == catCheck(&cr, offsetof(commitRecord, check));
+  file.close();
+  // a torn record was being created, so its file not yet preallocated
+  if (!valid || strncmp(cr.name, tempName, sizeof(cr.name))) return false;
+  len = cr.len;
+  return true;
+}
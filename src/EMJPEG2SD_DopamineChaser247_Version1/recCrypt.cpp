@@ -0,0 +1,501 @@
+// Encryption of recordings at rest, so that recordings on a removed SD card
+// cannot be viewed or altered undetected.
+// When enabled, each avi or mp4 recording is encrypted with AES-256-CTR as
+// each staged buffer is passed to the SD flush task, using mbedTLS which is
+// hardware accelerated on ESP32-S3. The recording is preceded by a header
+// holding the device salt and a random per file nonce, from which the file
+// keys are derived:
+//   master key = PBKDF2-HMAC-SHA256(Rec_Pass, salt, ENC_KDF_ITERS)
+//   enc key = HMAC-SHA256(master key, "enc" | nonce)
+//   mac key = HMAC-SHA256(master key, "mac" | nonce)
+// so that recordings can also be decrypted off device with the passphrase,
+// eg by openssl enc -aes-256-ctr with a zero IV on content after the header.
+// The salt is generated randomly once per device and kept in NVS, so that
+// keys for a passphrase cannot be precomputed, while the master key is only
+// derived once for the recordings of a device. As the header holds the salt,
+// recordings from another device can still be read with its passphrase.
+// Content is authenticated by the XOR of HMAC-SHA256 of each 4KB block of
+// ciphertext, prefixed by its block number, with the HMAC of the content
+// length. As the avi header and RIFF sizes are rewritten on close, only the
+// MACs of the blocks containing them are replaced rather than rereading the
+// file. The avi header space is first written as unencrypted zeros so that its
+// keystream is only used once. The RIFF sizes of recordings over 1GB are
+// rewritten under the same keystream, but only reveal sizes.
+// Recordings are decrypted by wrapping the opened File with recDecrypt(),
+// which checks the tag when the file is read in sequence to its end, as for
+// download, upload and scrub, and withholds the end of the file if the check
+// fails. Random access for playback is decrypted without the check.
+// Timelapse, loop, telemetry and photo files are not encrypted.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/platform_util.h"
+#include "esp_random.h"
+
+#define ENC_NVS "recCrypt" // NVS namespace for device salt
+#define ENC_WORK_LEN 512 // bytes encrypted per write to encrypted file
+#define ENC_BENCH_LEN (16 * 1024) // same as default staging buffer
+#define ENC_BENCH_LOOPS 16
+
+bool recEncrypt = false; // encrypt new recordings
+char Rec_Pass[MAX_PWD_LEN] = ""; // passphrase that recording keys are derived from
+
+static SemaphoreHandle_t keyMutex = NULL;
+static uint8_t masterKey[ENC_KEY_LEN];
+static uint8_t masterId[ENC_ID_LEN];
+static char keyPass[MAX_PWD_LEN] = ""; // passphrase that master key was derived from
+static uint8_t keySalt[ENC_SALT_LEN]; // salt that master key was derived with
+static uint8_t deviceSalt[ENC_SALT_LEN]; // salt for new recordings
+static bool haveKey = false;
+
+/************** primitives **************/
+
+struct encCipher {
+  mbedtls_aes_context aes;
+  mbedtls_md_context_t md; // HMAC of current MAC block
+  uint8_t macKey[ENC_KEY_LEN];
+  uint8_t acc[ENC_TAG_LEN]; // XOR of MACs of completed blocks
+  uint64_t macPos; // content bytes added to MACs
+  bool blockOpen; // partial block in md
+};
+
+static const mbedtls_md_info_t* sha256() {
+  return mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+}
+
+static void hmac(const uint8_t* key, const char* label, const uint8_t* data, size_t dataLen, uint8_t* mac) {
+  // HMAC-SHA256 of label followed by data
+  mbedtls_md_context_t md;
+  mbedtls_md_init(&md);
+  mbedtls_md_setup(&md, sha256(), 1);
+  mbedtls_md_hmac_starts(&md, key, ENC_KEY_LEN);
+  mbedtls_md_hmac_update(&md, (const uint8_t*)label, strlen(label));
+  if (dataLen) mbedtls_md_hmac_update(&md, data, dataLen);
+  mbedtls_md_hmac_finish(&md, mac);
+  mbedtls_md_free(&md);
+}
+
+static bool fileKeys(encHeader& eh, bool newFile, uint8_t* encKey, uint8_t* macKey) {
+  // derive file keys from master key, which is derived when passphrase first used or changed,
+  // or for recording from another device
+  if (keyMutex == NULL) return false;
+  xSemaphoreTake(keyMutex, portMAX_DELAY);
+  if (newFile) memcpy(eh.salt, deviceSalt, ENC_SALT_LEN);
+  if (strcmp(keyPass, Rec_Pass) || memcmp(keySalt, eh.salt, ENC_SALT_LEN)) {
+    haveKey = false;
+    strcpy(keyPass, Rec_Pass);
+    memcpy(keySalt, eh.salt, ENC_SALT_LEN);
+    if (strlen(keyPass)) {
+      uint32_t kTime = millis();
+      haveKey = !mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256, (const uint8_t*)keyPass, strlen(keyPass),
+        keySalt, ENC_SALT_LEN, ENC_KDF_ITERS, ENC_KEY_LEN, masterKey);
+      uint8_t id[ENC_TAG_LEN];
+      hmac(masterKey, "id", NULL, 0, id);
+      memcpy(masterId, id, ENC_ID_LEN);
+      LOG_INF("Recording key %sderived in %lu ms", haveKey ? "" : "not ", millis() - kTime);
+    }
+  }
+  bool res = haveKey && (newFile || !memcmp(eh.keyId, masterId, ENC_ID_LEN));
+  if (res) {
+    if (newFile) memcpy(eh.keyId, masterId, ENC_ID_LEN);
+    if (encKey != NULL) hmac(masterKey, "enc", eh.nonce, ENC_NONCE_LEN, encKey);
+    if (macKey != NULL) hmac(masterKey, "mac", eh.nonce, ENC_NONCE_LEN, macKey);
+  }
+  xSemaphoreGive(keyMutex);
+  return res;
+}
+
+static void cipherKeys(encCipher& ec, const uint8_t* encKey, const uint8_t* macKey) {
+  mbedtls_aes_init(&ec.aes);
+  mbedtls_aes_setkey_enc(&ec.aes, encKey, ENC_KEY_LEN * 8);
+  mbedtls_md_init(&ec.md);
+  mbedtls_md_setup(&ec.md, sha256(), 1);
+  memcpy(ec.macKey, macKey, ENC_KEY_LEN);
+  memset(ec.acc, 0, ENC_TAG_LEN);
+  ec.macPos = 0;
+  ec.blockOpen = false;
+}
+
+static bool cipherInit(encCipher& ec, encHeader& eh, bool newFile) {
+  uint8_t encKey[ENC_KEY_LEN], macKey[ENC_KEY_LEN];
+  bool res = fileKeys(eh, newFile, encKey, macKey);
+  if (res) cipherKeys(ec, encKey, macKey);
+  mbedtls_platform_zeroize(encKey, ENC_KEY_LEN);
+  mbedtls_platform_zeroize(macKey, ENC_KEY_LEN);
+  return res;
+}
+
+static void cipherFree(encCipher& ec) {
+  mbedtls_aes_free(&ec.aes);
+  mbedtls_md_free(&ec.md);
+  mbedtls_platform_zeroize(ec.macKey, ENC_KEY_LEN);
+}
+
+static void cipherCtr(encCipher& ec, uint64_t offset, const uint8_t* in, uint8_t* out, size_t len) {
+  // encrypt or decrypt content at offset
+  uint8_t counter[16], stream[16];
+  size_t streamOff = offset % 16;
+  encCounter(offset, counter);
+  if (streamOff) {
+    // part way through counter block
+    mbedtls_aes_crypt_ecb(&ec.aes, MBEDTLS_AES_ENCRYPT, counter, stream);
+    encCounter(offset + 16, counter);
+  }
+  mbedtls_aes_crypt_ctr(&ec.aes, len, &streamOff, counter, stream, in, out);
+}
+
+static void macBlock(encCipher& ec, uint64_t blockNum, const uint8_t* data, size_t len, uint8_t* mac) {
+  // MAC of whole block of ciphertext
+  uint8_t prefix[ENC_PREFIX_LEN];
+  encPrefix(prefix, ENC_DOMAIN_BLOCK, blockNum);
+  mbedtls_md_hmac_starts(&ec.md, ec.macKey, ENC_KEY_LEN);
+  mbedtls_md_hmac_update(&ec.md, prefix, ENC_PREFIX_LEN);
+  mbedtls_md_hmac_update(&ec.md, data, len);
+  mbedtls_md_hmac_finish(&ec.md, mac);
+}
+
+static void macStream(encCipher& ec, const uint8_t* data, size_t len) {
+  // add ciphertext following previous content to block MACs
+  uint8_t mac[ENC_TAG_LEN];
+  while (len) {
+    if (!ec.blockOpen) {
+      uint8_t prefix[ENC_PREFIX_LEN];
+      encPrefix(prefix, ENC_DOMAIN_BLOCK, ec.macPos / ENC_MAC_BLOCK);
+      mbedtls_md_hmac_starts(&ec.md, ec.macKey, ENC_KEY_LEN);
+      mbedtls_md_hmac_update(&ec.md, prefix, ENC_PREFIX_LEN);
+      ec.blockOpen = true;
+    }
+    size_t part = std::min(len, (size_t)(ENC_MAC_BLOCK - ec.macPos % ENC_MAC_BLOCK));
+    mbedtls_md_hmac_update(&ec.md, data, part);
+    ec.macPos += part;
+    data += part;
+    len -= part;
+    if (!(ec.macPos % ENC_MAC_BLOCK)) {
+      mbedtls_md_hmac_finish(&ec.md, mac);
+      encXor(ec.acc, mac);
+      ec.blockOpen = false;
+    }
+  }
+}
+
+static void macFlush(encCipher& ec) {
+  // complete MAC of final partial block
+  if (ec.blockOpen) {
+    uint8_t mac[ENC_TAG_LEN];
+    mbedtls_md_hmac_finish(&ec.md, mac);
+    encXor(ec.acc, mac);
+    ec.blockOpen = false;
+  }
+}
+
+static void macTag(encCipher& ec, uint8_t* tag) {
+  // tag for content added to MACs
+  uint8_t prefix[ENC_PREFIX_LEN];
+  macFlush(ec);
+  encPrefix(prefix, ENC_DOMAIN_FINAL, ec.macPos);
+  mbedtls_md_hmac_starts(&ec.md, ec.macKey, ENC_KEY_LEN);
+  mbedtls_md_hmac_update(&ec.md, prefix, ENC_PREFIX_LEN);
+  mbedtls_md_hmac_finish(&ec.md, tag);
+  encXor(tag, ec.acc);
+}
+
+/************** recording being written **************/
+
+static encCipher wc;
+static encHeader wh;
+static bool writing = false;
+static bool writeFailed;
+static size_t holdLen; // content at start rewritten on close, so first written unencrypted
+static uint8_t* patchBuf = NULL; // MAC block read back to patch content
+static uint32_t cryptUs; // time spent encrypting and authenticating current recording
+
+bool encReady() {
+  // whether new recording is to be encrypted
+  encHeader eh;
+  return recEncrypt && fileKeys(eh, true, NULL, NULL);
+}
+
+bool encBegin(File& file, size_t hold) {
+  // start recording with encryption header, if enabled
+  writing = false;
+  if (!recEncrypt) return false;
+  if (patchBuf == NULL) patchBuf = (uint8_t*)malloc(ENC_MAC_BLOCK);
+  memset(&wh, 0, sizeof(wh));
+  wh.magic = ENC_MAGIC;
+  wh.version = ENC_VERSION;
+  esp_fill_random(wh.nonce, ENC_NONCE_LEN);
+  if (patchBuf == NULL || !cipherInit(wc, wh, true)) {
+    LOG_WRN("Recording not encrypted, as %s", patchBuf == NULL ? "insufficient memory" : "no passphrase");
+    return false;
+  }
+  // header written now so that recording can be decrypted if not closed
+  memset(patchBuf, 0, ENC_HDR_LEN);
+  memcpy(patchBuf, &wh, sizeof(wh));
+  file.write(patchBuf, ENC_HDR_LEN);
+  holdLen = hold;
+  cryptUs = 0;
+  writing = true;
+  writeFailed = false;
+  return true;
+}
+
+void encStage(uint8_t* buf, size_t len) {
+  // encrypt staged content in place before it is written to SD, and add it to MAC
+  uint32_t eTime = micros();
+  uint64_t pos = wc.macPos;
+  size_t skip = pos < holdLen ? std::min(len, (size_t)(holdLen - pos)) : 0;
+  cipherCtr(wc, pos + skip, buf + skip, buf + skip, len - skip);
+  macStream(wc, buf, len);
+  cryptUs += micros() - eTime;
+}
+
+void encPatch(File& file, size_t offset, const uint8_t* data, size_t len) {
+  // rewrite content after it was staged, replacing MACs of changed blocks
+  macFlush(wc);
+  uint8_t mac[ENC_TAG_LEN];
+  while (len && !writeFailed) {
+    uint64_t blockNum = offset / ENC_MAC_BLOCK;
+    size_t blockOff = offset % ENC_MAC_BLOCK;
+    size_t blockLen = encBlockLen(wc.macPos, blockNum);
+    size_t part = std::min(len, blockLen - blockOff);
+    file.seek(ENC_HDR_LEN + blockNum * ENC_MAC_BLOCK, SeekSet);
+    if (file.read(patchBuf, blockLen) != blockLen) {
+      LOG_WRN("Failed to read back encrypted content at %u", offset);
+      writeFailed = true;
+      break;
+    }
+    macBlock(wc, blockNum, patchBuf, blockLen, mac);
+    encXor(wc.acc, mac);
+    cipherCtr(wc, offset, data, patchBuf + blockOff, part);
+    macBlock(wc, blockNum, patchBuf, blockLen, mac);
+    encXor(wc.acc, mac);
+    file.seek(ENC_HDR_LEN + offset, SeekSet);
+    file.write(patchBuf + blockOff, part);
+    offset += part;
+    data += part;
+    len -= part;
+  }
+}
+
+uint32_t encEnd(File& file) {
+  // seal header with tag for content, returns crypto time in us
+  if (!writing) return 0;
+  macTag(wc, wh.tag);
+  if (!writeFailed) wh.flags |= ENC_SEALED;
+  file.seek(0, SeekSet);
+  file.write((uint8_t*)&wh, sizeof(wh));
+  cipherFree(wc);
+  writing = false;
+  return cryptUs;
+}
+
+/************** encrypted file access **************/
+
+class encFile : public fs::FileImpl {
+  // recording content decrypted as read, or encrypted as written
+ public:
+  encFile(File& raw, const encHeader& eh) : raw(raw), eh(eh) {
+    ready = cipherInit(ec, this->eh, false);
+    verifying = ready && eh.flags & ENC_SEALED;
+  }
+  ~encFile() {
+    if (ready) cipherFree(ec);
+  }
+  bool ready;
+
+  size_t read(uint8_t* buf, size_t size) override {
+    if (authFailed) return 0;
+    size_t readLen = raw.read(buf, size);
+    if (verifying && ec.macPos == pos) {
+      // authenticate ciphertext when read in sequence
+      macStream(ec, buf, readLen);
+      if (ec.macPos >= contentLen()) {
+        uint8_t tag[ENC_TAG_LEN];
+        uint8_t diff = 0;
+        macTag(ec, tag);
+        for (int i = 0; i < ENC_TAG_LEN; i++) diff |= tag[i] ^ eh.tag[i];
+        verifying = false;
+        if (diff) {
+          // withhold end of content, so that reader sees incomplete file
+          LOG_WRN("Recording %s failed authentication", raw.path());
+          authFailed = true;
+          return 0;
+        }
+      }
+    }
+    cipherCtr(ec, pos, buf, buf, readLen);
+    pos += readLen;
+    return readLen;
+  }
+
+  size_t write(const uint8_t* buf, size_t size) override {
+    if (eh.flags & ENC_SEALED) {
+      // tag no longer valid once content changed
+      eh.flags &= ~ENC_SEALED;
+      verifying = false;
+      raw.seek(0, SeekSet);
+      raw.write((uint8_t*)&eh, sizeof(eh));
+      raw.seek(ENC_HDR_LEN + pos, SeekSet);
+    }
+    uint8_t work[ENC_WORK_LEN];
+    size_t done = 0;
+    while (done < size) {
+      size_t part = std::min(size - done, (size_t)ENC_WORK_LEN);
+      cipherCtr(ec, pos, buf + done, work, part);
+      size_t wrote = raw.write(work, part);
+      pos += wrote;
+      done += wrote;
+      if (wrote < part) break;
+    }
+    return done;
+  }
+
+  bool seek(uint32_t offset, SeekMode mode) override {
+    size_t newPos = mode == SeekSet ? offset : mode == SeekCur ? pos + offset : contentLen() + offset;
+    if (!raw.seek(ENC_HDR_LEN + newPos, SeekSet)) return false;
+    pos = newPos;
+    return true;
+  }
+
+  size_t position() const override { return pos; }
+  size_t size() const override { return contentLen(); }
+  void flush() override { raw.flush(); }
+  bool setBufferSize(size_t size) override { return raw.setBufferSize(size); }
+  void close() override { raw.close(); }
+  time_t getLastWrite() override { return raw.getLastWrite(); }
+  const char* path() const override { return raw.path(); }
+  const char* name() const override { return raw.name(); }
+  boolean isDirectory(void) override { return false; }
+  fs::FileImplPtr openNextFile(const char*) override { return fs::FileImplPtr(); }
+  boolean seekDir(long) override { return false; }
+  String getNextFileName(void) override { return String(); }
+  String getNextFileName(bool*) override { return String(); }
+  void rewindDirectory(void) override {}
+  operator bool() override { return (bool)raw; }
+
+ private:
+  size_t contentLen() const {
+    size_t rawLen = raw.size();
+    return rawLen > ENC_HDR_LEN ? rawLen - ENC_HDR_LEN : 0;
+  }
+  File raw;
+  encHeader eh;
+  encCipher ec;
+  size_t pos = 0; // content position
+  bool verifying = false;
+  bool authFailed = false;
+};
+
+File recDecrypt(File raw, encState* state) {
+  // return encrypted recording as file of its content, else file unchanged
+  if (state != NULL) *state = ENC_NONE;
+  if (!raw || raw.isDirectory() || raw.size() < ENC_HDR_LEN) return raw;
+  encHeader eh;
+  size_t startPos = raw.position();
+  if (raw.read((uint8_t*)&eh, sizeof(eh)) != sizeof(eh) || !encValid(eh)) {
+    raw.seek(startPos, SeekSet);
+    return raw;
+  }
+  auto ef = std::make_shared<encFile>(raw, eh);
+  if (!ef->ready) {
+    LOG_WRN("Recording %s encrypted with different or no passphrase", raw.path());
+    if (state != NULL) *state = ENC_NO_KEY;
+    raw.seek(startPos, SeekSet);
+    return raw;
+  }
+  if (!(eh.flags & ENC_SEALED)) LOG_INF("Recording %s not authenticated, as not closed normally", raw.path());
+  if (state != NULL) *state = ENC_OPEN;
+  raw.seek(ENC_HDR_LEN, SeekSet);
+  return File(ef);
+}
+
+File recOpen(const char* path, const char* mode, encState* state) {
+  return recDecrypt(STORAGE.open(path, mode), state);
+}
+
+/************** checks **************/
+
+static bool selfTest() {
+  // known answer tests, NIST SP 800-38A F.5.5 and RFC 4231 case 2
+  static const uint8_t key[32] = {0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4};
+  static const uint8_t plain[32] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51};
+  static const uint8_t cipher[32] = {0x60, 0x1e, 0xc3, 0x13, 0x77, 0x57, 0x89, 0xa5, 0xb7, 0xa7, 0xf5, 0x04, 0xbb, 0xf3, 0xd2, 0x28,
+    0xf4, 0x43, 0xe3, 0xca, 0x4d, 0x62, 0xb5, 0x9a, 0xca, 0x84, 0xe9, 0x90, 0xca, 0xca, 0xf5, 0xc5};
+  static const uint8_t hmacOut[32] = {0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43};
+  uint8_t counter[16] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+  uint8_t stream[16], out[32];
+  size_t streamOff = 0;
+  mbedtls_aes_context aes;
+  mbedtls_aes_init(&aes);
+  mbedtls_aes_setkey_enc(&aes, key, 256);
+  mbedtls_aes_crypt_ctr(&aes, sizeof(plain), &streamOff, counter, stream, plain, out);
+  mbedtls_aes_free(&aes);
+  bool res = !memcmp(out, cipher, sizeof(cipher));
+  const char* data = "what do ya want for nothing?";
+  mbedtls_md_hmac(sha256(), (const uint8_t*)"Jefe", 4, (const uint8_t*)data, strlen(data), out);
+  return res && !memcmp(out, hmacOut, sizeof(hmacOut));
+}
+
+static void benchCrypt() {
+  // time encryption and authentication of staged buffers, to show recording rate sustainable
+  uint8_t* benchBuf = (uint8_t*)heap_caps_malloc(ENC_BENCH_LEN, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+  if (benchBuf == NULL) return;
+  uint8_t keys[ENC_KEY_LEN * 2];
+  esp_fill_random(keys, sizeof(keys));
+  esp_fill_random(benchBuf, ENC_BENCH_LEN);
+  encCipher ec;
+  cipherKeys(ec, keys, keys + ENC_KEY_LEN);
+  uint32_t aesUs = micros();
+  for (int i = 0; i < ENC_BENCH_LOOPS; i++) cipherCtr(ec, i * ENC_BENCH_LEN, benchBuf, benchBuf, ENC_BENCH_LEN);
+  aesUs = micros() - aesUs + 1;
+  uint32_t macUs = micros();
+  for (int i = 0; i < ENC_BENCH_LOOPS; i++) macStream(ec, benchBuf, ENC_BENCH_LEN);
+  macUs = micros() - macUs + 1;
+  cipherFree(ec);
+  free(benchBuf);
+  float benchBytes = (float)ENC_BENCH_LEN * ENC_BENCH_LOOPS;
+  float bothMBps = benchBytes / (aesUs + macUs); // bytes per us is MB/s
+  char rateStr[20];
+  strcpy(rateStr, fmtSize(recordingByteRate()));
+  LOG_INF("AES-256-CTR %0.1f MB/s, HMAC-SHA256 %0.1f MB/s, sustains %0.1f Mbps recording",
+    benchBytes / aesUs, benchBytes / macUs, bothMBps * 8);
+  LOG_INF("Encryption would take %0.1f%% CPU at recording rate %s/s", 100.0f * recordingByteRate() / (bothMBps * 1000000), rateStr);
+}
+
+static void loadSalt() {
+  // salt for this device, created on first use
+  Preferences encPrefs;
+  bool saved = encPrefs.begin(ENC_NVS, false);
+  if (saved && encPrefs.getBytes("salt", deviceSalt, ENC_SALT_LEN) == ENC_SALT_LEN) {
+    encPrefs.end();
+    return;
+  }
+  esp_fill_random(deviceSalt, ENC_SALT_LEN);
+  // if not saved, master key is derived again after restart to read earlier recordings
+  saved = saved && encPrefs.putBytes("salt", deviceSalt, ENC_SALT_LEN) == ENC_SALT_LEN;
+  if (!saved) LOG_WRN("Failed to save recording salt in NVS");
+  encPrefs.end();
+}
+
+void prepRecCrypt() {
+  // check primitives, then derive key so that first recording is not delayed
+  keyMutex = xSemaphoreCreateMutex();
+  loadSalt();
+  if (!selfTest()) {
+    LOG_ERR("Encryption self test failed, recordings not encrypted");
+    recEncrypt = false;
+    return;
+  }
+  benchCrypt();
+  if (recEncrypt) {
+    if (encReady()) LOG_INF("New recordings encrypted");
+    else LOG_WRN("Recording encryption needs a passphrase, recordings not encrypted");
+  }
+}
@@ -0,0 +1,74 @@
+// Layout of encrypted recordings on SD, see recCrypt.cpp
+// Kept free of Arduino / ESP dependencies so that encrypted files can be
+// generated and checked on a host.
+//
+// s60sc 2025
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "catalog.h" // for catEntry
+
+#define ENC_MAGIC 0x31434552 // "REC1"
+#define ENC_VERSION 2 // version 1 had no salt in header
+#define ENC_HDR_LEN 512 // precedes content, whole sector so that content writes stay sector aligned
+#define ENC_MAC_BLOCK 4096 // content bytes per MAC block
+#define ENC_KEY_LEN 32
+#define ENC_SALT_LEN 16
+#define ENC_KDF_ITERS 10000 // PBKDF2 iterations for master key
+#define ENC_NONCE_LEN 16
+#define ENC_TAG_LEN 32 // HMAC-SHA256 length
+#define ENC_ID_LEN 8
+#define ENC_SEALED 0x01 // tag is valid, else recording was not closed normally
+#define ENC_DOMAIN_BLOCK 0x00 // MAC input prefix for content block
+#define ENC_DOMAIN_FINAL 0x01 // MAC input prefix for content length
+#define ENC_PREFIX_LEN 9 // domain byte and 64 bit value
+
+enum encState {ENC_NONE, ENC_OPEN, ENC_NO_KEY}; // file not encrypted, decrypted, or no matching key
+
+struct encHeader {
+  // start of encrypted file, remainder of ENC_HDR_LEN is zero
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint8_t salt[ENC_SALT_LEN]; // PBKDF2 salt of device that recorded file
+  uint8_t keyId[ENC_ID_LEN]; // identifies passphrase that file keys are derived from
+  uint8_t nonce[ENC_NONCE_LEN]; // random per file, file keys derived from it
+  uint8_t tag[ENC_TAG_LEN]; // MAC of content and its length, if sealed
+};
+
+inline bool encValid(const encHeader& eh) {
+  return eh.magic == ENC_MAGIC && eh.version == ENC_VERSION;
+}
+
+inline void encCounter(uint64_t offset, uint8_t* counter) {
+  // big endian CTR counter block for 16 byte aligned content offset,
+  // starting from zero as the key is unique to the file
+  uint64_t block = offset / 16;
+  memset(counter, 0, 8);
+  for (int i = 15; i >= 8; i--, block >>= 8) counter[i] = block & 0xFF;
+}
+
+inline void encPrefix(uint8_t* prefix, uint8_t domain, uint64_t val) {
+  // MAC input prefix, so block and length inputs cannot be confused
+  prefix[0] = domain;
+  for (int i = 1; i < ENC_PREFIX_LEN; i++, val >>= 8) prefix[i] = val & 0xFF;
+}
+
+inline void encXor(uint8_t* acc, const uint8_t* mac) {
+  // MACs of blocks combined by XOR, so a block can be replaced later
+  // by removing its previous MAC and adding its new one
+  for (int i = 0; i < ENC_TAG_LEN; i++) acc[i] ^= mac[i];
+}
+
+inline size_t encBlockLen(uint64_t contentLen, uint64_t blockNum) {
+  // length of MAC block, last block may be partial
+  uint64_t start = blockNum * ENC_MAC_BLOCK;
+  return contentLen - start < ENC_MAC_BLOCK ? contentLen - start : ENC_MAC_BLOCK;
+}
+
+inline uint32_t encContentLen(const catEntry& ce) {
+  // recording content length, as catalog holds file size on SD
+  return ce.flags & CAT_ENC && ce.fileSize >= ENC_HDR_LEN ? ce.fileSize - ENC_HDR_LEN : ce.fileSize;
+}
@@ -0,0 +1,81 @@
+// Motion recording state machine used by processFrame() in mjpeg2sd.cpp
+// processFrame() performs the actions (motion checks, opening and closing
+// the AVI) while the transitions are decided here.
+// Kept free of Arduino / ESP dependencies so that the IDLE / RECORDING /
+// COOLDOWN transitions can be exercised on a host against sequences of
+// frame times and motion check results.
+//
+// s60sc 2025
+
+#pragma once
+#include <stdint.h>
+
+enum RecordState { IDLE, RECORDING, COOLDOWN };
+
+// outcome of frame on state machine
+enum recordEvent {
+  REC_NONE,
+  REC_START, // motion detected, start recording
+  REC_EXTEND, // motion continues, keep recording
+  REC_STOP, // motion ended, stop recording
+  REC_STOP_MAX, // motion ended after max recording time, stop recording
+  REC_READY // cooldown ended
+};
+
+struct recordTimes {
+  uint32_t minRecMs; // min recording time before checking motion ended
+  uint32_t maxRecMs;
+  uint32_t checkMs; // interval between motion checks while recording
+  uint32_t cooldownMs; // time after recording before motion checked
+  uint32_t cadence; // check motion every n frames when idle
+};
+
+struct recordMachine {
+  RecordState state;
+  uint32_t stateMs; // when recording or cooldown started
+  uint32_t checkMs; // when motion last checked while recording
+  uint32_t frameCount; // idle frames
+};
+
+static inline bool motionCheckDue(recordMachine& rm, const recordTimes& rt, uint32_t nowMs, bool useMotion) {
+  // whether motion is to be checked for current frame
+  switch (rm.state) {
+    case IDLE:
+      // only check every nth frame to reduce CPU load
+      return ++rm.frameCount % (rt.cadence ? rt.cadence : 1) == 0 && useMotion;
+    case RECORDING:
+      return nowMs - rm.stateMs >= rt.minRecMs && nowMs - rm.checkMs >= rt.checkMs;
+    default:
+      return false;
+  }
+}
+
+static inline recordEvent recordStep(recordMachine& rm, const recordTimes& rt, uint32_t nowMs, bool checked, bool motion) {
+  // advance state for current frame, given whether motion was checked and its result
+  switch (rm.state) {
+    case IDLE:
+      if (checked && motion) {
+        rm.state = RECORDING;
+        rm.stateMs = rm.checkMs = nowMs;
+        return REC_START;
+      }
+      break;
+    case RECORDING:
+      if (checked) {
+        rm.checkMs = nowMs;
+        if (motion) return REC_EXTEND;
+        recordEvent event = nowMs - rm.stateMs >= rt.maxRecMs ? REC_STOP_MAX : REC_STOP;
+        rm.state = COOLDOWN;
+        rm.stateMs = nowMs;
+        return event;
+      }
+      break;
+    case COOLDOWN:
+      if (nowMs - rm.stateMs >= rt.cooldownMs) {
+        rm.state = IDLE;
+        return REC_READY;
+      }
+      break;
+  }
+  return REC_NONE;
+}
@@ -0,0 +1,159 @@
+// Background storage retention manager.
+// When free space on SD falls below the low watermark (sdMinCardFreeSpace),
+// plus room for the next recording as hinted by closeAvi(), the oldest folders
+// are deleted in a batch until free space reaches the high watermark.
+// Runs on a low priority task, with unlinks paced while a recording is in
+// progress so that it does not compete with the SD writer, and free space
+// is read once per batch then tracked from the bytes reclaimed.
+// The free space found is kept for retentionFree(), so that recording
+// preallocation does not read it from the FAT on the capture task.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define RETAIN_CHECK_MS (10 * 60 * 1000) // interval between unprompted checks
+#define RETAIN_PACE_MS 250 // min interval between unlinks while recording
+#define RETAIN_WAIT_MS 1000 // poll interval while waiting for recording to end
+
+int sdFreeSpaceHigh = 500; // free MBytes on SD that retention reclaims up to
+static TaskHandle_t retentionHandle = NULL;
+static volatile size_t nextNeed = 0; // bytes expected for next recording
+static volatile uint32_t freeMB = 0; // free space when last checked, in MB so read atomically
+
+static bool recordingActive() {
+  return recordState == RECORDING;
+}
+
+static void pace(bool urgent) {
+  // while recording, pause unless space urgently needed, then limit unlink rate
+  if (!recordingActive()) {
+    delay(1); // yield
+    return;
+  }
+  if (urgent) delay(RETAIN_PACE_MS);
+  else while (recordingActive()) delay(RETAIN_WAIT_MS);
+}
+
+static size_t deleteFolderPaced(const char* folder, bool urgent, uint32_t& files) {
+  // delete files in folder one at a time, then folder itself
+  size_t reclaimed = 0;
+  std::vector<catEntry> entries;
+  if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+  if (catalogReady()) catalogFolder(folder, entries);
+  else {
+    File root = STORAGE.open(folder);
+    File file = root.openNextFile();
+    while (file) {
+      if (!file.isDirectory()) {
+        catEntry ce = {};
+        strncpy(ce.path, file.path(), CAT_PATH_LEN - 1);
+        ce.fileSize = file.size();
+        entries.push_back(ce);
+      }
+      file.close();
+      file = root.openNextFile();
+    }
+    root.close();
+  }
+  if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+  for (auto& ce : entries) {
+    pace(urgent);
+    if (STORAGE.remove(ce.path)) {
+      catalogRemove(ce.path);
+      reclaimed += ce.fileSize;
+      files++;
+    }
+  }
+  deleteFolderOrFile(folder); // any remaining content, and folder
+  return reclaimed;
+}
+
+static void reclaimSpace() {
+  // delete oldest folders until free space above high watermark
+  if (sdBenchActive()) return; // benchmark fills card, and removes its files after
+  uint64_t freeBytes = STORAGE.totalBytes() - STORAGE.usedBytes();
+  freeMB = freeBytes / ONEMEG;
+  uint64_t lowMark = (uint64_t)sdMinCardFreeSpace * ONEMEG + nextNeed;
+  if (freeBytes >= lowMark) return;
+  if (!sdFreeSpaceMode) {
+    if (freeBytes < (uint64_t)sdMinCardFreeSpace * ONEMEG) {
+      LOG_WRN("Space left %s is less than minimum %uMB, recording stopped", fmtSize(freeBytes), sdMinCardFreeSpace);
+      doRecording = false;
+    }
+    return;
+  }
+  uint64_t highMark = std::max((uint64_t)sdFreeSpaceHigh * ONEMEG, lowMark);
+  uint32_t rTime = millis();
+  uint32_t folders = 0, files = 0;
+  uint64_t reclaimed = 0;
+  char todayFolder[FILE_NAME_LEN];
+  char oldestDir[FILE_NAME_LEN];
+  while (freeBytes + reclaimed < highMark) {
+    getOldestDir(oldestDir);
+    dateFormat(todayFolder, sizeof(todayFolder), true);
+    if (!strcmp(oldestDir, todayFolder) && recordingActive()) {
+      // current recording to be saved into this folder
+      LOG_WRN("Only current folder %s left to delete, deferred until recording ends", todayFolder);
+      break;
+    }
+    File dir = STORAGE.open(oldestDir);
+    bool isFolder = dir && dir.isDirectory() && strcmp(oldestDir, "/");
+    dir.close();
+    if (!isFolder) break; // only folders deleted, as temporary recording files are in root
+#if INCLUDE_FTP_HFS
+    if (sdFreeSpaceMode == 2) {
+      // transfer oldest folder before deleting it
+      LOG_INF("Uploading oldest folder %s before deletion", oldestDir);
+      if (fsStartTransfer(oldestDir)) while (fsTransferBusy()) delay(RETAIN_WAIT_MS);
+      if (!STORAGE.exists(oldestDir)) {
+        // deleted after upload
+        freeBytes = STORAGE.totalBytes() - STORAGE.usedBytes();
+        folders++;
+        continue;
+      }
+    }
+#endif
+    LOG_INF("Retention deleting oldest folder: %s", oldestDir);
+    reclaimed += deleteFolderPaced(oldestDir, freeBytes + reclaimed < (uint64_t)sdMinCardFreeSpace * ONEMEG, files);
+    folders++;
+    if (STORAGE.exists(oldestDir)) {
+      LOG_WRN("Retention unable to delete %s", oldestDir);
+      break;
+    }
+  }
+  freeMB = (freeBytes + reclaimed) / ONEMEG; // at least, as cluster slack also freed
+  rTime = millis() - rTime;
+  if (folders) {
+    char reclaimedStr[20];
+    strcpy(reclaimedStr, fmtSize(reclaimed));
+    LOG_INF("Retention reclaimed %s in %u files from %u folders in %u ms, %0.1f MB/s, %0.1f files/s, free space: %s",
+      reclaimedStr, files, folders, rTime, (float)reclaimed / ONEMEG * 1000 / std::max(rTime, (uint32_t)1),
+      files * 1000.0f / std::max(rTime, (uint32_t)1), fmtSize(STORAGE.totalBytes() - STORAGE.usedBytes()));
+  }
+}
+
+static void retentionTask(void* parameter) {
+  // check free space when prompted, or periodically
+  while (true) {
+    reclaimSpace();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RETAIN_CHECK_MS));
+  }
+}
+
+void retentionHint(size_t recordingSize) {
+  // called after each recording, with its size as estimate of next one
+  nextNeed = recordingSize;
+  if (retentionHandle != NULL) xTaskNotifyGive(retentionHandle);
+  else if (!checkFreeStorage()) doRecording = false;
+}
+
+uint64_t retentionFree() {
+  // free space on SD as last checked by retention task, 0 before first check
+  return (uint64_t)freeMB * ONEMEG;
+}
+
+void prepRetention() {
+  if (retentionHandle == NULL) xTaskCreate(&retentionTask, "retentionTask", RETENTION_STACK_SIZE, NULL, RETENTION_PRI, &retentionHandle);
+  LOG_INF("Retention keeps %uMB free, reclaiming up to %uMB", sdMinCardFreeSpace, std::max(sdFreeSpaceHigh, sdMinCardFreeSpace));
+}
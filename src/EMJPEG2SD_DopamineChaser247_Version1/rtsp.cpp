@@ -79,15 +79,15 @@ RTSPServer::TransportType determineTransportType() {
 static void sendRTSPVideo(void* p) {
   // Send jpeg frames via RTSP at current frame rate
   uint8_t taskNum = 1;
-  streamBufferSize[taskNum] = 0;
   while (true) {
-    if (xSemaphoreTake(frameSemaphore[taskNum], pdMS_TO_TICKS(MAX_FRAME_WAIT)) == pdTRUE) {
-      if (streamBufferSize[taskNum] && rtspServer.readyToSendFrame()) {
-        // use frame stored by processFrame()
-        rtspServer.sendRTSPFrame(streamBuffer[taskNum], streamBufferSize[taskNum], quality, frameData[fsizePtr].frameWidth, frameData[fsizePtr].frameHeight);
+    frameHandle* fh = getStreamFrame(taskNum);
+    if (fh != NULL) {
+      if (rtspServer.readyToSendFrame()) {
+        // use frame shared by processFrame()
+        rtspServer.sendRTSPFrame(fh->buf, fh->len, quality, fh->width, fh->height);
       }
+      releaseFrame(fh);
     }
-    streamBufferSize[taskNum] = 0; 
   }
   vTaskDelete(NULL);
 }
@@ -0,0 +1,173 @@
+// Background integrity scrub of recordings.
+// Each recording has a CRC32C of its content computed by the SD flush task
+// as it is written, and held in its catalog entry. When the SD card is idle
+// the scrub re-reads each catalogued recording and compares its CRC, marking
+// the entry as bad if the content has changed, so that corruption is found
+// before the recording is needed. Recordings without a CRC, such as those
+// saved before checksums were kept, or timelapse and recovered files, are
+// given one from their current content.
+// Encrypted recordings are checked on their decrypted content, so that reading
+// them in full also checks their authentication tag.
+// Runs on a low priority task, paused while recording, benchmarking,
+// exporting or uploading so that it does not compete for the SD card.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+
+#define SCRUB_CHECK_MS (24 * 60 * 60 * 1000) // interval between unprompted scrubs
+#define SCRUB_WAIT_MS 1000 // poll interval while waiting for SD to be idle
+#define SCRUB_CHUNK (16 * 1024) // bytes per SD read
+#define SCRUB_BENCH_LEN (4 * SCRUB_CHUNK) // bytes hashed to time CRC at boot
+
+static TaskHandle_t scrubHandle = NULL;
+static uint8_t* scrubBuf = NULL;
+
+static bool sdBusy() {
+  // other users of SD card take precedence
+  return recordState == RECORDING || sdBenchActive() || loopExportActive()
+#if INCLUDE_FTP_HFS
+    || fsTransferBusy()
+#endif
+    ;
+}
+
+static void waitIdle() {
+  while (sdBusy()) delay(SCRUB_WAIT_MS);
+}
+
+static bool fileCrc(const char* path, uint32_t& crc, size_t& fileLen, encState& state) {
+  // CRC32C of file content, false if file could not be read in full
+  waitIdle();
+  File file = recOpen(path, FILE_READ, &state);
+  if (!file || state == ENC_NO_KEY) return false;
+  fileLen = file.size();
+  crc = 0;
+  size_t readLen, done = 0;
+  while (done < fileLen) {
+    if (sdBusy()) {
+      // resume from same position when idle
+      file.close();
+      waitIdle();
+      file = recOpen(path);
+      if (!file || !file.seek(done, SeekSet)) return false;
+    }
+    readLen = file.read(scrubBuf, SCRUB_CHUNK);
+    if (!readLen) break;
+    crc = crc32c(crc, scrubBuf, readLen);
+    done += readLen;
+    delay(1); // yield
+  }
+  file.close();
+  return done == fileLen;
+}
+
+static void scrubFolder(const char* folder, uint32_t& files, uint32_t& baselined, uint32_t& bad, uint64_t& bytes) {
+  // check each recording in folder against its catalogued CRC
+  std::vector<catEntry> entries;
+  if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+  catalogFolder(folder, entries);
+  if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+  for (auto& ce : entries) {
+    if (ce.flags & CAT_OTHER) continue;
+    uint32_t crc;
+    size_t fileLen = 0;
+    encState state = ENC_NONE;
+    bool readOk = fileCrc(ce.path, crc, fileLen, state);
+    if (state == ENC_NO_KEY) continue; // encrypted with other passphrase
+    if (!readOk && !STORAGE.exists(ce.path)) continue; // deleted meanwhile
+    files++;
+    bytes += fileLen;
+    catEntry cur;
+    if (!catalogFind(ce.path, cur)) continue; // removed meanwhile
+    if (!(cur.flags & CAT_CRC)) {
+      if (!readOk) continue; // retry next scrub
+      // record CRC of current content
+      cur.crc = crc;
+      cur.fileSize = state == ENC_OPEN ? fileLen + ENC_HDR_LEN : fileLen;
+      cur.flags |= state == ENC_OPEN ? CAT_CRC | CAT_ENC : CAT_CRC;
+      catalogAdd(cur);
+      baselined++;
+    } else if (!readOk || crc != cur.crc || fileLen != encContentLen(cur)) {
+      bad++;
+      if (!readOk) LOG_WRN("Scrub unable to read all of %s", ce.path);
+      else LOG_WRN("Scrub found %s corrupt, CRC32C %08x size %u, expected %08x size %u",
+        ce.path, crc, fileLen, cur.crc, encContentLen(cur));
+      if (!(cur.flags & CAT_BAD)) {
+        cur.flags |= CAT_BAD;
+        catalogAdd(cur);
+      }
+    } else if (cur.flags & CAT_BAD) {
+      // previous failure was transient
+      LOG_INF("Scrub found %s now matches its CRC", ce.path);
+      cur.flags &= ~CAT_BAD;
+      catalogAdd(cur);
+    }
+  }
+}
+
+static void scrubStorage() {
+  // check recordings in all folders, oldest first
+  if (!catalogReady()) return;
+  scrubBuf = (uint8_t*)heap_caps_malloc(SCRUB_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+  if (scrubBuf == NULL) {
+    LOG_WRN("Insufficient memory for scrub");
+    return;
+  }
+  uint32_t sTime = millis();
+  uint32_t files = 0, baselined = 0, bad = 0;
+  uint64_t bytes = 0;
+  std::vector<catEntry> folders;
+  if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM);
+  catalogFolders(folders);
+  if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+  LOG_INF("Scrub started for %u folders", folders.size());
+  for (auto& folder : folders) scrubFolder(folder.path, files, baselined, bad, bytes);
+  free(scrubBuf);
+  scrubBuf = NULL;
+  sTime = millis() - sTime;
+  char bytesStr[20];
+  strcpy(bytesStr, fmtSize(bytes));
+  if (bad) LOG_ALT("Scrub found %u corrupt recordings", bad);
+  LOG_INF("Scrub checked %u recordings, %s in %u secs, new CRCs: %u, corrupt: %u",
+    files, bytesStr, sTime / 1000, baselined, bad);
+}
+
+static void scrubTask(void* parameter) {
+  // scrub when prompted, or periodically
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCRUB_CHECK_MS));
+    scrubStorage();
+  }
+}
+
+bool startScrub() {
+  // web request to scrub recordings now
+  if (scrubHandle == NULL || !catalogReady()) {
+    LOG_WRN("Scrub not available");
+    return false;
+  }
+  xTaskNotifyGive(scrubHandle);
+  return true;
+}
+
+void prepScrub() {
+  // time CRC to show its load on recording, as done by flush task for each SD write
+  if (crc32c(0, "123456789", 9) != 0xE3069283) LOG_ERR("CRC32C check value incorrect");
+  uint8_t* benchBuf = (uint8_t*)heap_caps_malloc(SCRUB_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+  if (benchBuf != NULL) {
+    for (int i = 0; i < SCRUB_CHUNK; i++) benchBuf[i] = i * 7;
+    uint32_t crc = 0;
+    uint32_t cTimeUs = micros();
+    for (int i = 0; i < SCRUB_BENCH_LEN / SCRUB_CHUNK; i++) crc = crc32c(crc, benchBuf, SCRUB_CHUNK);
+    cTimeUs = micros() - cTimeUs + 1;
+    free(benchBuf);
+    float mbps = (float)SCRUB_BENCH_LEN / cTimeUs; // bytes per us is MB/s
+    char rateStr[20];
+    strcpy(rateStr, fmtSize(recordingByteRate()));
+    LOG_INF("CRC32C %0.1f MB/s, %0.2f%% CPU at recording rate %s/s", mbps, 
+      100.0f * recordingByteRate() / (mbps * 1000000), rateStr);
+    LOG_VRB("CRC32C timing value %08x", crc);
+  }
+  if (scrubHandle == NULL) xTaskCreate(&scrubTask, "scrubTask", SCRUB_STACK_SIZE, NULL, SCRUB_PRI, &scrubHandle);
+}
@@ -0,0 +1,310 @@
+// On device SD card benchmark, to qualify cards for recording.
+// Sweeps write block size from 512 bytes to 64KB for a sequential file and
+// for two interleaved files, whose clusters are fragmented as with telemetry
+// files written alongside a recording. The full benchmark repeats the
+// sequential sweep with the card filled to near capacity, then writes for
+// 5 minutes paced at the current recording bitrate.
+// Each test reports p50 / p99 / max write() latency and MB/s. Results are
+// returned as JSON and kept in NVS per card, so that they survive card swaps.
+// As the SD_MMC library does not expose the card CID, cards are identified
+// by their FAT volume serial number, with card type and size in the results.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include <Preferences.h>
+#include "nvs.h"
+
+#define BENCH_NVS "sdBench" // NVS namespace for results
+#define BENCH_FILE DATA_DIR "/bench%u.tmp"
+#define BENCH_FILL DATA_DIR "/benchfill%u.tmp"
+#define BENCH_FILE_LEN (4 * ONEMEG) // bytes written per sweep test
+#define BENCH_MIN_BLOCK 512
+#define BENCH_MAX_BLOCK (64 * 1024)
+#define BENCH_HEADROOM (64 * ONEMEG) // free space left when card filled
+#define BENCH_FILL_MAX 32 // max filler files
+#define BENCH_SUSTAIN_MS (5 * 60 * 1000)
+#define BENCH_RESULTS 25 // seq, frag and full sweeps of 8 block sizes, then sustain
+#define BENCH_RESULT_LEN 128 // longest json of one result
+#define BENCH_JSON_LEN (128 + BENCH_RESULTS * BENCH_RESULT_LEN) // header then results
+#define HIST_SUB 8 // latency histogram buckets per power of 2
+#define HIST_LEN (32 * HIST_SUB)
+
+static_assert(BENCH_JSON_LEN < 4000, "SD bench results exceed NVS string limit");
+
+struct benchStats {
+  uint32_t hist[HIST_LEN]; // write() latency in us, log scale
+  uint32_t writes;
+  uint32_t maxUs;
+  uint64_t bytes;
+  uint32_t elapsedMs; // from file open to close
+};
+
+static TaskHandle_t benchHandle = NULL;
+static volatile bool benchActive = false;
+static bool benchFull = false;
+static char cardId[12]; // volume serial as hex
+static char* benchJson = NULL;
+static char* jsonPtr;
+static uint8_t* benchBuf = NULL;
+
+static size_t histIdx(uint32_t us) {
+  // values below HIST_SUB exact, then HIST_SUB buckets per power of 2
+  if (us < HIST_SUB) return us;
+  int msb = 31 - __builtin_clz(us);
+  return (msb - 2) * HIST_SUB + ((us >> (msb - 3)) & (HIST_SUB - 1));
+}
+
+static uint32_t histUpper(size_t idx) {
+  // highest latency in bucket
+  if (idx < HIST_SUB) return idx;
+  int msb = idx / HIST_SUB + 2;
+  uint32_t lower = (uint32_t)(HIST_SUB + idx % HIST_SUB) << (msb - 3);
+  return lower + (1u << (msb - 3)) - 1;
+}
+
+static uint32_t percentile(const benchStats& bs, uint32_t pct) {
+  uint64_t want = ((uint64_t)bs.writes * pct + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HIST_LEN; i++) {
+    seen += bs.hist[i];
+    if (seen >= want && seen) return std::min(histUpper(i), bs.maxUs);
+  }
+  return bs.maxUs;
+}
+
+static inline void timedWrite(File& file, size_t blockLen, benchStats& bs) {
+  uint32_t wUs = micros();
+  size_t written = file.write(benchBuf, blockLen);
+  wUs = micros() - wUs;
+  bs.hist[histIdx(wUs)]++;
+  bs.writes++;
+  bs.bytes += written;
+  if (wUs > bs.maxUs) bs.maxUs = wUs;
+}
+
+static void report(const char* test, size_t blockLen, const benchStats& bs) {
+  // log and add test results to json
+  float mbps = bs.elapsedMs ? (float)bs.bytes / ONEMEG * 1000 / bs.elapsedMs : 0;
+  uint32_t p50 = percentile(bs, 50), p99 = percentile(bs, 99);
+  LOG_INF("SD bench %s %u bytes: %0.2f MB/s, latency p50 %u us, p99 %u us, max %u us",
+    test, blockLen, mbps, p50, p99, bs.maxUs);
+  size_t room = benchJson + BENCH_JSON_LEN - jsonPtr - 2; // keep space for closing "]}"
+  int len = snprintf(jsonPtr, room,
+    "{\"test\":\"%s\",\"block\":%u,\"mbps\":%0.2f,\"p50us\":%u,\"p99us\":%u,\"maxUs\":%u,\"writes\":%u},",
+    test, blockLen, mbps, p50, p99, bs.maxUs, bs.writes);
+  if (len > 0 && (size_t)len < room) jsonPtr += len;
+  else {
+    *jsonPtr = 0;
+    LOG_WRN("SD bench results full, %s %u bytes not saved", test, blockLen);
+  }
+}
+
+static void benchSequential(const char* test, size_t blockLen) {
+  // single file written in given block size
+  benchStats bs = {};
+  char benchName[FILE_NAME_LEN];
+  snprintf(benchName, sizeof(benchName), BENCH_FILE, 0);
+  uint32_t bTime = millis();
+  File file = STORAGE.open(benchName, FILE_WRITE);
+  for (size_t i = 0; file && i < BENCH_FILE_LEN / blockLen; i++) timedWrite(file, blockLen, bs);
+  file.close();
+  bs.elapsedMs = millis() - bTime;
+  STORAGE.remove(benchName);
+  report(test, blockLen, bs);
+}
+
+static void benchInterleaved(size_t blockLen) {
+  // two files written alternately, so that clusters of each are fragmented
+  benchStats bs = {};
+  char benchName[2][FILE_NAME_LEN];
+  File files[2];
+  uint32_t bTime = millis();
+  for (int f = 0; f < 2; f++) {
+    snprintf(benchName[f], FILE_NAME_LEN, BENCH_FILE, f);
+    files[f] = STORAGE.open(benchName[f], FILE_WRITE);
+  }
+  for (size_t i = 0; files[0] && files[1] && i < BENCH_FILE_LEN / blockLen; i++) timedWrite(files[i & 1], blockLen, bs);
+  for (int f = 0; f < 2; f++) files[f].close();
+  bs.elapsedMs = millis() - bTime;
+  for (int f = 0; f < 2; f++) STORAGE.remove(benchName[f]);
+  report("frag", blockLen, bs);
+}
+
+static void benchSustained() {
+  // write RAMSIZE blocks paced at recording byte rate
+  benchStats bs = {};
+  uint32_t byteRate = std::max(recordingByteRate(), (uint32_t)RAMSIZE);
+  uint32_t intervalUs = (uint64_t)RAMSIZE * 1000000 / byteRate;
+  char benchName[FILE_NAME_LEN];
+  snprintf(benchName, sizeof(benchName), BENCH_FILE, 0);
+  uint32_t bTime = millis();
+  uint32_t startUs = micros();
+  File file = STORAGE.open(benchName, FILE_WRITE);
+  for (uint32_t i = 0; file && millis() - bTime < BENCH_SUSTAIN_MS; i++) {
+    // wait for next block due, unless behind
+    int32_t waitUs = (int32_t)(startUs + i * intervalUs - micros());
+    if (waitUs > 1000) delay(waitUs / 1000);
+    timedWrite(file, RAMSIZE, bs);
+  }
+  file.close();
+  bs.elapsedMs = millis() - bTime;
+  STORAGE.remove(benchName);
+  LOG_INF("SD bench sustained target %0.2f MB/s", (float)byteRate / ONEMEG);
+  report("sustain", RAMSIZE, bs);
+}
+
+static int fillCard() {
+  // fill card to near capacity with preallocated files, which only update the FAT
+  int fills = 0;
+  uint64_t freeBytes = STORAGE.totalBytes() - STORAGE.usedBytes();
+  size_t fillLen = UINT32_MAX - ONEMEG; // FAT32 file size limit
+  while (fills < BENCH_FILL_MAX && freeBytes > BENCH_HEADROOM + ONEMEG) {
+    fillLen = std::min((uint64_t)fillLen, freeBytes - BENCH_HEADROOM);
+    char fillName[FILE_NAME_LEN];
+    snprintf(fillName, sizeof(fillName), BENCH_FILL, fills);
+    if (preallocFile(fillName, fillLen)) {
+      fills++;
+      freeBytes -= fillLen;
+    } else if ((fillLen /= 2) < ONEMEG) break; // no contiguous space of that size
+  }
+  LOG_INF("SD bench filled card leaving %s free", fmtSize(STORAGE.totalBytes() - STORAGE.usedBytes()));
+  return fills;
+}
+
+static void removeBenchFiles() {
+  // remove any files left by interrupted benchmark
+  char benchName[FILE_NAME_LEN];
+  for (int i = 0; i < BENCH_FILL_MAX; i++) {
+    snprintf(benchName, sizeof(benchName), BENCH_FILL, i);
+    STORAGE.remove(benchName);
+  }
+  for (int i = 0; i < 2; i++) {
+    snprintf(benchName, sizeof(benchName), BENCH_FILE, i);
+    STORAGE.remove(benchName);
+  }
+}
+
+static uint32_t volumeSerial() {
+  // FAT volume serial number from boot sector, via partition table if present
+  uint8_t* sector = benchBuf;
+  if (!SD_MMC.readRAW(sector, 0)) return 0;
+  bool isBoot = (sector[0] == 0xEB || sector[0] == 0xE9);
+  if (!isBoot && !SD_MMC.readRAW(sector, *(uint32_t*)(sector + 0x1C6))) return 0;
+  if (!memcmp(sector + 3, "EXFAT", 5)) return *(uint32_t*)(sector + 0x64);
+  if (!memcmp(sector + 0x52, "FAT32", 5)) return *(uint32_t*)(sector + 0x43);
+  return *(uint32_t*)(sector + 0x27); // FAT12 / FAT16
+}
+
+static void saveResults() {
+  Preferences benchPrefs;
+  if (benchPrefs.begin(BENCH_NVS, false)) {
+    if (!benchPrefs.putString(cardId, benchJson)) LOG_WRN("Insufficient NVS space to save SD bench results");
+    benchPrefs.end();
+  }
+}
+
+static void benchTask(void* parameter) {
+  // run benchmark with recording suspended
+  uint32_t bTime = millis();
+  bool saveRecording = doRecording;
+  doRecording = false;
+  while (recordState == RECORDING) delay(1000); // let current recording finish
+  removeBenchFiles();
+  uint8_t cardType = SD_MMC.cardType();
+  snprintf(cardId, sizeof(cardId), "%08lx", volumeSerial());
+  jsonPtr = benchJson;
+  jsonPtr += sprintf(jsonPtr, "{\"card\":\"%s\",\"type\":\"%s\",\"sizeMB\":%llu,\"time\":%lu,\"full\":%u,\"tests\":[",
+    cardId, cardType == CARD_MMC ? "MMC" : cardType == CARD_SD ? "SDSC" : cardType == CARD_SDHC ? "SDHC" : "UNKNOWN",
+    SD_MMC.cardSize() / ONEMEG, (uint32_t)getEpoch(), benchFull);
+  LOG_INF("SD bench started on card %s", cardId);
+
+  for (size_t blockLen = BENCH_MIN_BLOCK; blockLen <= BENCH_MAX_BLOCK; blockLen *= 2) benchSequential("seq", blockLen);
+  for (size_t blockLen = BENCH_MIN_BLOCK; blockLen <= BENCH_MAX_BLOCK; blockLen *= 2) benchInterleaved(blockLen);
+  if (benchFull) {
+    int fills = fillCard();
+    if (fills) for (size_t blockLen = BENCH_MIN_BLOCK; blockLen <= BENCH_MAX_BLOCK; blockLen *= 2) benchSequential("full", blockLen);
+    removeBenchFiles();
+    benchSustained();
+  }
+  if (jsonPtr[-1] == ',') jsonPtr--; // drop final comma
+  strcpy(jsonPtr, "]}");
+  saveResults();
+  LOG_ALT("SD bench completed for card %s in %lu secs", cardId, (millis() - bTime) / 1000);
+  doRecording = saveRecording;
+  benchActive = false;
+  benchHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+bool sdBenchActive() {
+  return benchActive;
+}
+
+bool startSdBench(bool fullBench) {
+  // web request to benchmark SD card, sweep only or full
+  if (benchActive || (fs::SDMMCFS*)&STORAGE != &SD_MMC) {
+    LOG_WRN("SD bench not available");
+    return false;
+  }
+  // sd driver transfers from internal ram without bounce buffer
+  if (benchBuf == NULL) benchBuf = (uint8_t*)heap_caps_malloc(BENCH_MAX_BLOCK, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+  if (benchJson == NULL) benchJson = psramFound() ? (char*)ps_malloc(BENCH_JSON_LEN) : (char*)malloc(BENCH_JSON_LEN);
+  if (benchBuf == NULL || benchJson == NULL) {
+    LOG_WRN("Insufficient memory for SD bench");
+    return false;
+  }
+  memset(benchBuf, 0xAA, BENCH_MAX_BLOCK);
+  benchFull = fullBench;
+  benchActive = true;
+  xTaskCreate(&benchTask, "benchTask", BENCH_STACK_SIZE, NULL, BENCH_PRI, &benchHandle);
+  debugMemory("startSdBench");
+  return true;
+}
+
+void sdBenchResults(httpd_req_t* req, const char* card) {
+  // send stored results as json, for given card id, current card if empty, or all
+  Preferences benchPrefs;
+  httpd_resp_set_type(req, "application/json");
+  if (!benchPrefs.begin(BENCH_NVS, true)) {
+    httpd_resp_sendstr(req, "{}");
+    return;
+  }
+  if (!strcmp(card, "all")) {
+    // object of results keyed by card id
+    httpd_resp_sendstr_chunk(req, "{");
+    nvs_iterator_t it = NULL;
+    bool first = true;
+    esp_err_t res = nvs_entry_find(NVS_DEFAULT_PART_NAME, BENCH_NVS, NVS_TYPE_STR, &it);
+    while (res == ESP_OK) {
+      nvs_entry_info_t info;
+      nvs_entry_info(it, &info);
+      String result = benchPrefs.getString(info.key);
+      char keyStr[NVS_KEY_NAME_MAX_SIZE + 8];
+      sprintf(keyStr, "%s\"%s\":", first ? "" : ",", info.key);
+      httpd_resp_sendstr_chunk(req, keyStr);
+      httpd_resp_sendstr_chunk(req, result.c_str());
+      first = false;
+      res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    httpd_resp_sendstr_chunk(req, "}");
+    httpd_resp_sendstr_chunk(req, NULL);
+  } else {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    if (strlen(card)) snprintf(key, sizeof(key), "%s", card);
+    else if (benchActive) snprintf(key, sizeof(key), "%s", cardId); // buffer in use
+    else {
+      if (benchBuf == NULL) benchBuf = (uint8_t*)heap_caps_malloc(BENCH_MAX_BLOCK, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+      snprintf(key, sizeof(key), "%08lx", benchBuf == NULL ? 0 : volumeSerial());
+    }
+    String result = benchPrefs.isKey(key) ? benchPrefs.getString(key) : String("{}");
+    httpd_resp_sendstr(req, result.c_str());
+  }
+  benchPrefs.end();
+}
+
+void prepSdBench() {
+  // tidy up after any benchmark interrupted by restart
+  if ((fs::SDMMCFS*)&STORAGE == &SD_MMC) removeBenchFiles();
+}
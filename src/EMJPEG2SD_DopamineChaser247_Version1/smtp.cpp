@@ -139,7 +139,11 @@ static bool emailSend(const char* mimeType = MIME_TYPE, const char* fileName = A
   }
   // cleanly terminate connection
   remoteServerClose(client);
+#ifdef ISCAM
+  releaseAlert();
+#else
   alertBufferSize = 0;
+#endif
   return res;
 }
 
@@ -23,11 +23,10 @@ bool streamVid = false;
 bool streamAud = false;
 bool streamSrt = false;
 static bool isStreaming[MAX_STREAMS] = {false};
-size_t streamBufferSize[MAX_STREAMS] = {0};
-byte* streamBuffer[MAX_STREAMS] = {NULL}; // buffer for stream frame
 static char variable[FILE_NAME_LEN]; 
 static char value[FILE_NAME_LEN];
 uint16_t sustainId = 0;
+static uint32_t playbackFrame = 0; // frame to start playback from
 uint8_t numStreams = 1;
 uint8_t vidStreams = 1;
 int srtInterval = 1; // subtitle interval in secs
@@ -68,7 +67,7 @@ static void showPlayback(httpd_req_t* req) {
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
     char hdrBuf[HDR_BUF_LEN];
-    openSDfile(inFileName);
+    openSDfile(inFileName, playbackFrame);
     mjpegData = getNextFrame(true);
     while (doPlayback) {
       size_t jpgLen = mjpegData.buffLen;
@@ -106,11 +105,11 @@ static void showStream(httpd_req_t* req, uint8_t taskNum) {
   esp_err_t res = ESP_OK; 
   size_t jpgLen = 0;
   uint8_t* jpgBuf = NULL;
+  frameHandle* fh = NULL;
   uint32_t startTime = millis();
   uint32_t frameCnt = 0;
   uint32_t mjpegLen = 0;
   isStreaming[taskNum] = true;
-  streamBufferSize[taskNum] = 0;
   if (!taskNum) motionJpegLen = 0;
   // output header for streaming request
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
@@ -118,24 +117,22 @@ static void showStream(httpd_req_t* req, uint8_t taskNum) {
   char hdrBuf[HDR_BUF_LEN];
   while (isStreaming[taskNum]) {
     // stream from camera at current frame rate
-    if (xSemaphoreTake(frameSemaphore[taskNum], pdMS_TO_TICKS(MAX_FRAME_WAIT)) == pdFAIL) {
-      // failed to take semaphore, allow retry
-      streamBufferSize[taskNum] = 0;
-      continue;
-    }
+    fh = getStreamFrame(taskNum);
+    // failed to get frame, allow retry
+    if (fh == NULL) continue;
     if (dbgMotion && !taskNum && recordState == IDLE) {
     // Motion tracking stream on task 0 only, wait for new move mapping image
+    releaseFrame(fh);
+    fh = NULL;
     if (xSemaphoreTake(motionSemaphore, pdMS_TO_TICKS(MAX_FRAME_WAIT)) == pdFAIL) 
         continue;
     jpgLen = motionJpegLen;
     if (!jpgLen) continue;
     jpgBuf = motionJpeg;
     } else {
-      // live stream 
-      if (!streamBufferSize[taskNum]) continue;
-      jpgLen = streamBufferSize[taskNum];
-      // use frame stored by processFrame()
-      jpgBuf = streamBuffer[taskNum];
+      // live stream, use frame shared by processFrame()
+      jpgLen = fh->len;
+      jpgBuf = fh->buf;
     }
     if (res == ESP_OK) {
       // send next frame in stream
@@ -146,7 +143,9 @@ static void showStream(httpd_req_t* req, uint8_t taskNum) {
       frameCnt++;
     } 
     mjpegLen += jpgLen;
-    jpgLen = streamBufferSize[taskNum] = 0;
+    jpgLen = 0;
+    releaseFrame(fh);
+    fh = NULL;
     if (dbgMotion && !taskNum) motionJpegLen = 0;
     if (res != ESP_OK) {
       // get send error when browser closes stream 
@@ -154,6 +153,7 @@ static void showStream(httpd_req_t* req, uint8_t taskNum) {
       isStreaming[taskNum] = false;
     }     
   }
+  cancelStreamFrame(taskNum);
   if (res == ESP_OK) httpd_resp_sendstr_chunk(req, NULL);
   uint32_t mjpegTime = millis() - startTime;
   float mjpegTimeF = float(mjpegTime) / 1000; // secs
@@ -265,13 +265,7 @@ void startSustainTasks() {
     LOG_WRN("numStreams %d exceeds MAX_STREAMS %d", numStreams, MAX_STREAMS);
     numStreams = MAX_STREAMS;
   }
-  if (maxFrameBuffSize * (vidStreams + 1) > ESP.getFreePsram()) {
-    LOG_WRN("Insufficient PSRAM for NVR streams");
-    vidStreams = 1;
-    streamVid = streamAud = streamSrt = false;
-  }
-  for (int i = 0; i < vidStreams; i++)
-    if (streamBuffer[i] == NULL) streamBuffer[i] = (byte*)ps_malloc(maxFrameBuffSize); 
+  // stream frames are shared with processFrame() so no stream buffers needed
 
   for (int i = 0; i < numStreams; i++) {
     sustainReq[i].taskNum = i; // so task knows its number
@@ -344,6 +338,8 @@ esp_err_t appSpecificSustainHandler(httpd_req_t* req) {
           sustainReq[i].req->aux = psramFound() ? ps_malloc(AUX_STRUCT_SIZE) : malloc(AUX_STRUCT_SIZE); 
           memcpy(sustainReq[i].req->aux, req->aux, AUX_STRUCT_SIZE);
           strncpy(sustainReq[i].activity, variable, sizeof(sustainReq[i].activity) - 1); 
+          // optional file and start position, eg playback=<file>&t=<secs>
+          if (!strcmp(variable, "playback")) playbackFrame = parseSeek(value);
           // activate relevant task
           xTaskNotifyGive(sustainHandle[i]);
           return ESP_OK;
@@ -180,8 +180,10 @@ static void telemetryTask(void* pvParameters) {
     // rename temp files to specific file names using avi file name with relevant extension
     changeExtension(teleFileName, CSV_EXT);
     STORAGE.rename(TELETEMP, teleFileName);
+    catalogAddFile(teleFileName);
     changeExtension(teleFileName, SRT_EXT);
     STORAGE.rename(SRTTEMP, teleFileName);
+    catalogAddFile(teleFileName);
     LOG_INF("Saved %d entries in telemetry files", srtSeqNo);
   }
 }
@@ -0,0 +1,436 @@
+// Host tests of the OpenDML AVI writer in avi.cpp, checked by aviCheck.h:
+// - random recordings, with empty frames, audio, timelapse, frame alignment
+//   and interrupted recordings, must validate clean
+// - targeted corruptions of header, list and index fields must each be detected
+// - audio strh length must be in samples rather than bytes
+// - unfinished recordings cut at every chunk boundary, and within each chunk,
+//   must recover exactly the frames completed before the cut
+// - an interrupted recording in a preallocated file over an earlier recording
+//   must only be recovered up to its committed length, see recCommit.cpp
+// - when built with a reduced ODML_SEG_MAX, as aviRiffTest, recordings span
+//   several RIFFs, and every frame must be located through the super index
+//
+// Usage: aviTest [iterations] [seed]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "aviCheck.h"
+#include "host.h"
+#include <random>
+#include <unistd.h>
+
+#define CHECK_BUF 32768
+
+struct cutPoint {
+  size_t pos;
+  uint32_t frames; // complete frames before pos
+};
+
+struct recCase {
+  bool isTL;
+  bool audio;
+  bool crash; // recording interrupted, so recovered
+  uint32_t frames;
+  uint16_t alignLen;
+};
+
+static std::mt19937 rng;
+static uint8_t checkBuf[CHECK_BUF];
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static void noIssue(void*, const char* issue) {
+  if (getenv("V")) printf("  issue: %s\n", issue);
+}
+
+static uint32_t checkFile(const char* name, aviCheck& ac) {
+  // number of issues found by checker in file on emulated SD
+  FILE* f = fopen(hostPath(name).c_str(), "rb");
+  if (f == NULL) return 1;
+  fseeko(f, 0, SEEK_END);
+  uint64_t fileSize = ftello(f);
+  uint32_t issues = checkAviFile(ac, hostRead, noIssue, f, fileSize, checkBuf, sizeof(checkBuf));
+  fclose(f);
+  return issues;
+}
+
+static void writeIndex(File& aviFile, bool isTL) {
+  // write out pending index and RIFF data, as SD writer task does
+  const uint8_t* idxData;
+  size_t idxLen;
+  while ((idxLen = getAviIndex(&idxData, isTL))) aviFile.write(idxData, idxLen);
+}
+
+static void writeChunk(File& aviFile, const uint8_t* chunkId, size_t chunkLen, uint8_t fill) {
+  // chunk header and content, jpeg starting with SOF0 for VGA frame
+  static const uint8_t sof[] = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x01, 0xE0, 0x02, 0x80};
+  uint8_t chunkHdr[CHUNK_HDR];
+  uint32_t len32 = chunkLen;
+  memcpy(chunkHdr, chunkId, 4);
+  memcpy(chunkHdr + 4, &len32, 4);
+  aviFile.write(chunkHdr, CHUNK_HDR);
+  if (!chunkLen) return;
+  std::vector<uint8_t> content(chunkLen, fill);
+  if (chunkId == dcBuf) memcpy(content.data(), sof, std::min(chunkLen, sizeof(sof)));
+  aviFile.write(content.data(), chunkLen);
+}
+
+static uint32_t recoverFile(const char* name, bool isTL) {
+  // rebuild index and header of interrupted recording, as recoverAvi() in mjpeg2sd.cpp
+  File aviFile = STORAGE.open(name, "r+");
+  size_t tempSize = aviFile.size();
+  uint8_t frameType = FRAMESIZE_QVGA;
+  uint32_t frames = recoverAviIndex(aviFile, checkBuf, sizeof(checkBuf), frameType, isTL);
+  if (!frames) {
+    aviFile.close();
+    return 0;
+  }
+  finalizeAviIndex(frames, isTL);
+  writeIndex(aviFile, isTL);
+  size_t aviLen = aviFile.position();
+  buildAviHdr(isTL ? 1 : 10, frameType, frames, isTL);
+  patchAviSegments(aviFile, isTL);
+  aviFile.seek(0, SeekSet);
+  aviFile.write(aviHeader, AVI_HEADER_LEN);
+  aviFile.close();
+  if (tempSize > aviLen && truncate(hostPath(name).c_str(), aviLen)) CHECK(false, "truncate %s", name);
+  CHECK(frameType == FRAMESIZE_VGA, "recovered frame type %u", frameType);
+  return frames;
+}
+
+static uint32_t makeAvi(const char* name, const recCase& rc) {
+  // write random recording through the index and RIFF split functions,
+  // as the SD writer task does, returning number of frames
+  File aviFile = STORAGE.open(name, FILE_WRITE);
+  prepAviIndex(rc.isTL);
+  uint8_t zeroHdr[AVI_HEADER_LEN] = {0};
+  aviFile.write(zeroHdr, AVI_HEADER_LEN);
+  for (uint32_t i = 0; i < rc.frames; i++) {
+    // some empty frames, which represent gaps in capture
+    size_t jpegLen = rnd(20) ? 16 + rnd(rnd(4) ? 3000 : 60000) : 0;
+    size_t frameLen = (jpegLen + 3) & ~3; // with filler
+    if (prepAviSplit(frameLen + CHUNK_HDR, rc.isTL, frameLen ? rc.alignLen : 0)) writeIndex(aviFile, rc.isTL);
+    if (frameLen && rc.alignLen) CHECK((aviFile.position() + CHUNK_HDR) % rc.alignLen == 0, "frame %u not aligned", i);
+    writeChunk(aviFile, dcBuf, frameLen, 0xAB);
+    buildAviIdx(frameLen, true, rc.isTL);
+    if (rc.audio && !rc.isTL && !rnd(3)) {
+      size_t audLen = sizeof(int16_t) * (1 + rnd(4000));
+      if (prepAviSplit(audLen + CHUNK_HDR, rc.isTL)) writeIndex(aviFile, rc.isTL);
+      writeChunk(aviFile, wbBuf, audLen, 0x01);
+      buildAviIdx(audLen, false, rc.isTL);
+    }
+  }
+  if (rc.crash) {
+    // partial frame left by restart
+    aviFile.write((const uint8_t*)"00dc\x10\0\0\0abc", 11);
+    aviFile.close();
+    return recoverFile(name, rc.isTL);
+  }
+  finalizeAviIndex(rc.frames, rc.isTL, rc.alignLen ? 512 : 0);
+  writeIndex(aviFile, rc.isTL);
+  if (rc.alignLen) CHECK(aviFile.position() % 512 == 0, "file length %zu not sector multiple", aviFile.position());
+  buildAviHdr(rc.isTL ? 1 : 10, FRAMESIZE_VGA, rc.frames, rc.isTL);
+  patchAviSegments(aviFile, rc.isTL);
+  aviFile.seek(0, SeekSet);
+  aviFile.write(aviHeader, AVI_HEADER_LEN);
+  aviFile.close();
+  return rc.frames;
+}
+
+static size_t findId(const uint8_t* hdr, const char* id, int nth = 0) {
+  // offset of nth occurrence of fourcc in header, 0 if absent
+  for (size_t i = 4; i + 4 <= AVI_HEADER_LEN; i++)
+    if (!memcmp(hdr + i, id, 4) && !nth--) return i;
+  return 0;
+}
+
+static bool corruptDetected(const char* name, size_t offset, uint32_t delta) {
+  // alter 32 bit field, check issue found, then restore field
+  FILE* f = fopen(hostPath(name).c_str(), "r+b");
+  uint32_t val;
+  fseeko(f, offset, SEEK_SET);
+  if (fread(&val, 4, 1, f) != 1) val = 0;
+  val += delta;
+  fseeko(f, offset, SEEK_SET);
+  fwrite(&val, 4, 1, f);
+  fclose(f);
+  aviCheck ac;
+  bool detected = checkFile(name, ac) > 0;
+  f = fopen(hostPath(name).c_str(), "r+b");
+  val -= delta;
+  fseeko(f, offset, SEEK_SET);
+  fwrite(&val, 4, 1, f);
+  fclose(f);
+  return detected;
+}
+
+static void corruptTest(const char* name, const recCase& rc, const aviCheck& clean) {
+  // each header, list and index field must be checked against content
+  struct field { const char* what; size_t offset; uint32_t delta; };
+  std::vector<field> fields;
+  uint8_t hdr[AVI_HEADER_LEN];
+  FILE* f = fopen(hostPath(name).c_str(), "rb");
+  if (fread(hdr, 1, AVI_HEADER_LEN, f) != AVI_HEADER_LEN) CHECK(false, "short header");
+  fclose(f);
+  size_t avih = findId(hdr, "avih") + CHUNK_HDR;
+  size_t vidStrh = findId(hdr, "strh") + CHUNK_HDR;
+  size_t audStrh = findId(hdr, "strh", 1);
+  size_t indx = findId(hdr, "indx") + CHUNK_HDR + 24; // first super index entry
+  fields.push_back({"RIFF size", 4, 1});
+  fields.push_back({"avih usecs", avih, 5}); // rounding tolerated
+  fields.push_back({"avih frames", avih + 16, 1});
+  fields.push_back({"avih width", avih + 32, 1});
+  fields.push_back({"hdrl size", findId(hdr, "hdrl") - 4, 1});
+  fields.push_back({"video strh length", vidStrh + 32, 1});
+  if (audStrh) fields.push_back({"audio strh length", audStrh + CHUNK_HDR + 32, 1});
+  fields.push_back({"dmlh frames", findId(hdr, "dmlh") + CHUNK_HDR, 1});
+  fields.push_back({"super offset", indx, 1});
+  fields.push_back({"super size", indx + 8, 1});
+  fields.push_back({"super duration", indx + 12, 1});
+  fields.push_back({"movi size", findId(hdr, "movi") - 4, 1});
+  if (clean.idx1Cnt) {
+    size_t lastEntry = clean.idx1Pos + (clean.idx1Cnt - 1) * 16;
+    fields.push_back({"idx1 size", clean.idx1Pos - 4, 1});
+    fields.push_back({"idx1 offset", lastEntry + 8, 1});
+    fields.push_back({"idx1 length", lastEntry + 12, 1});
+  }
+  for (auto& fld : fields)
+    CHECK(corruptDetected(name, fld.offset, fld.delta), "%s corruption undetected, tl %d audio %d crash %d frames %u",
+      fld.what, rc.isTL, rc.audio, rc.crash, rc.frames);
+}
+
+static void fuzzTest(int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    recCase rc;
+    rc.isTL = !rnd(3);
+    rc.audio = !rnd(2);
+    rc.crash = !rnd(5);
+    rc.frames = 1 + rnd(rnd(3) ? 300 : 12000);
+    rc.alignLen = rnd(3) ? (rnd(2) ? 512 : 8192) : 0;
+    const char* name = rc.isTL ? TLTEMP : AVITEMP;
+    uint32_t frames = makeAvi(name, rc);
+    aviCheck ac;
+    uint32_t issues = checkFile(name, ac);
+    CHECK(!issues, "%u issues, tl %d audio %d crash %d frames %u", issues, rc.isTL, rc.audio, rc.crash, frames);
+    CHECK(ac.frames == frames, "checker found %u frames of %u", ac.frames, frames);
+    if (!issues) corruptTest(name, rc, ac);
+  }
+}
+
+static void audioLengthTest() {
+  // strh dwLength of audio stream is in samples, earlier builds wrote bytes
+  recCase rc = {false, true, false, 500, 0};
+  makeAvi(AVITEMP, rc);
+  aviCheck ac;
+  CHECK(!checkFile(AVITEMP, ac), "audio recording has issues");
+  CHECK(ac.audBytes && ac.audLength == ac.audBytes / sizeof(int16_t), "audio length %u for %llu bytes",
+    ac.audLength, (unsigned long long)ac.audBytes);
+  uint8_t hdr[AVI_HEADER_LEN];
+  FILE* f = fopen(hostPath(AVITEMP).c_str(), "rb");
+  if (fread(hdr, 1, AVI_HEADER_LEN, f) != AVI_HEADER_LEN) CHECK(false, "short header");
+  fclose(f);
+  size_t audLength = findId(hdr, "strh", 1) + CHUNK_HDR + 32;
+  CHECK(corruptDetected(AVITEMP, audLength, ac.audBytes - ac.audLength), "audio length in bytes undetected");
+}
+
+static uint32_t cutTest(uint32_t frameCnt, size_t maxFrame, uint16_t alignLen, uint32_t stride) {
+  // unfinished recording, as left by restart, cut after every chunk and index part written,
+  // and within each, checking every stride'th cut and all of those around a RIFF split.
+  // Returns number of RIFFs
+  std::vector<cutPoint> cuts;
+  std::vector<size_t> splits;
+  File aviFile = STORAGE.open(AVITEMP, FILE_WRITE);
+  prepAviIndex(false);
+  uint8_t zeroHdr[AVI_HEADER_LEN] = {0};
+  aviFile.write(zeroHdr, AVI_HEADER_LEN);
+  uint32_t frames = 0, riffs = 1;
+  cuts.push_back({aviFile.position(), 0});
+  auto writeParts = [&]() {
+    const uint8_t* idxData;
+    size_t idxLen;
+    while ((idxLen = getAviIndex(&idxData, false))) {
+      aviFile.write(idxData, idxLen);
+      if (idxLen >= 12 && !memcmp(idxData + 8, "AVIX", 4)) {
+        riffs++;
+        splits.push_back(cuts.size());
+      }
+      cuts.push_back({aviFile.position(), frames});
+    }
+  };
+  for (uint32_t i = 0; i < frameCnt; i++) {
+    size_t frameLen = rnd(20) ? (16 + rnd(maxFrame)) & ~3 : 0;
+    if (prepAviSplit(frameLen + CHUNK_HDR, false, frameLen ? alignLen : 0)) writeParts();
+    writeChunk(aviFile, dcBuf, frameLen, 0xAB);
+    buildAviIdx(frameLen, true, false);
+    cuts.push_back({aviFile.position(), ++frames});
+    if (!rnd(3)) {
+      size_t audLen = sizeof(int16_t) * (1 + rnd(2000));
+      if (prepAviSplit(audLen + CHUNK_HDR, false)) writeParts();
+      writeChunk(aviFile, wbBuf, audLen, 0x01);
+      buildAviIdx(audLen, false, false);
+      cuts.push_back({aviFile.position(), frames});
+    }
+  }
+  aviFile.close();
+
+  std::vector<uint8_t> orig(cuts.back().pos);
+  FILE* f = fopen(hostPath(AVITEMP).c_str(), "rb");
+  if (fread(orig.data(), 1, orig.size(), f) != orig.size()) CHECK(false, "short read");
+  fclose(f);
+  std::vector<bool> nearSplit(cuts.size());
+  for (size_t s : splits) for (size_t i = s > 2 ? s - 2 : 0; i < std::min(s + 8, cuts.size()); i++) nearSplit[i] = true;
+  uint32_t checked = 0;
+  for (size_t i = 0; i < cuts.size(); i++) {
+    if (i % stride && !nearSplit[i]) continue;
+    size_t nextPos = i + 1 < cuts.size() ? cuts[i + 1].pos : cuts[i].pos;
+    // at boundary, then part way into following chunk
+    for (size_t cutPos : {cuts[i].pos, cuts[i].pos + rnd(nextPos - cuts[i].pos)}) {
+      f = fopen(hostPath(AVITEMP).c_str(), "wb");
+      fwrite(orig.data(), 1, cutPos, f);
+      fclose(f);
+      uint32_t got = recoverFile(AVITEMP, false);
+      CHECK(got == cuts[i].frames, "cut at %zu recovered %u frames, expected %u", cutPos, got, cuts[i].frames);
+      if (got) {
+        aviCheck ac;
+        uint32_t issues = checkFile(AVITEMP, ac);
+        CHECK(!issues && ac.frames == got, "cut at %zu recovered with %u issues, %u frames", cutPos, issues, ac.frames);
+      }
+      checked++;
+    }
+  }
+  if (getenv("V")) printf("cutTest: %u cuts of %zu bytes, %u RIFFs\n", checked, orig.size(), riffs);
+  return riffs;
+}
+
+static void staleTest() {
+  // earlier recording with same frame sizes left in preallocated space, so that its
+  // chunks continue those of the interrupted recording written over it
+  std::vector<size_t> frameLens(300);
+  for (auto& len : frameLens) len = (16 + rnd(3000)) & ~3;
+  uint32_t committed = 0;
+  for (bool stale : {true, false}) {
+    // preallocated file opened "r+" by openAvi()
+    File aviFile = STORAGE.open(AVITEMP, stale ? FILE_WRITE : "r+");
+    if (!stale) CHECK(commitBegin(AVITEMP), "commit record not created");
+    prepAviIndex(false);
+    uint8_t zeroHdr[AVI_HEADER_LEN] = {0};
+    aviFile.write(zeroHdr, AVI_HEADER_LEN);
+    uint32_t count = stale ? frameLens.size() : frameLens.size() / 2;
+    for (uint32_t i = 0; i < count; i++) {
+      if (prepAviSplit(frameLens[i] + CHUNK_HDR, false)) writeIndex(aviFile, false);
+      writeChunk(aviFile, dcBuf, frameLens[i], stale ? 0x5A : 0xAB);
+      buildAviIdx(frameLens[i], true, false);
+      if (!stale && i % 40 == 39) {
+        // flushed each AVI_SYNC_MS by sdFlushTask()
+        aviFile.flush();
+        commitLength(aviFile.position());
+        committed = i + 1;
+      }
+    }
+    aviFile.close();
+  }
+  std::string path = hostPath(AVITEMP);
+  std::vector<uint8_t> image;
+  FILE* f = fopen(path.c_str(), "rb");
+  fseeko(f, 0, SEEK_END);
+  image.resize(ftello(f));
+  fseeko(f, 0, SEEK_SET);
+  if (fread(image.data(), 1, image.size(), f) != image.size()) CHECK(false, "short read");
+  fclose(f);
+
+  // whole file would recover earlier frames as part of this recording
+  uint32_t spliced = recoverFile(AVITEMP, false);
+  CHECK(spliced > frameLens.size() / 2, "stale tail not recovered, %u frames", spliced);
+  f = fopen(path.c_str(), "wb");
+  fwrite(image.data(), 1, image.size(), f);
+  fclose(f);
+
+  // as trimUncommitted() in mjpeg2sd.cpp
+  size_t commitLen = 0;
+  CHECK(!committedLength(MP4TEMP, commitLen), "commit record applied to other file");
+  CHECK(committedLength(AVITEMP, commitLen) && commitLen < image.size(), "committed length %zu of %zu", commitLen, image.size());
+  if (truncate(path.c_str(), commitLen)) CHECK(false, "truncate %s", AVITEMP);
+  commitEnd();
+  CHECK(!committedLength(AVITEMP, commitLen), "commit record not removed");
+  uint32_t got = recoverFile(AVITEMP, false);
+  CHECK(got == committed, "recovered %u frames, %u committed", got, committed);
+  aviCheck ac;
+  uint32_t issues = checkFile(AVITEMP, ac);
+  CHECK(!issues && ac.frames == committed, "recovered file has %u issues, %u frames", issues, ac.frames);
+  File aviFile = STORAGE.open(AVITEMP, FILE_READ);
+  size_t chunkPos = 0;
+  uint8_t fill = 0;
+  bool found = seekAviFrame(aviFile, committed - 1, chunkPos);
+  aviFile.seek(chunkPos + CHUNK_HDR + frameLens[committed - 1] - 1, SeekSet);
+  aviFile.read(&fill, 1);
+  aviFile.close();
+  CHECK(found && fill == 0xAB, "last recovered frame from earlier recording");
+}
+
+#ifdef ODML_SEG_MAX
+static void multiRiffTest() {
+  // recording of several RIFFs, with frames located as for playback
+  recCase rc = {false, true, false, 0, 512};
+  std::vector<size_t> frameLens;
+  File aviFile = STORAGE.open(AVITEMP, FILE_WRITE);
+  prepAviIndex(false);
+  uint8_t zeroHdr[AVI_HEADER_LEN] = {0};
+  aviFile.write(zeroHdr, AVI_HEADER_LEN);
+  size_t totalLen = 0;
+  while (totalLen < 5 * ODML_SEG_MAX) {
+    size_t frameLen = (16 + rnd(40000)) & ~3;
+    if (prepAviSplit(frameLen + CHUNK_HDR, false, rc.alignLen)) writeIndex(aviFile, false);
+    writeChunk(aviFile, dcBuf, frameLen, (uint8_t)frameLens.size());
+    buildAviIdx(frameLen, true, false);
+    frameLens.push_back(frameLen);
+    totalLen += frameLen;
+  }
+  rc.frames = frameLens.size();
+  finalizeAviIndex(rc.frames, false, 512);
+  writeIndex(aviFile, false);
+  buildAviHdr(10, FRAMESIZE_VGA, rc.frames, false);
+  patchAviSegments(aviFile, false);
+  aviFile.seek(0, SeekSet);
+  aviFile.write(aviHeader, AVI_HEADER_LEN);
+  aviFile.close();
+
+  aviCheck ac;
+  uint32_t issues = checkFile(AVITEMP, ac);
+  CHECK(!issues, "multi RIFF recording has %u issues", issues);
+  CHECK(ac.riffs >= 5, "recording of %zu bytes in %u RIFFs", totalLen, ac.riffs);
+  aviFile = STORAGE.open(AVITEMP, FILE_READ);
+  for (uint32_t i = 0; i < rc.frames; i += 1 + rnd(50)) {
+    size_t chunkPos = 0;
+    uint32_t chunkLen = 0;
+    uint8_t fill = 0;
+    bool found = seekAviFrame(aviFile, i, chunkPos);
+    aviFile.seek(chunkPos + 4, SeekSet);
+    aviFile.read((uint8_t*)&chunkLen, 4);
+    aviFile.seek(chunkPos + CHUNK_HDR + frameLens[i] - 1, SeekSet);
+    aviFile.read(&fill, 1);
+    CHECK(found && chunkLen == frameLens[i] && fill == (uint8_t)i, "frame %u of %u not located", i, rc.frames);
+  }
+  aviFile.close();
+}
+#endif
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 50;
+  rng.seed(argc > 2 ? atoi(argv[2]) : 1);
+  hostClear();
+  fuzzTest(iterations);
+  audioLengthTest();
+#ifdef ODML_SEG_MAX
+  multiRiffTest();
+  CHECK(cutTest(3000, 3000, 512, 64) > 1, "cut recording not split into RIFFs");
+
+  return hostResult("aviRiffTest");
+#endif
+  cutTest(300, 1000, 0, 1);
+  cutTest(300, 1000, 512, 1);
+  staleTest();
+  return hostResult("aviTest");
+}
@@ -0,0 +1,165 @@
+// Host tests of the CRC32C functions in crc32c.h:
+// - check value, and slicing by 8 against bitwise CRC at each alignment
+// - combine and shift against CRC of zero bytes, with lengths from bytes up
+//   to beyond FAT32 file size, so including shifts of 512MB and more
+// - patch, as for the avi header rewritten on close, of small files against
+//   recalculation, and of files over 512MB against the shift reference
+// Followed by a microbenchmark of CRC and shift.
+//
+// Usage: crcTest [seed]
+//
+// s60sc 2025
+
+#include "crc32c.h"
+#include "host.h"
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define ONEMEG (1024 * 1024)
+#define BENCH_LEN (16 * ONEMEG)
+
+static std::mt19937 rng;
+static std::vector<uint8_t> zeros(ONEMEG);
+static uint32_t megShift; // x^(8 * ONEMEG) mod poly, from CRC of zero bytes
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static uint64_t rnd64(uint64_t n) {
+  return n ? (((uint64_t)rng() << 32) | rng()) % n : 0;
+}
+
+static std::vector<uint8_t> randomData(size_t len) {
+  std::vector<uint8_t> data(len);
+  for (auto& b : data) b = rng();
+  return data;
+}
+
+static uint32_t bitwiseRaw(uint32_t crc, const uint8_t* data, size_t len) {
+  // reference raw CRC, a bit at a time
+  while (len--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+  }
+  return crc;
+}
+
+static uint32_t zeroRaw(uint32_t crc, uint64_t len) {
+  // reference raw CRC followed by len zero bytes, shifting by whole megabytes
+  // using CRC of zero bytes rather than the x2n table
+  for (uint64_t meg = len / ONEMEG; meg; meg--) crc = crc32cTables::multModP(megShift, crc);
+  return crc32cRaw(crc, zeros.data(), len % ONEMEG);
+}
+
+static void checkValueTest() {
+  CHECK(crc32c(0, "123456789", 9) == 0xE3069283, "check value %08x", crc32c(0, "123456789", 9));
+  // continued CRC same as CRC of whole
+  CHECK(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xE3069283, "continued check value incorrect");
+}
+
+static void slicingTest(int iterations) {
+  // table CRC matches bitwise for each start alignment and length
+  std::vector<uint8_t> data = randomData(4096);
+  for (int i = 0; i < iterations; i++) {
+    size_t offset = rnd(16);
+    size_t len = rnd(i < iterations / 2 ? 64 : data.size() - offset);
+    uint32_t crc = rng();
+    uint32_t want = bitwiseRaw(crc, data.data() + offset, len);
+    uint32_t got = crc32cRaw(crc, data.data() + offset, len);
+    CHECK(got == want, "offset %zu length %zu gave %08x, expected %08x", offset, len, got, want);
+  }
+}
+
+static void shiftTest(int iterations) {
+  // shift against CRC of zero bytes
+  megShift = crc32cRaw(1u << 31, zeros.data(), ONEMEG); // x^0 in reflected order
+  CHECK(megShift == crc32cShift(1u << 31, ONEMEG), "1MB shift %08x, expected %08x",
+    crc32cShift(1u << 31, ONEMEG), megShift);
+  for (uint32_t len = 0; len < 4096; len++) {
+    uint32_t crc = rng();
+    CHECK(crc32cShift(crc, len) == crc32cRaw(crc, zeros.data(), len), "shift of %u bytes", len);
+  }
+  // lengths at and around the 512MB where an x2n table of 32 entries wraps,
+  // then up to 4GB FAT32 and exFAT file sizes
+  std::vector<uint64_t> lens = {512ULL * ONEMEG - 1, 512ULL * ONEMEG, 512ULL * ONEMEG + 1,
+    1024ULL * ONEMEG + 12345, 4096ULL * ONEMEG - 1, 4096ULL * ONEMEG, 64ULL * 1024 * ONEMEG + 7};
+  for (int i = 0; i < iterations; i++) lens.push_back(512ULL * ONEMEG + rnd64(15ULL * 512 * ONEMEG));
+  for (uint64_t len : lens) {
+    uint32_t crc = rng();
+    uint32_t want = zeroRaw(crc, len);
+    uint32_t got = crc32cShift(crc, len);
+    CHECK(got == want, "shift of %llu bytes gave %08x, expected %08x", (unsigned long long)len, got, want);
+  }
+}
+
+static void combineTest(int iterations) {
+  // CRC of two blocks from CRC of each
+  std::vector<uint8_t> data = randomData(8192);
+  for (int i = 0; i < iterations; i++) {
+    size_t len1 = rnd(data.size());
+    size_t len2 = rnd(data.size() - len1);
+    uint32_t crc1 = crc32c(0, data.data(), len1);
+    uint32_t crc2 = crc32c(0, data.data() + len1, len2);
+    uint32_t want = crc32c(0, data.data(), len1 + len2);
+    CHECK(crc32cCombine(crc1, crc2, len2) == want, "combine of %zu and %zu bytes", len1, len2);
+  }
+}
+
+static void patchTest(int iterations) {
+  // small files patched at random position, against recalculation
+  for (int i = 0; i < iterations; i++) {
+    std::vector<uint8_t> file = randomData(1 + rnd(20000));
+    size_t offset = rnd(file.size());
+    size_t len = rnd(file.size() - offset + 1);
+    std::vector<uint8_t> newData = randomData(len);
+    uint32_t crc = crc32c(0, file.data(), file.size());
+    // patch of data originally written as zeros, as avi header placeholder
+    bool fromZero = rnd(2);
+    if (fromZero) {
+      memset(file.data() + offset, 0, len);
+      crc = crc32c(0, file.data(), file.size());
+    }
+    uint32_t patched = crc32cPatch(crc, file.size(), offset, fromZero ? NULL : file.data() + offset, newData.data(), len);
+    memcpy(file.data() + offset, newData.data(), len);
+    uint32_t want = crc32c(0, file.data(), file.size());
+    CHECK(patched == want, "patch of %zu bytes at %zu in %zu gave %08x, expected %08x", len, offset, file.size(), patched, want);
+  }
+  // header of zeros replaced in files of header then zeros, so that the
+  // patched data is shifted over 512MB and more
+  for (uint64_t fileLen : {600ULL * ONEMEG, 2048ULL * ONEMEG + 999, 4096ULL * ONEMEG - 1}) {
+    std::vector<uint8_t> header(512, 0);
+    uint32_t crc = ~zeroRaw(crc32cRaw(~0u, header.data(), header.size()), fileLen - header.size());
+    std::vector<uint8_t> newHeader = randomData(header.size());
+    uint32_t want = ~zeroRaw(crc32cRaw(~0u, newHeader.data(), newHeader.size()), fileLen - newHeader.size());
+    uint32_t patched = crc32cPatch(crc, fileLen, 0, NULL, newHeader.data(), newHeader.size());
+    CHECK(patched == want, "header patch of %llu byte file gave %08x, expected %08x",
+      (unsigned long long)fileLen, patched, want);
+  }
+}
+
+static void benchmark() {
+  // CRC rate as for flush task, and cost of shift as for each patch on close
+  std::vector<uint8_t> data = randomData(BENCH_LEN);
+  auto start = std::chrono::steady_clock::now();
+  uint32_t crc = crc32c(0, data.data(), data.size());
+  double crcSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const int shifts = 100000;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < shifts; i++) crc = crc32cShift(crc, 4096ULL * ONEMEG - 1 - i);
+  double shiftSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("crc32c %0.0f MB/s, shift of 4GB %0.2f us (%08x)\n", BENCH_LEN / crcSecs / ONEMEG,
+    shiftSecs * 1000000 / shifts, crc);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) rng.seed(atoi(argv[1]));
+  checkValueTest();
+  slicingTest(2000);
+  shiftTest(200);
+  combineTest(2000);
+  patchTest(1000);
+  benchmark();
+  return hostResult("crcTest");
+}
@@ -0,0 +1,305 @@
+// Host tests of recording encryption in recCrypt.cpp, with mbedTLS provided
+// over OpenSSL by host/mbedtls.cpp:
+// - recordings written as by the SD flush task, then patched as on close,
+//   including patches across MAC blocks, must read back in sequence and at
+//   random positions
+// - the tag sealed in the header must equal the tag calculated here from the
+//   final ciphertext, so the MACs of patched blocks are correctly replaced
+// - changed, moved or truncated ciphertext and a changed tag must fail
+//   authentication
+// - content must decrypt with openssl enc -aes-256-ctr and a zero IV, using
+//   keys derived here from the passphrase and the salt in the header
+// - the salt is random per device and kept in NVS, and recordings from
+//   another device remain readable
+// - unsealed recordings, wrong passphrase and plain files
+//
+// Usage: encTest [seed]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <random>
+#include <unistd.h>
+
+#define REC_PATH "/rec.avi"
+#define HOLD_LEN AVI_HEADER_LEN // rewritten on close
+#define PASSPHRASE "correct horse"
+
+struct recKeys {
+  uint8_t enc[ENC_KEY_LEN];
+  uint8_t mac[ENC_KEY_LEN];
+};
+
+static std::mt19937 rng;
+static std::vector<uint8_t> plain; // content of recording last made
+
+// functions of modules not under test
+uint32_t recordingByteRate() {
+  return 1000000;
+}
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static std::vector<uint8_t> readRaw(const char* path) {
+  std::vector<uint8_t> raw;
+  FILE* f = fopen(hostPath(path).c_str(), "rb");
+  if (f == NULL) return raw;
+  fseeko(f, 0, SEEK_END);
+  raw.resize(ftello(f));
+  fseeko(f, 0, SEEK_SET);
+  if (fread(raw.data(), 1, raw.size(), f) != raw.size()) raw.clear();
+  fclose(f);
+  return raw;
+}
+
+static void writeRaw(const char* path, const std::vector<uint8_t>& raw) {
+  FILE* f = fopen(hostPath(path).c_str(), "wb");
+  fwrite(raw.data(), 1, raw.size(), f);
+  fclose(f);
+}
+
+static encHeader rawHeader(const std::vector<uint8_t>& raw) {
+  encHeader eh = {};
+  if (raw.size() >= sizeof(eh)) memcpy(&eh, raw.data(), sizeof(eh));
+  return eh;
+}
+
+static void contentPatch(File& file, size_t offset, size_t len) {
+  // replace content, as avi header and RIFF sizes are on close
+  std::vector<uint8_t> data(len);
+  for (auto& b : data) b = rng();
+  encPatch(file, offset, data.data(), len);
+  memcpy(plain.data() + offset, data.data(), len);
+}
+
+static void makeRecording(size_t len, bool seal) {
+  // recording of random content, apart from header space written as zeros
+  plain.assign(len, 0);
+  for (size_t i = HOLD_LEN; i < len; i++) plain[i] = rng();
+  File file = STORAGE.open(REC_PATH, "w+");
+  CHECK(encBegin(file, HOLD_LEN), "recording of %zu bytes not encrypted", len);
+  std::vector<uint8_t> stage;
+  for (size_t pos = 0; pos < len; ) {
+    size_t stageLen = std::min(len - pos, (size_t)(1 + rnd(40000)));
+    stage.assign(plain.begin() + pos, plain.begin() + pos + stageLen);
+    encStage(stage.data(), stageLen);
+    file.write(stage.data(), stageLen);
+    pos += stageLen;
+  }
+  // patches within blocks and across block boundaries, then header space
+  for (int i = 0; i < 20 && len > HOLD_LEN + 8; i++) {
+    size_t offset = HOLD_LEN + rnd(len - HOLD_LEN - 8);
+    contentPatch(file, offset, 1 + rnd(std::min(len - offset, (size_t)600)));
+  }
+  for (size_t boundary = ENC_MAC_BLOCK; boundary + 8 <= len; boundary += ENC_MAC_BLOCK * 97)
+    if (boundary > HOLD_LEN + 8) contentPatch(file, boundary - 8, 16);
+  contentPatch(file, 0, std::min(len, (size_t)HOLD_LEN));
+  if (seal) encEnd(file);
+  file.close();
+}
+
+static bool readAll(const char* path, std::vector<uint8_t>& out, encState& state) {
+  // read in random lengths as for download, whether all content returned
+  File file = recOpen(path, FILE_READ, &state);
+  out.clear();
+  std::vector<uint8_t> buf(70000);
+  size_t readLen;
+  while ((readLen = file.read(buf.data(), 1 + rnd(buf.size())))) out.insert(out.end(), buf.begin(), buf.begin() + readLen);
+  bool full = out.size() == file.size();
+  file.close();
+  return full;
+}
+
+static recKeys fileKeys(const encHeader& eh, const char* passphrase) {
+  // derived independently of recCrypt.cpp, as for decryption off device
+  uint8_t master[ENC_KEY_LEN], input[3 + ENC_NONCE_LEN];
+  unsigned int macLen;
+  recKeys rk;
+  PKCS5_PBKDF2_HMAC(passphrase, strlen(passphrase), eh.salt, ENC_SALT_LEN, ENC_KDF_ITERS, EVP_sha256(), ENC_KEY_LEN, master);
+  memcpy(input + 3, eh.nonce, ENC_NONCE_LEN);
+  memcpy(input, "enc", 3);
+  HMAC(EVP_sha256(), master, ENC_KEY_LEN, input, sizeof(input), rk.enc, &macLen);
+  memcpy(input, "mac", 3);
+  HMAC(EVP_sha256(), master, ENC_KEY_LEN, input, sizeof(input), rk.mac, &macLen);
+  return rk;
+}
+
+static void expectedTag(const std::vector<uint8_t>& raw, const uint8_t* macKey, uint8_t* tag) {
+  // XOR of MAC of each block of final ciphertext with MAC of content length
+  uint64_t contentLen = raw.size() - ENC_HDR_LEN;
+  uint8_t mac[ENC_TAG_LEN], prefix[ENC_PREFIX_LEN];
+  unsigned int macLen;
+  encPrefix(prefix, ENC_DOMAIN_FINAL, contentLen);
+  HMAC(EVP_sha256(), macKey, ENC_KEY_LEN, prefix, ENC_PREFIX_LEN, tag, &macLen);
+  for (uint64_t block = 0; block * ENC_MAC_BLOCK < contentLen; block++) {
+    HMAC_CTX* hmac = HMAC_CTX_new();
+    HMAC_Init_ex(hmac, macKey, ENC_KEY_LEN, EVP_sha256(), NULL);
+    encPrefix(prefix, ENC_DOMAIN_BLOCK, block);
+    HMAC_Update(hmac, prefix, ENC_PREFIX_LEN);
+    HMAC_Update(hmac, raw.data() + ENC_HDR_LEN + block * ENC_MAC_BLOCK, encBlockLen(contentLen, block));
+    HMAC_Final(hmac, mac, &macLen);
+    HMAC_CTX_free(hmac);
+    encXor(tag, mac);
+  }
+}
+
+static bool tagValid(const std::vector<uint8_t>& raw) {
+  // sealed tag equals tag over final ciphertext, with keys from header salt
+  uint8_t tag[ENC_TAG_LEN];
+  encHeader eh = rawHeader(raw);
+  expectedTag(raw, fileKeys(eh, PASSPHRASE).mac, tag);
+  return !memcmp(tag, eh.tag, ENC_TAG_LEN);
+}
+
+static void opensslTest(const std::vector<uint8_t>& raw) {
+  // decrypt content after header with openssl command
+  if (system("openssl version > /dev/null 2>&1")) {
+    printf("openssl not found, decryption cross check skipped\n");
+    return;
+  }
+  writeRaw("/content.bin", std::vector<uint8_t>(raw.begin() + ENC_HDR_LEN, raw.end()));
+  recKeys rk = fileKeys(rawHeader(raw), PASSPHRASE);
+  char cmd[400];
+  int cmdLen = snprintf(cmd, sizeof(cmd), "openssl enc -d -aes-256-ctr -in %s -out %s -iv %032x -K ",
+    hostPath("/content.bin").c_str(), hostPath("/plain.bin").c_str(), 0);
+  for (int i = 0; i < ENC_KEY_LEN; i++) cmdLen += snprintf(cmd + cmdLen, sizeof(cmd) - cmdLen, "%02x", rk.enc[i]);
+  CHECK(!system(cmd), "openssl failed");
+  CHECK(readRaw("/plain.bin") == plain, "openssl decryption differs from content");
+}
+
+static void tamperTest(const std::vector<uint8_t>& raw) {
+  // each change detected, withholding end of content
+  size_t contentLen = raw.size() - ENC_HDR_LEN;
+  std::vector<uint8_t> out;
+  encState state;
+  for (int change = 0; change < 4; change++) {
+    std::vector<uint8_t> bad = raw;
+    if (change == 0) bad[ENC_HDR_LEN + rnd(contentLen)] ^= 1 << rnd(8);
+    else if (change == 1) bad[offsetof(encHeader, tag) + rnd(ENC_TAG_LEN)] ^= 1 << rnd(8);
+    else if (change == 2) bad.pop_back();
+    else if (contentLen >= 2 * ENC_MAC_BLOCK) {
+      // blocks swapped
+      std::swap_ranges(bad.begin() + ENC_HDR_LEN, bad.begin() + ENC_HDR_LEN + ENC_MAC_BLOCK,
+        bad.begin() + ENC_HDR_LEN + ENC_MAC_BLOCK);
+    } else continue;
+    writeRaw(REC_PATH, bad);
+    CHECK(!readAll(REC_PATH, out, state), "change %d to %zu byte recording not detected", change, contentLen);
+  }
+  writeRaw(REC_PATH, raw);
+}
+
+static void recordingTest(size_t len) {
+  makeRecording(len, true);
+  std::vector<uint8_t> out;
+  encState state;
+  bool full = readAll(REC_PATH, out, state);
+  CHECK(state == ENC_OPEN && full && out == plain, "%zu byte recording not read back", len);
+  std::vector<uint8_t> raw = readRaw(REC_PATH);
+  encHeader eh = rawHeader(raw);
+  CHECK(raw.size() == len + ENC_HDR_LEN && eh.flags & ENC_SEALED, "%zu byte recording not sealed", len);
+  CHECK(memcmp(raw.data() + ENC_HDR_LEN, plain.data(), std::min(len, (size_t)64)), "content not encrypted");
+  CHECK(tagValid(raw), "%zu byte recording tag differs from ciphertext MAC", len);
+  // random access, as for playback
+  File file = recOpen(REC_PATH);
+  for (int i = 0; i < 200; i++) {
+    size_t offset = rnd(len), readLen = std::min(len - offset, (size_t)rnd(5000));
+    std::vector<uint8_t> buf(readLen);
+    file.seek(offset, SeekSet);
+    CHECK(file.read(buf.data(), readLen) == readLen && !memcmp(buf.data(), plain.data() + offset, readLen)
+      && file.position() == offset + readLen, "read of %zu bytes at %zu", readLen, offset);
+  }
+  file.close();
+  tamperTest(raw);
+  if (len > 1000000) opensslTest(raw);
+}
+
+static void rewriteTest() {
+  // content rewritten through decrypting file, as by recovery, unseals recording
+  makeRecording(200000, true);
+  File file = recOpen(REC_PATH, "r+");
+  uint8_t patch[1000];
+  for (auto& b : patch) b = rng();
+  file.seek(123457, SeekSet);
+  file.write(patch, sizeof(patch));
+  memcpy(plain.data() + 123457, patch, sizeof(patch));
+  file.close();
+  std::vector<uint8_t> out;
+  encState state;
+  CHECK(readAll(REC_PATH, out, state) && out == plain, "rewritten recording not read back");
+  CHECK(!(rawHeader(readRaw(REC_PATH)).flags & ENC_SEALED), "rewritten recording still sealed");
+  // not closed, so header space still zeros
+  makeRecording(200000, false);
+  CHECK(readAll(REC_PATH, out, state) && state == ENC_OPEN
+    && !memcmp(out.data() + HOLD_LEN, plain.data() + HOLD_LEN, plain.size() - HOLD_LEN), "unsealed recording not read back");
+}
+
+static void saltTest() {
+  // salt from NVS in each recording, kept over restart, differing per device
+  Preferences encPrefs;
+  uint8_t salt[ENC_SALT_LEN] = {0}, zero[ENC_SALT_LEN] = {0};
+  encPrefs.begin("recCrypt", false);
+  CHECK(encPrefs.getBytes("salt", salt, ENC_SALT_LEN) == ENC_SALT_LEN && memcmp(salt, zero, ENC_SALT_LEN), "no salt in NVS");
+  encPrefs.end();
+  makeRecording(50000, true);
+  encHeader first = rawHeader(readRaw(REC_PATH));
+  std::vector<uint8_t> firstPlain = plain;
+  std::vector<uint8_t> firstRaw = readRaw(REC_PATH);
+  makeRecording(50000, true);
+  encHeader second = rawHeader(readRaw(REC_PATH));
+  CHECK(!memcmp(first.salt, salt, ENC_SALT_LEN) && !memcmp(second.salt, salt, ENC_SALT_LEN), "salt not from NVS");
+  CHECK(memcmp(first.nonce, second.nonce, ENC_NONCE_LEN), "nonce reused");
+  prepRecCrypt();
+  makeRecording(50000, true);
+  CHECK(!memcmp(rawHeader(readRaw(REC_PATH)).salt, salt, ENC_SALT_LEN), "salt changed by restart");
+  // other device, new salt, but recording of first device readable
+  encPrefs.begin("recCrypt", false);
+  encPrefs.clear();
+  encPrefs.end();
+  prepRecCrypt();
+  makeRecording(50000, true);
+  std::vector<uint8_t> raw = readRaw(REC_PATH);
+  CHECK(memcmp(rawHeader(raw).salt, salt, ENC_SALT_LEN), "salt not renewed");
+  CHECK(tagValid(raw), "recording keys not derived with renewed salt");
+  writeRaw(REC_PATH, firstRaw);
+  std::vector<uint8_t> out;
+  encState state;
+  CHECK(readAll(REC_PATH, out, state) && out == firstPlain, "recording from other device not read back");
+}
+
+static void otherFileTest() {
+  // wrong passphrase leaves file unchanged, as does plain file
+  makeRecording(50000, true);
+  strcpy(Rec_Pass, "wrong");
+  encState state;
+  File file = recOpen(REC_PATH, FILE_READ, &state);
+  CHECK(state == ENC_NO_KEY && file.size() == 50000 + ENC_HDR_LEN && file.position() == 0, "wrong passphrase");
+  file.close();
+  std::vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i;
+  writeRaw("/plain.avi", data);
+  file = recOpen("/plain.avi", FILE_READ, &state);
+  uint8_t buf[4];
+  CHECK(state == ENC_NONE && file.size() == data.size() && file.read(buf, 4) == 4 && buf[1] == 1, "plain file changed");
+  file.close();
+  strcpy(Rec_Pass, PASSPHRASE);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) rng.seed(atoi(argv[1]));
+  hostClear();
+  recEncrypt = true;
+  strcpy(Rec_Pass, PASSPHRASE);
+  prepRecCrypt(); // includes known answer tests
+  CHECK(encReady(), "encryption not ready");
+  for (size_t len : {(size_t)HOLD_LEN + 1, (size_t)ENC_MAC_BLOCK, (size_t)8192 + 17, (size_t)3000000, (size_t)5000001})
+    recordingTest(len);
+  rewriteTest();
+  saltTest();
+  otherFileTest();
+  return hostResult("encTest");
+}
@@ -0,0 +1,376 @@
+// Host stand-ins for the Arduino and ESP-IDF declarations used by
+// appGlobals.h, so that the host pure units can be built and tested on Linux.
+// Only declared, unless used by a unit under test, see host.cpp
+//
+// s60sc 2025
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <sys/time.h>
+
+#define ESP_ARDUINO_VERSION_VAL(a,b,c) ((a<<16)|(b<<8)|c)
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(3,2,0)
+#define ESP_ARDUINO_VERSION_STR "3.2.0"
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define IRAM_ATTR
+#define PROGMEM
+#define ARDUINO_ISR_ATTR
+typedef uint8_t byte;
+typedef bool boolean;
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(x) (x)
+#define portTICK_PERIOD_MS 1
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void* QueueHandle_t;
+typedef void* TimerHandle_t;
+typedef void* esp_ping_handle_t;
+typedef void (*TaskFunction_t)(void*);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, int);
+void vTaskDelete(TaskHandle_t);
+void vTaskDelay(TickType_t);
+void vTaskSuspend(TaskHandle_t);
+void vTaskResume(TaskHandle_t);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t*, TickType_t);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, int);
+#define eSetValueWithOverwrite 0
+#define eIncrement 1
+#define eNoAction 2
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t);
+char* pcTaskGetTaskName(TaskHandle_t);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+int xPortGetCoreID();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t, UBaseType_t);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t, BaseType_t*);
+void vSemaphoreDelete(SemaphoreHandle_t);
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t);
+BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t);
+#define portYIELD_FROM_ISR() do {} while (0)
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+void portENTER_CRITICAL(portMUX_TYPE*);
+void portEXIT_CRITICAL(portMUX_TYPE*);
+void portENTER_CRITICAL_ISR(portMUX_TYPE*);
+void portEXIT_CRITICAL_ISR(portMUX_TYPE*);
+
+unsigned long millis();
+unsigned long micros();
+int64_t esp_timer_get_time();
+void delay(uint32_t);
+void delayMicroseconds(uint32_t);
+void yield();
+void* ps_malloc(size_t);
+void* ps_calloc(size_t, size_t);
+void* ps_realloc(void*, size_t);
+bool psramFound();
+void pinMode(uint8_t, uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+int analogRead(uint8_t);
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define OneMHz 1000000
+template<class T> T constrain(T a, T b, T c) { return a < b ? b : (a > c ? c : a); }
+long map(long, long, long, long, long);
+
+struct hw_timer_t;
+hw_timer_t* timerBegin(uint32_t);
+void timerEnd(hw_timer_t*);
+void timerAttachInterrupt(hw_timer_t*, void (*)());
+void timerDetachInterrupt(hw_timer_t*);
+void timerAlarm(hw_timer_t*, uint64_t, bool, uint64_t);
+
+class Print {
+ public:
+  size_t write(const uint8_t*, size_t);
+  size_t write(uint8_t);
+  size_t print(const char*);
+  size_t println(const char* = "");
+  size_t printf(const char*, ...);
+};
+class HWSerial : public Print { public: void begin(int); void flush(); int available(); int read(); };
+extern HWSerial Serial;
+
+class String {
+ public:
+  String(const char* cstr = "") : str(cstr) {}
+  String(int);
+  const char* c_str() const { return str.c_str(); }
+  size_t length() const { return str.size(); }
+  bool endsWith(const char*) const;
+  bool startsWith(const char*) const;
+  int indexOf(const char*) const;
+  String substring(int, int = -1) const;
+  String operator+(const String&) const;
+  String& operator+=(const String&);
+  bool operator==(const char*) const;
+ private:
+  std::string str;
+};
+class Stream : public Print { public: int available(); int read(); size_t readBytes(uint8_t*, size_t); };
+class Client : public Stream { public: int connect(const char*, uint16_t); void stop(); bool connected(); };
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+#include <memory>
+typedef bool boolean;
+namespace fs {
+class File;
+class FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+class FileImpl {
+ public:
+  virtual ~FileImpl() {}
+  virtual size_t write(const uint8_t *buf, size_t size) = 0;
+  virtual size_t read(uint8_t *buf, size_t size) = 0;
+  virtual void flush() = 0;
+  virtual bool seek(uint32_t pos, SeekMode mode) = 0;
+  virtual size_t position() const = 0;
+  virtual size_t size() const = 0;
+  virtual bool setBufferSize(size_t size) = 0;
+  virtual void close() = 0;
+  virtual time_t getLastWrite() = 0;
+  virtual const char *path() const = 0;
+  virtual const char *name() const = 0;
+  virtual boolean isDirectory(void) = 0;
+  virtual FileImplPtr openNextFile(const char *mode) = 0;
+  virtual boolean seekDir(long position) = 0;
+  virtual String getNextFileName(void) = 0;
+  virtual String getNextFileName(bool *isDir) = 0;
+  virtual void rewindDirectory(void) = 0;
+  virtual operator bool() = 0;
+};
+class File : public Stream {
+  // as Arduino fs::File, a handle onto a FileImpl
+ public:
+  File(FileImplPtr p = FileImplPtr()) : _p(p) {}
+  size_t write(const uint8_t* buf, size_t size) { return _p ? _p->write(buf, size) : 0; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t read(uint8_t* buf, size_t size) { return _p ? _p->read(buf, size) : 0; }
+  int read() { uint8_t c; return read(&c, 1) ? c : -1; }
+  bool seek(uint32_t pos, SeekMode mode = SeekSet) { return _p && _p->seek(pos, mode); }
+  size_t position() const { return _p ? _p->position() : 0; }
+  size_t size() const { return _p ? _p->size() : 0; }
+  void close() { if (_p) { _p->close(); _p = nullptr; } }
+  void flush() { if (_p) _p->flush(); }
+  operator bool() const { return _p && *_p; }
+  const char* name() const { return _p ? _p->name() : ""; }
+  const char* path() const { return _p ? _p->path() : ""; }
+  bool isDirectory() { return _p && _p->isDirectory(); }
+  time_t getLastWrite() { return _p ? _p->getLastWrite() : 0; }
+  bool setBufferSize(size_t size) { return _p && _p->setBufferSize(size); }
+  int available() { return (int)(size() - position()); }
+  File openNextFile(const char* = FILE_READ);
+  String getNextFileName();
+  String getNextFileName(bool*);
+  void rewindDirectory();
+ private:
+  FileImplPtr _p;
+};
+class FS {
+ public:
+  File open(const char*, const char* = FILE_READ, bool = false);
+  File open(const String&, const char* = FILE_READ, bool = false);
+  bool exists(const char*);
+  bool exists(const String&);
+  bool remove(const char*);
+  bool rename(const char*, const char*);
+  bool mkdir(const char*);
+  bool rmdir(const char*);
+};
+class SDMMCFS : public FS {
+ public:
+  bool begin(const char* = "/sdcard", bool = false, bool = false, int = 20000, uint8_t = 5);
+  void end();
+  uint64_t cardSize();
+  uint64_t totalBytes();
+  uint64_t usedBytes();
+  uint8_t cardType();
+  bool setPins(int, int, int, int = -1, int = -1, int = -1);
+  bool readRAW(uint8_t*, uint32_t);
+};
+class LittleFSFS : public FS {
+ public:
+  bool begin(bool = false, const char* = "/littlefs", uint8_t = 10, const char* = "spiffs");
+  size_t totalBytes();
+  size_t usedBytes();
+};
+}
+using fs::File;
+extern fs::SDMMCFS SD_MMC;
+extern fs::LittleFSFS LittleFS;
+#define CARD_NONE 0
+
+class EspClass {
+ public:
+  uint32_t getFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getFreePsram();
+  uint32_t getPsramSize();
+  uint32_t getMaxAllocPsram();
+  void restart();
+};
+extern EspClass ESP;
+
+// esp32-camera
+typedef enum {
+  FRAMESIZE_96X96, FRAMESIZE_QQVGA, FRAMESIZE_128X128, FRAMESIZE_QCIF, FRAMESIZE_HQVGA, FRAMESIZE_240X240,
+  FRAMESIZE_QVGA, FRAMESIZE_320X320, FRAMESIZE_CIF, FRAMESIZE_HVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA,
+  FRAMESIZE_XGA, FRAMESIZE_HD, FRAMESIZE_SXGA, FRAMESIZE_UXGA, FRAMESIZE_FHD, FRAMESIZE_P_HD,
+  FRAMESIZE_P_3MP, FRAMESIZE_QXGA, FRAMESIZE_QHD, FRAMESIZE_WQXGA, FRAMESIZE_P_FHD, FRAMESIZE_QSXGA,
+  FRAMESIZE_5MP, FRAMESIZE_INVALID
+} framesize_t;
+typedef enum { PIXFORMAT_RGB565, PIXFORMAT_YUV422, PIXFORMAT_GRAYSCALE, PIXFORMAT_JPEG, PIXFORMAT_RGB888 } pixformat_t;
+typedef struct {
+  uint8_t* buf;
+  size_t len;
+  size_t width;
+  size_t height;
+  pixformat_t format;
+  struct timeval timestamp;
+} camera_fb_t;
+typedef struct { framesize_t framesize; int quality; int brightness; int contrast; int saturation; } camera_status_t;
+typedef struct { uint16_t PID; } sensor_id_t;
+typedef struct _sensor sensor_t;
+struct _sensor {
+  sensor_id_t id;
+  camera_status_t status;
+  int (*set_framesize)(sensor_t*, framesize_t);
+  int (*set_quality)(sensor_t*, int);
+  int (*set_brightness)(sensor_t*, int);
+  int (*set_contrast)(sensor_t*, int);
+  int (*set_saturation)(sensor_t*, int);
+  int (*set_whitebal)(sensor_t*, int);
+  int (*set_awb_gain)(sensor_t*, int);
+  int (*set_exposure_ctrl)(sensor_t*, int);
+  int (*set_vflip)(sensor_t*, int);
+  int (*set_hmirror)(sensor_t*, int);
+  int (*set_gain_ctrl)(sensor_t*, int);
+};
+#define OV5640_PID 0x5640
+#define OV2640_PID 0x2642
+#define OV3660_PID 0x3660
+typedef enum { CAMERA_GRAB_WHEN_EMPTY, CAMERA_GRAB_LATEST } camera_grab_mode_t;
+typedef enum { CAMERA_FB_IN_PSRAM, CAMERA_FB_IN_DRAM } camera_fb_location_t;
+typedef struct {
+  int pin_pwdn, pin_reset, pin_xclk, pin_sccb_sda, pin_sccb_scl, pin_d7, pin_d6, pin_d5, pin_d4, pin_d3, pin_d2, pin_d1, pin_d0,
+      pin_vsync, pin_href, pin_pclk;
+  int xclk_freq_hz;
+  int ledc_timer, ledc_channel;
+  pixformat_t pixel_format;
+  framesize_t frame_size;
+  int jpeg_quality;
+  size_t fb_count;
+  camera_fb_location_t fb_location;
+  camera_grab_mode_t grab_mode;
+  int sccb_i2c_port;
+} camera_config_t;
+esp_err_t esp_camera_init(const camera_config_t*);
+esp_err_t esp_camera_deinit();
+camera_fb_t* esp_camera_fb_get();
+void esp_camera_fb_return(camera_fb_t*);
+sensor_t* esp_camera_sensor_get();
+bool jpg2rgb565(const uint8_t*, size_t, uint8_t*, int);
+#define LEDC_TIMER_0 0
+#define LEDC_TIMER_1 1
+#define LEDC_CHANNEL_0 0
+#define LEDC_CHANNEL_1 1
+#define LEDC_LOW_SPEED_MODE 0
+#define LEDC_TIMER_1_BIT 1
+#define LEDC_AUTO_CLK 0
+#define LEDC_INTR_DISABLE 0
+typedef struct { int speed_mode; int duty_resolution; int timer_num; uint32_t freq_hz; int clk_cfg; } ledc_timer_config_t;
+typedef struct { int gpio_num; int speed_mode; int channel; int intr_type; int timer_sel; uint32_t duty; int hpoint; } ledc_channel_config_t;
+esp_err_t ledc_stop(int, int, uint32_t);
+esp_err_t ledc_timer_config(const ledc_timer_config_t*);
+esp_err_t ledc_channel_config(const ledc_channel_config_t*);
+
+// http server
+typedef struct httpd_req { const char* uri; void* aux; void* user_ctx; size_t content_len; } httpd_req_t;
+typedef void* httpd_handle_t;
+esp_err_t httpd_resp_send(httpd_req_t*, const char*, ssize_t);
+esp_err_t httpd_resp_send_chunk(httpd_req_t*, const char*, ssize_t);
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t*, const char*);
+esp_err_t httpd_resp_sendstr(httpd_req_t*, const char*);
+esp_err_t httpd_resp_set_type(httpd_req_t*, const char*);
+esp_err_t httpd_resp_set_hdr(httpd_req_t*, const char*, const char*);
+esp_err_t httpd_resp_set_status(httpd_req_t*, const char*);
+esp_err_t httpd_resp_send_404(httpd_req_t*);
+esp_err_t httpd_resp_send_500(httpd_req_t*);
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_400_BAD_REQUEST 400
+#define HTTPD_500_INTERNAL_SERVER_ERROR 500
+esp_err_t httpd_resp_send_err(httpd_req_t*, int, const char*);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t*, char*, size_t);
+size_t httpd_req_get_url_query_len(httpd_req_t*);
+esp_err_t httpd_query_key_value(const char*, const char*, char*, size_t);
+int httpd_req_recv(httpd_req_t*, char*, size_t);
+int httpd_req_to_sockfd(httpd_req_t*);
+esp_err_t httpd_req_async_handler_begin(httpd_req_t*, httpd_req_t**);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t*);
+
+class WiFiClient : public Client {};
+class NetworkClientSecure : public Client { public: void setCACert(const char*); void setInsecure(); };
+class HTTPClient { public: bool begin(NetworkClientSecure&, const char*); bool begin(const char*); int GET(); int POST(uint8_t*, size_t); int sendRequest(const char*, uint8_t*, size_t); void end(); void addHeader(const char*, const char*); String getString(); void setTimeout(int); int getSize(); };
+#define HTTP_CODE_OK 200
+class WiFiClass { public: int status(); String localIP(); int RSSI(); };
+extern WiFiClass WiFi;
+#define WL_CONNECTED 3
+class Preferences { public:
+  bool begin(const char*, bool = false, const char* = NULL); void end();
+  size_t putString(const char*, const char*); String getString(const char*, String = String()); bool isKey(const char*);
+  size_t putBytes(const char*, const void*, size_t); size_t getBytes(const char*, void*, size_t); bool clear();
+ private: std::string nvsName; };
+#define MALLOC_CAP_INTERNAL (1<<11)
+#define MALLOC_CAP_DMA (1<<3)
+void* heap_caps_malloc(size_t, uint32_t);
+void heap_caps_malloc_extmem_enable(size_t);
+class IPAddress {};
+
+// log
+#define ESP_LOGE(tag, ...)
+const char* esp_log_system_timestamp();
+const char* esp_err_to_name(esp_err_t);
+typedef int esp_sleep_wakeup_cause_t;
+const char* pathToFileName(const char*);
+#define timezone app_timezone
+using std::min;
+using std::max;
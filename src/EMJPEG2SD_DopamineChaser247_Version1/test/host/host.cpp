@@ -0,0 +1,146 @@
+// Host implementation of the Arduino file system and utilities used by
+// the units under test. The SD card is emulated by the directory HOST_SD.
+// Time and FreeRTOS primitives are provided by either rtos.cpp for single
+// threaded tests, or tasks.cpp for tests running tasks on threads.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+#include <stdarg.h>
+#include <map>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef HOST_SD
+#define HOST_SD "sdcard"
+#endif
+
+uint32_t hostMs = 0;
+int hostFails = 0;
+void (*hostWriteHook)(const char* path, size_t len) = NULL;
+
+// settings of modules not under test
+uint32_t SAMPLE_RATE = 16000;
+__attribute__((weak)) int maxFrames = 20000; // as mjpeg2sd.cpp, if not linked
+
+class HostFile : public fs::FileImpl {
+  // file on emulated SD as a FILE*
+ public:
+  HostFile(FILE* f, const char* path) : fp(f), filePath(path) {}
+  ~HostFile() override { close(); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    if (hostWriteHook != NULL) hostWriteHook(filePath.c_str(), size);
+    return fwrite(buf, 1, size, fp);
+  }
+  size_t read(uint8_t* buf, size_t size) override { return fread(buf, 1, size, fp); }
+  void flush() override { fflush(fp); }
+  bool seek(uint32_t pos, SeekMode mode) override {
+    return !fseeko(fp, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END);
+  }
+  size_t position() const override { return ftello(fp); }
+  size_t size() const override { struct stat st; fflush(fp); return fstat(fileno(fp), &st) ? 0 : st.st_size; }
+  bool setBufferSize(size_t) override { return true; }
+  void close() override { if (fp != NULL) fclose(fp); fp = NULL; }
+  time_t getLastWrite() override { return 0; }
+  const char* path() const override { return filePath.c_str(); }
+  const char* name() const override { return strrchr(filePath.c_str(), '/') + 1; }
+  boolean isDirectory(void) override { return false; }
+  fs::FileImplPtr openNextFile(const char*) override { return fs::FileImplPtr(); }
+  boolean seekDir(long) override { return false; }
+  String getNextFileName(void) override { return String(); }
+  String getNextFileName(bool*) override { return String(); }
+  void rewindDirectory(void) override {}
+  operator bool() override { return fp != NULL; }
+ private:
+  FILE* fp;
+  std::string filePath;
+};
+
+std::string hostPath(const char* path) {
+  return std::string(HOST_SD) + path;
+}
+
+void hostClear() {
+  std::string cmd = std::string("rm -rf " HOST_SD " && mkdir -p " HOST_SD);
+  if (system(cmd.c_str())) printf("Failed to clear %s\n", HOST_SD);
+}
+
+size_t hostRead(void* ctx, uint64_t pos, uint8_t* buf, size_t len) {
+  FILE* f = (FILE*)ctx;
+  fseeko(f, pos, SEEK_SET);
+  return fread(buf, 1, len, f);
+}
+
+namespace fs {
+
+File FS::open(const char* path, const char* mode, bool) {
+  // Arduino "w" creates file for reading and writing
+  const char* hostMode = !strcmp(mode, FILE_WRITE) ? "w+b" : !strcmp(mode, FILE_READ) ? "rb"
+    : !strcmp(mode, FILE_APPEND) ? "a+b" : mode;
+  FILE* f = fopen(hostPath(path).c_str(), hostMode);
+  if (f == NULL) return File();
+  return File(std::make_shared<HostFile>(f, path));
+}
+
+File FS::open(const String& path, const char* mode, bool create) { return open(path.c_str(), mode, create); }
+bool FS::exists(const char* path) { return access(hostPath(path).c_str(), F_OK) == 0; }
+bool FS::exists(const String& path) { return exists(path.c_str()); }
+bool FS::remove(const char* path) { return ::remove(hostPath(path).c_str()) == 0; }
+bool FS::rename(const char* from, const char* to) { return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0; }
+bool FS::mkdir(const char* path) { return ::mkdir(hostPath(path).c_str(), 0777) == 0 || errno == EEXIST; }
+bool FS::rmdir(const char* path) { return ::rmdir(hostPath(path).c_str()) == 0; }
+
+}
+
+fs::SDMMCFS SD_MMC;
+fs::LittleFSFS LittleFS;
+EspClass ESP;
+
+// NVS held in memory, so cleared at start of each test
+static std::map<std::string, std::vector<uint8_t>> hostNvs;
+
+bool Preferences::begin(const char* name, bool, const char*) { nvsName = name; return true; }
+void Preferences::end() {}
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  hostNvs[nvsName + "/" + key].assign((const uint8_t*)value, (const uint8_t*)value + len);
+  return len;
+}
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  auto it = hostNvs.find(nvsName + "/" + key);
+  if (it == hostNvs.end() || it->second.size() > maxLen) return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+bool Preferences::clear() {
+  for (auto it = hostNvs.begin(); it != hostNvs.end(); )
+    it = it->first.compare(0, nvsName.size() + 1, nvsName + "/") ? std::next(it) : hostNvs.erase(it);
+  return true;
+}
+
+void* ps_malloc(size_t size) { return malloc(size); }
+void* heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+void heap_caps_malloc_extmem_enable(size_t) {}
+bool psramFound() { return false; }
+uint32_t EspClass::getFreePsram() { return 8 * 1024 * 1024; }
+
+void debugMemory(const char*) {}
+
+bool dbgVerbose = false;
+const char* esp_log_system_timestamp() { return ""; }
+const char* pathToFileName(const char* path) { return path; }
+
+void logPrint(const char* fmtStr, ...) {
+  // warnings and errors only, unless V set in environment
+  if (!strstr(fmtStr, " WARN ") && !strstr(fmtStr, " ERROR ") && !getenv("V")) return;
+  va_list args;
+  va_start(args, fmtStr);
+  vprintf(fmtStr, args);
+  va_end(args);
+}
+
+char* fmtSize(uint64_t sizeVal) {
+  static char returnStr[32];
+  snprintf(returnStr, sizeof(returnStr), "%lu", (unsigned long)sizeVal);
+  return returnStr;
+}
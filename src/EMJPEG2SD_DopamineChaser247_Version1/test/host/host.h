@@ -0,0 +1,25 @@
+// Helpers shared by the host tests, see host.cpp
+//
+// s60sc 2025
+
+#pragma once
+#include <stdio.h>
+#include <string>
+
+extern uint32_t hostMs; // value returned by millis(), or its start if tasks.cpp used
+extern float hostSpeed; // rate of time against real time, if tasks.cpp used
+extern int hostFails; // count of failed checks
+extern void (*hostWriteHook)(const char* path, size_t len); // if set, called before each write to emulated SD
+
+std::string hostPath(const char* path); // host path of file on emulated SD
+void hostClear(); // remove all files from emulated SD
+size_t hostRead(void* ctx, uint64_t pos, uint8_t* buf, size_t len); // for checkAviFile() on a FILE*
+
+// record failure of check, with reason
+#define CHECK(cond, format, ...) do { if (!(cond)) { hostFails++; \
+  printf("FAIL %s:%d " format "\n", __FILE__, __LINE__, ##__VA_ARGS__); } } while (0)
+
+inline int hostResult(const char* name) {
+  printf("%s: %s\n", name, hostFails ? "FAILED" : "passed");
+  return hostFails != 0;
+}
@@ -0,0 +1,106 @@
+// Host implementation of the mbedTLS and ESP random functions used by
+// recCrypt.cpp, over OpenSSL libcrypto, with mbedTLS 3 semantics.
+//
+// s60sc 2025
+
+#include "mbedtls/aes.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/platform_util.h"
+#include "esp_random.h"
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+void mbedtls_aes_free(mbedtls_aes_context* ctx) { memset(ctx, 0, sizeof(*ctx)); }
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+  if (keybits != 256) return -1;
+  memcpy(ctx->key, key, keybits / 8);
+  ctx->bits = keybits;
+  return 0;
+}
+
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context* ctx, int mode, const unsigned char input[16], unsigned char output[16]) {
+  // encrypt only, as needed for CTR
+  EVP_CIPHER_CTX* evp = EVP_CIPHER_CTX_new();
+  int outLen;
+  int ok = EVP_EncryptInit_ex(evp, EVP_aes_256_ecb(), NULL, ctx->key, NULL) && EVP_CIPHER_CTX_set_padding(evp, 0)
+    && EVP_EncryptUpdate(evp, output, &outLen, input, 16);
+  EVP_CIPHER_CTX_free(evp);
+  return ok && mode == MBEDTLS_AES_ENCRYPT ? 0 : -1;
+}
+
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+  unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+  // as mbedTLS, stream block used from nc_off, then counter incremented big endian after each block
+  size_t n = *nc_off;
+  for (size_t i = 0; i < length; i++) {
+    if (!n) {
+      mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, nonce_counter, stream_block);
+      for (int j = 15; j >= 0 && !++nonce_counter[j]; j--);
+    }
+    output[i] = input[i] ^ stream_block[n];
+    n = (n + 1) & 15;
+  }
+  *nc_off = n;
+  return 0;
+}
+
+struct mbedtls_md_info_t {
+  mbedtls_md_type_t type;
+};
+static const mbedtls_md_info_t sha256Info = {MBEDTLS_MD_SHA256};
+
+const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t type) {
+  return type == MBEDTLS_MD_SHA256 ? &sha256Info : NULL;
+}
+
+void mbedtls_md_init(mbedtls_md_context_t* ctx) { ctx->ctx = NULL; }
+
+void mbedtls_md_free(mbedtls_md_context_t* ctx) {
+  if (ctx->ctx != NULL) HMAC_CTX_free((HMAC_CTX*)ctx->ctx);
+  ctx->ctx = NULL;
+}
+
+int mbedtls_md_setup(mbedtls_md_context_t* ctx, const mbedtls_md_info_t* info, int hmac) {
+  ctx->ctx = HMAC_CTX_new();
+  return info != NULL && hmac && ctx->ctx != NULL ? 0 : -1;
+}
+
+int mbedtls_md_hmac_starts(mbedtls_md_context_t* ctx, const unsigned char* key, size_t keylen) {
+  return HMAC_Init_ex((HMAC_CTX*)ctx->ctx, key, keylen, EVP_sha256(), NULL) ? 0 : -1;
+}
+
+int mbedtls_md_hmac_update(mbedtls_md_context_t* ctx, const unsigned char* input, size_t ilen) {
+  return HMAC_Update((HMAC_CTX*)ctx->ctx, input, ilen) ? 0 : -1;
+}
+
+int mbedtls_md_hmac_finish(mbedtls_md_context_t* ctx, unsigned char* output) {
+  unsigned int outLen;
+  return HMAC_Final((HMAC_CTX*)ctx->ctx, output, &outLen) ? 0 : -1;
+}
+
+int mbedtls_md_hmac(const mbedtls_md_info_t* info, const unsigned char* key, size_t keylen, const unsigned char* input,
+  size_t ilen, unsigned char* output) {
+  unsigned int outLen;
+  return info != NULL && HMAC(EVP_sha256(), key, keylen, input, ilen, output, &outLen) ? 0 : -1;
+}
+
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t type, const unsigned char* password, size_t plen,
+  const unsigned char* salt, size_t slen, unsigned int iteration_count, uint32_t key_length, unsigned char* output) {
+  return type == MBEDTLS_MD_SHA256 && PKCS5_PBKDF2_HMAC((const char*)password, plen, salt, slen, iteration_count,
+    EVP_sha256(), key_length, output) ? 0 : -1;
+}
+
+void mbedtls_platform_zeroize(void* buf, size_t len) { memset(buf, 0, len); }
+
+void esp_fill_random(void* buf, size_t len) { RAND_bytes((unsigned char*)buf, len); }
+
+uint32_t esp_random() {
+  uint32_t val;
+  esp_fill_random(&val, sizeof(val));
+  return val;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#define MBEDTLS_AES_ENCRYPT 1
+#define MBEDTLS_AES_DECRYPT 0
+typedef struct { uint8_t key[32]; unsigned bits; } mbedtls_aes_context;
+void mbedtls_aes_init(mbedtls_aes_context*);
+void mbedtls_aes_free(mbedtls_aes_context*);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context*, const unsigned char*, unsigned int);
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context*, int, const unsigned char in[16], unsigned char out[16]);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context*, size_t, size_t*, unsigned char nonce_counter[16], unsigned char stream_block[16], const unsigned char*, unsigned char*);
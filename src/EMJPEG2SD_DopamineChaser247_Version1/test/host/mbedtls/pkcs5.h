@@ -0,0 +1,3 @@
+#pragma once
+#include "md.h"
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t, const unsigned char*, size_t, const unsigned char*, size_t, unsigned int, uint32_t, unsigned char*);
@@ -0,0 +1,138 @@
+// Host stand-ins for the modules around mjpeg2sd.cpp, so that its capture,
+// SD writer, staging and AVI code can be run on Linux with tasks.cpp.
+// Frames are passed to processFrame() by the test, in place of the capture
+// task, and the test defines esp_camera_fb_return(), checkMotion() and
+// catalogAdd() to follow the frames, motion and recordings. Recordings are
+// not encrypted, and there is no audio, streaming or web server.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+#include <stdarg.h>
+#include <unistd.h>
+
+#define HOST_EPOCH 1760000000 // wall clock at start of test
+
+// camera, a sensor whose settings are only recorded
+static int setFramesize(sensor_t* s, framesize_t frameSize) { s->status.framesize = frameSize; return 0; }
+static int setQuality(sensor_t* s, int quality) { s->status.quality = quality; return 0; }
+static int setOther(sensor_t*, int) { return 0; }
+static sensor_t hostSensor = {{OV5640_PID}, {FRAMESIZE_FHD, 10, 0, 0, 0}, setFramesize, setQuality,
+  setOther, setOther, setOther, setOther, setOther, setOther, setOther, setOther, setOther};
+
+sensor_t* esp_camera_sensor_get() { return &hostSensor; }
+esp_err_t esp_camera_init(const camera_config_t*) { return ESP_OK; }
+esp_err_t esp_camera_deinit() { return ESP_OK; }
+camera_fb_t* esp_camera_fb_get() { return NULL; } // capture task not used
+esp_err_t ledc_stop(int, int, uint32_t) { return ESP_OK; }
+esp_err_t ledc_timer_config(const ledc_timer_config_t*) { return ESP_OK; }
+esp_err_t ledc_channel_config(const ledc_channel_config_t*) { return ESP_OK; }
+
+// frame timer, which never fires as frames are passed by the test
+static char hostTimer;
+hw_timer_t* timerBegin(uint32_t) { return (hw_timer_t*)&hostTimer; }
+void timerEnd(hw_timer_t*) {}
+void timerAttachInterrupt(hw_timer_t*, void (*)()) {}
+void timerDetachInterrupt(hw_timer_t*) {}
+void timerAlarm(hw_timer_t*, uint64_t, bool, uint64_t) {}
+
+// mjpeg2sd.cpp truncates files by their VFS path, so linked with --wrap=truncate
+extern "C" int __real_truncate(const char* path, off_t len);
+extern "C" int __wrap_truncate(const char* path, off_t len) {
+  return __real_truncate(strncmp(path, "/sdcard/", 8) ? path : hostPath(path + 7).c_str(), len);
+}
+
+bool preallocFile(const char* path, size_t len) {
+  // sparse file of given length
+  FILE* f = fopen(hostPath(path).c_str(), "wb");
+  if (f == NULL) return false;
+  bool sized = !ftruncate(fileno(f), len);
+  fclose(f);
+  return sized;
+}
+
+File fs::File::openNextFile(const char*) { return File(); } // no folders to list
+
+// serial output shown only if V set in environment
+HWSerial Serial;
+
+size_t Print::println(const char* line) {
+  return getenv("V") ? printf("%s\n", line) : 0;
+}
+
+size_t Print::printf(const char* fmtStr, ...) {
+  if (!getenv("V")) return 0;
+  va_list args;
+  va_start(args, fmtStr);
+  int len = vprintf(fmtStr, args);
+  va_end(args);
+  return len;
+}
+
+uint32_t EspClass::getPsramSize() { return 8 * ONEMEG; }
+
+// utils
+char startupFailure[SF_LEN] = {0};
+bool timeSynchronized = true;
+bool sdLog = false;
+byte* alertBuffer = NULL;
+size_t alertBufferSize = 0;
+size_t maxAlertBuffSize = 0;
+
+time_t getEpoch() { return HOST_EPOCH + millis() / 1000; }
+
+void dateFormat(char* inBuff, size_t inBuffLen, bool isFolder) {
+  time_t currEpoch = getEpoch();
+  strftime(inBuff, inBuffLen, isFolder ? "/%Y%m%d" : "/%Y%m%d/%Y%m%d_%H%M%S", gmtime(&currEpoch));
+}
+
+void replaceChar(char* s, char c, char r) {
+  for (; *s; s++) if (*s == c) *s = r;
+}
+
+void setFolderName(const char* fname, char* fileName) { strcpy(fileName, fname); }
+const char* espErrMsg(esp_err_t) { return "host"; }
+void checkMemory(const char*) {}
+void logLine() {}
+void showProgress(const char*) {}
+void stopPing() {}
+bool retrieveConfigVal(const char*, char*) { return false; }
+void reloadConfigs() {}
+
+// storage management
+int sdFreeSpaceMode = 0;
+int sdMinCardFreeSpace = 0;
+uint64_t retentionFree() { return 16ULL * 1024 * ONEMEG; }
+void retentionHint(size_t) {}
+void prepRetention() {}
+void prepScrub() {}
+void prepSdBench() {}
+void prepCatalog() {}
+void catalogAddFile(const char*) {}
+bool catalogFind(const char*, catEntry&) { return false; }
+
+// recordings not encrypted
+void prepRecCrypt() {}
+bool encReady() { return false; }
+bool encBegin(File&, size_t) { return false; }
+void encStage(uint8_t*, size_t) {}
+void encPatch(File&, size_t, const uint8_t*, size_t) {}
+uint32_t encEnd(File&) { return 0; }
+File recDecrypt(File raw, encState* state) { if (state != NULL) *state = ENC_NONE; return raw; }
+File recOpen(const char* path, const char* mode, encState* state) { return recDecrypt(STORAGE.open(path, mode), state); }
+
+// no audio
+TaskHandle_t audioHandle = NULL;
+void startAudioRecord(uint32_t) {}
+void finishAudioRecord(bool) {}
+size_t pendingAudio() { return 0; }
+size_t takeAudio(const uint8_t**, size_t) { return 0; }
+void releaseAudio(size_t) {}
+size_t queueAudio(const uint8_t*, size_t sampleLen) { return sampleLen; }
+
+// no streams
+uint8_t numStreams = 0;
+uint8_t vidStreams = 0;
+TaskHandle_t sustainHandle[MAX_STREAMS] = {NULL};
+char inFileName[IN_FILE_NAME_LEN];
@@ -0,0 +1,24 @@
+// Host time and FreeRTOS primitives for single threaded tests, where time
+// only advances when set by the test or by delay(), semaphores are no-ops,
+// and a task runs to completion when created.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+
+unsigned long millis() { return hostMs; }
+unsigned long micros() { return hostMs * 1000UL; }
+void delay(uint32_t ms) { hostMs += ms; }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+SemaphoreHandle_t xSemaphoreCreateBinary() { return (SemaphoreHandle_t)1; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+BaseType_t xTaskCreate(TaskFunction_t fn, const char*, uint32_t, void* param, UBaseType_t, TaskHandle_t* handle) {
+  // task run to completion on creation
+  if (handle != NULL) *handle = (TaskHandle_t)1;
+  fn(param);
+  return pdPASS;
+}
+void vTaskDelete(TaskHandle_t) {}
@@ -0,0 +1,94 @@
+// Host time and FreeRTOS primitives for tests running app tasks on threads,
+// such as the SD writer and flush tasks of mjpeg2sd.cpp.
+// Time is real time since start, scaled by hostSpeed so that replays can run
+// faster than real time, from a start of hostMs. Each task is a detached
+// thread, its handle being the counting semaphore for its notifications.
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+float hostSpeed = 1;
+
+struct hostSem {
+  // counting semaphore, also used for mutexes and task notifications
+  std::mutex m;
+  std::condition_variable cv;
+  uint32_t count;
+  uint32_t maxCount;
+};
+
+// never deleted, as task threads may still be waiting on them at exit
+static hostSem* newSem(uint32_t count, uint32_t maxCount) {
+  hostSem* sem = new hostSem;
+  sem->count = count;
+  sem->maxCount = maxCount;
+  return sem;
+}
+
+static thread_local hostSem* currentTask = NULL;
+static const auto hostStart = std::chrono::steady_clock::now();
+
+static uint64_t elapsedUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count()
+    * hostSpeed;
+}
+
+unsigned long millis() { return hostMs + elapsedUs() / 1000; }
+unsigned long micros() { return hostMs * 1000UL + elapsedUs(); }
+int64_t esp_timer_get_time() { return micros(); }
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(ms * 1000 / hostSpeed)));
+}
+
+static uint32_t semWait(hostSem* sem, TickType_t ticks, bool takeAll) {
+  // wait for count, then take one or all of it, returns count before taken
+  std::unique_lock<std::mutex> lock(sem->m);
+  auto ready = [sem] { return sem->count > 0; };
+  if (ticks == portMAX_DELAY) sem->cv.wait(lock, ready);
+  else if (!sem->cv.wait_for(lock, std::chrono::microseconds((int64_t)(ticks * 1000 / hostSpeed)), ready)) return 0;
+  uint32_t count = sem->count;
+  sem->count = takeAll ? 0 : count - 1;
+  return count;
+}
+
+static BaseType_t semGive(hostSem* sem) {
+  std::lock_guard<std::mutex> lock(sem->m);
+  if (sem->count >= sem->maxCount) return pdFALSE;
+  sem->count++;
+  sem->cv.notify_all();
+  return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return newSem(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary() { return newSem(0, 1); }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) { return semWait((hostSem*)sem, ticks, false) ? pdTRUE : pdFALSE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { return semGive((hostSem*)sem); }
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t*) { return semGive((hostSem*)sem); }
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char*, uint32_t, void* param, UBaseType_t, TaskHandle_t* handle) {
+  hostSem* task = newSem(0, UINT32_MAX);
+  if (handle != NULL) *handle = task;
+  std::thread([=] {
+    currentTask = task;
+    fn(param);
+  }).detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t) {} // thread ends when task function returns
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  // caller not created by xTaskCreate, such as main, given its own notifications
+  if (currentTask == NULL) currentTask = newSem(0, UINT32_MAX);
+  return semWait(currentTask, ticks, clearOnExit);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return semGive((hostSem*)task); }
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t*) { semGive((hostSem*)task); }
@@ -0,0 +1,244 @@
+// Host tests of loop recording in loopRec.cpp, with the loop file as an
+// image on the emulated SD:
+// - sessions of frames are written until the ring wraps, evicting the
+//   oldest segments
+// - exports of the full time range and of random ranges must validate clean
+//   with aviCheck.h, and hold exactly the retained frames in range, in order
+//   and with their content
+// - a recording interrupted in a reused segment must, at restart, recover the
+//   frames written after the last table commit, but not the frames left in
+//   the segment from the previous wrap
+//
+// Usage: loopTest [seed]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "aviCheck.h"
+#include "host.h"
+#include <map>
+#include <random>
+#include <unistd.h>
+
+#define CHECK_BUF 65536
+#define TEST_LOOP_MB 256 // smallest loop file, with 1MB segments
+#define FRAME_MS 100
+#define START_EPOCH 1760000000
+
+struct frameRec {
+  uint64_t epochMs;
+  size_t len;
+};
+
+struct loopStatus {
+  unsigned long oldest, newest, frames;
+};
+
+static std::mt19937 rng;
+static uint8_t checkBuf[CHECK_BUF];
+static std::map<uint32_t, frameRec> written; // frames expected in loop file, by id
+static std::vector<std::string> exported; // recordings added to catalog
+static uint32_t nextId = 0;
+static size_t segOffset = 0; // of next frame in current segment
+
+// functions of modules not under test
+RecordState recordState = IDLE;
+SemaphoreHandle_t aviMutex = NULL;
+
+time_t getEpoch() {
+  return START_EPOCH + hostMs / 1000;
+}
+
+bool preallocFile(const char* path, size_t len) {
+  // sparse file image of given length
+  FILE* f = fopen(hostPath(path).c_str(), "wb");
+  if (f == NULL) return false;
+  bool sized = !ftruncate(fileno(f), len);
+  fclose(f);
+  return sized;
+}
+
+void catalogAddFile(const char* path) {
+  exported.push_back(path);
+}
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static void noIssue(void*, const char* issue) {
+  if (getenv("V")) printf("  issue: %s\n", issue);
+}
+
+static std::vector<uint8_t> makeJpeg(uint32_t id, size_t len) {
+  // content unique to frame, starting with SOF0 for FHD frame, followed by id
+  static const uint8_t sof[] = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x04, 0x38, 0x07, 0x80};
+  std::vector<uint8_t> jpeg(len);
+  for (size_t i = 0; i < len; i++) jpeg[i] = (uint8_t)(id * 7 + i);
+  memcpy(jpeg.data(), sof, sizeof(sof));
+  memcpy(jpeg.data() + sizeof(sof), &id, sizeof(id));
+  return jpeg;
+}
+
+static size_t frameLen(size_t offset) {
+  // frame size given by its offset in segment, so that each wrap writes frame
+  // records at the same offsets as the previous one
+  return 20000 + (offset * 2654435761u >> 7) % 40000;
+}
+
+static void writeSession(uint32_t frames, bool interrupted = false) {
+  // recording session of given frames, ended as loopRecord() does unless interrupted
+  hostMs += 60 * 1000;
+  loopBegin(FRAMESIZE_FHD, 1000 / FRAME_MS);
+  uint64_t epochBase = (uint64_t)getEpoch() * 1000 - hostMs; // as loopBegin()
+  for (uint32_t i = 0; i < frames; i++, nextId++) {
+    hostMs += FRAME_MS;
+    size_t len = frameLen(segOffset);
+    if (segOffset + loopRecLen(len) > TEST_LOOP_MB * ONEMEG / LOOP_SEGS) len = frameLen(segOffset = 0);
+    std::vector<uint8_t> jpeg = makeJpeg(nextId, len);
+    size_t recLen = loopFrame(jpeg.data(), len, hostMs);
+    CHECK(recLen == loopRecLen(len), "frame %u not written", nextId);
+    segOffset += recLen;
+    written[nextId] = {epochBase + hostMs, len};
+  }
+  if (!interrupted) loopEnd();
+}
+
+static loopStatus getStatus() {
+  char jsonBuff[256];
+  loopInfo(jsonBuff);
+  loopStatus ls = {};
+  const char* oldest = strstr(jsonBuff, "\"oldest\"");
+  if (oldest == NULL || sscanf(oldest, "\"oldest\":%lu,\"newest\":%lu,\"frames\":%lu", &ls.oldest, &ls.newest, &ls.frames) != 3)
+    CHECK(false, "loop info %s", jsonBuff);
+  return ls;
+}
+
+static std::vector<uint32_t> exportFrames(const char* name) {
+  // ids of frames in exported avi, which must validate clean and match frames written
+  std::vector<uint32_t> ids;
+  FILE* f = fopen(hostPath(name).c_str(), "rb");
+  CHECK(f != NULL, "export %s missing", name);
+  if (f == NULL) return ids;
+  fseeko(f, 0, SEEK_END);
+  uint64_t fileSize = ftello(f);
+  aviCheck ac;
+  uint32_t issues = checkAviFile(ac, hostRead, noIssue, f, fileSize, checkBuf, sizeof(checkBuf));
+  CHECK(!issues, "export %s has %u issues", name, issues);
+  // walk chunks of each RIFF movi list
+  uint64_t pos = AVI_HEADER_LEN;
+  std::vector<uint8_t> chunk;
+  while (pos + CHUNK_HDR <= fileSize) {
+    uint8_t hdr[CHUNK_HDR];
+    uint32_t len;
+    hostRead(f, pos, hdr, CHUNK_HDR);
+    memcpy(&len, hdr + 4, 4);
+    if (!memcmp(hdr, "RIFF", 4) || !memcmp(hdr, "LIST", 4)) {
+      pos += 12;
+      continue;
+    }
+    if (!memcmp(hdr, dcBuf, 4)) {
+      uint32_t id;
+      chunk.resize(len);
+      hostRead(f, pos + CHUNK_HDR, chunk.data(), len);
+      memcpy(&id, chunk.data() + 11, sizeof(id));
+      auto it = written.find(id);
+      bool match = it != written.end() && len >= it->second.len
+        && makeJpeg(id, it->second.len) == std::vector<uint8_t>(chunk.begin(), chunk.begin() + it->second.len);
+      CHECK(match, "export %s frame %u content differs from written", name, id);
+      ids.push_back(id);
+    }
+    pos += CHUNK_HDR + len + (len & 1);
+  }
+  fclose(f);
+  return ids;
+}
+
+static std::vector<uint32_t> framesInRange(uint64_t fromMs, uint64_t toMs) {
+  std::vector<uint32_t> ids;
+  for (auto& w : written) if (w.second.epochMs >= fromMs && w.second.epochMs <= toMs) ids.push_back(w.first);
+  return ids;
+}
+
+static void checkFullExport(const char* stage) {
+  // all retained frames, with the frames evicted by wrapping being the oldest
+  loopStatus ls = getStatus();
+  char range[40];
+  snprintf(range, sizeof(range), "%lu-%lu", ls.oldest, ls.newest);
+  size_t before = exported.size();
+  CHECK(startLoopExport(range), "%s: export %s not started", stage, range);
+  CHECK(exported.size() == before + 1, "%s: export %s not saved", stage, range);
+  if (exported.size() == before) return;
+  std::vector<uint32_t> ids = exportFrames(exported.back().c_str());
+  CHECK(!ids.empty() && ids.size() == ls.frames, "%s: exported %zu frames of %lu", stage, ids.size(), ls.frames);
+  if (ids.empty()) return;
+  written.erase(written.begin(), written.lower_bound(ids.front()));
+  std::vector<uint32_t> want = framesInRange(0, UINT64_MAX);
+  CHECK(ids == want, "%s: exported %zu frames from %u, expected %zu from %u", stage, ids.size(), ids.front(),
+    want.size(), want.empty() ? 0 : want.front());
+}
+
+static void rangeTest(int exports) {
+  // random ranges hold retained frames in range only
+  loopStatus ls = getStatus();
+  for (int i = 0; i < exports; i++) {
+    unsigned long fromSecs = ls.oldest + rnd(ls.newest - ls.oldest + 1);
+    unsigned long toSecs = fromSecs + rnd(std::min(ls.newest - fromSecs + 1, 600UL));
+    char range[40];
+    snprintf(range, sizeof(range), "%lu-%lu", fromSecs, toSecs);
+    std::vector<uint32_t> want = framesInRange((uint64_t)fromSecs * 1000, (uint64_t)toSecs * 1000 + 999);
+    size_t before = exported.size();
+    CHECK(startLoopExport(range), "export %s not started", range);
+    if (want.empty()) {
+      // range between sessions
+      CHECK(exported.size() == before, "export %s saved without frames", range);
+      continue;
+    }
+    CHECK(exported.size() == before + 1, "export %s not saved", range);
+    if (exported.size() == before) continue;
+    std::vector<uint32_t> ids = exportFrames(exported.back().c_str());
+    CHECK(ids == want, "export %s has %zu frames, expected %zu", range, ids.size(), want.size());
+  }
+  char range[] = "200-100";
+  CHECK(!startLoopExport(range), "reversed range %s accepted", range);
+}
+
+static void wrapTest() {
+  // write about 1.3 times the loop file size, so that it wraps
+  hostClear();
+  STORAGE.mkdir(DATA_DIR);
+  loopRecord = true;
+  loopSizeMB = TEST_LOOP_MB;
+  prepLoop();
+  CHECK(loopReady(), "loop file not created");
+  if (!loopReady()) return;
+  size_t target = (size_t)TEST_LOOP_MB * ONEMEG * 13 / 10;
+  for (size_t total = 0; total < target; total = (size_t)nextId * 40000) writeSession(50 + rnd(400));
+  checkFullExport("wrapped");
+  CHECK(written.begin()->first > 0, "no frames evicted after wrap");
+  rangeTest(8);
+}
+
+static void recoveryTest() {
+  // recording interrupted in reused segment more than one commit interval after
+  // it starts, then restarted with existing loop file
+  writeSession(256, true);
+  loopStatus committed = getStatus();
+  prepLoop();
+  CHECK(loopReady(), "loop file not reopened");
+  loopStatus recovered = getStatus();
+  CHECK(recovered.frames > committed.frames, "no frames recovered, %lu committed", committed.frames);
+  checkFullExport("recovered");
+  // recording continues after recovered frames
+  writeSession(100);
+  checkFullExport("continued");
+  rangeTest(4);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) rng.seed(atoi(argv[1]));
+  hostMs = 1000;
+  wrapTest();
+  recoveryTest();
+  return hostResult("loopTest");
+}
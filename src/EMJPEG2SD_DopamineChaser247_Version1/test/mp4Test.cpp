@@ -0,0 +1,281 @@
+// Host tests of the fragmented MP4 writer in mp4.cpp.
+// Recordings of random frame sizes and capture intervals, including frames
+// too large for the fragment buffer, are written as mjpeg2sd.cpp does, then
+// parsed as ISO BMFF boxes: box sizes must tile the file, the moov must describe
+// the track, each moof must locate its frames in the following mdat with the
+// durations of their capture intervals, and the mfra must index every moof.
+// Truncated copies must be recovered to their last complete fragment.
+//
+// Usage: mp4Test [iterations] [seed]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "host.h"
+#include <random>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define REC_FPS 10
+#define TIMESCALE 90000 // as MP4_TIMESCALE
+#define BIG_FRAME (ONEMEG + 4096) // larger than fragment buffer
+
+size_t maxFrameBuffSize = 0;
+
+struct frameInfo {
+  size_t len;
+  uint32_t ms;
+  bool noNext; // fragment closed without capture time of next frame
+};
+
+static std::mt19937 rng;
+static std::vector<frameInfo> frames;
+static uint32_t prevDuration; // of last frame checked
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static inline uint32_t get32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline uint64_t get64(const uint8_t* p) {
+  return (uint64_t)get32(p) << 32 | get32(p + 4);
+}
+
+static void fillFrame(std::vector<uint8_t>& buf, uint32_t frameNum) {
+  for (size_t i = 0; i < buf.size(); i++) buf[i] = (uint8_t)(frameNum * 31 + i);
+}
+
+static void stageMp4(File& mp4File, uint32_t nextMs) {
+  // as stageMp4() in mjpeg2sd.cpp
+  const uint8_t* mp4Data;
+  size_t mp4Len;
+  while ((mp4Len = getMp4Data(&mp4Data, nextMs))) mp4File.write(mp4Data, mp4Len);
+}
+
+static void makeMp4(uint32_t frameCnt) {
+  // write recording as saveMp4Frame() and closeAvi() in mjpeg2sd.cpp
+  File mp4File = STORAGE.open(MP4TEMP, FILE_WRITE);
+  const uint8_t* initData;
+  size_t initLen = prepMp4(WIDTH, HEIGHT, REC_FPS, &initData);
+  mp4File.write(initData, initLen);
+  frames.clear();
+  uint32_t nowMs = 1000 + rnd(100000);
+  std::vector<uint8_t> jpeg;
+  for (uint32_t i = 0; i < frameCnt; i++) {
+    size_t len = rnd(40) ? 1000 + rnd(rnd(4) ? 40000 : 200000) : BIG_FRAME;
+    jpeg.resize(len);
+    fillFrame(jpeg, i);
+    if (mp4FragDue(len)) stageMp4(mp4File, nowMs);
+    addMp4Frame(jpeg.data(), len, nowMs);
+    frames.push_back({len, nowMs, false});
+    if (mp4FragDue(0)) {
+      // frame not copied, so output before buffer reused
+      stageMp4(mp4File, 0);
+      frames.back().noNext = true;
+    }
+    nowMs += 60 + rnd(120);
+  }
+  stageMp4(mp4File, 0);
+  if (!frames.empty()) frames.back().noNext = true;
+  const uint8_t* mfraData;
+  size_t mfraLen = finishMp4(&mfraData);
+  CHECK(mfraLen, "no mfra");
+  mp4File.write(mfraData, mfraLen);
+  mp4File.close();
+}
+
+static const uint8_t* childBox(const std::vector<uint8_t>& file, size_t pos, size_t end, const char* type, size_t skip = 0) {
+  // locate child box of given type within container content, checking child sizes fill it exactly
+  const uint8_t* found = NULL;
+  pos += skip;
+  while (pos + 8 <= end) {
+    uint32_t size = get32(&file[pos]);
+    if (size < 8 || pos + size > end) break;
+    if (!memcmp(&file[pos + 4], type, 4) && found == NULL) found = &file[pos];
+    pos += size;
+  }
+  CHECK(pos == end, "children of container end at %zu, container ends at %zu", pos, end);
+  return found;
+}
+
+static const uint8_t* findPath(const std::vector<uint8_t>& file, const uint8_t* box, const char* path) {
+  // descend through containers given as "type/type/..."
+  while (box != NULL && *path) {
+    size_t pos = box - file.data();
+    size_t end = pos + get32(box);
+    size_t skip = !memcmp(box + 4, "stsd", 4) ? 16 : !memcmp(box + 4, "dref", 4) ? 16 : 8;
+    char type[5] = {0};
+    memcpy(type, path, 4);
+    box = childBox(file, pos, end, type, skip);
+    path += path[4] == '/' ? 5 : 4;
+  }
+  return box;
+}
+
+static void checkMoov(const std::vector<uint8_t>& file, const uint8_t* moov) {
+  const uint8_t* mvhd = findPath(file, moov, "mvhd");
+  CHECK(mvhd && get32(mvhd + 20) == TIMESCALE, "mvhd timescale");
+  const uint8_t* tkhd = findPath(file, moov, "trak/tkhd");
+  CHECK(tkhd && get32(tkhd + 84) >> 16 == WIDTH && get32(tkhd + 88) >> 16 == HEIGHT, "tkhd dimensions");
+  const uint8_t* mdhd = findPath(file, moov, "trak/mdia/mdhd");
+  CHECK(mdhd && get32(mdhd + 20) == TIMESCALE, "mdhd timescale");
+  const uint8_t* hdlr = findPath(file, moov, "trak/mdia/hdlr");
+  CHECK(hdlr && !memcmp(hdlr + 16, "vide", 4), "hdlr not video");
+  CHECK(findPath(file, moov, "trak/mdia/minf/dinf/dref/url ") != NULL, "no data reference");
+  const uint8_t* jpeg = findPath(file, moov, "trak/mdia/minf/stbl/stsd/jpeg");
+  CHECK(jpeg && (jpeg[32] << 8 | jpeg[33]) == WIDTH && (jpeg[34] << 8 | jpeg[35]) == HEIGHT, "jpeg sample entry");
+  for (const char* table : {"trak/mdia/minf/stbl/stts", "trak/mdia/minf/stbl/stsc", "trak/mdia/minf/stbl/stco", "trak/mdia/minf/stbl/stsz"})
+    CHECK(findPath(file, moov, table) != NULL, "no %s", table + 20);
+  const uint8_t* trex = findPath(file, moov, "mvex/trex");
+  CHECK(trex && get32(trex + 12) == 1, "trex track");
+}
+
+static uint32_t checkFragment(const std::vector<uint8_t>& file, const uint8_t* moof, const uint8_t* mdat,
+  uint32_t fragNum, uint32_t firstFrame, uint64_t& decodeTime) {
+  // moof locates its frames in following mdat, with their capture durations, returns frame count
+  const uint8_t* mfhd = findPath(file, moof, "mfhd");
+  CHECK(mfhd && get32(mfhd + 12) == fragNum + 1, "fragment %u sequence number", fragNum);
+  const uint8_t* tfhd = findPath(file, moof, "traf/tfhd");
+  CHECK(tfhd && get32(tfhd + 12) == 1 && (get32(tfhd + 8) & 0x020000), "fragment %u tfhd", fragNum);
+  const uint8_t* tfdt = findPath(file, moof, "traf/tfdt");
+  CHECK(tfdt && get64(tfdt + 12) == decodeTime, "fragment %u decode time %llu, expected %llu", fragNum,
+    tfdt ? (unsigned long long)get64(tfdt + 12) : 0ULL, (unsigned long long)decodeTime);
+  const uint8_t* trun = findPath(file, moof, "traf/trun");
+  if (trun == NULL || mdat == NULL) {
+    CHECK(false, "fragment %u incomplete", fragNum);
+    return 0;
+  }
+  uint32_t count = get32(trun + 12);
+  CHECK(moof + get32(trun + 16) == mdat + 8, "fragment %u data offset", fragNum);
+  size_t dataPos = mdat + 8 - file.data();
+  std::vector<uint8_t> want;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t frameNum = firstFrame + i;
+    uint32_t duration = get32(trun + 20 + i * 8);
+    uint32_t size = get32(trun + 24 + i * 8);
+    if (frameNum >= frames.size()) {
+      CHECK(false, "fragment %u has more frames than recorded", fragNum);
+      return count;
+    }
+    const frameInfo& fi = frames[frameNum];
+    CHECK(size == fi.len, "frame %u size %u, expected %zu", frameNum, size, fi.len);
+    // frame without a next capture time repeats previous duration
+    uint32_t wantDuration = fi.noNext ? prevDuration : (frames[frameNum + 1].ms - fi.ms) * (TIMESCALE / 1000);
+    CHECK(duration == wantDuration, "frame %u duration %u, expected %u", frameNum, duration, wantDuration);
+    prevDuration = duration;
+    want.resize(size);
+    fillFrame(want, frameNum);
+    CHECK(dataPos + size <= file.size() && !memcmp(&file[dataPos], want.data(), size), "frame %u content", frameNum);
+    dataPos += size;
+    decodeTime += duration;
+  }
+  CHECK(dataPos == (size_t)(mdat - file.data()) + get32(mdat), "fragment %u frames do not fill mdat", fragNum);
+  return count;
+}
+
+static void checkMp4(const char* name) {
+  // parse top level boxes, which must tile file
+  std::vector<uint8_t> file;
+  FILE* f = fopen(hostPath(name).c_str(), "rb");
+  fseeko(f, 0, SEEK_END);
+  file.resize(ftello(f));
+  fseeko(f, 0, SEEK_SET);
+  if (fread(file.data(), 1, file.size(), f) != file.size()) CHECK(false, "short read");
+  fclose(f);
+  size_t pos = 0;
+  const uint8_t* moof = NULL;
+  const uint8_t* mfra = NULL;
+  std::vector<std::pair<uint64_t, size_t>> fragStarts; // decode time, offset
+  uint32_t fragNum = 0, frameNum = 0;
+  uint64_t decodeTime = 0;
+  bool haveMoov = false;
+  prevDuration = TIMESCALE / REC_FPS; // nominal
+  while (pos + 8 <= file.size()) {
+    const uint8_t* box = &file[pos];
+    uint32_t size = get32(box);
+    if (size < 8 || pos + size > file.size()) break;
+    if (!pos) CHECK(!memcmp(box + 4, "ftyp", 4), "file does not start with ftyp");
+    else if (!memcmp(box + 4, "moov", 4)) {
+      checkMoov(file, box);
+      haveMoov = true;
+    } else if (!memcmp(box + 4, "moof", 4)) {
+      CHECK(moof == NULL, "moof at %zu without mdat", pos);
+      moof = box;
+      fragStarts.push_back({decodeTime, pos});
+    } else if (!memcmp(box + 4, "mdat", 4)) {
+      frameNum += checkFragment(file, moof, box, fragNum++, frameNum, decodeTime);
+      moof = NULL;
+    } else if (!memcmp(box + 4, "mfra", 4)) mfra = box;
+    else CHECK(false, "unexpected box %.4s at %zu", (const char*)box + 4, pos);
+    pos += size;
+  }
+  CHECK(pos == file.size(), "boxes end at %zu of %zu", pos, file.size());
+  CHECK(haveMoov, "no moov");
+  CHECK(frameNum == frames.size(), "%u frames in fragments, %zu recorded", frameNum, frames.size());
+  if (mfra == NULL) {
+    CHECK(false, "no mfra");
+    return;
+  }
+  CHECK(mfra + get32(mfra) == file.data() + file.size(), "mfra not at end");
+  const uint8_t* tfra = findPath(file, mfra, "tfra");
+  const uint8_t* mfro = findPath(file, mfra, "mfro");
+  CHECK(mfro && get32(mfro + 12) == get32(mfra), "mfro size");
+  CHECK(tfra && get32(tfra + 20) == fragStarts.size(), "tfra has %u entries for %zu fragments", tfra ? get32(tfra + 20) : 0, fragStarts.size());
+  for (size_t i = 0; tfra && i < std::min((size_t)get32(tfra + 20), fragStarts.size()); i++) {
+    const uint8_t* entry = tfra + 24 + i * 19;
+    CHECK(get64(entry) == fragStarts[i].first && get64(entry + 8) == fragStarts[i].second, "tfra entry %zu", i);
+  }
+}
+
+static void truncateTest() {
+  // cut file at random points, recovery keeps complete fragments only
+  std::string path = hostPath(MP4TEMP);
+  FILE* f = fopen(path.c_str(), "rb");
+  std::vector<uint8_t> file;
+  fseeko(f, 0, SEEK_END);
+  file.resize(ftello(f));
+  fseeko(f, 0, SEEK_SET);
+  if (fread(file.data(), 1, file.size(), f) != file.size()) CHECK(false, "short read");
+  fclose(f);
+  // fragment ends and frames before each, from box walk
+  std::vector<std::pair<size_t, uint32_t>> fragEnds;
+  uint32_t frameCnt = 0, moofFrames = 0;
+  for (size_t pos = 0; pos + 8 <= file.size(); pos += get32(&file[pos])) {
+    if (!memcmp(&file[pos + 4], "moof", 4)) moofFrames = get32(findPath(file, &file[pos], "traf/trun") + 12);
+    if (!memcmp(&file[pos + 4], "mdat", 4)) fragEnds.push_back({pos + get32(&file[pos]), frameCnt += moofFrames});
+    if (!memcmp(&file[pos + 4], "mfra", 4)) break;
+  }
+  for (int i = 0; i < 20; i++) {
+    size_t cutLen = 8 + rnd(file.size() - 8);
+    f = fopen(path.c_str(), "wb");
+    fwrite(file.data(), 1, cutLen, f);
+    fclose(f);
+    File mp4File = STORAGE.open(MP4TEMP, FILE_READ);
+    size_t validLen = 0;
+    uint32_t got = recoverMp4(mp4File, validLen);
+    mp4File.close();
+    size_t wantLen = 0;
+    uint32_t want = 0;
+    for (auto& fe : fragEnds) if (fe.first <= cutLen) {
+      wantLen = fe.first;
+      want = fe.second;
+    }
+    CHECK(got == want, "cut at %zu recovered %u frames, expected %u", cutLen, got, want);
+    if (want) CHECK(validLen == wantLen, "cut at %zu kept %zu bytes, expected %zu", cutLen, validLen, wantLen);
+  }
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+  rng.seed(argc > 2 ? atoi(argv[2]) : 1);
+  hostClear();
+  for (int i = 0; i < iterations; i++) {
+    makeMp4(1 + rnd(rnd(4) ? 100 : 1000));
+    checkMp4(MP4TEMP);
+    if (i < 3) truncateTest();
+  }
+  return hostResult("mp4Test");
+}
@@ -0,0 +1,148 @@
+// Host tests of the frame decimator in pacing.h, fed with synthetic sensor
+// timestamp streams at a target of 10 fps. The exact sensor frames kept are
+// checked for:
+// - sensors faster than the target, by whole and by fractional ratios
+// - a sensor slower than the target, where every frame is kept
+// - jitter of the sensor timestamps around its period
+// - timestamps going backwards, or restarting, when the sensor is reset
+// - gaps in the sensor output, caught up within PACE_RESYNC periods and
+//   resynced from the next frame beyond that
+//
+// Usage: pacingTest [seed]
+//
+// s60sc 2025
+
+#include "pacing.h"
+#include "host.h"
+#include <random>
+#include <vector>
+
+#define TARGET_US 100000 // 10 fps
+#define BASE_US 5000000000LL // sensor timestamps since boot, beyond 32 bits
+
+static std::mt19937 rng;
+
+static int64_t rnd(int64_t n) {
+  return n ? (int64_t)(rng() % n) : 0;
+}
+
+static std::vector<int64_t> stream(uint32_t frames, int64_t periodUs, int64_t fromUs = BASE_US, int64_t jitterUs = 0) {
+  // timestamps of sensor frames at given period, each with up to jitterUs either side
+  std::vector<int64_t> ts;
+  for (uint32_t i = 0; i < frames; i++) ts.push_back(fromUs + i * periodUs + rnd(2 * jitterUs + 1) - jitterUs);
+  return ts;
+}
+
+static std::vector<uint32_t> kept(const std::vector<int64_t>& ts, uint32_t periodUs = TARGET_US) {
+  // indexes of sensor frames kept by decimator
+  frameDecimator dec;
+  resetDecimator(dec);
+  std::vector<uint32_t> ids;
+  for (size_t i = 0; i < ts.size(); i++) if (decimateFrame(dec, ts[i], periodUs)) ids.push_back(i);
+  return ids;
+}
+
+static std::vector<uint32_t> every(uint32_t step, uint32_t from, uint32_t to) {
+  // indexes from .. to - 1 at given step
+  std::vector<uint32_t> ids;
+  for (uint32_t i = from; i < to; i += step) ids.push_back(i);
+  return ids;
+}
+
+static std::vector<uint32_t> join(std::vector<uint32_t> a, const std::vector<uint32_t>& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+static void checkKept(const char* name, const std::vector<uint32_t>& got, const std::vector<uint32_t>& want) {
+  // exact frames kept, reporting first difference
+  size_t i = 0;
+  while (i < got.size() && i < want.size() && got[i] == want[i]) i++;
+  CHECK(got == want, "%s: kept %zu frames, expected %zu, first difference at kept frame %zu: %d instead of %d",
+    name, got.size(), want.size(), i, i < got.size() ? (int)got[i] : -1, i < want.size() ? (int)want[i] : -1);
+}
+
+static void fasterTest() {
+  // whole ratio keeps every nth frame, 30 fps to 10 fps and 15 fps
+  checkKept("30 to 10 fps", kept(stream(300, 33333)), every(3, 0, 300));
+  checkKept("30 to 15 fps", kept(stream(300, 33333), 66666), every(2, 0, 300));
+  // 25 fps to 10 fps alternates intervals of 2 and 3 frames, the frame
+  // nearest each due time being kept
+  std::vector<uint32_t> want;
+  for (uint32_t i = 0; i < 250; i += 5) want = join(want, {i, i + 2});
+  checkKept("25 to 10 fps", kept(stream(250, 40000)), want);
+}
+
+static void slowerTest() {
+  // sensor at or below target rate, so every frame kept, including when
+  // falling behind due time by more than PACE_RESYNC periods
+  checkKept("5 to 10 fps", kept(stream(100, 200000)), every(1, 0, 100));
+  checkKept("10 to 10 fps", kept(stream(100, TARGET_US)), every(1, 0, 100));
+  checkKept("9 to 10 fps", kept(stream(100, 111111)), every(1, 0, 100));
+}
+
+static void jitterTest(int iterations) {
+  // jitter of up to 5ms on 30 fps sensor does not change the frames kept
+  for (int i = 0; i < iterations; i++) {
+    int64_t jitterUs = 1 + rnd(5000);
+    std::vector<int64_t> ts = stream(600, 33333, BASE_US, jitterUs);
+    std::vector<uint32_t> ids = kept(ts);
+    checkKept("30 fps with jitter", ids, every(3, 0, 600));
+    // so kept intervals are within jitter of the target
+    for (size_t k = 1; k < ids.size(); k++) {
+      int64_t intervalUs = ts[ids[k]] - ts[ids[k - 1]];
+      CHECK(intervalUs >= TARGET_US - 2 * jitterUs && intervalUs <= TARGET_US + 2 * jitterUs,
+        "jitter %lld us gave interval %lld us", (long long)jitterUs, (long long)intervalUs);
+    }
+  }
+}
+
+static void restartTest() {
+  // timestamps going backwards, as on sensor reset, restart the cadence
+  // from the first frame after the reset
+  std::vector<int64_t> ts = stream(31, 33333);
+  std::vector<int64_t> after = stream(60, 33333, BASE_US - 1000000 + 5000);
+  ts.insert(ts.end(), after.begin(), after.end());
+  checkKept("backwards", kept(ts), join(every(3, 0, 31), every(3, 31, 91)));
+  // restarted from zero
+  ts = stream(31, 33333);
+  after = stream(60, 33333, 0);
+  ts.insert(ts.end(), after.begin(), after.end());
+  checkKept("restart from 0", kept(ts), join(every(3, 0, 31), every(3, 31, 91)));
+  // repeated timestamp also taken as restart
+  ts = stream(10, 33333);
+  ts.push_back(ts.back());
+  after = stream(20, 33333, ts.back() + 33333);
+  ts.insert(ts.end(), after.begin(), after.end());
+  checkKept("repeated", kept(ts), join(every(3, 0, 10), {10, 13, 16, 19, 22, 25, 28}));
+  // decimator reset before use, as on starting sensor pacing
+  frameDecimator dec;
+  resetDecimator(dec);
+  CHECK(decimateFrame(dec, 0, TARGET_US) && dec.started, "first frame at 0 not kept");
+  CHECK(!decimateFrame(dec, 33333, TARGET_US), "second frame kept");
+}
+
+static void gapTest() {
+  // 30 fps sensor missing frames, the gap excluded from the sensor period
+  std::vector<int64_t> all = stream(200, 33333);
+  // frames 10 to 14 missing, so frame 15 is within PACE_RESYNC periods of
+  // due time, and cadence catches up by keeping frame 16
+  std::vector<int64_t> ts(all.begin(), all.begin() + 10);
+  ts.insert(ts.end(), all.begin() + 15, all.end());
+  std::vector<uint32_t> want = join(every(3, 0, 10), {10, 11});
+  checkKept("short gap", kept(ts), join(want, every(3, 13, ts.size())));
+  // frames 10 to 39 missing, so cadence resyncs from frame 40
+  ts.assign(all.begin(), all.begin() + 10);
+  ts.insert(ts.end(), all.begin() + 40, all.end());
+  checkKept("long gap", kept(ts), join(every(3, 0, 10), every(3, 10, ts.size())));
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) rng.seed(atoi(argv[1]));
+  fasterTest();
+  slowerTest();
+  jitterTest(200);
+  restartTest();
+  gapTest();
+  return hostResult("pacingTest");
+}
@@ -0,0 +1,159 @@
+// Host tests of the QoS control law in qos.h.
+// Scripted scenarios check the order in which settings are degraded and
+// restored. Traces of qosInputs, as logged at verbose level by qosWindow()
+// in lines containing QOS_TRACE, are replayed to check that settings stay
+// within bounds, and that quality and fps are only changed while recording.
+//
+// Usage: qosTest [trace log files]
+//
+// s60sc 2025
+
+#include "qos.h"
+#include "host.h"
+#include <string.h>
+#include <vector>
+
+#define REC_FPS 10 // recording defaults, as qosRecordSettings()
+#define REC_QUALITY QOS_Q_BEST
+
+static const qosLimits lim = {0, REC_FPS, QOS_MIN_FPS};
+static const qosState startState = {REC_QUALITY, REC_FPS, QOS_CADENCE_MIN, 0, 0, NULL};
+
+static qosInputs window(bool recording, uint32_t sdPct, uint32_t cpuPct, uint32_t dropped = 0) {
+  // one second window with given load, SD writer queue tracking SD load
+  qosInputs in = {};
+  in.recording = recording;
+  in.windowMs = 1000;
+  in.sdWriteMs = recording ? sdPct * 10 : 0;
+  in.busyMs = cpuPct * 10;
+  in.bytes = recording ? 200000 : 0;
+  in.frames = recording ? REC_FPS : 0;
+  in.dropped = dropped;
+  in.queueLen = 8;
+  in.queueHW = recording ? (sdPct > QOS_SD_HIGH ? 6 : 2) : 0;
+  return in;
+}
+
+static std::vector<qosState> replay(const char* name, const std::vector<qosInputs>& trace) {
+  // apply control law to each window, checking invariants, returns state after each window
+  std::vector<qosState> states;
+  qosState st = startState;
+  uint32_t sinceChange = QOS_COOLDOWN;
+  for (size_t i = 0; i < trace.size(); i++) {
+    const qosInputs& in = trace[i];
+    qosState prev = st;
+    st = qosControl(st, in, lim);
+    states.push_back(st);
+    CHECK(st.quality >= QOS_Q_BEST && st.quality <= QOS_Q_WORST, "%s window %zu quality %d", name, i, st.quality);
+    CHECK(st.fps >= lim.minFPS && st.fps <= lim.maxFPS, "%s window %zu fps %u", name, i, st.fps);
+    CHECK(st.cadence >= QOS_CADENCE_MIN && st.cadence <= QOS_CADENCE_MAX, "%s window %zu cadence %u", name, i, st.cadence);
+    int changes = (st.quality != prev.quality) + (st.fps != prev.fps) + (st.cadence != prev.cadence);
+    CHECK(changes <= 1, "%s window %zu has %d changes", name, i, changes);
+    CHECK((changes == 1) == (st.reason != NULL), "%s window %zu reason does not match change", name, i);
+    if (!in.recording) CHECK(st.quality == prev.quality && st.fps == prev.fps, "%s window %zu quality or fps changed while idle", name, i);
+    if (changes) {
+      // only dropped frames override cooldown
+      CHECK(sinceChange >= QOS_COOLDOWN || in.dropped, "%s window %zu changed %u windows after last change", name, i, sinceChange);
+      sinceChange = 0;
+    } else sinceChange++;
+  }
+  return states;
+}
+
+static void idleCpuTest() {
+  // cpu overload while idle only slows motion checks
+  std::vector<qosInputs> trace(30, window(false, 0, 95));
+  std::vector<qosState> states = replay("idleCpu", trace);
+  CHECK(states.back().cadence == QOS_CADENCE_MAX, "idle cadence %u", states.back().cadence);
+}
+
+static void recordCpuTest() {
+  // cpu overload while recording lowers quality then fps before motion checks,
+  // as slower motion checks would end recordings early
+  std::vector<qosInputs> trace(60, window(true, 30, 95));
+  std::vector<qosState> states = replay("recordCpu", trace);
+  CHECK(states[0].quality == REC_QUALITY + QOS_Q_STEP && states[0].cadence == QOS_CADENCE_MIN,
+    "first change while recording: %s", states[0].reason ? states[0].reason : "none");
+  for (auto& st : states) {
+    if (st.cadence > QOS_CADENCE_MIN) {
+      CHECK(st.quality == QOS_Q_WORST && st.fps == lim.minFPS, "cadence %u with quality %d fps %u", st.cadence, st.quality, st.fps);
+      break;
+    }
+  }
+  CHECK(states.back().cadence > QOS_CADENCE_MIN, "cadence not raised once quality and fps at limits");
+}
+
+static void recordSdTest() {
+  // sd overload lowers quality to its limit, then fps, leaving motion checks
+  std::vector<qosInputs> trace(80, window(true, 90, 40));
+  std::vector<qosState> states = replay("recordSd", trace);
+  int lastQuality = REC_QUALITY;
+  for (auto& st : states) {
+    if (st.fps < REC_FPS) CHECK(st.quality == QOS_Q_WORST, "fps lowered with quality %d", st.quality);
+    CHECK(st.quality >= lastQuality, "quality improved during overload");
+    CHECK(st.cadence == QOS_CADENCE_MIN, "cadence changed for sd overload");
+    lastQuality = st.quality;
+  }
+  CHECK(states.back().fps == lim.minFPS, "fps %u after sustained overload", states.back().fps);
+}
+
+static void restoreTest() {
+  // after overload, sustained spare capacity restores fps then quality,
+  // each step only after QOS_UP_HOLD healthy windows
+  std::vector<qosInputs> trace(40, window(true, 90, 40));
+  trace.insert(trace.end(), 200, window(true, 20, 20));
+  std::vector<qosState> states = replay("restore", trace);
+  const qosState& last = states.back();
+  CHECK(last.fps == REC_FPS && last.quality == REC_QUALITY, "restored to fps %u quality %d", last.fps, last.quality);
+  size_t lastChange = 0;
+  for (size_t i = 0; i < states.size(); i++) {
+    if (states[i].reason == NULL) continue;
+    if (i >= 40) CHECK(i - lastChange >= QOS_UP_HOLD, "restore step at window %zu, %zu windows after last", i, i - lastChange);
+    if (i >= 40) CHECK(states[i].quality <= states[i - 1].quality || states[i].fps == REC_FPS, "quality restored before fps");
+    lastChange = i;
+  }
+}
+
+static void droppedTest() {
+  // dropped frames act during cooldown
+  std::vector<qosInputs> trace = {window(true, 90, 40), window(true, 30, 40, 3)};
+  std::vector<qosState> states = replay("dropped", trace);
+  CHECK(states[1].quality == REC_QUALITY + 2 * QOS_Q_STEP, "dropped frames ignored during cooldown");
+}
+
+static void traceTest(const char* path) {
+  // replay windows logged on device
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    CHECK(false, "cannot open %s", path);
+    return;
+  }
+  std::vector<qosInputs> trace;
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    const char* p = strstr(line, QOS_TRACE);
+    if (p == NULL) continue;
+    qosInputs in;
+    unsigned recording;
+    int got = sscanf(p + strlen(QOS_TRACE), QOS_TRACE_FMT, &recording, &in.windowMs, &in.sdWriteMs, &in.busyMs,
+      &in.bytes, &in.frames, &in.dropped, &in.backlog, &in.queueHW, &in.queueLen);
+    CHECK(got == 10, "%s: bad trace line %s", path, line);
+    in.recording = recording;
+    trace.push_back(in);
+  }
+  fclose(f);
+  CHECK(!trace.empty(), "%s: no trace lines", path);
+  std::vector<qosState> states = replay(path, trace);
+  for (size_t i = 0; i < states.size(); i++)
+    if (getenv("V") && states[i].reason) printf("%s %zu: %s\n", path, i, states[i].reason);
+}
+
+int main(int argc, char** argv) {
+  idleCpuTest();
+  recordCpuTest();
+  recordSdTest();
+  restoreTest();
+  droppedTest();
+  for (int i = 1; i < argc; i++) traceTest(argv[i]);
+  return hostResult("qosTest");
+}
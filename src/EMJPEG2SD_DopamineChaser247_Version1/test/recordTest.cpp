@@ -0,0 +1,146 @@
+// Host tests of the motion recording state machine in recordControl.h.
+// Frames are fed at a fixed rate against a scripted motion timeline, as
+// processFrame() does, and the resulting IDLE / RECORDING / COOLDOWN
+// transitions are checked against the configured times.
+//
+// s60sc 2025
+
+#include "recordControl.h"
+#include "host.h"
+#include <algorithm>
+#include <vector>
+
+#define FRAME_MS 100 // 10 fps
+
+// as processFrame() with default settings
+static const recordTimes defTimes = {60 * 1000, 5 * 60 * 1000, 5 * 1000, 10 * 1000, 3};
+
+struct motionSpan {
+  uint32_t fromMs;
+  uint32_t toMs;
+};
+
+struct stepResult {
+  uint32_t ms;
+  recordEvent event;
+};
+
+struct simResult {
+  std::vector<stepResult> events;
+  uint32_t checks; // motion checks made
+  uint32_t checksOutsideRec; // of which in cooldown
+};
+
+static simResult simulate(const recordTimes& rt, const std::vector<motionSpan>& motion, uint32_t runMs,
+  uint32_t startMs = 0, bool useMotion = true) {
+  // feed frames from startMs for runMs, motion present within given spans relative to startMs
+  simResult res = {};
+  recordMachine rm = {IDLE, 0, 0, 0};
+  for (uint32_t t = 0; t < runMs; t += FRAME_MS) {
+    uint32_t nowMs = startMs + t;
+    RecordState before = rm.state;
+    bool checked = motionCheckDue(rm, rt, nowMs, useMotion);
+    bool moving = false;
+    for (auto& span : motion) if (t >= span.fromMs && t < span.toMs) moving = true;
+    if (checked) {
+      res.checks++;
+      if (before == COOLDOWN) res.checksOutsideRec++;
+    }
+    recordEvent event = recordStep(rm, rt, nowMs, checked, checked && moving);
+    if (event != REC_NONE) res.events.push_back({t, event});
+  }
+  return res;
+}
+
+static const char* eventName(recordEvent event) {
+  static const char* names[] = {"NONE", "START", "EXTEND", "STOP", "STOP_MAX", "READY"};
+  return names[event];
+}
+
+static void expectEvents(const char* name, const simResult& res, const std::vector<recordEvent>& want) {
+  // sequence of events, ignoring extensions
+  std::vector<recordEvent> got;
+  for (auto& step : res.events) if (step.event != REC_EXTEND) got.push_back(step.event);
+  CHECK(got == want, "%s: got %zu events, expected %zu", name, got.size(), want.size());
+  if (got != want) for (auto& step : res.events) printf("  %u ms %s\n", step.ms, eventName(step.event));
+}
+
+static uint32_t eventMs(const simResult& res, recordEvent event, int nth = 0) {
+  for (auto& step : res.events) if (step.event == event && !nth--) return step.ms;
+  return UINT32_MAX;
+}
+
+static void cycleTest(uint32_t startMs) {
+  // brief motion gives IDLE -> RECORDING -> COOLDOWN -> IDLE, with recording
+  // lasting the minimum time, and no motion checked during cooldown
+  simResult res = simulate(defTimes, {{10000, 12000}, {75000, 80000}}, 100000, startMs);
+  expectEvents("cycle", res, {REC_START, REC_STOP, REC_READY});
+  uint32_t start = eventMs(res, REC_START);
+  uint32_t stop = eventMs(res, REC_STOP);
+  uint32_t ready = eventMs(res, REC_READY);
+  CHECK(start >= 10000 && start < 10000 + defTimes.cadence * FRAME_MS, "started at %u ms", start);
+  CHECK(stop - start >= defTimes.minRecMs && stop - start < defTimes.minRecMs + FRAME_MS, "recorded for %u ms", stop - start);
+  CHECK(ready - stop >= defTimes.cooldownMs && ready - stop < defTimes.cooldownMs + FRAME_MS, "cooldown of %u ms", ready - stop);
+  CHECK(!res.checksOutsideRec, "%u motion checks during cooldown", res.checksOutsideRec);
+}
+
+static void minTimeTest() {
+  // motion not checked until minRecMs into recording, nor within checkMs of start,
+  // so recordings outlast the default minSeconds of 30 and are kept by closeAvi()
+  for (uint32_t minSecs : {1u, 10u, 30u, 60u}) {
+    recordTimes rt = defTimes;
+    rt.minRecMs = minSecs * 1000;
+    simResult res = simulate(rt, {{1000, 1500}}, 200000);
+    uint32_t length = eventMs(res, REC_STOP) - eventMs(res, REC_START);
+    uint32_t wantMs = std::max(rt.minRecMs, rt.checkMs);
+    CHECK(length >= wantMs && length < wantMs + FRAME_MS, "min %u secs recorded for %u ms", minSecs, length);
+  }
+  simResult res = simulate(defTimes, {{1000, 1500}}, 200000);
+  CHECK(eventMs(res, REC_STOP) - eventMs(res, REC_START) >= 30 * 1000, "recording shorter than minSeconds");
+}
+
+static void extendTest() {
+  // continued motion extends recording at each check, stopping at first check without motion
+  simResult res = simulate(defTimes, {{1000, 100000}}, 200000);
+  expectEvents("extend", res, {REC_START, REC_STOP, REC_READY});
+  uint32_t start = eventMs(res, REC_START);
+  uint32_t firstExtend = eventMs(res, REC_EXTEND);
+  uint32_t secondExtend = eventMs(res, REC_EXTEND, 1);
+  uint32_t stop = eventMs(res, REC_STOP);
+  CHECK(firstExtend - start >= defTimes.minRecMs, "extended at %u ms into recording", firstExtend - start);
+  CHECK(secondExtend - firstExtend >= defTimes.checkMs && secondExtend - firstExtend < defTimes.checkMs + FRAME_MS,
+    "motion checked every %u ms", secondExtend - firstExtend);
+  CHECK(stop >= 100000 && stop < 100000 + defTimes.checkMs + FRAME_MS, "stopped at %u ms", stop);
+}
+
+static void maxTimeTest() {
+  // motion ending after max recording time is reported as such,
+  // and before it as a normal stop
+  simResult res = simulate(defTimes, {{1000, 400000}}, 500000);
+  expectEvents("max", res, {REC_START, REC_STOP_MAX, REC_READY});
+  CHECK(eventMs(res, REC_STOP_MAX) - eventMs(res, REC_START) >= defTimes.maxRecMs, "max stop before max time");
+  res = simulate(defTimes, {{1000, 200000}}, 300000);
+  expectEvents("under max", res, {REC_START, REC_STOP, REC_READY});
+}
+
+static void idleTest() {
+  // idle motion checked every cadence frames, and never if motion detection off
+  recordTimes rt = defTimes;
+  for (uint32_t cadence : {1u, 3u, 12u}) {
+    rt.cadence = cadence;
+    simResult res = simulate(rt, {}, 60000);
+    CHECK(res.checks == 60000 / FRAME_MS / cadence, "cadence %u gave %u checks", cadence, res.checks);
+  }
+  simResult res = simulate(defTimes, {{0, 60000}}, 60000, 0, false);
+  CHECK(res.events.empty() && !res.checks, "recording started with motion detection off");
+}
+
+int main() {
+  cycleTest(0);
+  cycleTest(UINT32_MAX - 50000); // millis() wraps during recording
+  minTimeTest();
+  extendTest();
+  maxTimeTest();
+  idleTest();
+  return hostResult("recordTest");
+}
@@ -0,0 +1,336 @@
+// Host replay of captured frames through processFrame() in mjpeg2sd.cpp,
+// and so through its IDLE / RECORDING / COOLDOWN state machine, openAvi(),
+// closeAvi() and SD writer, with the app tasks on threads and time running
+// at REPLAY_SPEED times real time. Frames are the files of a folder named by
+// their capture time in ms, as <ms>.jpg, with <ms>_M.jpg for frames in which
+// checkMotion() is to find motion, as the motion detector needs the camera
+// jpeg decoder. Each frame is passed at its capture time, and:
+// - the recordings saved are in sdcard/, each validated with aviCheck.h
+// - replay.csv has, for each frame, whether motion checked, the state after
+//   it, its processFrame() time in real us, and when its camera buffer was
+//   returned after capture
+// With no folder given, a sequence of motion and quiet periods, including
+// motion during cooldown and a gap in capture, is generated in replay/ and
+// the state changes, and the frames of each recording, are checked against
+// those expected.
+//
+// Usage: replayTest [folder]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "aviCheck.h"
+#include "host.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECK_BUF 65536
+#define REPLAY_SPEED 20 // host time to real time
+#define FRAME_MS 100
+#define START_TOL 8 // frames from start of motion to its detection, given check cadence
+#define STOP_TOL 2 // frames from due time of motion check to its frame
+
+struct replayFrame {
+  std::string file;
+  uint32_t ms; // capture time from first frame
+  bool motion;
+  // outcome
+  bool checked;
+  RecordState state;
+  uint32_t processUs;
+  int32_t returnMs; // after capture time, -1 if not returned
+};
+
+struct replayFb {
+  camera_fb_t fb; // as passed to processFrame()
+  uint32_t index;
+  uint32_t dueMs; // host time of capture
+};
+
+struct recording {
+  std::string path;
+  uint32_t frames; // in avi index, including empty frames
+  uint8_t fps;
+  std::vector<uint32_t> ids; // of frames recorded, for generated frames
+};
+
+// functions of module under test, not declared in appGlobals.h
+void processFrame(camera_fb_t* fb);
+void stopRecording();
+
+static uint8_t checkBuf[CHECK_BUF];
+static std::vector<replayFrame> frames;
+static std::mutex frameMutex;
+static std::vector<recording> recordings;
+static replayFrame* current = NULL; // frame being processed
+static bool generated = false;
+
+// functions of modules not under test
+void esp_camera_fb_return(camera_fb_t* fb) {
+  replayFb* rfb = (replayFb*)fb;
+  int32_t returnMs = millis() - rfb->dueMs;
+  {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    frames[rfb->index].returnMs = returnMs;
+  }
+  free(fb->buf);
+  delete rfb;
+}
+
+bool checkMotion(camera_fb_t*, bool, bool) {
+  current->checked = true;
+  return current->motion;
+}
+
+void catalogAdd(const catEntry& ce) {
+  recordings.push_back({ce.path, ce.frames, ce.fps, {}});
+}
+
+static void noIssue(void*, const char* issue) {
+  if (getenv("V")) printf("  issue: %s\n", issue);
+}
+
+static std::vector<uint8_t> makeJpeg(uint32_t id, size_t len) {
+  // content unique to frame, starting with SOF0 for FHD frame, followed by id
+  static const uint8_t sof[] = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x04, 0x38, 0x07, 0x80};
+  std::vector<uint8_t> jpeg(len);
+  for (size_t i = 0; i < len; i++) jpeg[i] = (uint8_t)(id * 7 + i);
+  memcpy(jpeg.data(), sof, sizeof(sof));
+  memcpy(jpeg.data() + sizeof(sof), &id, sizeof(id));
+  return jpeg;
+}
+
+static bool jpegSize(const std::vector<uint8_t>& jpeg, uint16_t& width, uint16_t& height) {
+  // frame dimensions from SOF segment
+  size_t pos = 2;
+  while (pos + 9 <= jpeg.size() && jpeg[pos] == 0xFF) {
+    uint8_t marker = jpeg[pos + 1];
+    if (marker >= 0xC0 && marker <= 0xC2) {
+      height = jpeg[pos + 5] << 8 | jpeg[pos + 6];
+      width = jpeg[pos + 7] << 8 | jpeg[pos + 8];
+      return true;
+    }
+    pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+  }
+  return false;
+}
+
+static std::vector<uint8_t> readFile(const std::string& path) {
+  std::vector<uint8_t> data;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == NULL) return data;
+  fseeko(f, 0, SEEK_END);
+  data.resize(ftello(f));
+  if (!hostRead(f, 0, data.data(), data.size())) data.clear();
+  fclose(f);
+  return data;
+}
+
+static void generate(const char* folder) {
+  // 10 fps frames over 165 secs, with motion from 10 to 15 secs, then during
+  // cooldown from 75 to 77 secs, and from 85 to 150 secs with no frames
+  // captured from 100 to 103 secs
+  mkdir(folder, 0755);
+  for (uint32_t i = 0; i < 1650; i++) {
+    if (i >= 1000 && i < 1030) continue;
+    bool motion = (i >= 100 && i < 150) || (i >= 750 && i < 770) || (i >= 850 && i < 1500);
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%u%s.jpg", folder, i * FRAME_MS + 123, motion ? "_M" : "");
+    std::vector<uint8_t> jpeg = makeJpeg(i, 15000 + i * 2654435761u % 20000);
+    FILE* f = fopen(path, "wb");
+    fwrite(jpeg.data(), 1, jpeg.size(), f);
+    fclose(f);
+  }
+}
+
+static void loadFrames(const char* folder) {
+  // frame files in capture time order
+  DIR* dir = opendir(folder);
+  CHECK(dir != NULL, "folder %s not found", folder);
+  if (dir == NULL) return;
+  struct dirent* de;
+  while ((de = readdir(dir)) != NULL) {
+    char* end;
+    unsigned long ms = strtoul(de->d_name, &end, 10);
+    if (end == de->d_name || (strcmp(end, ".jpg") && strcmp(end, "_M.jpg"))) continue;
+    frames.push_back({de->d_name, (uint32_t)ms, *end == '_', false, IDLE, 0, -1});
+  }
+  closedir(dir);
+  std::sort(frames.begin(), frames.end(), [](const replayFrame& a, const replayFrame& b) { return a.ms < b.ms; });
+  if (frames.empty()) return;
+  uint32_t firstMs = frames[0].ms;
+  for (auto& rf : frames) rf.ms -= firstMs;
+}
+
+static void replay(const char* folder) {
+  // pass each frame to processFrame() at its capture time
+  uint32_t startMs = millis();
+  for (uint32_t i = 0; i < frames.size(); i++) {
+    replayFrame& rf = frames[i];
+    std::vector<uint8_t> jpeg = readFile(std::string(folder) + "/" + rf.file);
+    uint16_t width = 0, height = 0;
+    CHECK(jpegSize(jpeg, width, height), "frame %s has no SOF", rf.file.c_str());
+    if (jpeg.empty()) continue;
+    uint32_t dueMs = startMs + rf.ms;
+    if (millis() < dueMs) delay(dueMs - millis());
+    replayFb* rfb = new replayFb();
+    rfb->index = i;
+    rfb->dueMs = dueMs;
+    camera_fb_t* fb = &rfb->fb;
+    fb->buf = (uint8_t*)malloc(jpeg.size());
+    memcpy(fb->buf, jpeg.data(), jpeg.size());
+    fb->len = jpeg.size();
+    fb->width = width;
+    fb->height = height;
+    fb->format = PIXFORMAT_JPEG;
+    fb->timestamp.tv_sec = dueMs / 1000;
+    fb->timestamp.tv_usec = dueMs % 1000 * 1000;
+    current = &rf;
+    auto processStart = std::chrono::steady_clock::now();
+    processFrame(fb);
+    rf.processUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - processStart).count();
+    rf.state = recordState;
+  }
+  // save recording in progress, as on controlled shutdown
+  if (recordState == RECORDING) stopRecording();
+  delay(1000); // for SD writer to return last frames
+}
+
+static void checkRecording(recording& rec) {
+  // recording validates clean, and for generated frames, holds frame ids
+  FILE* f = fopen(hostPath(rec.path.c_str()).c_str(), "rb");
+  CHECK(f != NULL, "recording %s missing", rec.path.c_str());
+  if (f == NULL) return;
+  fseeko(f, 0, SEEK_END);
+  uint64_t fileSize = ftello(f);
+  aviCheck ac;
+  uint32_t issues = checkAviFile(ac, hostRead, noIssue, f, fileSize, checkBuf, sizeof(checkBuf));
+  CHECK(!issues, "recording %s has %u issues", rec.path.c_str(), issues);
+  uint64_t pos = AVI_HEADER_LEN;
+  uint8_t idBuf[15];
+  while (generated && pos + CHUNK_HDR <= fileSize) {
+    uint8_t hdr[CHUNK_HDR];
+    uint32_t len;
+    hostRead(f, pos, hdr, CHUNK_HDR);
+    memcpy(&len, hdr + 4, 4);
+    if (!memcmp(hdr, "RIFF", 4) || !memcmp(hdr, "LIST", 4)) {
+      pos += 12;
+      continue;
+    }
+    if (!memcmp(hdr, dcBuf, 4) && len >= sizeof(idBuf)) {
+      uint32_t id;
+      hostRead(f, pos + CHUNK_HDR, idBuf, sizeof(idBuf));
+      memcpy(&id, idBuf + 11, sizeof(id));
+      rec.ids.push_back(id);
+    }
+    pos += CHUNK_HDR + len + (len & 1);
+  }
+  fclose(f);
+}
+
+static void writeReport() {
+  FILE* f = fopen("replay.csv", "w");
+  fprintf(f, "frame,file,captureMs,motion,checked,state,processUs,returnMs\n");
+  for (size_t i = 0; i < frames.size(); i++) {
+    replayFrame& rf = frames[i];
+    fprintf(f, "%zu,%s,%u,%d,%d,%s,%u,%d\n", i, rf.file.c_str(), rf.ms, rf.motion, rf.checked,
+      rf.state == IDLE ? "IDLE" : rf.state == RECORDING ? "RECORDING" : "COOLDOWN", rf.processUs, rf.returnMs);
+  }
+  fclose(f);
+  // summary of per frame cost
+  std::vector<uint32_t> us;
+  for (auto& rf : frames) us.push_back(rf.processUs);
+  std::sort(us.begin(), us.end());
+  if (!us.empty()) printf("replayTest: %zu frames, processFrame() us median %u, 99%% %u, max %u, %zu recordings\n",
+    us.size(), us[us.size() / 2], us[us.size() * 99 / 100], us.back(), recordings.size());
+}
+
+static uint32_t frameAt(uint32_t id) {
+  // index of generated frame, allowing for gap in capture
+  return id < 1000 ? id : id - 30;
+}
+
+static void checkGenerated() {
+  // state after each frame as expected of motion in generated frames
+  std::vector<std::pair<uint32_t, RecordState>> changes; // frame id and new state
+  RecordState state = IDLE;
+  for (size_t i = 0; i < frames.size(); i++) {
+    CHECK(!frames[i].checked || state != COOLDOWN, "motion checked in cooldown at frame %zu", i);
+    if (frames[i].state != state) changes.push_back({frames[i].ms / FRAME_MS, state = frames[i].state});
+    CHECK(frames[i].returnMs >= 0, "camera buffer of frame %zu not returned", i);
+  }
+  const RecordState want[] = {RECORDING, COOLDOWN, IDLE, RECORDING, COOLDOWN, IDLE};
+  CHECK(changes.size() == 6, "%zu state changes, expected 6", changes.size());
+  if (changes.size() != 6) return;
+  for (int i = 0; i < 6; i++) CHECK(changes[i].second == want[i], "state change %d to %d, expected %d", i, changes[i].second, want[i]);
+  // started on motion, stopped on first check after minimum time, and ready after cooldown
+  CHECK(changes[0].first >= 100 && changes[0].first < 100 + START_TOL, "recording started at frame %u", changes[0].first);
+  uint32_t stopId = changes[0].first + 600;
+  CHECK(changes[1].first + STOP_TOL >= stopId && changes[1].first <= stopId + STOP_TOL,
+    "recording stopped at frame %u, expected %u", changes[1].first, stopId);
+  CHECK(changes[2].first >= changes[1].first + 100 && changes[2].first <= changes[1].first + 100 + STOP_TOL,
+    "ready at frame %u after cooldown from frame %u", changes[2].first, changes[1].first);
+  // motion continuing at first check extends recording until next check
+  CHECK(changes[3].first >= 850 && changes[3].first < 850 + START_TOL, "recording started at frame %u", changes[3].first);
+  stopId = changes[3].first + 650;
+  CHECK(changes[4].first + STOP_TOL >= stopId && changes[4].first <= stopId + STOP_TOL,
+    "recording stopped at frame %u, expected %u", changes[4].first, stopId);
+  // each recording holds its frames in order, from motion detected to stopped,
+  // with empty frames for gap in capture
+  CHECK(recordings.size() == 2, "%zu recordings, expected 2", recordings.size());
+  if (recordings.size() != 2) return;
+  for (int r = 0; r < 2; r++) {
+    recording& rec = recordings[r];
+    // frame detecting motion precedes recording, frame stopping it is recorded
+    uint32_t fromId = changes[r * 3].first + 1, toId = changes[r * 3 + 1].first;
+    std::vector<uint32_t> want;
+    for (uint32_t id = fromId; id <= toId; id++) if (id < 1000 || id >= 1030) want.push_back(id);
+    CHECK(rec.ids == want, "recording %s has %zu frames from %u, expected %zu from %u to %u", rec.path.c_str(),
+      rec.ids.size(), rec.ids.empty() ? 0 : rec.ids[0], want.size(), fromId, toId);
+    CHECK(rec.fps == 1000 / FRAME_MS, "recording %s at %u fps", rec.path.c_str(), rec.fps);
+    CHECK(rec.frames + 1 >= toId - fromId + 1 && rec.frames <= toId - fromId + 2, "recording %s has %u frames for %u to %u",
+      rec.path.c_str(), rec.frames, fromId, toId);
+    // frames held no longer than SD writer queue allows
+    for (uint32_t id = fromId; id <= toId; id++) if (id < 1000 || id >= 1030) {
+      int32_t returnMs = frames[frameAt(id)].returnMs;
+      CHECK(returnMs >= 0 && returnMs < 8 * FRAME_MS, "frame %u returned after %d ms", id, returnMs);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  hostSpeed = REPLAY_SPEED;
+  alarm(600); // tasks stuck
+  generated = argc < 2;
+  const char* folder = generated ? "replay" : argv[1];
+  if (generated) generate(folder);
+  loadFrames(folder);
+  CHECK(!frames.empty(), "no frames in %s", folder);
+  if (frames.empty()) return hostResult("replayTest");
+  // frame size of recordings from first frame
+  std::vector<uint8_t> jpeg = readFile(std::string(folder) + "/" + frames[0].file);
+  uint16_t width = 0, height = 0;
+  jpegSize(jpeg, width, height);
+  fsizePtr = FRAMESIZE_FHD;
+  for (uint8_t i = 0; i < FRAMESIZE_INVALID; i++)
+    if (frameData[i].frameWidth == width && frameData[i].frameHeight == height) fsizePtr = i;
+  // frame rate configured as median interval between frames
+  std::vector<uint32_t> intervals;
+  for (size_t i = 1; i < frames.size(); i++) intervals.push_back(frames[i].ms - frames[i - 1].ms);
+  std::sort(intervals.begin(), intervals.end());
+  uint32_t intervalMs = intervals.empty() ? FRAME_MS : std::max(intervals[intervals.size() / 2], (uint32_t)1);
+  hostClear();
+  minSeconds = 1;
+  useMotion = true;
+  prepRecording();
+  setFPS(std::min(std::max((1000 + intervalMs / 2) / intervalMs, (uint32_t)1), (uint32_t)UINT8_MAX));
+  replay(folder);
+  for (auto& rec : recordings) checkRecording(rec);
+  writeReport();
+  if (generated) checkGenerated();
+  return hostResult("replayTest");
+}
@@ -0,0 +1,213 @@
+// Host tests of the SD writer queue, SD writer and flush tasks, and staging
+// ring in mjpeg2sd.cpp, with the tasks on threads and frames passed to
+// processFrame() at 10 fps in real time. Writes to the recording stall for
+// chosen times, and for each recording it is checked that:
+// - the queue high water and dropped frame counts are as the stalls allow
+// - the recording validates clean with aviCheck.h, and holds every frame not
+//   dropped, in capture order and with its content
+// - the frames dropped are represented by empty frames, so that the frame
+//   count matches the time recorded
+// - every camera buffer is returned
+//
+// Usage: sdWriterTest [seed]
+//
+// s60sc 2025
+
+#include "appGlobals.h"
+#include "aviCheck.h"
+#include "host.h"
+#include <map>
+#include <mutex>
+#include <random>
+#include <unistd.h>
+
+#define CHECK_BUF 65536
+#define FRAME_MS 100
+#define SDQ_LEN 8 // as mjpeg2sd.cpp
+#define MAX_REC_BYTES (64 * ONEMEG) // far beyond any recording of test
+
+struct stall {
+  uint32_t frame; // stall armed when this frame passed
+  uint32_t ms;
+};
+
+static std::mt19937 rng;
+static uint8_t checkBuf[CHECK_BUF];
+static std::mutex fedMutex;
+static std::map<uint32_t, size_t> fed; // length of each frame passed to processFrame(), by id
+static std::atomic<uint32_t> returned(0); // camera buffers returned
+static std::atomic<uint32_t> stallMs(0); // next write to recording stalls for this time
+static std::atomic<size_t> recBytes(0); // written to current recording
+static catEntry lastRec;
+
+// functions of module under test, not declared in appGlobals.h
+void startRecording();
+void stopRecording();
+void processFrame(camera_fb_t* fb);
+
+// functions of modules not under test
+void esp_camera_fb_return(camera_fb_t* fb) {
+  free(fb->buf);
+  delete fb;
+  returned++;
+}
+
+bool checkMotion(camera_fb_t*, bool, bool) {
+  return false; // recording started by test
+}
+
+void catalogAdd(const catEntry& ce) {
+  lastRec = ce;
+}
+
+static uint32_t rnd(uint32_t n) {
+  return n ? rng() % n : 0;
+}
+
+static void noIssue(void*, const char* issue) {
+  if (getenv("V")) printf("  issue: %s\n", issue);
+}
+
+static void stallWrite(const char* path, size_t len) {
+  // SD card busy, as for wear levelling or garbage collection
+  if (strcmp(path, AVITEMP)) return;
+  if ((recBytes += len) > MAX_REC_BYTES) {
+    // flush task writing without end, so stop before filling disk
+    CHECK(false, "recording exceeded %u bytes", MAX_REC_BYTES);
+    hostResult("sdWriterTest");
+    fflush(stdout);
+    _exit(1);
+  }
+  uint32_t ms = stallMs.exchange(0);
+  if (ms) delay(ms);
+}
+
+static std::vector<uint8_t> makeJpeg(uint32_t id, size_t len) {
+  // content unique to frame, starting with SOF0 for FHD frame, followed by id
+  static const uint8_t sof[] = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x04, 0x38, 0x07, 0x80};
+  std::vector<uint8_t> jpeg(len);
+  for (size_t i = 0; i < len; i++) jpeg[i] = (uint8_t)(id * 7 + i);
+  memcpy(jpeg.data(), sof, sizeof(sof));
+  memcpy(jpeg.data() + sizeof(sof), &id, sizeof(id));
+  return jpeg;
+}
+
+static camera_fb_t* makeFrame(uint32_t id) {
+  // camera buffer as from driver, freed when returned
+  size_t len = 15000 + rnd(20000);
+  std::vector<uint8_t> jpeg = makeJpeg(id, len);
+  camera_fb_t* fb = new camera_fb_t();
+  fb->buf = (uint8_t*)malloc(len);
+  memcpy(fb->buf, jpeg.data(), len);
+  fb->len = len;
+  fb->width = frameData[FRAMESIZE_FHD].frameWidth;
+  fb->height = frameData[FRAMESIZE_FHD].frameHeight;
+  fb->format = PIXFORMAT_JPEG;
+  uint32_t ms = millis();
+  fb->timestamp.tv_sec = ms / 1000;
+  fb->timestamp.tv_usec = ms % 1000 * 1000;
+  std::lock_guard<std::mutex> lock(fedMutex);
+  fed[id] = len;
+  return fb;
+}
+
+static std::vector<uint32_t> recordedFrames(const char* name, uint32_t& slots) {
+  // ids of frames in recording, which must validate clean and match frames passed,
+  // with slots being the count of all frames including empty frames
+  std::vector<uint32_t> ids;
+  slots = 0;
+  FILE* f = fopen(hostPath(name).c_str(), "rb");
+  CHECK(f != NULL, "recording %s missing", name);
+  if (f == NULL) return ids;
+  fseeko(f, 0, SEEK_END);
+  uint64_t fileSize = ftello(f);
+  aviCheck ac;
+  uint32_t issues = checkAviFile(ac, hostRead, noIssue, f, fileSize, checkBuf, sizeof(checkBuf));
+  CHECK(!issues, "recording %s has %u issues", name, issues);
+  uint64_t pos = AVI_HEADER_LEN;
+  std::vector<uint8_t> chunk;
+  while (pos + CHUNK_HDR <= fileSize) {
+    uint8_t hdr[CHUNK_HDR];
+    uint32_t len;
+    hostRead(f, pos, hdr, CHUNK_HDR);
+    memcpy(&len, hdr + 4, 4);
+    if (!memcmp(hdr, "RIFF", 4) || !memcmp(hdr, "LIST", 4)) {
+      pos += 12;
+      continue;
+    }
+    if (!memcmp(hdr, dcBuf, 4)) {
+      slots++;
+      if (len) {
+        uint32_t id;
+        chunk.resize(len);
+        hostRead(f, pos + CHUNK_HDR, chunk.data(), len);
+        memcpy(&id, chunk.data() + 11, sizeof(id));
+        auto it = fed.find(id);
+        bool match = it != fed.end() && len >= it->second
+          && makeJpeg(id, it->second) == std::vector<uint8_t>(chunk.begin(), chunk.begin() + it->second);
+        CHECK(match, "recording %s frame %u content differs from passed", name, id);
+        ids.push_back(id);
+      }
+    }
+    pos += CHUNK_HDR + len + (len & 1);
+  }
+  fclose(f);
+  return ids;
+}
+
+static void record(const char* test, uint32_t frames, const std::vector<stall>& stalls, uint32_t minHW,
+  uint32_t maxHW, uint32_t minDropped, uint32_t maxDropped) {
+  // record given frames in real time, with writes stalled as given, and check outcome
+  fed.clear();
+  returned = 0;
+  recBytes = 0;
+  lastRec = {};
+  recordState = RECORDING;
+  startRecording();
+  uint32_t startMs = millis();
+  for (uint32_t i = 0; i < frames; i++) {
+    uint32_t dueMs = startMs + i * FRAME_MS;
+    if (millis() < dueMs) delay(dueMs - millis());
+    for (auto& st : stalls) if (st.frame == i) stallMs = st.ms;
+    processFrame(makeFrame(i));
+  }
+  stopRecording();
+  recordState = IDLE;
+  uint32_t dropped = droppedFrames;
+  CHECK(sdqHighWater >= minHW && sdqHighWater <= maxHW, "%s: queue high water %u, expected %u to %u",
+    test, sdqHighWater, minHW, maxHW);
+  CHECK(dropped >= minDropped && dropped <= maxDropped, "%s: dropped %u frames, expected %u to %u",
+    test, dropped, minDropped, maxDropped);
+  CHECK(returned == frames, "%s: %u of %u camera buffers returned", test, returned.load(), frames);
+  CHECK(lastRec.path[0], "%s: recording not saved", test);
+  if (!lastRec.path[0]) return;
+  uint32_t slots;
+  std::vector<uint32_t> ids = recordedFrames(lastRec.path, slots);
+  CHECK(ids.size() == frames - dropped, "%s: recorded %zu frames, expected %u", test, ids.size(), frames - dropped);
+  for (size_t i = 1; i < ids.size(); i++) CHECK(ids[i] > ids[i - 1], "%s: frame %u after frame %u", test, ids[i], ids[i - 1]);
+  CHECK(!ids.empty() && ids.back() == frames - 1, "%s: last frame not recorded", test);
+  CHECK(slots + 1 >= frames && slots <= frames + 1 && lastRec.frames == slots, "%s: %u frames in index, %u in file for %u passed",
+    test, lastRec.frames, slots, frames);
+  if (getenv("V")) printf("%s: high water %u, dropped %u\n", test, sdqHighWater, dropped);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) rng.seed(atoi(argv[1]));
+  alarm(120); // tasks stuck
+  hostClear();
+  hostWriteHook = stallWrite;
+  minSeconds = 1;
+  useMotion = false;
+  fsizePtr = FRAMESIZE_FHD;
+  prepRecording();
+  setFPS(1000 / FRAME_MS);
+  // writer keeps up
+  record("no stall", 30, {}, 1, 2, 0, 0);
+  // stalls absorbed by staging ring and queue
+  record("short stalls", 60, {{10, 600}, {30, 600}, {45, 600}}, 3, SDQ_LEN - 1, 0, 0);
+  // stall longer than staging ring and queue can absorb
+  record("long stall", 50, {{10, 2500}}, SDQ_LEN, SDQ_LEN, 10, 25);
+  // bursts of stalls, each longer than can be absorbed
+  record("stall bursts", 80, {{10, 1500}, {12, 1500}, {40, 1500}, {60, 1500}}, SDQ_LEN, SDQ_LEN, 25, 55);
+  return hostResult("sdWriterTest");
+}
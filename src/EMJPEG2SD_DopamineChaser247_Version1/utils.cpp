@@ -1043,7 +1043,7 @@ void checkMemory(const char* source) {
 uint32_t checkStackUse(TaskHandle_t thisTask, int taskIdx) {
   // get minimum free stack size for task since started
   // taskIdx used to index minStack[] array
-  static uint32_t minStack[20]; 
+  static uint32_t minStack[24]; 
   uint32_t freeStack = 0;
   if (thisTask != NULL) {
     freeStack = (uint32_t)uxTaskGetStackHighWaterMark(thisTask);
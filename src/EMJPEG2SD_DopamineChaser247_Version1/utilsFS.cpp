@@ -17,6 +17,7 @@
 #include "appGlobals.h"
 #include <Arduino.h> // For Serial
 #include <SD_MMC.h>  // For SD_MMC
+#include "esp_vfs_fat.h" // For esp_vfs_fat_create_contiguous_file
 
 
 // Storage settings
@@ -234,8 +235,11 @@ bool startStorage() {
   return res;
 }
 
-static void getOldestDir(char* oldestDir) {
+void getOldestDir(char* oldestDir) {
   // get oldest folder by its date name
+#ifdef ISCAM
+  if (catalogOldest(oldestDir)) return;
+#endif
   File root = fp.open("/");
   File file = root.openNextFile();
   if (file) strcpy(oldestDir, file.path()); // initialise oldestDir
@@ -280,6 +284,21 @@ bool checkFreeStorage() {
   return res;
 } 
 
+bool preallocFile(const char* fileName, size_t fileSize) {
+  // create file of given size as contiguous clusters, so that writing within it
+  // needs no FAT cluster allocation. File to be opened "r+" and truncated when done
+#ifdef NO_SD
+  return false;
+#else
+  char sdPath[FILE_NAME_LEN];
+  snprintf(sdPath, FILE_NAME_LEN, "/sdcard%s", fileName);
+  if (STORAGE.exists(fileName)) STORAGE.remove(fileName); // must be created empty
+  esp_err_t res = esp_vfs_fat_create_contiguous_file("/sdcard", sdPath, fileSize, true);
+  if (res != ESP_OK) LOG_WRN("Failed to preallocate %s for %s: %s", fmtSize(fileSize), fileName, espErrMsg(res));
+  return res == ESP_OK;
+#endif
+}
+
 void setFolderName(const char* fname, char* fileName) {
   // set current or previous folder 
   char partName[FILE_NAME_LEN];
@@ -329,8 +348,27 @@ bool listDir(const char* fname, char* jsonBuff, size_t jsonBuffLen, const char*
     
     // build relevant option list
     strcpy(jsonBuff, returnDirs ? "{" : "{\"/\":\".. [ Up ]\",");            
-    File file = root.openNextFile();
     if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+    bool fromCatalog = false;
+#ifdef ISCAM
+    if (catalogReady() && (!returnDirs || !strcmp(fileName, "/"))) {
+      // list from catalog instead of walking folder
+      std::vector<catEntry> entries;
+      if (returnDirs) catalogFolders(entries);
+      else catalogFolder(fileName, entries);
+      for (auto& ce : entries) {
+        const char* name = returnDirs ? ce.path + 1 : strrchr(ce.path, '/') + 1;
+        if (returnDirs && strstr(DATA_DIR, name) == NULL) sprintf(partJson, "\"%s\":\"%s\",", ce.path, name);
+        else if (!returnDirs && strstr(name, extension) != NULL) 
+          sprintf(partJson, "\"%s\":\"%s %s\",", ce.path, name, fmtSize(ce.fileSize));
+        else continue;
+        fileVec.push_back(std::string(partJson));
+        noEntries = false;
+      }
+      fromCatalog = true;
+    }
+#endif
+    File file = fromCatalog ? File() : root.openNextFile();
     while (file) {
       if (returnDirs && file.isDirectory() && strstr(DATA_DIR, file.name()) == NULL) {  
         // build folder list, ignore data folder
@@ -375,8 +413,10 @@ static void deleteOthers(const char* baseFile) {
   strcpy(otherDeleteName, baseFile);
   changeExtension(otherDeleteName, CSV_EXT);
   if (STORAGE.remove(otherDeleteName)) LOG_INF("File %s deleted", otherDeleteName);
+  catalogRemove(otherDeleteName);
   changeExtension(otherDeleteName, SRT_EXT);
   if (STORAGE.remove(otherDeleteName)) LOG_INF("File %s deleted", otherDeleteName);
+  catalogRemove(otherDeleteName);
 #endif  
 }
 
@@ -422,6 +462,9 @@ void deleteFolderOrFile(const char* deleteThis) {
     LOG_ALT("File %s %sdeleted", deleteThis, STORAGE.remove(deleteThis) ? "" : "not ");  //Remove the file
     deleteOthers(deleteThis);
   }
+#ifdef ISCAM
+  catalogRemove(fileName);
+#endif
 }
 
 /************** uncompressed tarball **************/
@@ -460,13 +503,13 @@ esp_err_t downloadFile(File& df, httpd_req_t* req) {
   
   // check if ancillary files present
   needZip = STORAGE.exists(fsSavePath);
-  const char* extensions[3] = {AVI_EXT, CSV_EXT, SRT_EXT};
+  const char* extensions[4] = {AVI_EXT, MP4_EXT, CSV_EXT, SRT_EXT};
   if (needZip) {
     // ancillary files, calculate total size for http header
     downloadSize = 0;
     for (const auto& ext : extensions) {
       changeExtension(fsSavePath, ext);
-      File inFile = STORAGE.open(fsSavePath, FILE_READ);
+      File inFile = recOpen(fsSavePath); // encrypted recording sent as its content
       if (inFile) {
         // round up file size to 512 byte boundary and add header size
         downloadSize += (((inFile.size() + BLOCKSIZE - 1) / BLOCKSIZE) * BLOCKSIZE) + BLOCKSIZE;
@@ -495,7 +538,7 @@ esp_err_t downloadFile(File& df, httpd_req_t* req) {
     // package avi file and ancillary files into uncompressed tarball
     for (const auto& ext : extensions) {
       changeExtension(fsSavePath, ext);
-      File inFile = STORAGE.open(fsSavePath, FILE_READ);
+      File inFile = recOpen(fsSavePath); // encrypted recording sent as its content
       if (inFile) {
         res = writeHeader(inFile, req);
         if (res == ESP_OK) res = sendChunks(inFile, req, false);
@@ -532,7 +575,7 @@ void uploadToComputer(const char* filepath) {
     http.addHeader("Content-Type", "application/octet-stream");
     http.addHeader("X-Filename", filepath);
 
-    File file = SD_MMC.open(filepath, FILE_READ); // Changed from SD to SD_MMC
+    File file = recOpen(filepath); // decrypted if encrypted recording
     if (!file) {
         LOG_WRN("Failed to open file: %s", filepath);
         http.end();
@@ -593,36 +636,41 @@ void uploadRecordings() {
     char todayFolder[FILE_NAME_LEN];
     dateFormat(todayFolder, sizeof(todayFolder), true);
     
-    File root = SD_MMC.open(todayFolder);
-    if (!root) {
-        LOG_WRN("Failed to open today's folder: %s", todayFolder);
-        return;
-    }
-    
-    if (!root.isDirectory()) {
-        LOG_WRN("%s is not a directory", todayFolder);
+    // Get recordings in folder from catalog, else by walking folder
+    std::vector<catEntry> recordings;
+    if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+    if (catalogReady()) catalogFolder(todayFolder, recordings);
+    else {
+        File root = SD_MMC.open(todayFolder);
+        if (!root || !root.isDirectory()) {
+            if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+            LOG_WRN("Failed to open today's folder: %s", todayFolder);
+            return;
+        }
+        
+        File file = root.openNextFile();
+        while (file) {
+            if (!file.isDirectory()) {
+                catEntry ce = {};
+                strncpy(ce.path, file.path(), CAT_PATH_LEN - 1);
+                ce.fileSize = file.size();
+                recordings.push_back(ce);
+            }
+            file.close();
+            file = root.openNextFile();
+        }
         root.close();
-        return;
     }
+    if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
     
     // Count files to upload
     int fileCount = 0;
-    File file = root.openNextFile();
-    while (file) {
-        if (!file.isDirectory() && strstr(file.name(), AVI_EXT)) {
-            fileCount++;
-        }
-        file.close();
-        file = root.openNextFile();
+    for (auto& ce : recordings) {
+        if (strstr(ce.path, AVI_EXT) || strstr(ce.path, MP4_EXT)) fileCount++;
     }
     
-    // Reset directory reading
-    root.close();
-    root = SD_MMC.open(todayFolder);
-    
     if (fileCount == 0) {
         LOG_INF("No files to upload in %s", todayFolder);
-        root.close();
         return;
     }
     
@@ -630,14 +678,14 @@ void uploadRecordings() {
     
     // Upload each file
     int uploadedCount = 0;
-    file = root.openNextFile();
-    while (file) {
-        if (!file.isDirectory() && strstr(file.name(), AVI_EXT)) {
+    for (auto& ce : recordings) {
+        if (strstr(ce.path, AVI_EXT) || strstr(ce.path, MP4_EXT)) {
             char filepath[FILE_NAME_LEN];
-            snprintf(filepath, FILE_NAME_LEN, "%s/%s", todayFolder, file.name());
+            strcpy(filepath, ce.path);
+            File file = recOpen(filepath); // decrypted if encrypted recording
             
             // Get file size
-            size_t fileSize = file.size();
+            size_t fileSize = encContentLen(ce);
             if (fileSize > 0) {
                 LOG_INF("Uploading file: %s (%s)", filepath, fmtSize(fileSize));
                 
@@ -651,7 +699,7 @@ void uploadRecordings() {
                          
                 http.begin(uploadUrl);
                 http.addHeader("Content-Type", "application/octet-stream");
-                http.addHeader("X-Filename", file.name());
+                http.addHeader("X-Filename", strrchr(filepath, '/') + 1);
                 
                 // Set timeout appropriately for large files
                 // Convert fileSize to integer for comparison
@@ -703,12 +751,9 @@ void uploadRecordings() {
             } else {
                 LOG_WRN("Empty file, skipping: %s", filepath);
             }
+            file.close();
         }
-        
-        file.close();
-        file = root.openNextFile();
     }
     
-    root.close();
     LOG_INF("Upload session complete. Uploaded %d out of %d files", uploadedCount, fileCount);
 }
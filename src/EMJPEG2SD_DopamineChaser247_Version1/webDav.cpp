@@ -86,28 +86,29 @@ static void sendContentProp(const char* prop, const char* value) {
   LOG_VRB("propStr %s", propStr);
 }
 
-static void sendPropResponse(File& file, const char* payload) {
+static void sendPropResponse(const char* path, time_t lastWrite, bool isDir, size_t fileSize, const char* payload) {
   // send SD properties details to PC
-  size_t encodeLen = 3 + strlen(file.path()) * 2;
+  size_t encodeLen = 3 + strlen(path) * 2;
   size_t maxLen = strlen(XML2) + encodeLen + strlen(XML3);
   char resp[maxLen + 1];
-  snprintf(resp, maxLen, "%s%s%s", XML2, file.path(), XML3);
+  snprintf(resp, maxLen, "%s%s%s", XML2, path, XML3);
   httpd_resp_sendstr_chunk(req, resp);
   LOG_VRB("resp xml: %s", resp);
   
-  formatTime(file.getLastWrite());
+  formatTime(lastWrite);
   sendContentProp("getlastmodified", formattedTime);
   sendContentProp("creationdate", formattedTime);
 
-  if (file.isDirectory()) sendContentProp("resourcetype", "<D:collection/>");
+  if (isDir) sendContentProp("resourcetype", "<D:collection/>");
   else {
     char fsizeStr[15];
-    sprintf(fsizeStr, "%u", file.size());
+    sprintf(fsizeStr, "%u", fileSize);
     sendContentProp("getcontentlength", fsizeStr);
-    sendContentProp("getcontenttype", mimeTypes[getMimeType(file.path())]);
+    sendContentProp("getcontenttype", mimeTypes[getMimeType(path)]);
     httpd_resp_sendstr_chunk(req, "<resourcetype/>");
   }
-  sendContentProp("displayname", file.name());
+  const char* name = strrchr(path, '/');
+  sendContentProp("displayname", name == NULL ? path : name + 1);
   
   if (strlen(payload)) {
     // return quota data if requested
@@ -165,15 +166,27 @@ static bool handleProp() {
   httpd_resp_sendstr_chunk(req, XML1);
   
   // return details of selected folder
-  File root = STORAGE.open(pathName);
-  sendPropResponse(root, payload);
+  File root = recDecrypt(STORAGE.open(pathName)); // size of recording content if encrypted
+  sendPropResponse(root.path(), root.getLastWrite(), root.isDirectory(), root.size(), payload);
   if (depth && root.isDirectory()) {
-    // if requested return details of each resource in folder
-    File entry = root.openNextFile();
-    while (entry) {
-      sendPropResponse(entry, "");
-      entry.close();
-      entry = root.openNextFile();
+    // if requested return details of each resource in folder,
+    // from catalog for recording folders, as root may hold other folders
+    std::vector<catEntry> entries;
+    if (strcmp(pathName, "/") && strchr(pathName + 1, '/') == NULL && catalogReady()) {
+      if (psramFound()) heap_caps_malloc_extmem_enable(MIN_RAM); // small number to force vector into psram
+      catalogFolder(pathName, entries);
+      if (psramFound()) heap_caps_malloc_extmem_enable(MAX_RAM);
+      for (auto& ce : entries) {
+        time_t lastWrite = ce.flags & CAT_OTHER ? ce.startTime : ce.startTime + ce.duration;
+        sendPropResponse(ce.path, lastWrite, false, encContentLen(ce), "");
+      }
+    } else {
+      File entry = root.openNextFile();
+      while (entry) {
+        sendPropResponse(entry.path(), entry.getLastWrite(), entry.isDirectory(), entry.size(), "");
+        entry.close();
+        entry = root.openNextFile();
+      }
     }
   }
   root.close();
@@ -240,8 +253,10 @@ static bool handlePut() {
     // transfer file content to SD
     strcpy(inFileName, pathName);
     esp_err_t res = uploadHandler(req);
+    catalogAddFile(pathName);
     return res == ESP_OK ? true : false;
   } 
+  catalogAddFile(pathName);
   return true;
 }
 
@@ -290,6 +305,7 @@ static bool handleMove() {
     if (isFolder()) res = checkSamePath(pathName, dest);
     if (res) {
       res = STORAGE.rename(pathName, dest);
+      if (res) catalogRename(pathName, dest);
       if (res) httpd_resp_set_status(req, "201 Created");
       else httpd_resp_set_status(req, "500 Internal Server Error");
       httpd_resp_sendstr(req, NULL);
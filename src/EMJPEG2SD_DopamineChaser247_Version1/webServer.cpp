@@ -44,7 +44,11 @@ esp_err_t fileHandler(httpd_req_t* req, bool download) {
   // send file contents to browser
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
   if (!strcmp(inFileName, LOG_FILE_PATH)) flush_log(false);
+#ifdef ISCAM
+  File df = recDecrypt(fp.open(inFileName)); // encrypted recording sent as its content
+#else
   File df = fp.open(inFileName);
+#endif
   if (!df) {
     LOG_WRN("File does not exist or cannot be opened: %s", inFileName);
     httpd_resp_send_404(req);